@@ -64,6 +64,8 @@
    kT/e ~ 0.007/V ~ 0.07 mm/Vcm, => close enough to 0.12, okay
  */
 
+static int alloc_work(MJD_Siggen_Setup *setup);
+
 /* signal_calc_init
    read setup from configuration file,
    then read the electric field and weighting potential,
@@ -71,8 +73,23 @@
    returns 0 for success
 */
 int signal_calc_init(char *config_file_name, MJD_Siggen_Setup *setup) {
+  int k;
 
   if (read_config(config_file_name, setup)) return 1;
+  /* lists of values are expanded only by mjd_fieldgen -s */
+  for (k=0; k<setup->nsweep; k++)
+    tell("WARNING: only the first of the values %s is used for %s;\n"
+	 "  use the config files written by mjd_fieldgen -s for the others\n",
+	 setup->sweep_spec[k], setup->sweep_key[k]);
+  return signal_calc_init_setup(setup);
+}
+
+/* signal_calc_init_setup
+   as signal_calc_init, but for a setup that has already been filled in,
+   e.g. by read_config, and possibly with fields from fieldgen_export
+   returns 0 for success
+*/
+int signal_calc_init_setup(MJD_Siggen_Setup *setup) {
 
   TELL_CHATTY("r: %.2f  z: %.2f\n", setup->xtal_radius, setup->xtal_length);
   setup->ntsteps_out = setup->time_steps_calc /
@@ -85,39 +102,98 @@ int signal_calc_init(char *config_file_name, MJD_Siggen_Setup *setup) {
   TELL_NORMAL("Reading field data...\n");
   if (field_setup(setup) != 0) return -1;
   
+  if (alloc_work(setup)) return -1;
+  signal_calc_stats_reset(setup);
+
+  tell("Setup of signal calculation done\n");
+  return 0;
+}
+
+/* alloc_work
+   allocate the drift paths and get_signal work space of setup
+   returns 0 for success
+*/
+static int alloc_work(MJD_Siggen_Setup *setup) {
+
   if ((setup->dpath_e = (point *) malloc(setup->time_steps_calc*sizeof(point))) == NULL ||
-      (setup->dpath_h = (point *) malloc(setup->time_steps_calc*sizeof(point))) == NULL) {
+      (setup->dpath_h = (point *) malloc(setup->time_steps_calc*sizeof(point))) == NULL ||
+      (setup->sig_work = (float *) malloc(3*setup->time_steps_calc*sizeof(float))) == NULL) {
     error("Path malloc failed\n");
     return -1;
   }
-
-  tell("Setup of signal calculation done\n");
   return 0;
 }
 
+/* signal_calc_clone
+   make a copy of setup, after signal_calc_init, for use by another thread;
+   the copy has its own drift paths and work space, but shares the fields
+   and velocity table of setup
+   returns 0 for success
+*/
+int signal_calc_clone(MJD_Siggen_Setup *copy, MJD_Siggen_Setup *setup) {
+
+  memcpy(copy, setup, sizeof(*copy));
+  copy->nearest_valid = 0;
+  signal_calc_stats_reset(copy);
+  return alloc_work(copy);
+}
+
+/* signal_calc_clone_free
+   free the drift paths and work space of a copy made by signal_calc_clone
+*/
+void signal_calc_clone_free(MJD_Siggen_Setup *copy) {
+
+  free(copy->dpath_e);
+  free(copy->dpath_h);
+  free(copy->sig_work);
+  copy->dpath_e = copy->dpath_h = NULL;
+  copy->sig_work = NULL;
+}
+
 /* get_signal
    calculate signal for point pt. Result is placed in signal_out array
    returns -1 if outside crystal
    if signal_out == NULL => no signal is stored
 */
 int get_signal(point pt, float *signal_out, MJD_Siggen_Setup *setup) {
-  static float *signal, *sum, *tmp;
-  static int tsteps = 0;
-  float w, x, y;
-  char  tmpstr[MAX_LINE];
-  int   j, k, l, dt, err, comp_f;
-
-  /* first time -- allocate signal and sum arrays */
-  if (tsteps != setup->time_steps_calc) {
-    tsteps = setup->time_steps_calc;
-    if ((signal = (float *) malloc(tsteps*sizeof(*signal))) == NULL ||
-	(tmp    = (float *) malloc(tsteps*sizeof(*tmp))) == NULL ||
-	(sum    = (float *) malloc(tsteps*sizeof(*sum))) == NULL) {
-      error("malloc failed in get_signal\n");
-      return -1;
+  float *signal = setup->sig_work;   // from signal_calc_init or signal_calc_clone
+  int   err;
+  STATS_TIMER(t0);
+
+  STATS_ADD(signals, 1);
+  err = drift_signal(pt, signal, setup);
+  STATS_PHASE(STATS_DRIFT, t0);
+  if (err < 0) return -1;
+
+  if (signal_out != NULL) {
+    charge_cloud_convolve(signal, setup);
+    STATS_PHASE(STATS_CONVOLUTION, t0);
+    compress_signal(signal, signal_out, setup);
+    STATS_PHASE(STATS_COMPRESSION, t0);
+
+    /* do RC integration for preamp risetime */
+    if (setup->preamp_tau/setup->step_time_out >= 0.1f) {
+      rc_integrate(signal_out, signal_out,
+		   setup->preamp_tau/setup->step_time_out, setup->ntsteps_out);
+      STATS_PHASE(STATS_RC, t0);
     }
   }
 
+  /* drift_signal returns 0 for success; require hole signal but not electron */
+  if (err) return -1;
+  return 1;
+}
+
+/* drift_signal
+   the first step of get_signal: drift the electrons and holes from point pt,
+   and put the charge signal (time_steps_calc steps) in signal.
+   returns -1 if pt is outside the crystal, 1 if the holes could not be drifted,
+   0 for success
+*/
+int drift_signal(point pt, float *signal, MJD_Siggen_Setup *setup) {
+  char  tmpstr[MAX_LINE];
+  int   j, err, tsteps = setup->time_steps_calc;
+
   for (j = 0; j < tsteps; j++) signal[j] = 0.0;
 
   if (outside_detector(pt, setup)) {
@@ -137,95 +213,111 @@ int get_signal(point pt, float *signal_out, MJD_Siggen_Setup *setup) {
      each time step contains the summed signals of all previous time steps */
   for (j = 1; j < tsteps; j++) signal[j] += signal[j-1];
 
-  if (signal_out != NULL) {
+  return (err ? 1 : 0);
+}
 
-    if (setup->charge_cloud_size > 0.001 || setup->use_diffusion) {
-      /* convolute with a Gaussian to correct for charge cloud size
-	 and initial velocity
-	 charge_cloud_size = initial FWHM of charge cloud, in mm,
-	 NOTE this uses initial velocity of holes only;
-	 this may not be quite right if electron signal is strong */
-      /* difference in time between center and edge of charge cloud */
-      dt = (int) (1.5f + setup->charge_cloud_size /
-		  (setup->step_time_calc * setup->initial_vel));
-      if (setup->initial_vel < 0.00001f) dt = 0;
-      TELL_CHATTY("Initial vel, size, dt = %f mm/ns, %f mm, %d steps\n",
-		  setup->initial_vel, setup->charge_cloud_size, dt);
-      if (setup->use_diffusion) {
-	dt = (int) (1.5f + setup->final_charge_size /
-		    (setup->step_time_calc * setup->final_vel));
-	TELL_CHATTY("  Final vel, size, dt = %f mm/ns, %f mm, %d steps\n",
-		    setup->final_vel, setup->final_charge_size, dt);
-      }
-      if (dt > 1) {
-	/* Gaussian */
-	w = ((float) dt) / 2.355;
-	l = dt/10;     // use l to speed up convolution of waveform with gaussian;
-	if (l < 1) {   // instead of using every 1-ns step, use steps of FWHM/10
-	  l = 1;
-	} else if (setup->step_time_out > setup->preamp_tau) {
-	  if (l > setup->step_time_out/setup->step_time_calc)
-	    l = setup->step_time_out/setup->step_time_calc;
-	} else {
-	  if (l > setup->preamp_tau/setup->step_time_calc)
-	    l = setup->preamp_tau/setup->step_time_calc;
-	}
-	// TELL_CHATTY(">> l: %d\n", l);
-	for (j = 0; j < tsteps; j++) {
-	  sum[j] = 1.0;
-	  tmp[j] = signal[j];
-	}
-	for (k = l; k < 2*dt; k+=l) {
-	  x = ((float) k)/w;
-	  y = exp(-x*x/2.0);
-	  for (j = 0; j < tsteps - k; j++){
-	    sum[j] += y;
-	    tmp[j] += signal[j+k] * y;
-	    sum[j+k] += y;
-	    tmp[j+k] += signal[j] * y;
-	  }
-	}
-        for (j = 0; j < tsteps; j++){
-          signal[j] = tmp[j]/sum[j];
-        }
+/* charge_cloud_convolve
+   the second step of get_signal: if the charge cloud size or diffusion
+   is used, convolute signal (time_steps_calc steps) with a Gaussian
+*/
+void charge_cloud_convolve(float *signal, MJD_Siggen_Setup *setup) {
+  float *sum, *tmp;
+  float w, x, y;
+  int   j, k, l, dt, tsteps = setup->time_steps_calc;
+
+  if (setup->charge_cloud_size <= 0.001 && !setup->use_diffusion) return;
+
+  /* work space; signal may itself be the start of sig_work */
+  tmp = setup->sig_work + tsteps;
+  sum = tmp + tsteps;
+
+  /* convolute with a Gaussian to correct for charge cloud size
+     and initial velocity
+     charge_cloud_size = initial FWHM of charge cloud, in mm,
+     NOTE this uses initial velocity of holes only;
+     this may not be quite right if electron signal is strong */
+  /* difference in time between center and edge of charge cloud */
+  dt = (int) (1.5f + setup->charge_cloud_size /
+	      (setup->step_time_calc * setup->initial_vel));
+  if (setup->initial_vel < 0.00001f) dt = 0;
+  TELL_CHATTY("Initial vel, size, dt = %f mm/ns, %f mm, %d steps\n",
+	      setup->initial_vel, setup->charge_cloud_size, dt);
+  if (setup->use_diffusion) {
+    dt = (int) (1.5f + setup->final_charge_size /
+		(setup->step_time_calc * setup->final_vel));
+    TELL_CHATTY("  Final vel, size, dt = %f mm/ns, %f mm, %d steps\n",
+		setup->final_vel, setup->final_charge_size, dt);
+  }
+  if (dt > 1) {
+    /* Gaussian */
+    w = ((float) dt) / 2.355;
+    l = dt/10;     // use l to speed up convolution of waveform with gaussian;
+    if (l < 1) {   // instead of using every 1-ns step, use steps of FWHM/10
+      l = 1;
+    } else if (setup->step_time_out > setup->preamp_tau) {
+      if (l > setup->step_time_out/setup->step_time_calc)
+	l = setup->step_time_out/setup->step_time_calc;
+    } else {
+      if (l > setup->preamp_tau/setup->step_time_calc)
+	l = setup->preamp_tau/setup->step_time_calc;
+    }
+    // TELL_CHATTY(">> l: %d\n", l);
+    for (j = 0; j < tsteps; j++) {
+      sum[j] = 1.0;
+      tmp[j] = signal[j];
+    }
+    for (k = l; k < 2*dt; k+=l) {
+      x = ((float) k)/w;
+      y = exp(-x*x/2.0);
+      for (j = 0; j < tsteps - k; j++){
+	sum[j] += y;
+	tmp[j] += signal[j+k] * y;
+	sum[j+k] += y;
+	tmp[j+k] += signal[j] * y;
       }
     }
-
-    /* now, compress the signal and place it in the signal_out array;
-       truncate the signal if time_steps_calc % ntsteps_out != 0 */
-    comp_f = setup->time_steps_calc/setup->ntsteps_out;
-    for (j = 0; j < setup->ntsteps_out; j++) signal_out[j] = 0;
-    for (j = 0; j < setup->ntsteps_out*comp_f; j++)
-      signal_out[j/comp_f] += signal[j]/comp_f;
-
-    /* do RC integration for preamp risetime */
-    if (setup->preamp_tau/setup->step_time_out >= 0.1f)
-      rc_integrate(signal_out, signal_out,
-		   setup->preamp_tau/setup->step_time_out, setup->ntsteps_out);
+    for (j = 0; j < tsteps; j++){
+      signal[j] = tmp[j]/sum[j];
+    }
   }
+}
 
-  /* make_signal returns 0 for success; require hole signal but not electron */
-  if (err) return -1;
-  return 1;
+/* compress_signal
+   the third step of get_signal: compress signal (time_steps_calc steps) into
+   signal_out (ntsteps_out steps), averaging over each output time step;
+   truncate the signal if time_steps_calc % ntsteps_out != 0
+*/
+void compress_signal(float *signal, float *signal_out, MJD_Siggen_Setup *setup) {
+  int   j, comp_f;
+
+  comp_f = setup->time_steps_calc/setup->ntsteps_out;
+  for (j = 0; j < setup->ntsteps_out; j++) signal_out[j] = 0;
+  for (j = 0; j < setup->ntsteps_out*comp_f; j++)
+    signal_out[j/comp_f] += signal[j]/comp_f;
 }
 
-/* make_signal
-   Generates the signal originating at point pt, for charge q
+/* drift_kernel
+   the body of make_signal; the last four arguments are the features used:
+   holes (or electrons), collection at the point contact, diffusion and
+   charge trapping. They are constants in each of the kernels below, so that
+   each one compiles to a drift loop without the tests for unused features.
    returns 0 for success
 */
-int make_signal(point pt, float *signal, float q, MJD_Siggen_Setup *setup) {
-  static float wpot, wpot_old, dwpot;
+static ALWAYS_INLINE int drift_kernel(point pt, float *signal, float q,
+				      MJD_Siggen_Setup *setup, const int holes,
+				      const int collect2pc, const int diffusion,
+				      const int trapping) {
+  float  wpot = 0, wpot_old = 0, dwpot;
   char   tmpstr[MAX_LINE];
   point  new_pt;
+  cyl_pt cyl;
   vector v, dx;
-  float  vel0, vel1 = 0;
+  float  vel0, vel1 = 0, d;
   // double diffusion_coeff;
   double repulsion_fact = 0.0, ds2, ds3, dv, ds_dt;
-  int    ntsteps, i, t, n, collect2pc, low_field=0;
+  int    ntsteps, i, t, n, low_field=0;
 
   new_pt = pt;
-  collect2pc = ((q > 0 && setup->impurity_z0 < 0) ||  // holes for p-type 
-		(q < 0 && setup->impurity_z0 > 0));   // electrons for n-type
   /*
   if (q > 0) {
     diffusion_coeff = TWO_TIMES_DIFFUSION_COEF_H;
@@ -234,8 +326,9 @@ int make_signal(point pt, float *signal, float q, MJD_Siggen_Setup *setup) {
   }
   */
   ntsteps = setup->time_steps_calc;
-  for (t = 0; drift_velocity(new_pt, q, &v, setup) >= 0; t++) { 
-    if (q > 0) {
+  for (t = 0; (holes ? drift_velocity_h(new_pt, &v, setup) :
+		      drift_velocity_e(new_pt, &v, setup)) >= 0; t++) {
+    if (holes) {
       setup->dpath_h[t] = new_pt;
     } else {
       setup->dpath_e[t] = new_pt;
@@ -244,7 +337,7 @@ int make_signal(point pt, float *signal, float q, MJD_Siggen_Setup *setup) {
       if (t == 0) {
 	vel1 = setup->final_vel = setup->initial_vel = vector_length(v);
 	setup->final_charge_size = setup->charge_cloud_size;
-	if (setup->use_diffusion) {
+	if (diffusion) {
 	  if (setup->final_charge_size < 0.01) setup->final_charge_size = 0.01;
 	  /* for a spherically symmetric charge cloud, the equivalent
 	     delta-E at a distance of 1 sigma from the cloud center is
@@ -264,7 +357,7 @@ int make_signal(point pt, float *signal, float q, MJD_Siggen_Setup *setup) {
 	}
 	TELL_CHATTY("initial v: %f (%e %e %e)\n",
 		    setup->initial_vel, v.x, v.y, v.z);
-      } else if (setup->use_diffusion) {
+      } else if (diffusion) {
 	vel0 = vel1;
 	vel1 = vector_length(v);
 	setup->final_charge_size *= vel1/vel0;  // effect of acceleration
@@ -293,6 +386,7 @@ int make_signal(point pt, float *signal, float q, MJD_Siggen_Setup *setup) {
     TELL_CHATTY("pt: (%.2f %.2f %.2f), v: (%e %e %e)",
 		new_pt.x, new_pt.y, new_pt.z, v.x, v.y, v.z);
     if (t >= ntsteps - 2) {
+      STATS_ADD(max_steps[holes], 1);
       if (collect2pc || wpot > WP_THRESH_ELECTRONS) {
 	/* for p-type, this is hole or electron+high wp */
 	TELL_CHATTY("\nExceeded maximum number of time steps (%d)\n", ntsteps);
@@ -311,6 +405,7 @@ int make_signal(point pt, float *signal, float q, MJD_Siggen_Setup *setup) {
     if (t > 0) signal[t] += q*(wpot - wpot_old);
     // FIXME? Hack added by DCR to deal with undepleted point contact
     if (wpot >= 0.999 && (wpot - wpot_old) < 0.0002) {
+      STATS_ADD(low_field[holes], 1);
       low_field = 1;
       break;
     }
@@ -319,13 +414,15 @@ int make_signal(point pt, float *signal, float q, MJD_Siggen_Setup *setup) {
     dx = vector_scale(v, setup->step_time_calc);
     new_pt = vector_add(new_pt, dx);
     // do charge trapping
-    q *= setup->charge_trapping_per_step;
+    if (trapping) q *= setup->charge_trapping_per_step;
   }
   if (t == 0) {
     TELL_CHATTY("The starting point %s is outside the field.\n",
 		pt_to_str(tmpstr, MAX_LINE, pt));
     return -1;
   }
+  STATS_ADD(drifts[holes], 1);
+  STATS_ADD(drift_steps[holes], t);
 
   if (low_field) {
     TELL_CHATTY("Too many time steps or low field; this may or may not be a problem.\n");
@@ -334,12 +431,16 @@ int make_signal(point pt, float *signal, float q, MJD_Siggen_Setup *setup) {
 		pt_to_str(tmpstr, MAX_LINE, new_pt), q);
 
     /* now we are outside the electric grid. figure out how much we must
-       drift to get to the crystal boundary */
+       drift to get to the crystal boundary; the first d steps cannot reach it */
+    cyl.r = sqrt(new_pt.x*new_pt.x + new_pt.y*new_pt.y);
+    cyl.z = new_pt.z;
+    d = detector_distance(cyl, setup);
+    if (d > 0) d /= vector_length(dx);
     for (n = 0; n+t < ntsteps; n++){
       new_pt = vector_add(new_pt, dx);
-      if (q > 0) setup->dpath_h[t+n] = new_pt;
+      if (holes) setup->dpath_h[t+n] = new_pt;
       else setup->dpath_e[t+n] = new_pt;
-      if (outside_detector(new_pt, setup)) break;
+      if (n+1 >= d && outside_detector(new_pt, setup)) break;
     }
     if (n == 0) n = 1; /* always drift at least one more step */
     // TELL_CHATTY(
@@ -347,8 +448,9 @@ int make_signal(point pt, float *signal, float q, MJD_Siggen_Setup *setup) {
 		q, t, n, pt.x, pt.y, pt.z, new_pt.x, new_pt.y, new_pt.z);
 
     if (n + t >= ntsteps){
-      if (q > 0 || wpot > WP_THRESH_ELECTRONS) { /* hole or electron+high wp */
+      if (holes || wpot > WP_THRESH_ELECTRONS) { /* hole or electron+high wp */
 	TELL_CHATTY("Exceeded maximum number of time steps (%d)\n", ntsteps);
+	STATS_ADD(max_steps[holes], 1);
 	return -1;  /* FIXME DCR: does this happen? could this be improved? */
       }
       n = ntsteps -t;
@@ -361,19 +463,61 @@ int make_signal(point pt, float *signal, float q, MJD_Siggen_Setup *setup) {
     }
 
     /*now drift the final n steps*/
+    STATS_ADD(final_steps[holes], n);
     dx = vector_scale(v, setup->step_time_calc);
     for (i = 0; i < n; i++){
       signal[i+t] += q*dwpot;
       // do charge trapping
-      q *= setup->charge_trapping_per_step;
+      if (trapping) q *= setup->charge_trapping_per_step;
     }
   }
   TELL_CHATTY("q:%.2f pt: %s\n", q, pt_to_str(tmpstr, MAX_LINE, pt));
-  if (q > 0) setup->final_vel = vector_length(v);
+  if (holes) setup->final_vel = vector_length(v);
 
   return 0;
 }
 
+/* one kernel for each combination of features; diffusion only matters
+   for the carriers that are collected at the point contact */
+#define DRIFT_KERNEL(name, holes, collect2pc, diffusion, trapping)	\
+  static int name(point pt, float *signal, float q, MJD_Siggen_Setup *setup) { \
+    return drift_kernel(pt, signal, q, setup, holes, collect2pc, diffusion, trapping); \
+  }
+DRIFT_KERNEL(drift_e,          0, 0, 0, 0)
+DRIFT_KERNEL(drift_e_trap,     0, 0, 0, 1)
+DRIFT_KERNEL(drift_e_pc,       0, 1, 0, 0)
+DRIFT_KERNEL(drift_e_pc_trap,  0, 1, 0, 1)
+DRIFT_KERNEL(drift_e_pcd,      0, 1, 1, 0)
+DRIFT_KERNEL(drift_e_pcd_trap, 0, 1, 1, 1)
+DRIFT_KERNEL(drift_h,          1, 0, 0, 0)
+DRIFT_KERNEL(drift_h_trap,     1, 0, 0, 1)
+DRIFT_KERNEL(drift_h_pc,       1, 1, 0, 0)
+DRIFT_KERNEL(drift_h_pc_trap,  1, 1, 0, 1)
+DRIFT_KERNEL(drift_h_pcd,      1, 1, 1, 0)
+DRIFT_KERNEL(drift_h_pcd_trap, 1, 1, 1, 1)
+#undef DRIFT_KERNEL
+
+/* make_signal
+   Generates the signal originating at point pt, for charge q;
+   picks the drift kernel for the features needed, once per call
+   returns 0 for success
+*/
+int make_signal(point pt, float *signal, float q, MJD_Siggen_Setup *setup) {
+  static int (*kernel[2][3][2])(point, float *, float, MJD_Siggen_Setup *) = {
+    {{drift_e, drift_e_trap}, {drift_e_pc, drift_e_pc_trap}, {drift_e_pcd, drift_e_pcd_trap}},
+    {{drift_h, drift_h_trap}, {drift_h_pc, drift_h_pc_trap}, {drift_h_pcd, drift_h_pcd_trap}}};
+  int holes, collect;
+
+  holes = (q > 0);
+  if ((q > 0 && setup->impurity_z0 < 0) ||    // holes for p-type
+      (q < 0 && setup->impurity_z0 > 0)) {    // electrons for n-type
+    collect = (setup->use_diffusion ? 2 : 1);
+  } else {
+    collect = 0;
+  }
+  return kernel[holes][collect][setup->charge_trapping_per_step != 1.0f](pt, signal, q, setup);
+}
+
 int rc_integrate(float *s_in, float *s_out, float tau, int time_steps){
   int   j;
   float s_in_old, s;  /* DCR: added so that it's okay to
@@ -394,16 +538,120 @@ int rc_integrate(float *s_in, float *s_out, float tau, int time_steps){
   return 0;
 }
 
+/* signal_params
+   find the times (in ns) at which signal s, of nsteps steps of step_time ns,
+   reaches 10% and 90% of its final value of 1, and A/E, the maximum slope
+   over 4 time steps, per time step
+*/
+void signal_params(float *s, int nsteps, float step_time,
+		   float *t10, float *t90, float *a_over_e){
+  float d;
+  int   i, dt = 4;
+
+  *t10 = *t90 = *a_over_e = 0;
+  for (i = 0; i < nsteps - dt; i++) {
+    d = (s[i+dt] - s[i]) / (float) dt;
+    if (d > *a_over_e) *a_over_e = d;
+    if (s[i] < 0.1f && s[i+1] >= 0.1f)
+      *t10 = step_time * ((float) i + (0.1f - s[i]) / (s[i+1] - s[i]));
+    if (s[i] < 0.9f && s[i+1] >= 0.9f)
+      *t90 = step_time * ((float) i + (0.9f - s[i]) / (s[i+1] - s[i]));
+  }
+}
+
 /* signal_calc_finalize
  * Clean up (free arrays, close open files...)
  */
 int signal_calc_finalize(MJD_Siggen_Setup *setup){
+#ifdef SIGGEN_STATS
+  if (setup->stats.signals > 0) signal_calc_stats_print(stdout, &setup->stats);
+#endif
   fields_finalize(setup);
-  free(setup->dpath_h);
-  free(setup->dpath_e);
+  signal_calc_clone_free(setup);
   return 0;
 }
 
+/* signal_calc_stats
+   copy the counters and timers of setup to stats
+   returns 1 if they are kept (compiled with SIGGEN_STATS), 0 if not,
+   in which case they are all zero
+*/
+int signal_calc_stats(MJD_Siggen_Setup *setup, Siggen_Stats *stats) {
+
+  *stats = setup->stats;
+#ifdef SIGGEN_STATS
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+/* signal_calc_stats_reset
+   set the counters and timers of setup to zero
+*/
+void signal_calc_stats_reset(MJD_Siggen_Setup *setup) {
+
+  memset(&setup->stats, 0, sizeof(setup->stats));
+}
+
+/* signal_calc_stats_add
+   add the counters and timers of setup copy (from signal_calc_clone) to
+   those of setup, e.g. before signal_calc_finalize, and reset those of copy
+*/
+void signal_calc_stats_add(MJD_Siggen_Setup *setup, MJD_Siggen_Setup *copy) {
+  Siggen_Stats *s = &setup->stats, *c = &copy->stats;
+  int i;
+
+  s->signals += c->signals;
+  for (i = 0; i < 2; i++) {
+    s->drifts[i]      += c->drifts[i];
+    s->drift_steps[i] += c->drift_steps[i];
+    s->final_steps[i] += c->final_steps[i];
+    s->low_field[i]   += c->low_field[i];
+    s->max_steps[i]   += c->max_steps[i];
+  }
+  s->nearest_calls  += c->nearest_calls;
+  s->nearest_hits   += c->nearest_hits;
+  s->extrapolations += c->extrapolations;
+  s->efield_exists  += c->efield_exists;
+  s->velo_lookups   += c->velo_lookups;
+  s->velo_search    += c->velo_search;
+  for (i = 0; i < 4; i++) s->phase_time[i] += c->phase_time[i];
+  signal_calc_stats_reset(copy);
+}
+
+/* signal_calc_stats_print
+   write a summary of stats to file fp
+*/
+void signal_calc_stats_print(FILE *fp, Siggen_Stats *stats) {
+  static const char *carrier[2] = {"electrons", "holes"};
+  static const char *phase[4] = {"drift", "convolution", "compression", "RC"};
+  double total = 0;
+  int    i;
+
+#define PER(a, b) ((b) > 0 ? (double) (a) / (double) (b) : 0.0)
+  fprintf(fp, "\nSignal calculation statistics: %ld signals\n", stats->signals);
+  for (i = 1; i >= 0; i--)
+    fprintf(fp, " %9s: %9ld drifts, %7.1f steps/drift in field, %5.1f final steps;\n"
+	    "            %9ld stopped by low field, %ld used all time steps\n",
+	    carrier[i], stats->drifts[i], PER(stats->drift_steps[i], stats->drifts[i]),
+	    PER(stats->final_steps[i], stats->drifts[i]),
+	    stats->low_field[i], stats->max_steps[i]);
+  fprintf(fp, " grid index: %ld calls, %.1f%% from cache, %.2f%% extrapolated;"
+	  " %ld efield_exists calls\n",
+	  stats->nearest_calls, 100.0 * PER(stats->nearest_hits, stats->nearest_calls),
+	  100.0 * PER(stats->extrapolations, stats->nearest_calls), stats->efield_exists);
+  fprintf(fp, " velocity table: %ld lookups, %.1f rows searched per lookup\n",
+	  stats->velo_lookups, PER(stats->velo_search, stats->velo_lookups));
+  for (i = 0; i < 4; i++) total += stats->phase_time[i];
+  fprintf(fp, " time:");
+  for (i = 0; i < 4; i++)
+    fprintf(fp, " %s %.3f s (%.1f%%)%s", phase[i], stats->phase_time[i],
+	    100.0 * PER(stats->phase_time[i], total), (i < 3 ? "," : "\n"));
+  fprintf(fp, "       %.2f us per signal\n", 1e6 * PER(total, stats->signals));
+#undef PER
+}
+
 int drift_path_e(point **pp, MJD_Siggen_Setup *setup){
   *pp = setup->dpath_e;
   return setup->time_steps_calc;
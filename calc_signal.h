@@ -7,12 +7,15 @@
  * To use: 
  * -- call signal_calc_init. This will initialize geometry, fields,
  *       drift velocities etc.
+ *       (or fill the setup and fields in memory, e.g. using the fieldgen library,
+ *        and then call signal_calc_init_setup)
  * -- call get_signal
  */
 #ifndef _CALC_SIGNAL_H
 #define _CALC_SIGNAL_H
 
 #include <stdarg.h>
+#include <stdio.h>
 #include "point.h"
 #include "mjd_siggen.h"
 
@@ -36,20 +39,63 @@ typedef struct {
 */
 int signal_calc_init(char *config_file_name, MJD_Siggen_Setup *setup);
 
+/* signal_calc_init_setup
+   as signal_calc_init, but for a setup that has already been filled in,
+   e.g. by read_config; if setup->efld and setup->wpot have been filled
+   by fieldgen_export (see fieldgen.h), the field files are not read
+   returns 0 for success
+*/
+int signal_calc_init_setup(MJD_Siggen_Setup *setup);
+
+/* signal_calc_clone
+   make a copy of setup, after signal_calc_init, for use by another thread;
+   the copy has its own drift paths and work space, but shares the fields
+   and velocity table of setup, which must not be changed (e.g. by set_temp)
+   or finalized while the copy is in use
+   returns 0 for success
+*/
+int signal_calc_clone(MJD_Siggen_Setup *copy, MJD_Siggen_Setup *setup);
+
+/* signal_calc_clone_free
+   free the drift paths and work space of a copy made by signal_calc_clone
+*/
+void signal_calc_clone_free(MJD_Siggen_Setup *copy);
+
 /* get_signal calculate signal for point pt. Result is placed in signal
  * array which is assumed to have at least (number of time steps) elements
  * returns -1 if outside crystal
  */
 int get_signal(point pt, float *signal, MJD_Siggen_Setup *setup);
 
+/* drift_signal, charge_cloud_convolve, compress_signal
+   the steps of get_signal, for programs that need them separately (e.g. to time them):
+   drift_signal drifts the charges from pt and puts the charge signal, of
+     time_steps_calc steps, in signal; it returns -1 if pt is outside the crystal,
+     1 if the holes could not be drifted, and 0 for success
+   charge_cloud_convolve then applies the charge cloud size and diffusion, if used
+   compress_signal averages signal into signal_out, of ntsteps_out steps
+   get_signal finally calls rc_integrate on signal_out, if preamp_tau is used
+*/
+int  drift_signal(point pt, float *signal, MJD_Siggen_Setup *setup);
+void charge_cloud_convolve(float *signal, MJD_Siggen_Setup *setup);
+void compress_signal(float *signal, float *signal_out, MJD_Siggen_Setup *setup);
+
 /* make_signal
    Generates the signal originating at point pt, for charge q
    returns 0 for success
 */
 int make_signal(point pt, float *signal, float q, MJD_Siggen_Setup *setup);
 
+/* signal_params
+   find the times (in ns) at which signal s, of nsteps steps of step_time ns,
+   reaches 10% and 90% of its final value of 1, and A/E, the maximum slope
+   over 4 time steps, per time step
+*/
+void signal_params(float *s, int nsteps, float step_time,
+		   float *t10, float *t90, float *a_over_e);
+
 /* signal_calc_finalize
- * Clean up
+ * Clean up; if compiled with SIGGEN_STATS, first print the statistics
  */
 int signal_calc_finalize(MJD_Siggen_Setup *setup);
 
@@ -58,6 +104,19 @@ int signal_calc_finalize(MJD_Siggen_Setup *setup);
  */
 int rc_integrate(float *s_in, float *s_out, float tau, int time_steps);
 
+/* signal_calc_stats, signal_calc_stats_reset, signal_calc_stats_add,
+   signal_calc_stats_print
+   counters and timers of the signal calculation, kept only if the code is
+   compiled with SIGGEN_STATS (e.g. "make STATS=1"); see Siggen_Stats in
+   mjd_siggen.h. signal_calc_stats copies them to stats and returns 1 if
+   they are kept, 0 if not. signal_calc_stats_add adds those of a copy from
+   signal_calc_clone to setup, and resets the copy's.
+*/
+int  signal_calc_stats(MJD_Siggen_Setup *setup, Siggen_Stats *stats);
+void signal_calc_stats_reset(MJD_Siggen_Setup *setup);
+void signal_calc_stats_add(MJD_Siggen_Setup *setup, MJD_Siggen_Setup *copy);
+void signal_calc_stats_print(FILE *fp, Siggen_Stats *stats);
+
 /*drift paths for last calculated signal.
   after the call, "path" will point at a 1D array containing the points
   (one per time step) of the drift path. 
@@ -2,6 +2,11 @@
  * Karin Lagergren
  *
  * This module keeps track of the detector geometry
+ *
+ * Oct 2026: added a grid of distances to the surface (geometry_setup), so that
+ *           points away from the surface need only a table lookup
+ * Oct 2026: the shape itself now comes from geometry.c, shared with fieldgen;
+ *           this also fixes the taper, which was placed using zmax instead of rmax
  */
 
 #include <stdio.h>
@@ -11,75 +16,108 @@
 #include "detector_geometry.h"
 #include "point.h"
 #include "cyl_point.h"
+#include "calc_signal.h"
+#include "geometry.h"
 
 
 #define SQ(x) ((x)*(x))
+/* outside
+   the full test of the detector geometry, for radius r and height z
+   returns 1 if (r,z) is outside the detector, 0 if inside detector
+*/
+static int outside(float r, float z, MJD_Siggen_Setup *setup){
+  return (geometry_classify(&setup->geom, r, z, 0) != GEOM_GE);
+}
+
 /* outside_detector
    returns 1 if pt is outside the detector, 0 if inside detector
 */
 int outside_detector(point pt, MJD_Siggen_Setup *setup){
-  float r, z, br, a;
+  cyl_pt cyl;
 
-  z = pt.z;
-  if (z >= setup->zmax || z < 0) return 1;
+  cyl.r = sqrt(SQ(pt.x)+SQ(pt.y));
+  cyl.z = pt.z;
+  cyl.phi = 0;
+  return outside_detector_cyl(cyl, setup);
+}
 
-  r = sqrt(SQ(pt.x)+SQ(pt.y));
-  if (r > setup->rmax) return 1;
-  br = setup->top_bullet_radius;
-  if (z > setup->zmax - br &&
-      r > (setup->rmax - br) + sqrt(SQ(br)- SQ(z-(setup->zmax - br)))) return 1;
-  if (setup->pc_radius > 0 &&
-      z <= setup->pc_length && r <= setup->pc_radius) {
-    if (!setup->bulletize_PC) return 1;
-    if (setup->pc_length > setup->pc_radius) {
-      a = setup->pc_length - setup->pc_radius;
-      if (z < a || SQ(z-a) + SQ(r) < SQ(setup->pc_radius)) return 1;
-    } else {
-      a = setup->pc_radius - setup->pc_length;
-      if (r < a || SQ(z) + SQ(r-a) < SQ(setup->pc_length)) return 1;
-    }
-    return 0;
-  }
-  if (setup->taper_length > 0 && z < setup->taper_length &&
-      r > setup->zmax - setup->taper_length + z) return 1;
-  if (setup->ditch_depth > 0 && z < setup->ditch_depth  &&
-      setup->ditch_thickness > 0 && setup->wrap_around_radius > 0 &&
-      r < setup->wrap_around_radius &&
-      r > setup->wrap_around_radius - setup->ditch_thickness) return 1;
+int outside_detector_cyl(cyl_pt pt, MJD_Siggen_Setup *setup){
+  float d;
 
-  return 0;
+  /* away from the surface, the distance grid gives the answer */
+  if ((d = detector_distance(pt, setup)) != 0) return (d < 0);
+  return outside(pt.r, pt.z, setup);
 }
 
-int outside_detector_cyl(cyl_pt pt, MJD_Siggen_Setup *setup){
-  float r, z, br, a;
+/* detector_distance
+   returns a lower bound on the distance in mm from pt to the detector surface,
+   positive inside the detector and negative outside, or 0 if pt is close
+   to the surface (or off the field grid, or geometry_setup() was not called)
+*/
+float detector_distance(cyl_pt pt, MJD_Siggen_Setup *setup){
+  int i, j;
 
-  z = pt.z;
-  if (z >= setup->zmax || z < 0) return 1;
+  if (!setup->sdist ||
+      pt.r < setup->rmin || pt.z < setup->zmin) return 0;
+  i = (pt.r - setup->rmin)/setup->rstep;
+  j = (pt.z - setup->zmin)/setup->zstep;
+  if (i >= setup->rlen - 1 || j >= setup->zlen - 1) return 0;
+  return setup->sdist[i][j];
+}
+
+/* geometry_setup
+   compile the detector shape into setup->geom, and fill setup->sdist, which
+   for each cell of the field grid gives a lower bound on the distance from
+   any point in the cell to the detector surface: the distance from the middle
+   of the cell, less half the cell diagonal. Cells that the surface may pass
+   through are set to 0.
+   returns 0 for success
+*/
+int geometry_setup(MJD_Siggen_Setup *setup){
+  float  h, d;
+  int    i, j;
 
-  r = pt.r;
-  if (r > setup->rmax) return 1;
-  br = setup->top_bullet_radius;
-  if (z > setup->zmax - br &&
-      r > (setup->rmax - br) + sqrt(SQ(br)- SQ(z-(setup->zmax - br)))) return 1;
-  if (setup->pc_radius > 0 &&
-      z <= setup->pc_length && r <= setup->pc_radius) {
-    if (!setup->bulletize_PC) return 1;
-    if (setup->pc_length > setup->pc_radius) {
-      a = setup->pc_length - setup->pc_radius;
-      if (z < a || SQ(z-a) + SQ(r) < SQ(setup->pc_radius)) return 1;
-    } else {
-      a = setup->pc_radius - setup->pc_length;
-      if (r < a || SQ(z) + SQ(r-a) < SQ(setup->pc_length)) return 1;
+  geometry_finalize(setup);
+  geometry_compile(&setup->geom, setup, 0);
+  setup->rlen = lrintf((setup->rmax - setup->rmin)/setup->rstep) + 1;
+  setup->zlen = lrintf((setup->zmax - setup->zmin)/setup->zstep) + 1;
+
+  if ((setup->sdist = (float **) malloc((setup->rlen-1)*sizeof(*setup->sdist))) == NULL) {
+    error("Malloc failed in geometry_setup\n");
+    return 1;
+  }
+  /* half the diagonal, plus a little for rounding */
+  h = 0.5*sqrt(SQ(setup->rstep) + SQ(setup->zstep)) + 0.001;
+  for (i = 0; i < setup->rlen-1; i++){
+    if ((setup->sdist[i] = (float *) malloc((setup->zlen-1)*sizeof(*setup->sdist[i]))) == NULL) {
+      error("Malloc failed in geometry_setup\n");
+      return 1;
+    }
+    for (j = 0; j < setup->zlen-1; j++){
+      d = geometry_distance(&setup->geom,
+			    setup->rmin + (i+0.5)*setup->rstep,
+			    setup->zmin + (j+0.5)*setup->zstep);
+      if (d > h) {
+	setup->sdist[i][j] = d - h;
+      } else if (d < -h) {
+	setup->sdist[i][j] = d + h;
+      } else {
+	setup->sdist[i][j] = 0;
+      }
     }
-    return 0;
   }
-  if (setup->taper_length > 0 && z < setup->taper_length &&
-      r > setup->zmax - setup->taper_length + z) return 1;
-  if (setup->ditch_depth > 0 && z < setup->ditch_depth  &&
-      setup->ditch_thickness > 0 && setup->wrap_around_radius > 0 &&
-      r < setup->wrap_around_radius &&
-      r > setup->wrap_around_radius - setup->ditch_thickness) return 1;
-
   return 0;
 }
+
+/* geometry_finalize
+   free the distance grid made by geometry_setup()
+*/
+void geometry_finalize(MJD_Siggen_Setup *setup){
+  int i;
+
+  if (!setup->sdist) return;
+  for (i = 0; i < setup->rlen-1; i++) free(setup->sdist[i]);
+  free(setup->sdist);
+  setup->sdist = NULL;
+}
 #undef SQ
@@ -16,4 +16,20 @@
 int outside_detector(point pt, MJD_Siggen_Setup *setup);
 int outside_detector_cyl(cyl_pt pt, MJD_Siggen_Setup *setup);
 
+/* geometry_setup
+   compile the detector shape into setup->geom (see geometry.h) and
+   calculate the grid of distances to the detector surface, setup->sdist, on
+   the field grid, so that outside_detector() only needs the full geometry
+   near the surface; rmin, rmax, rstep etc must already be set
+   returns 0 for success
+*/
+int geometry_setup(MJD_Siggen_Setup *setup);
+void geometry_finalize(MJD_Siggen_Setup *setup);
+
+/* detector_distance
+   returns a lower bound on the distance (mm) from pt to the detector surface;
+   > 0 inside the detector, < 0 outside, and 0 if pt is near the surface
+*/
+float detector_distance(cyl_pt pt, MJD_Siggen_Setup *setup);
+
 #endif /*#ifndef _DETECTOR_GEOMETRY_H*/
@@ -0,0 +1,2443 @@
+/* fieldgen.c -- calculation of electric fields and weighting potentials
+              of PPC and BEGe Ge detectors by relaxation
+   author:           D.C. Radford
+   first written:    Nov 2007
+   this modified version for MJD:  Oct 2014
+      - uses the same (single) config file as modified MJD siggen
+      - added intelligent coarse grid / refinement of grid
+      - added interpolation of RC and LC positions on the grid
+   June 2016: added optional bulletization of point contact
+   Nov  2017: added top bulletization
+   Oct  2026: relaxation iterations are done several at a time in cache-sized
+                wavefront blocks (see relax_block())
+   Oct  2026: split out of mjd_fieldgen.c into a library, see fieldgen.h;
+                results can be handed directly to siggen with fieldgen_export()
+   Oct  2026: added fieldgen_run(), which calculates the WP on a second thread
+                at the same time as the potential
+   Oct  2026: with a thread pool (fg->pool), idle threads help with the
+                relaxation, each doing a band of rows (see relax_sweep())
+   Oct  2026: added fieldgen_find_voltages(), a bisection search for the
+                depletion and pinch-off voltages
+   Oct  2026: added fg->linear, which turns off the search for undepleted regions,
+                for the basis fields of the impurity fit (fieldgen_fit.c)
+   Oct  2026: the shape of the detector now comes from geometry.c, shared with siggen;
+                voxels cut by the ditch are partly filled
+   Oct  2026: added the central borehole of inverted-coax (ICPC) detectors,
+                with its edges interpolated as for the PC (bulk = 1 and 4)
+
+   TO DO:
+      - add other bulletizations
+      - add dead layer / Li thickness
+      - on coarse grids, interpolate the position of L, R and LT
+            (as is done now already for RC and LC, and the ditch)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "mjd_siggen.h"
+#include "cyl_point.h"
+#include "geometry.h"
+#include "fieldgen.h"
+#include "timer.h"
+
+static int grid_alloc(Relax_Grid *g, int L, int R, int LC);
+static void grid_free(Relax_Grid *g);
+static void grid_expand(Relax_Grid *g, float grid_old, float grid_new, int LL, int RR);
+static void grid_geometry(MJD_Siggen_Setup *setup, Relax_Grid *g, float grid,
+			  float dLC_min, float *dLC, float *dRC);
+static void grid_permittivity(Relax_Grid *g);
+static void ev_setup_level(MJD_Fieldgen *fg, int istep, int init);
+static void wp_setup_level(MJD_Fieldgen *fg, int istep, int expand);
+static int wp_solve(MJD_Fieldgen *fg, int depleted);
+static int relax(Relax_Grid *g, int wp, int depth, int max_its, int *iter, Relax_Stats *last);
+
+/* fieldgen_init
+   set up the grids for the detector described in setup and allocate arrays;
+   config_file_name may be NULL, otherwise the contents of that file are copied
+   to the headers of the output files; messages are written to out, or to
+   stdout if out is NULL
+   returns 0 for success; on failure, nothing is left allocated
+*/
+int fieldgen_init(MJD_Fieldgen *fg, MJD_Siggen_Setup *setup, char *config_file_name,
+		  FILE *out) {
+
+  int   L, R, LC, RC, LT, RO, LO, WO, BRT, i, j, r;
+  float grid, cs;
+
+  memset(fg, 0, sizeof(*fg));
+  fg->setup = setup;
+  if (config_file_name)
+    strncpy(fg->config_file_name, config_file_name, sizeof(fg->config_file_name)-1);
+  fg->undepleted_file = "undepleted.txt";
+  fg->tile_depth = TILE_DEPTH;
+  fg->nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  fg->out = fg->ev.out = fg->wp.out = (out ? out : stdout);
+
+  if (setup->xtal_grid < 0.001) setup->xtal_grid = 0.5;
+  grid = setup->xtal_grid;
+
+  L  = fg->LL = lrint(setup->xtal_length/grid);
+  R  = fg->RR = lrint(setup->xtal_radius/grid);
+  BRT = lrint(setup->top_bullet_radius/grid);
+  // BRB = lrint(setup->bottom_bullet_radius/grid);
+  LC = lrint(setup->pc_length/grid);
+  RC = lrint(setup->pc_radius/grid);
+  LT = lrint(setup->taper_length/grid);
+  RO = lrint(setup->wrap_around_radius/grid);
+  LO = lrint(setup->ditch_depth/grid);
+  WO = lrint(setup->ditch_thickness/grid);
+  // LiT = lrint(setup->Li_thickness/grid);
+  fg->N  = setup->impurity_z0;
+  fg->M  = setup->impurity_gradient;
+  fg->BV = setup->xtal_HV;
+
+  if (L <= 1 || R <= 1) {
+    fprintf(fg->out, "ERROR: Crystal size is too small compared to the grid size.\n");
+    return 1;
+  }
+  if (L*R > 2500*2500) {
+    fprintf(fg->out, "Error: Crystal size divided by grid size is too large!\n");
+    return 1;
+  }
+
+  if (RO <= 0.0 || RO >= R) {
+    RO = R - LT;    // inner radius of taper, in grid lengths
+    fprintf(fg->out, "\n\n"
+	   " Crystal: Radius x Length: %.1f x %.1f mm\n"
+	   "   Taper: %.1f mm\n"
+	   "No wrap-around contact or ditch...\n"
+	   "Bias: %.0f V\n"
+	   "Impurities: (%.3f + %.3fz) e10/cm3\n\n",
+	   grid * (float) R, grid * (float) L, grid * (float) LT,
+	   fg->BV, fg->N, fg->M);
+  } else {
+    fprintf(fg->out, "\n\n"
+	   "    Crystal: Radius x length: %.1f x %.1f mm\n"
+	   "      Taper: %.1f mm\n"
+	   "Wrap-around: Radius x ditch x gap:  %.1f x %.1f x %.1f mm\n"
+	   "       Bias: %.0f V\n"
+	   " Impurities: (%.3f + %.3fz) e10/cm3\n\n",
+	   grid * (float) R, grid * (float) L, grid * (float) LT,
+	   grid * (float) RO, grid * (float) LO, grid * (float) WO, fg->BV, fg->N, fg->M);
+  }
+  if (setup->bulletize_PC)
+    fprintf(fg->out, "   Contact: Radius x length: %.1f x %.1f mm, bulletized\n\n",
+	   grid * (float) RC, grid * (float) LC);
+  else
+    fprintf(fg->out, "   Contact: Radius x length: %.1f x %.1f mm, not bulletized\n\n",
+	   grid * (float) RC, grid * (float) LC);
+
+  if ((fg->BV < 0 && fg->N < 0) || (fg->BV > 0 && fg->N > 0)) {
+    fprintf(fg->out, "ERROR: Expect bias and impurity to be opposite sign!\n");
+    return 1;
+  }
+  if (BRT > 0)
+    fprintf(fg->out, "   Radius of top-of-crystal bulletization is %.1f mm\n\n", grid * (float) BRT);
+  if (setup->hole_length > 0 && setup->hole_radius > 0)
+    fprintf(fg->out, "  Borehole: Radius x length: %.1f x %.1f mm\n\n",
+	    setup->hole_radius, setup->hole_length);
+
+  if (fg->N > 0) {
+    // swap polarity for n-type material; this lets me assume all voltages are positive
+    fg->BV = -fg->BV;
+    fg->M = -fg->M;
+    fg->N = -fg->N;
+  }
+
+  /* malloc arrays; the potential and WP each get their own set,
+     so that both results are available at the end */
+  if ((fg->undepleted = (char **) calloc(R+1, sizeof(*fg->undepleted))) == NULL) {
+    fprintf(fg->out, "Malloc failed\n");
+    return 1;
+  }
+  for (j=0; j<R+1; j++) {
+    if ((fg->undepleted[j] = (char *) malloc((L+1)*sizeof(**fg->undepleted))) == NULL) {
+      fprintf(fg->out, "Malloc failed; j = %d\n", j);
+      goto fail;
+    }
+    memset(fg->undepleted[j], ' ', (L+1)*sizeof(**fg->undepleted));
+  }
+  fg->ev.undepleted = fg->wp.undepleted = fg->undepleted;
+  if (grid_alloc(&fg->ev, L, R, LC) || grid_alloc(&fg->wp, L, R, LC)) goto fail;
+
+  /* In the following we divide areas and volumes by pi
+    r_bin   rmax  A_top A_outside A_inside  volume  total_surf  out/top  tot/vol
+      0     1/2    1/4      1         0       1/4      1.5         4        6  << special case
+      1     3/2      2      3         1        2        8        3/2        4
+      2     5/2      4      5         3        4       16        5/4        4
+      3     7/2      6      7         5        6       24        7/6        4
+      r   r+0.5     2r    2r+1      2r-1      2r       8r     (2r+1)/2r     4
+                                                              = 1+0.5/r
+  */
+  // weighting values for the relaxation alg. as a function of r
+  fg->ev.s1[0] = fg->wp.s1[0] = 4.0;
+  fg->ev.s2[0] = fg->wp.s2[0] = 0.0;
+  for (r=1; r<R+1; r++) {
+    fg->ev.s1[r] = fg->wp.s1[r] = 1.0 + 0.5 / (double) r;   //  for r+1
+    fg->ev.s2[r] = fg->wp.s2[r] = 1.0 - 0.5 / (double) r;   //  for r-1
+  }
+
+  /*
+    If grid is too small compared to the crystal size, then it will take too
+    long for the relaxation to converge. In that case, we use an adaptive
+    grid, where we start out coarse and then refine the grid.
+  */
+  cs = sqrt(setup->xtal_length * setup->xtal_radius);
+  i = 1 + ((int) (cs/grid)) / 100;
+  if (i < 2) {
+    fg->gridstep[0] = grid;
+    fg->gridstep[1] = fg->gridstep[2] = 0;
+    fprintf(fg->out, "Single grid size: %.4f\n", grid);
+  } else if (i < 6) {
+    fg->gridstep[0] = (float) i * grid;
+    fg->gridstep[1] = grid;
+    fg->gridstep[2] = 0;
+    fprintf(fg->out, "Two grid sizes: %.4f %.4f\n", fg->gridstep[0], grid);
+  } else {  // i > 5
+    j = (i+4)/5;
+    i = (i+j-1)/j;
+    fg->gridstep[0] = (float) (i*j) * grid;
+    fg->gridstep[1] = (float) j * grid;
+    fg->gridstep[2] = grid;
+    fprintf(fg->out, "Three grid sizes: %.4f %.4f %.4f (%d %d)\n",
+	   fg->gridstep[0], fg->gridstep[1], grid, i, j);
+  }
+
+  /* the rows used by the borehole edges must not overlap those of the PC,
+     since they share frrc[], even on the coarsest grid */
+  if (setup->hole_length > 0 && setup->hole_radius > 0 &&
+      lrint((setup->xtal_length - setup->hole_length)/fg->gridstep[0]) - 1 <=
+      lrint(setup->pc_length/fg->gridstep[0]) + 1) {
+    fprintf(fg->out, "ERROR: Borehole is too close to the point contact.\n");
+    goto fail;
+  }
+
+  return 0;
+
+ fail:
+  fieldgen_free(fg);
+  return 1;
+}
+
+/* ev_setup_level
+   set up the grid, impurities, initial values and boundary conditions for the
+   relaxation of the potential on grid level istep; if init is nonzero, the
+   result from the previous (coarser) level is interpolated onto the new grid,
+   or for istep = 0 a first guess is made; otherwise v[0] is used as it is
+*/
+static void ev_setup_level(MJD_Fieldgen *fg, int istep, int init) {
+
+  MJD_Siggen_Setup *setup = fg->setup;
+  Relax_Grid  *g = &fg->ev;
+  double **v[2] = {g->v[0], g->v[1]}, **vfraction = g->vfraction;
+  int    **bulk = g->bulk, *rrc = g->rrc;
+  float  *drrc = g->drrc, *frrc = g->frrc;
+  double e_over_E = 11.31; // e/epsilon
+                           // for 1 mm2, charge units 1e10 e/cm3, espilon = 16*epsilon0
+  float  BV = fg->BV, N = fg->N, M = fg->M;
+  float  a, grid, dLC, dRC;
+  int    r, z, L, R, LC;
+
+  grid = fg->gridstep[istep]; // grid size for this go-around
+  /*  e/espilon * area of pixel in mm2 / 4
+      for 1 mm2, charge units 1e10 e/cm3, espilon = 16*epsilon0
+      4.0 = surface area / volume of voxel in cylindrical (2D) coords
+      (this would be 6.0 in cartesian coords) */
+  e_over_E = 11.31 * grid*grid / 4.0;
+
+  if (istep > 0 && init) {
+    /* not the first go-around, so the previous calculation was on a coarser grid...
+       now copy/expand the potential to the new finer grid
+    */
+    grid_expand(g, fg->gridstep[istep-1], grid, fg->LL, fg->RR);
+  }
+
+  // recalculate geometry dimensions in units of the current grid size
+  grid_geometry(setup, g, grid, 0.01, &dLC, &dRC);
+  L = g->L;  R = g->R;  LC = g->LC;
+
+  g->S = setup->impurity_surface * e_over_E / grid;
+  for (z=0; z<L+1; z++) {
+    g->imp_z[z] = (N + 0.1 * M * grid * (double) z +
+		   setup->impurity_quadratic * (1.0 - (double) ((z-L/2)*(z-L/2)) /
+						(double) (L*L/4))) * e_over_E;
+  }
+  if (setup->impurity_rpower > 0.1) {
+    for (r=0; r<R+1; r++) {
+      g->imp_ra[r] = setup->impurity_radial_add * e_over_E *
+	pow((double) r / (double) R, setup->impurity_rpower);
+      g->imp_rm[r] = 1.0 + (setup->impurity_radial_mult - 1.0f) *
+	pow((double) r / (double) R, setup->impurity_rpower);
+    }
+  }
+  if (setup->verbosity >= NORMAL && !g->quiet)
+    fprintf(fg->out, "grid = %f  RC = %d  dRC = %f  LC = %d  dLC = %f\n\n",
+	   grid, g->RC, dRC, LC, dLC);
+
+  if (istep == 0 && init) {
+    // no previous coarse relaxation, so make initial wild guess at potential:
+    for (z=0; z<L; z++) {
+      a = BV * (float) (z) / (float) L;
+      for (r=0; r<R; r++) {
+	v[0][z][r] =  a + (BV - a) * (float) (r) / (float) R;
+      }
+    }
+  }
+
+  /* boundary conditions and permittivity
+     boundary condition at Ge-vacuum interface:
+     epsilon0 * E_vac = espilon_Ge * E_Ge
+  */
+  grid_permittivity(g);
+
+  for (z=0; z<L+1; z++) {
+    for (r=0; r<R+1; r++) {
+      // boundary conditions
+      bulk[z][r] = 0;  // flag for normal bulk, no complications
+      // outside (HV) contact, including taper, wrap-around and top bulletization:
+      if (geometry_classify(&g->geom, r, z, 1) == GEOM_OUTER) {
+	bulk[z][r] = -1;               // value of v[*][z][r] is fixed...
+	v[0][z][r] = v[1][z][r] = BV;  // at the bias voltage
+      }
+      // inside (point) contact, with optional bulletization:
+      else if (z <= LC && r <= rrc[z]) {
+	bulk[z][r] = -1;                // value of v[*][z][r] is fixed...
+	v[0][z][r] = v[1][z][r] = 0;    // at zero volts
+	/* radial edge of inside contact; if the PC radius is not in the middle
+	   of a pixel, we want to modify interpolation of V in surrounding pixels
+	*/
+	if (r == rrc[z] && drrc[z] < -0.05) {
+	  bulk[z][r] = 1;  // flag for radial edge of PC
+	  frrc[z] = -1.0/drrc[z];  // interpolation weight for pixel at (r-1)
+	  // only part of the pixel has volume charge density, the rest is contact
+	  vfraction[z][r] *= -2.0*drrc[z];
+	}
+	/* z edge of inside contact; if the PC length is not in the middle
+	   of a pixel, we want to modify interpolation of V in surrounding pixels
+	*/
+	if (z == LC && dLC < -0.05) {
+	  bulk[z][r] = 2;  // flag for z edge of PC
+	  g->fLC = -1.0/dLC;  // interpolation weight for pixel at (z-1)
+	  // only part of the pixel has volume charge density, the rest is contact
+	  vfraction[z][r] *= -2.0*dLC;
+	}
+      }
+      /* edges of inside contact; if the PC radius and/or legth is not in the middle
+	 of a pixel, we want to modify interpolation of V in surrounding pixels...
+	 in this case, the radius/length > grid point, so it modifies the
+	 interpolation for the next point out
+      */
+      // FIXME: Check for adjacent ditch
+      else if (z <= LC && r == rrc[z]+1 && drrc[z] > 0.05) {
+	bulk[z][r] = 1;         // flag for radial edge of PC
+	frrc[z] = 1.0/(1.0 - drrc[z]);  // interpolation weight for pixel at (r-1)
+      }
+      else if (z == LC+1 && r <= rrc[z] && dLC > 0.05) {
+	bulk[z][r] = 2;         // flag for z edge of PC
+	g->fLC = 1.0/(1.0 - dLC);  // interpolation weight for pixel at (z-1)
+      }
+      /* borehole of an inverted-coax detector, part of the outside contact;
+	 its edges are interpolated in the same way as those of the PC */
+      else if (z >= g->ZH && r <= g->RH) {
+	bulk[z][r] = -1;               // value of v[*][z][r] is fixed...
+	v[0][z][r] = v[1][z][r] = BV;  // at the bias voltage
+	if (r == g->RH && g->dRH < -0.05) {
+	  bulk[z][r] = 1;  // flag for radial edge, with contact at (r-1)
+	  frrc[z] = -1.0/g->dRH;
+	  vfraction[z][r] *= -2.0*g->dRH;
+	}
+	if (z == g->ZH && g->dZH > 0.05) {
+	  bulk[z][r] = 4;  // flag for bottom edge of borehole
+	  g->fZH = 1.0/g->dZH;  // interpolation weight for pixel at (z+1)
+	  vfraction[z][r] *= 2.0*g->dZH;
+	}
+      }
+      else if (z >= g->ZH && r == g->RH+1 && g->dRH > 0.05) {
+	bulk[z][r] = 1;
+	frrc[z] = 1.0/(1.0 - g->dRH);
+      }
+      else if (z == g->ZH-1 && r <= g->RH && g->dZH < -0.05) {
+	bulk[z][r] = 4;
+	g->fZH = 1.0/(1.0 + g->dZH);
+      }
+    }
+  }
+  g->pinched = 0;
+}
+
+/* ev_depleted
+   check the map of undepleted voxels left by the relaxation of the potential,
+   marking any that are at a nonzero potential as pinched-off (B)
+   returns 1 if the detector is fully depleted, 0 otherwise
+*/
+static int ev_depleted(MJD_Fieldgen *fg) {
+  Relax_Grid *g = &fg->ev;
+  char   **undepleted = fg->undepleted;
+  int    r, z, depleted = 1;
+
+  for (r=0; r<g->R+1; r++) {
+    for (z=0; z<g->L+1; z++) {
+      if (undepleted[r][z] == '*') {
+	depleted = 0;
+	if (g->v[g->cur][z][r] > 0.001) undepleted[r][z] = 'B';  // identifies pinch-off
+      }
+    }
+  }
+  return depleted;
+}
+
+/* fieldgen_solve_field
+   calculate the electric potential, using setup->xtal_HV as the bias
+   and identifying any undepleted regions of the detector
+   returns 0 for success
+*/
+int fieldgen_solve_field(MJD_Fieldgen *fg) {
+
+  MJD_Siggen_Setup *setup = fg->setup;
+  Relax_Grid  *g = &fg->ev;
+  Relax_Stats st;
+  double **v[2] = {g->v[0], g->v[1]};
+  char   **undepleted = fg->undepleted;
+  float  BV = fg->BV;
+  float  sum_dif=0, a, b, grid;
+  int    r, z, iter, istep, max_its, L, R;
+  FILE   *file;
+  double t0=0, t1, t2=0;
+
+  for (r=0; r<fg->RR+1; r++) {
+    g->imp_ra[r] = 0.0;
+    g->imp_rm[r] = 1.0;
+  }
+  fg->bubble_volts = 0;
+  fg->field_done = 0;
+  g->pool = fg->pool;
+  g->linear = fg->linear;
+  g->monitor = fg->monitor;
+  g->monitor_arg = fg->monitor_arg;
+
+  /* to be safe, initialize overall potential to bias voltage */
+  for (z=0; z<fg->LL+1; z++) {
+    for (r=0; r<fg->RR+1; r++) {
+      v[0][z][r] = v[1][z][r] = BV;
+    }
+  }
+  if (setup->verbosity >= CHATTY)
+    t0 = t2 = timer_now();  // for calculating elapsed time later...
+  max_its = MAX_ITS;
+  if (setup->max_iterations > 0) max_its = setup->max_iterations;
+  /* now set up and perform the relaxation for each of the grid step sizes in turn */
+  for (istep=0; istep<3 && fg->gridstep[istep]>0; istep++) {
+    grid = fg->gridstep[istep]; // grid size for this go-around
+    ev_setup_level(fg, istep, 1);
+    L = g->L;  R = g->R;
+
+    // now do the actual relaxation
+    if (relax(g, 0, fg->tile_depth, max_its, &iter, &st)) return 1;
+    sum_dif = st.sum_dif;
+    fg->bubble_volts = st.bubble_volts;
+
+    fprintf(fg->out, "\n>> %d %.16f\n\n", iter, sum_dif);
+
+    fg->fully_depleted = ev_depleted(fg);
+    if (fg->fully_depleted) {
+      fprintf(fg->out, "Detector is fully depleted.\n");
+    } else {
+      fprintf(fg->out, "Detector is not fully depleted.\n");
+      if (fg->bubble_volts > 0.0f)
+	fprintf(fg->out, "Pinch-off bubble at %.0f V potential\n", fg->bubble_volts);
+    }
+    if (setup->verbosity >= CHATTY) {
+      t1 = timer_now();
+      fprintf(fg->out, "\n ^^^^^^^^^^^^^ %.3f (%.3f) s elapsed ^^^^^^^^^^^^^^\n",
+	     t1 - t0, t1 - t2);
+      t2 = t1;
+    }
+
+    if (istep == 0) {
+      // can reduce # of iterations after first go-around
+      max_its /= MAX_ITS_FACTOR;
+      // report V and E along the axes r=0 and z=0
+      if (setup->verbosity >= NORMAL) {
+	fprintf(fg->out, "  z(mm)(r=0)      V   E(V/cm) |  r(mm)(z=0)      V   E(V/cm)\n");
+	a = b = v[g->cur][0][0];
+	for (z=0; z<L+1; z++) {
+	  fprintf(fg->out, "%10.1f %8.1f %8.1f  |",
+		 ((float) z)*grid, v[g->cur][z][0], (v[g->cur][z][0] - a)/(0.1*grid));
+	  a = v[g->cur][z][0];
+	  if (z > R) {
+	    fprintf(fg->out, "\n");
+	  } else {
+	    r = z;
+	    fprintf(fg->out, "%10.1f %8.1f %8.1f\n",
+		   ((float) r)*grid, v[g->cur][0][r], (v[g->cur][0][r] - b)/(0.1*grid));
+	    b = v[g->cur][0][r];
+	  }
+	}
+      }
+      // write a little file that shows any undepleted voxels in the crystal
+      if (fg->undepleted_file) {
+	if (!(file = fopen(fg->undepleted_file, "w"))) {
+	  fprintf(fg->out, "ERROR: Cannot open file %s\n", fg->undepleted_file);
+	  return 1;
+	}
+	for (r=R; r>=0; r--) {
+	  undepleted[r][L] = '\0';
+	  fprintf(file, "%s\n", undepleted[r]);
+	}
+	fclose(file);
+      }
+    }
+  }
+
+  fg->field_done = 1;
+  return 0;
+}
+
+/* header of the binary files used to cache the WP, see wp_cache_read() */
+typedef struct {
+  char   magic[8];
+  int    L, R;              // size of the final grid
+  unsigned long long geometry_hash, undepleted_signature;
+} WP_Cache_Header;
+
+#define WP_CACHE_MAGIC "FGWPv001"
+
+/* undepleted_signature
+   the WP depends on the impurity and bias only through the regions that are
+   undepleted (*) or pinched-off (B); returns a hash of those regions,
+   or 0 if depleted is nonzero (e.g. fg->wp_depleted, for a WP calculated
+   as for a fully-depleted detector)
+*/
+static unsigned long long undepleted_signature(MJD_Fieldgen *fg, int depleted) {
+  unsigned long long hash = 14695981039346656037ULL;
+  int    r, z;
+  char   c;
+
+  if (depleted) return 0;
+  for (r=0; r<fg->RR+1; r++) {
+    for (z=0; z<fg->LL+1; z++) {
+      c = fg->undepleted[r][z];
+      hash ^= (c == '*' ? 1 : (c == 'B' ? 2 : 0));
+      hash *= 1099511628211ULL;
+    }
+  }
+  return hash;
+}
+
+/* wp_cache_name
+   put the name of the binary WP cache file for the current geometry, grid
+   and undepleted regions into name
+   returns 0 on success, 1 if no cache directory is defined
+*/
+static int wp_cache_name(MJD_Fieldgen *fg, char *name, int len) {
+  if (!fg->setup->cache_dir[0]) return 1;
+  snprintf(name, len, "%s/wp_%016llx_%016llx.bin", fg->setup->cache_dir,
+	   wp_config_hash(fg->setup), undepleted_signature(fg, fg->wp_depleted));
+  return 0;
+}
+
+/* wp_cache_read
+   read a WP from binary cache file name, and set up the final grid to match,
+   so that the capacitance can be calculated exactly as for a new WP
+   returns 0 on success, 1 if the file does not exist or does not match
+*/
+static int wp_cache_read(MJD_Fieldgen *fg, char *name) {
+  WP_Cache_Header h;
+  Relax_Grid *g = &fg->wp;
+  FILE   *file;
+  int    z, last;
+
+  if (!(file = fopen(name, "r"))) return 1;
+  if (fread(&h, sizeof(h), 1, file) != 1 ||
+      memcmp(h.magic, WP_CACHE_MAGIC, sizeof(h.magic)) ||
+      h.L != fg->LL || h.R != fg->RR ||
+      h.geometry_hash != wp_config_hash(fg->setup) ||
+      h.undepleted_signature != undepleted_signature(fg, fg->wp_depleted)) {
+    fclose(file);
+    return 1;
+  }
+  for (last=0; last<2 && fg->gridstep[last+1]>0; last++) ;
+  wp_setup_level(fg, last, 0);
+  for (z=0; z<fg->LL+1; z++) {
+    if (fread(g->v[0][z], sizeof(**g->v[0]), fg->RR+1, file) != (size_t) fg->RR+1) {
+      fprintf(fg->out, "ERROR: Failed to read cached weighting potential %s\n", name);
+      fclose(file);
+      return 1;
+    }
+  }
+  fclose(file);
+  g->cur = 0;
+  fprintf(g->out, "Using cached weighting potential %s\n\n", name);
+  return 0;
+}
+
+/* wp_cache_write
+   save the WP to binary cache file name
+   returns 0 on success
+*/
+static int wp_cache_write(MJD_Fieldgen *fg, char *name) {
+  WP_Cache_Header h;
+  Relax_Grid *g = &fg->wp;
+  char   tmp[600];
+  FILE   *file;
+  int    z, err = 0;
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, WP_CACHE_MAGIC, sizeof(h.magic));
+  h.L = fg->LL;
+  h.R = fg->RR;
+  h.geometry_hash = wp_config_hash(fg->setup);
+  h.undepleted_signature = undepleted_signature(fg, fg->wp_depleted);
+  snprintf(tmp, sizeof(tmp), "%s.tmp%d", name, (int) getpid());
+  if (!(file = fopen(tmp, "w"))) {
+    fprintf(fg->out, "ERROR: Cannot open file %s\n", tmp);
+    return 1;
+  }
+  if (fwrite(&h, sizeof(h), 1, file) != 1) err = 1;
+  for (z=0; z<fg->LL+1 && !err; z++)
+    if (fwrite(g->v[g->cur][z], sizeof(**g->v[0]), fg->RR+1, file) != (size_t) fg->RR+1) err = 1;
+  if (fclose(file) || err || rename(tmp, name)) {
+    fprintf(fg->out, "ERROR: Failed to write cached weighting potential %s\n", name);
+    remove(tmp);
+    return 1;
+  }
+  return 0;
+}
+
+/* wp_setup_level
+   set up the grid, initial values and boundary conditions for the WP relaxation
+   on grid level istep; for istep > 0, the result from the previous (coarser)
+   level is interpolated onto the new grid if expand is nonzero
+*/
+static void wp_setup_level(MJD_Fieldgen *fg, int istep, int expand) {
+
+  MJD_Siggen_Setup *setup = fg->setup;
+  Relax_Grid  *g = &fg->wp;
+  double **v[2] = {g->v[0], g->v[1]};
+  char   **undepleted = fg->undepleted;
+  int    **bulk = g->bulk, *rrc = g->rrc;
+  float  *drrc = g->drrc, *frrc = g->frrc;
+  float  a, b, c, grid, dLC, dRC;
+  int    r, z, rr, zz, gridfact, L, R, LC, RC;
+
+  grid = fg->gridstep[istep];
+  // gridfact = integer ratio of current grid step size to final grid step size
+  gridfact = lrintf(grid / setup->xtal_grid);
+  g->pinched = 0;
+
+  if (istep > 0 && expand) {
+    /* the previous calculation was on a coarser grid...
+       now copy/expand the potential to the new finer grid
+    */
+    grid_expand(g, fg->gridstep[istep-1], grid, fg->LL, fg->RR);
+  }
+
+  grid_geometry(setup, g, grid, 0.05, &dLC, &dRC);
+  L = g->L;  R = g->R;  LC = g->LC;  RC = g->RC;
+  fprintf(g->out, "grid = %f  RC = %d  dRC = %f  LC = %d  dLC = %f\n\n",
+	 grid, RC, dRC, LC, dLC);
+
+  if (istep == 0) {
+    // no previous coarse relaxation, so set initial potential:
+    for (z=0; z<L+1; z++) {
+      for (r=0; r<R+1; r++) {
+	v[0][z][r] = v[1][z][r] = 0.0;
+      }
+    }
+    /*  ----- can comment out this next section to test convergence of WP ----- */
+    // perhaps this is a better initial guess than just zero everywhere
+    a = LC + RC / 2;
+    b = 2.0f*a / (float) (L + R);
+    for (z=1; z<L; z++) {
+      for (r=1; r<R; r++) {
+	c = a / sqrt(z*z + r*r) - b;
+	if (c < 0) c = 0;
+	if (c > 1) c = 1;
+	v[0][z][r] = v[1][z][r] = c;
+      }
+    }
+    /* ----- ----- */
+    // inside contact:
+    for (z=0; z<LC+1; z++) {
+      for (r=0; r<rrc[z]+1; r++) {
+	v[0][z][r] = v[1][z][r] = 1.0;
+      }
+    }
+  }
+
+  /* boundary conditions and permittivity
+     boundary condition at Ge-vacuum interface:
+     epsilon0 * E_vac = espilon_Ge * E_Ge
+  */
+  grid_permittivity(g);
+
+  for (z=0; z<L+1; z++) {
+    for (r=0; r<R+1; r++) {
+      // boundary conditions
+      bulk[z][r] = 0;  // normal bulk, no complications
+      // outside (HV) contact, including taper, wrap-around and top bulletization:
+      if (geometry_classify(&g->geom, r, z, 1) == GEOM_OUTER) {
+	bulk[z][r] = -1;                 // value of v[*][z][r] is fixed...
+	v[0][z][r] = v[1][z][r] = 0.0;   // to zero
+      }
+      // inside (point) contact:
+      else if (z <= LC && r <= rrc[z]) {
+	bulk[z][r] = -1;                 // value of v[*][z][r] is fixed...
+	v[0][z][r] = v[1][z][r] = 1.0;   // to 1.0
+	// radial edge of inside contact:
+	if (r == rrc[z] && drrc[z] < -0.05) {
+	  bulk[z][r] = 1;
+	  frrc[z] = -1.0/drrc[z];
+	}
+	// z edge of inside contact:
+	if (z == LC && dLC < -0.05) {
+	  bulk[z][r] = 2;
+	  g->fLC = -1.0/dLC;
+	}
+      }
+      // edge of inside contact:
+      // FIXME: Check for adjacent ditch
+      else if (z <= LC && r == rrc[z]+1 && drrc[z] > 0.05) {
+	bulk[z][r] = 1;
+	frrc[z] = 1.0/(1.0 - drrc[z]);
+      }
+      else if (z == LC+1 && r <= rrc[z] && dLC > 0.05) {
+	bulk[z][r] = 2;
+	g->fLC = 1.0/(1.0 - dLC);
+      }
+      // borehole, part of the outside contact:
+      else if (z >= g->ZH && r <= g->RH) {
+	bulk[z][r] = -1;                 // value of v[*][z][r] is fixed...
+	v[0][z][r] = v[1][z][r] = 0.0;   // to zero
+	if (r == g->RH && g->dRH < -0.05) {
+	  bulk[z][r] = 1;
+	  frrc[z] = -1.0/g->dRH;
+	}
+	if (z == g->ZH && g->dZH > 0.05) {
+	  bulk[z][r] = 4;
+	  g->fZH = 1.0/g->dZH;
+	}
+      }
+      else if (z >= g->ZH && r == g->RH+1 && g->dRH > 0.05) {
+	bulk[z][r] = 1;
+	frrc[z] = 1.0/(1.0 - g->dRH);
+      }
+      else if (z == g->ZH-1 && r <= g->RH && g->dZH < -0.05) {
+	bulk[z][r] = 4;
+	g->fZH = 1.0/(1.0 + g->dZH);
+      }
+
+      /* determine bulk regions where the detector is undepleted */
+      if (!fg->wp_depleted) {
+	/* position in the undepleted[][] map, which uses the final grid;
+	   rounding of L and R can take a coarse-grid point just past its edge */
+	rr = r*gridfact;
+	zz = z*gridfact;
+	if (rr > fg->RR) rr = fg->RR;
+	if (zz > fg->LL) zz = fg->LL;
+	if (undepleted[rr][zz] == '*') {
+	  bulk[z][r] = -1;	            // treat like part of point contact
+	  v[0][z][r] = v[1][z][r] = 1.0;  // set WP to one
+	} else if (undepleted[rr][zz] == 'B') { // pinch-off
+	  bulk[z][r] = 3;
+	  g->pinched = 1;
+	}
+      }
+    }
+  }
+}
+
+/* fieldgen_solve_wp
+   calculate the weighting potential of the point contact;
+   fieldgen_solve_field must be called first, so that undepleted regions are known
+   returns 0 for success
+*/
+int fieldgen_solve_wp(MJD_Fieldgen *fg) {
+
+  if (!fg->field_done) {
+    fprintf(fg->out, "ERROR: The potential must be calculated before the weighting potential\n");
+    return 1;
+  }
+  return wp_solve(fg, fg->fully_depleted);
+}
+
+/* wp_solve
+   calculate the weighting potential, treating the undepleted regions found
+   by fieldgen_solve_field as part of the point contact, or as for a fully
+   depleted detector if depleted is nonzero; in that case, the potential
+   need not have been calculated yet
+   returns 0 for success
+*/
+static int wp_solve(MJD_Fieldgen *fg, int depleted) {
+
+  MJD_Siggen_Setup *setup = fg->setup;
+  Relax_Grid  *g = &fg->wp;
+  Relax_Stats st;
+  double **v[2] = {g->v[0], g->v[1]};
+  char   cache_name[512];
+  float  sum_dif=0, dLC, dRC;
+  int    r, z, iter, istep, max_its;
+  double t0=0, t1, t2=0;
+
+  fg->wp_done = 0;
+  fg->wp_depleted = depleted;
+  g->pool = fg->pool;
+  g->monitor = fg->monitor;
+  g->monitor_arg = fg->monitor_arg;
+  /* start from the PC shape used for the potential on the final grid;
+     for a bulletized PC, rrc[LC+1] is not recalculated for the coarser grids,
+     so go through the same sequence of grids as fieldgen_solve_field does */
+  memset(g->rrc,  0, (g->LCmax+2)*sizeof(*g->rrc));
+  memset(g->drrc, 0, (g->LCmax+2)*sizeof(*g->drrc));
+  memset(g->frrc, 0, (g->Lmax+2)*sizeof(*g->frrc));
+  for (istep=0; istep<3 && fg->gridstep[istep]>0; istep++)
+    grid_geometry(setup, g, fg->gridstep[istep], 0.01, &dLC, &dRC);
+
+  /*
+    -------------------------------------------------------------------------
+    now calculate the weighting potential for the central contact
+    the WP is also needed for calculating the capacitance
+    -------------------------------------------------------------------------
+  */
+
+  fprintf(g->out, "\nCalculating weighting potential...\n\n");
+  if (setup->verbosity >= CHATTY) t0 = t2 = timer_now();
+  max_its = MAX_ITS;
+  if (setup->max_iterations > 0) max_its = setup->max_iterations;
+  // max_its = 2*MAX_ITS;  // use twice as many iterations for WP; accuracy is more important?
+  // if (setup->max_iterations > 0) max_its = 2*setup->max_iterations;
+
+  /* to be safe, initialize overall potential to 0 */
+  for (z=0; z<fg->LL+1; z++) {
+    for (r=0; r<fg->RR+1; r++) {
+      v[0][z][r] = v[1][z][r] = 0;
+    }
+  }
+  /* the WP depends only on the geometry and on any undepleted regions,
+     so it may already have been calculated for a different bias or impurity */
+  if (!wp_cache_name(fg, cache_name, sizeof(cache_name)) &&
+      !wp_cache_read(fg, cache_name)) {
+    fg->wp_done = 1;
+    return 0;
+  }
+
+  for (istep=0; istep<3 && fg->gridstep[istep]>0; istep++) {
+    wp_setup_level(fg, istep, 1);
+
+    // now do the actual relaxation
+    if (relax(g, 1, fg->tile_depth, max_its, &iter, &st)) return 1;
+    sum_dif = st.sum_dif;
+    fprintf(g->out, ">> %d %.16f\n\n", iter, sum_dif);
+    if (setup->verbosity >= CHATTY) {
+      t1 = timer_now();
+      fprintf(g->out, " ^^^^^^^^^^^^^ %.3f (%.3f) s elapsed ^^^^^^^^^^^^^^\n",
+	     t1 - t0, t1 - t2);
+      t2 = t1;
+    }
+    if (istep == 0) max_its /= MAX_ITS_FACTOR;
+  }
+
+  fg->wp_done = 1;
+  if (!wp_cache_name(fg, cache_name, sizeof(cache_name)))
+    wp_cache_write(fg, cache_name);
+  return 0;
+}
+
+/* fieldgen_capacitance
+   calculate the detector capacitance from the WP, in pF
+   returns the capacitance, or -1 if the WP has not been calculated
+*/
+double fieldgen_capacitance(MJD_Fieldgen *fg) {
+
+  Relax_Grid *g = &fg->wp;
+  double **v = g->v[g->cur], **eps_dr = g->eps_dr, **eps_dz = g->eps_dz;
+  double esum, esum2, pi=3.14159, Epsilon=(8.85*16.0/1000.0);  // permittivity of Ge in pF/mm
+  float  E_r, E_z, grid = g->grid;
+  int    r, z, j, L = g->L, R = g->R, LC = g->LC, RC = g->RC;
+
+  if (!fg->wp_done) return -1;
+
+  /* --------------------- calculate capacitance ---------------------
+     1/2 * epsilon * integral(E^2) = 1/2 * C * V^2
+     so    C = epsilon * integral(E^2) / V^2
+     V = 1 volt
+  */
+  fprintf(fg->out, "Calculating integrals of weighting field\n");
+  esum = esum2 = j = 0;
+  for (z=0; z<L; z++) {
+    for (r=1; r<R; r++) {
+      E_r = eps_dr[z][r]/16.0 * (v[z][r] - v[z][r+1])/(0.1*grid);
+      E_z = eps_dz[z][r]/16.0 * (v[z][r] - v[z+1][r])/(0.1*grid);
+      esum += (E_r*E_r + E_z*E_z) * (double) r;
+      /*
+      if ((z <= LC && r == rrc[z]) ||
+	  (z == LC && r <= rrc[z]) ||
+	  (z <= LC+1 && r == rrc[z]+1) || // average over two different surfaces
+	  (z == LC+1 && r <= rrc[z]+1)) {
+      */
+      if ((r == RC && z <= LC) ||
+	  (r <= RC && z == LC) ||
+	  (r == RC+1 && z <= LC+1) || // average over two different surfaces
+	  (r <= RC+1 && z == LC+1)) {
+	if (g->bulk[z+1][r+1] < 0) j = 1;
+	esum2 += 0.5 * sqrt(E_r*E_r + E_z*E_z) * (double) r;  // 0.5 since averaging over 2 surfaces
+      }
+    }
+  }
+  esum  *= 2.0 * pi * 0.01 * Epsilon * pow(grid, 3.0);
+  // Epsilon is in pF/mm
+  // 0.01 converts (V/cm)^2 to (V/mm)^2, pow() converts to grid^3 to mm3
+  esum2 *= 2.0 * pi * 0.1 * Epsilon * pow(grid, 2.0);
+  // 0.1 converts (V/cm) to (V/mm),  grid^2 to  mm2
+  fprintf(fg->out, "\n  >>  Calculated capacitance at %.0f V: %.3lf pF\n", fg->BV, esum);
+  if (j==0) {
+    fprintf(fg->out, "  >>  Alternative calculation of capacitance: %.3lf pF\n\n", esum2);
+  } else {
+    fprintf(fg->out, "\n");
+  }
+
+  fg->capacitance = esum;
+  fg->capacitance2 = esum2;
+  fg->capacitance2_ok = (j == 0);
+  return esum;
+}
+
+/* fieldgen_depletion_voltage
+   estimate the depletion voltage from the potential and WP close to the point contact;
+   only possible if the detector is fully depleted at the bias voltage
+   returns the estimated voltage, or 0 if it cannot be estimated
+*/
+float fieldgen_depletion_voltage(MJD_Fieldgen *fg) {
+
+  double **ev = fg->ev.v[fg->ev.cur], **wp = fg->wp.v[fg->wp.cur], min, vs;
+  int    r, z;
+
+  fg->depletion_voltage = 0;
+  if (!fg->field_done || !fg->wp_done || !fg->fully_depleted) return 0;
+
+  /* use the potential close to point contact, scaled by the WP */
+  min = fg->BV;
+  for (z=0; z<fg->wp.LC+2; z++) {
+    for (r=0; r<fg->wp.RC+2; r++) {
+      vs = fabs(ev[z][r]);
+      if (vs > 0 && min > vs / (1.0 - wp[z][r])) {
+	min = vs / (1.0 - wp[z][r]);
+      }
+    }
+  }
+  fprintf(fg->out, "\nEstimated depletion voltage (or pinch-off?) = %.0f V\n", fg->BV - min);
+  fg->depletion_voltage = fg->BV - min;
+  return fg->depletion_voltage;
+}
+
+/* ------------------------------------------------------------------------
+   bisection for the depletion and pinch-off voltages, see fieldgen_find_voltages
+*/
+
+#define UNDEPLETED  0   // states of the detector at a trial bias
+#define PINCHED_OFF 1
+#define DEPLETED    2
+#define COARSE_RANGE 8  // trial biases are done on the final grid once the range
+                        //   is less than COARSE_RANGE * tol
+#define MAX_DOUBLINGS 6 // bias may be raised by up to a factor 2^MAX_DOUBLINGS
+#define MIN_TRIAL_ITS 1000  // iterations needed for a warm start to settle
+
+static const char *state_name[3] = {"not depleted", "pinched off", "fully depleted"};
+
+/* a solution of the potential on one grid level, kept for warm starts */
+typedef struct {
+  float  BV;       // bias; negative if there is no solution
+  int    state;
+  double **v;      // [z][r] potential
+} Probe_Sol;
+
+typedef struct {
+  Probe_Sol lo[3], hi[3]; // on each grid level, the solutions just below and at
+                          //   or above the edge being searched for
+  int    nlev, max_its, nprobes[3];
+  float  tol;
+  double final_dif;       // max_dif at the end of the first trial on the final grid
+} Probe_Search;
+
+/* probe_start
+   set up grid level lev for bias BV, with a first guess at the potential in v[0].
+   Between two solutions on this level, the guess is interpolated from them;
+   with only one, the change between the solutions on the coarsest level is
+   interpolated onto this grid and added to it. Otherwise the relaxation
+   starts on the coarsest level as usual.
+   returns the level on which the relaxation starts
+*/
+static int probe_start(MJD_Fieldgen *fg, Probe_Search *s, int lev, float BV) {
+  Relax_Grid *g = &fg->ev;
+  Probe_Sol  *lo = &s->lo[lev], *hi = &s->hi[lev], *c0 = &s->lo[0], *c1 = &s->hi[0], *near;
+  double f = 0;
+  int    r, z;
+
+  if ((hi->BV >= 0 && (lo->BV > 0 || lev == 0)) || (lo->BV > 0 && lev == 0)) {
+    ev_setup_level(fg, lev, 0);
+    if (hi->BV >= 0) f = (BV - lo->BV) / (hi->BV - lo->BV);
+    for (z=0; z<g->L+1; z++) {
+      for (r=0; r<g->R+1; r++) {
+	if (g->bulk[z][r] < 0) continue;
+	g->v[0][z][r] = lo->v[z][r] + f * (hi->v[z][r] - lo->v[z][r]);
+      }
+    }
+  } else if (lev > 0 && (lo->BV > 0 || hi->BV >= 0) && c1->BV >= 0) {
+    near = (hi->BV >= 0 ? hi : lo);
+    f = (BV - near->BV) / (c1->BV - c0->BV);
+    g->L = lrint(fg->setup->xtal_length/fg->gridstep[0]);
+    g->R = lrint(fg->setup->xtal_radius/fg->gridstep[0]);
+    for (z=0; z<g->L+1; z++)
+      for (r=0; r<g->R+1; r++) g->v[1][z][r] = f * (c1->v[z][r] - c0->v[z][r]);
+    grid_expand(g, fg->gridstep[0], fg->gridstep[lev], fg->LL, fg->RR);
+    ev_setup_level(fg, lev, 0);
+    for (z=0; z<g->L+1; z++) {
+      for (r=0; r<g->R+1; r++) {
+	if (g->bulk[z][r] >= 0) g->v[0][z][r] += near->v[z][r];
+      }
+    }
+  } else {
+    for (z=0; z<fg->LL+1; z++)
+      for (r=0; r<fg->RR+1; r++) g->v[0][z][r] = g->v[1][z][r] = BV;
+    ev_setup_level(fg, 0, 1);
+    return 0;
+  }
+  for (z=0; z<g->L+1; z++)
+    for (r=0; r<g->R+1; r++)
+      if (g->v[0][z][r] < 0) g->v[0][z][r] = 0;
+  return lev;
+}
+
+/* probe
+   calculate the potential for bias BV up to grid level lev, and keep the
+   result in s->lo[lev] or s->hi[lev] depending on whether the detector is in
+   a state below that being searched for (target)
+   returns the state, or -1 on error
+*/
+static int probe(MJD_Fieldgen *fg, Probe_Search *s, float BV, int lev, int target) {
+  Relax_Grid  *g = &fg->ev;
+  Relax_Stats st;
+  Probe_Sol   *sol;
+  double **v;
+  int    r, z, istep, start, iter, max_its, state;
+
+  fg->BV = BV;
+  for (r=0; r<fg->RR+1; r++) memset(fg->undepleted[r], ' ', fg->LL+1);
+  start = probe_start(fg, s, lev, BV);
+  for (istep=start; istep<=lev; istep++) {
+    if (g->grid != fg->gridstep[istep]) ev_setup_level(fg, istep, 1);
+    /* the error in the potential is roughly max_dif times the number of
+       iterations needed for the slowest mode to decay, ~ (L^2 + R^2) / 4;
+       keep it well below the voltage resolution. On the final grid, a trial
+       need not converge further than the first one, which stops after
+       the same number of iterations as the normal calculation */
+    g->thresh = 0.2 * s->tol / (double) (g->L*g->L + g->R*g->R);
+    g->min_its = (istep == start ? MIN_TRIAL_ITS : 0);
+    if (istep == s->nlev-1 && g->thresh < s->final_dif) g->thresh = s->final_dif;
+    max_its = (istep == 0 ? s->max_its : s->max_its / MAX_ITS_FACTOR);
+    if (relax(g, 0, fg->tile_depth, max_its, &iter, &st)) return -1;
+    if (istep == s->nlev-1 && s->final_dif == 0) s->final_dif = st.max_dif;
+    s->nprobes[istep]++;
+  }
+  fg->bubble_volts = st.bubble_volts;
+  fg->fully_depleted = ev_depleted(fg);
+  state = UNDEPLETED;
+  if (fg->fully_depleted) {
+    state = DEPLETED;
+  } else if (fg->bubble_volts > 0.0f) {
+    state = PINCHED_OFF;
+  }
+  fprintf(fg->out, "  %8.1f V  grid %.4f  %6d its  %s\n",
+	  BV, g->grid, iter, state_name[state]);
+
+  /* keep the solution */
+  sol = (state < target ? &s->lo[lev] : &s->hi[lev]);
+  sol->BV = BV;
+  sol->state = state;
+  v = g->v[g->cur];
+  for (z=0; z<g->L+1; z++) memcpy(sol->v[z], v[z], (g->R+1)*sizeof(**v));
+  return state;
+}
+
+/* find_edge
+   narrow the range between the solutions s->lo and s->hi down to s->tol,
+   on the coarsest grid level first and then on the final level;
+   the solutions on the coarsest level must already be on either side of the edge
+   returns 0 for success
+*/
+static int find_edge(MJD_Fieldgen *fg, Probe_Search *s, int target, float vmax) {
+  Probe_Sol *lo = s->lo, *hi = s->hi;
+  float  x, w = s->tol;
+  int    f = s->nlev - 1, state, checked = 1;
+
+  if (f > 0) {
+    while (hi[0].BV - lo[0].BV > COARSE_RANGE * s->tol) {
+      if (probe(fg, s, (lo[0].BV + hi[0].BV)/2.0, 0, target) < 0) return 1;
+    }
+    /* the edge on the final grid should be close to that on the coarse grid,
+       but it still needs to be bracketed; start in the middle and step out */
+    w = (hi[0].BV - lo[0].BV)/2.0;
+    if (w < s->tol) w = s->tol;
+    checked = 0;
+    if ((state = probe(fg, s, (lo[0].BV + hi[0].BV)/2.0, f, target)) < 0) return 1;
+    if (state < target) checked = 1;
+  }
+  while (hi[f].BV < 0 || hi[f].BV - lo[f].BV > s->tol) {
+    if (hi[f].BV < 0) {
+      x = lo[f].BV + w;
+      if (x > vmax) {
+	fprintf(fg->out, "ERROR: Detector is not %s at %.0f V\n", state_name[target], lo[f].BV);
+	return 1;
+      }
+    } else if (!checked && hi[f].BV - w > lo[f].BV) {
+      x = hi[f].BV - w;
+    } else {
+      x = (lo[f].BV + hi[f].BV)/2.0;
+    }
+    w *= 2.0;
+    if ((state = probe(fg, s, x, f, target)) < 0) return 1;
+    if (state < target) checked = 1;
+  }
+  return 0;
+}
+
+/* fieldgen_find_voltages
+   find the lowest bias at which the detector is fully depleted, and the lowest
+   bias at which a pinch-off bubble appears (if any), to within tol volts,
+   by bisection on the bias
+   returns 0 for success
+*/
+int fieldgen_find_voltages(MJD_Fieldgen *fg, float tol) {
+
+  MJD_Siggen_Setup *setup = fg->setup;
+  Relax_Grid   *g = &fg->ev;
+  Probe_Search s;
+  Probe_Sol    t;
+  float  BV_save = fg->BV, x, vmax, grid;
+  int    i, j, lev, L, R, state, err = 1;
+
+  memset(&s, 0, sizeof(s));
+  if (tol <= 0) tol = 1;
+  s.tol = tol;
+  s.max_its = MAX_ITS;
+  if (setup->max_iterations > 0) s.max_its = setup->max_iterations;
+  for (s.nlev=0; s.nlev<3 && fg->gridstep[s.nlev]>0; s.nlev++) ;
+  fg->field_done = fg->full_depletion_voltage = fg->pinchoff_voltage = 0;
+  g->pool = fg->pool;
+  g->quiet = 1;
+  for (i=0; i<fg->RR+1; i++) {
+    g->imp_ra[i] = 0.0;
+    g->imp_rm[i] = 1.0;
+  }
+  /* at zero bias nothing is depleted and the potential is zero everywhere */
+  for (lev=0; lev<s.nlev; lev++) {
+    grid = fg->gridstep[lev];
+    L = lrint(setup->xtal_length/grid);
+    R = lrint(setup->xtal_radius/grid);
+    if (!(s.lo[lev].v = (double **) calloc(L+1, sizeof(*s.lo[lev].v))) ||
+	!(s.hi[lev].v = (double **) calloc(L+1, sizeof(*s.hi[lev].v)))) {
+      fprintf(fg->out, "Malloc failed\n");
+      goto done;
+    }
+    for (j=0; j<L+1; j++)
+      if (!(s.lo[lev].v[j] = (double *) calloc(R+1, sizeof(**s.lo[lev].v))) ||
+	  !(s.hi[lev].v[j] = (double *) calloc(R+1, sizeof(**s.hi[lev].v)))) {
+	fprintf(fg->out, "Malloc failed\n");
+	goto done;
+      }
+    s.lo[lev].BV = 0;
+    s.lo[lev].state = UNDEPLETED;
+    s.hi[lev].BV = -1;
+  }
+
+  fprintf(fg->out, "\nSearching for depletion voltage to within %.1f V...\n\n", tol);
+  /* raise the bias until the detector is depleted on the coarsest grid */
+  x = (BV_save < tol ? 1000 : BV_save);
+  vmax = x * (1 << MAX_DOUBLINGS);
+  for (; ; x *= 2.0) {
+    if ((state = probe(fg, &s, x, 0, DEPLETED)) < 0) goto done;
+    if (state == DEPLETED) break;
+    if (x * 2.0 > vmax) {
+      fprintf(fg->out, "ERROR: Detector is not depleted at %.0f V\n", x);
+      goto done;
+    }
+  }
+  if (find_edge(fg, &s, DEPLETED, vmax)) goto done;
+  fg->full_depletion_voltage = (s.lo[s.nlev-1].BV + s.hi[s.nlev-1].BV)/2.0;
+  fprintf(fg->out, "\nFull depletion at %.1f V (+/- %.1f)\n",
+	  fg->full_depletion_voltage, (s.hi[s.nlev-1].BV - s.lo[s.nlev-1].BV)/2.0);
+
+  /* a pinch-off bubble just below full depletion means that the
+     pinch-off voltage is lower still; the pinched-off solutions
+     become the upper limits of the new search */
+  if (s.lo[s.nlev-1].state == PINCHED_OFF) {
+    fprintf(fg->out, "\nSearching for pinch-off voltage...\n\n");
+    for (lev=0; lev<s.nlev; lev++) {
+      if (s.lo[lev].state < PINCHED_OFF) continue;
+      t = s.hi[lev];
+      s.hi[lev] = s.lo[lev];
+      s.lo[lev] = t;
+      s.lo[lev].BV = 0;
+      s.lo[lev].state = UNDEPLETED;
+      L = lrint(setup->xtal_length/fg->gridstep[lev]);
+      R = lrint(setup->xtal_radius/fg->gridstep[lev]);
+      for (j=0; j<L+1; j++) memset(s.lo[lev].v[j], 0, (R+1)*sizeof(**s.lo[lev].v));
+    }
+    if (find_edge(fg, &s, PINCHED_OFF, vmax)) goto done;
+    fg->pinchoff_voltage = (s.lo[s.nlev-1].BV + s.hi[s.nlev-1].BV)/2.0;
+    fprintf(fg->out, "\nPinch-off at %.1f V (+/- %.1f)\n",
+	    fg->pinchoff_voltage, (s.hi[s.nlev-1].BV - s.lo[s.nlev-1].BV)/2.0);
+  } else {
+    fprintf(fg->out, "\nNo pinch-off below full depletion\n");
+  }
+  fprintf(fg->out, "Trial biases on each grid:");
+  for (lev=0; lev<s.nlev; lev++) fprintf(fg->out, " %d", s.nprobes[lev]);
+  fprintf(fg->out, "\n");
+  err = 0;
+
+ done:
+  for (lev=0; lev<s.nlev; lev++) {
+    grid = fg->gridstep[lev];
+    L = lrint(setup->xtal_length/grid);
+    for (j=0; j<L+1; j++) {
+      if (s.lo[lev].v) free(s.lo[lev].v[j]);
+      if (s.hi[lev].v) free(s.hi[lev].v[j]);
+    }
+    free(s.lo[lev].v);
+    free(s.hi[lev].v);
+  }
+  g->thresh = 0;
+  g->min_its = g->quiet = 0;
+  fg->BV = BV_save;
+  return err;
+}
+
+/* write the header lines common to the field and WP files; the field file
+   (wp == 0) gets the hash of everything that was solved for, including bias
+   and impurities, and both get the hash of the geometry and grid, which is
+   all that the WP of a depleted detector depends on; see field_file_name()
+   in fields.c for how siggen checks them */
+static void write_header(MJD_Fieldgen *fg, FILE *file, int wp) {
+  MJD_Siggen_Setup s = *fg->setup;
+
+  if (*fg->config_file_name) report_config(file, fg->config_file_name);
+  fprintf(file, "#\n# HV bias in fieldgen: %.1f V\n", fg->BV);
+  /* hash the bias that the potential was calculated for, with its original sign */
+  s.xtal_HV = (s.impurity_z0 > 0 ? -fg->BV : fg->BV);
+  if (!wp) fprintf(file, "# Config hash: %016llx\n", field_config_hash(&s));
+  fprintf(file, "# Geometry hash: %016llx\n", wp_config_hash(fg->setup));
+  fprintf(file, "# Undepleted signature: %016llx\n",
+	  undepleted_signature(fg, (wp ? fg->wp_depleted : fg->fully_depleted)));
+  if (fg->fully_depleted) {
+    fprintf(file, "# Detector is fully depleted.\n");
+  } else {
+    fprintf(file, "# Detector is not fully depleted.\n");
+    if (fg->bubble_volts > 0.0f)
+      fprintf(file, "# Pinch-off bubble at %.0f V potential\n", fg->bubble_volts);
+  }
+}
+
+/* field_rz
+   calculate the potential and components of the field at grid point (z,r)
+   of the final grid, with the original sign of the bias
+*/
+static void field_rz(MJD_Fieldgen *fg, int z, int r, double *V, float *E_r, float *E_z) {
+  Relax_Grid *g = &fg->ev;
+  double **v = g->v[g->cur], sign = 1.0, grid = g->grid;
+  int    L = g->L, R = g->R;
+
+  // swap voltages back to negative for n-type material
+  if (fg->setup->impurity_z0 > 0) sign = -1.0;
+#define VV(z,r) (sign * v[z][r])
+  // calc E in r-direction
+  if (r==0) {
+    *E_r = 0;
+  } else if (r==R) {
+    *E_r = (VV(z,r-1) - VV(z,r))/(0.1*grid);
+  } else {
+    *E_r = (VV(z,r-1) - VV(z,r+1))/(0.2*grid);
+  }
+  // calc E in z-direction
+  if (z==0) {
+    *E_z = (VV(z,r) - VV(z+1,r))/(0.1*grid);
+  } else if (z==L) {
+    *E_z = (VV(z-1,r) - VV(z,r))/(0.1*grid);
+  } else {
+    *E_z = (VV(z-1,r) - VV(z+1,r))/(0.2*grid);
+  }
+  *V = VV(z,r);
+#undef VV
+}
+
+/* put_fixed
+   write x to p as printf("%*.*f", width, prec, x) would, and return a pointer
+   to the end of the string.  This is much faster than printf, since it
+   just has to round x*10^prec to an integer.  The rounding is done exactly
+   as by printf, except when x*10^prec is so close to a half-integer that
+   the rounding error of the multiplication might matter; in those (rare)
+   cases, and for very large or non-finite values, it falls back to snprintf.
+*/
+static char *put_fixed(char *p, double x, int width, int prec) {
+  static const double p10[] = {1, 10, 100, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8};
+  char   digits[32], *d = digits + sizeof(digits);
+  double y, f;
+  long   n;
+  int    len;
+
+  y = fabs(x) * p10[prec];
+  f = y - floor(y);
+  if (!(y < 1e9) || fabs(f - 0.5) < 1e-6)
+    return p + sprintf(p, "%*.*f", width, prec, x);
+
+  n = (long) y + (f > 0.5);
+  /* digits after the decimal point, then before it */
+  for (len = 0; len < prec; len++) {
+    *--d = '0' + n%10;
+    n /= 10;
+  }
+  if (prec > 0) *--d = '.';
+  do {
+    *--d = '0' + n%10;
+    n /= 10;
+  } while (n > 0);
+  if (signbit(x)) *--d = '-';   // printf writes -0.0 for small negative values
+
+  len = digits + sizeof(digits) - d;
+  for (; len < width; width--) *p++ = ' ';
+  memcpy(p, d, len);
+  return p + len;
+}
+
+#define WRITE_BUF_SIZE (1<<20)   // size of buffer used for writing the field files
+#define WRITE_LINE_MAX 128       // upper limit on length of one line of output
+
+/* write_field_data, write_wp_data
+   write the header and values for the potential and field, or the WP,
+   to file, which is then closed; the values are formatted into a large buffer
+   that is written with fwrite, rather than using fprintf for every value
+   returns 0 for success
+*/
+static int write_field_data(MJD_Fieldgen *fg, FILE *file) {
+
+  Relax_Grid *g = &fg->ev;
+  double V;
+  float  E_r, E_z, grid = g->grid;
+  int    r, z, err = 0;
+  char   *buf, *p;
+
+  if ((buf = (char *) malloc(WRITE_BUF_SIZE)) == NULL) {
+    fprintf(fg->out, "Malloc failed in write_field_data\n");
+    fclose(file);
+    return 1;
+  }
+  /* copy configuration parameters to output file */
+  write_header(fg, file, 0);
+  fprintf(file, "#\n## r (mm), z (mm), V (V),  E (V/cm), E_r (V/cm), E_z (V/cm)\n");
+
+  p = buf;
+  for (r=0; r<g->R+1; r++) {
+    for (z=0; z<g->L+1; z++) {
+      field_rz(fg, z, r, &V, &E_r, &E_z);
+      // same as fprintf(file, "%7.2f %7.2f %7.1f %7.1f %7.1f %7.1f\n", ...)
+      p = put_fixed(p, ((float) r)*grid, 7, 2);
+      *p++ = ' ';
+      p = put_fixed(p, ((float) z)*grid, 7, 2);
+      *p++ = ' ';
+      p = put_fixed(p, V, 7, 1);
+      *p++ = ' ';
+      p = put_fixed(p, sqrt(E_r*E_r + E_z*E_z), 7, 1);
+      *p++ = ' ';
+      p = put_fixed(p, E_r, 7, 1);
+      *p++ = ' ';
+      p = put_fixed(p, E_z, 7, 1);
+      *p++ = '\n';
+      if (p - buf > WRITE_BUF_SIZE - WRITE_LINE_MAX) {
+	if (fwrite(buf, 1, p - buf, file) != (size_t) (p - buf)) err = 1;
+	p = buf;
+      }
+    }
+    *p++ = '\n';
+  }
+  if (fwrite(buf, 1, p - buf, file) != (size_t) (p - buf)) err = 1;
+  free(buf);
+  if (fclose(file) || err) {
+    fprintf(fg->out, "ERROR: Failed to write electric field file\n");
+    return 1;
+  }
+  return 0;
+}
+
+static int write_wp_data(MJD_Fieldgen *fg, FILE *file) {
+
+  Relax_Grid *g = &fg->wp;
+  double **v = g->v[g->cur];
+  float  grid = g->grid;
+  int    r, z, err = 0;
+  char   *buf, *p;
+
+  if ((buf = (char *) malloc(WRITE_BUF_SIZE)) == NULL) {
+    fprintf(fg->out, "Malloc failed in write_wp_data\n");
+    fclose(file);
+    return 1;
+  }
+  /* copy configuration parameters to output file */
+  write_header(fg, file, 1);
+  fprintf(file, "#\n## r (mm), z (mm), WP\n");
+
+  p = buf;
+  for (r=0; r<g->R+1; r++) {
+    for (z=0; z<g->L+1; z++) {
+      // same as fprintf(file, "%7.2f %7.2f %10.6f\n", ...)
+      p = put_fixed(p, ((float) r)*grid, 7, 2);
+      *p++ = ' ';
+      p = put_fixed(p, ((float) z)*grid, 7, 2);
+      *p++ = ' ';
+      p = put_fixed(p, v[z][r], 10, 6);
+      *p++ = '\n';
+      if (p - buf > WRITE_BUF_SIZE - WRITE_LINE_MAX) {
+	if (fwrite(buf, 1, p - buf, file) != (size_t) (p - buf)) err = 1;
+	p = buf;
+      }
+    }
+    *p++ = '\n';
+  }
+  if (fwrite(buf, 1, p - buf, file) != (size_t) (p - buf)) err = 1;
+  free(buf);
+  if (fclose(file) || err) {
+    fprintf(fg->out, "ERROR: Failed to write weighting potential file\n");
+    return 1;
+  }
+  return 0;
+}
+
+/* fieldgen_write_field, fieldgen_write_wp
+   write the potential and field, or the WP, to text file fname
+   in the format read by the siggen code
+   returns 0 for success
+*/
+int fieldgen_write_field(MJD_Fieldgen *fg, char *fname) {
+
+  FILE   *file;
+
+  if (!fg->field_done) return 1;
+  // write potential and field to output file
+  if (!(file = fopen(fname, "w"))) {
+    fprintf(fg->out, "ERROR: Cannot open file %s for electric field...\n", fname);
+    return 1;
+  } else {
+    fprintf(fg->out, "Writing electric field data to file %s\n", fname);
+  }
+  return write_field_data(fg, file);
+}
+
+int fieldgen_write_wp(MJD_Fieldgen *fg, char *fname) {
+
+  FILE   *file;
+
+  if (!fg->wp_done) return 1;
+  // write WP values to output file
+  if (!(file = fopen(fname, "w"))) {
+    fprintf(fg->out, "ERROR: Cannot open file %s for weighting potential...\n", fname);
+    return 1;
+  } else {
+    fprintf(fg->out, "Writing weighting potential to file %s\n", fname);
+  }
+  return write_wp_data(fg, file);
+}
+
+/* field_writer
+   thread function for fieldgen_write_field_bg
+*/
+static void *field_writer(void *arg) {
+  MJD_Fieldgen *fg = (MJD_Fieldgen *) arg;
+
+  fg->writer_status = write_field_data(fg, fg->writer_file);
+  return NULL;
+}
+
+/* fieldgen_write_field_bg
+   as fieldgen_write_field, but the file is written by a background thread,
+   so that the WP can be calculated at the same time
+   returns 0 if the file was opened and the thread started
+*/
+int fieldgen_write_field_bg(MJD_Fieldgen *fg, char *fname) {
+
+  if (fieldgen_write_wait(fg) || !fg->field_done) return 1;
+  if (!(fg->writer_file = fopen(fname, "w"))) {
+    fprintf(fg->out, "ERROR: Cannot open file %s for electric field...\n", fname);
+    return 1;
+  } else {
+    fprintf(fg->out, "Writing electric field data to file %s\n", fname);
+  }
+  if (pthread_create(&fg->writer, NULL, field_writer, fg)) {
+    // no thread; just write it now
+    return write_field_data(fg, fg->writer_file);
+  }
+  fg->writer_active = 1;
+  return 0;
+}
+
+/* fieldgen_write_wait
+   wait for any file being written by fieldgen_write_field_bg to be finished
+   returns 0 for success, 1 if writing the file failed
+*/
+int fieldgen_write_wait(MJD_Fieldgen *fg) {
+
+  if (!fg->writer_active) return 0;
+  pthread_join(fg->writer, NULL);
+  fg->writer_active = 0;
+  return fg->writer_status;
+}
+
+/* wp_speculate
+   task for fieldgen_run; calculates the WP as for a fully depleted
+   detector, with the progress messages saved in fg->wp_log
+*/
+static void wp_speculate(void *arg) {
+  MJD_Fieldgen *fg = (MJD_Fieldgen *) arg;
+
+  fg->wp.out = open_memstream(&fg->wp_log, &fg->wp_log_len);
+  if (!fg->wp.out) {
+    fg->wp.out = fg->out;
+    fg->wp_status = 1;
+    return;
+  }
+  fg->wp_status = wp_solve(fg, 1);
+  fclose(fg->wp.out);
+  fg->wp.out = fg->out;
+}
+
+static void *wp_speculate_thread(void *arg) {
+  wp_speculate(arg);
+  return NULL;
+}
+
+/* fieldgen_run
+   calculate the potential and, if do_wp is nonzero, the WP, capacitance and
+   depletion voltage, writing the field and WP to files field_file and wp_file
+   unless they are NULL; the steps are overlapped where possible:
+   -- with more than one thread, the WP is started at the same time as the
+      potential, as for a fully depleted detector, and redone if that is not so
+   -- the field file is written while the WP is being calculated
+   returns 0 for success
+*/
+int fieldgen_run(MJD_Fieldgen *fg, char *field_file, int do_wp, char *wp_file) {
+
+  pthread_t  thread;
+  Pool_Group grp = {0};
+  int        spec = 0, err = 0;
+
+  /* start the WP on a separate thread, in the hope that the detector is
+     fully depleted, since then the WP does not depend on the potential */
+  if (do_wp && (fg->pool ? pool_nthreads(fg->pool) : fg->nthreads) > 1) {
+    fg->wp.stop = 0;
+    fg->wp_log = NULL;
+    if (fg->pool) {
+      pool_spawn(fg->pool, &grp, wp_speculate, fg);
+      spec = 1;
+    } else {
+      spec = !pthread_create(&thread, NULL, wp_speculate_thread, fg);
+    }
+  }
+  if (fieldgen_solve_field(fg)) err = 1;
+  if (spec && (err || !fg->fully_depleted)) {
+    /* the WP has to be recalculated for the undepleted regions */
+    fg->wp.stop = 1;
+    if (fg->pool) pool_wait(fg->pool, &grp);
+    else pthread_join(thread, NULL);
+    fg->wp.stop = 0;
+    spec = 0;
+    free(fg->wp_log);
+    fg->wp_log = NULL;
+  }
+  if (err) return 1;
+
+  /* the field file is written at the same time as the WP is calculated */
+  if (field_file) {
+    if (!do_wp) return fieldgen_write_field(fg, field_file);
+    if (fieldgen_write_field_bg(fg, field_file)) err = 1;
+  }
+  if (spec) {
+    if (fg->pool) pool_wait(fg->pool, &grp);
+    else pthread_join(thread, NULL);
+    if (fg->wp_log) {
+      fwrite(fg->wp_log, 1, fg->wp_log_len, fg->out);
+      free(fg->wp_log);
+      fg->wp_log = NULL;
+    }
+    if (fg->wp_status) err = 1;
+  } else if (do_wp && !err && fieldgen_solve_wp(fg)) {
+    err = 1;
+  }
+  if (fieldgen_write_wait(fg) || err) return 1;
+  if (!do_wp) return 0;
+
+  fieldgen_capacitance(fg);
+  if (wp_file && fieldgen_write_wp(fg, wp_file)) return 1;
+  if (fg->fully_depleted) fieldgen_depletion_voltage(fg);
+  return 0;
+}
+
+/* round x to the precision used in the output files,
+   so that exported values are the same as those read back from the files */
+static float file_precision(double x, const char *fmt) {
+  char s[32];
+
+  snprintf(s, sizeof(s), fmt, x);
+  return strtof(s, NULL);
+}
+
+/* export_free
+   free setup->efld and setup->wpot, of setup->rlen rows, as fields_finalize
+   does (fields.c is not part of mjd_fieldgen); either may be partly filled
+*/
+static void export_free(MJD_Siggen_Setup *setup) {
+  int i;
+
+  for (i=0; i<setup->rlen; i++) {
+    if (setup->efld) free(setup->efld[i]);
+    if (setup->wpot) free(setup->wpot[i]);
+  }
+  free(setup->efld);
+  free(setup->wpot);
+  setup->efld = NULL;
+  setup->wpot = NULL;
+}
+
+/* fieldgen_export
+   fill setup->efld and, if it has been calculated, setup->wpot with the results,
+   in the format used by the siggen code, so that no field files are needed;
+   any fields already in setup are freed first, and the arrays are freed as
+   usual by fields_finalize
+   returns 0 for success
+*/
+int fieldgen_export(MJD_Fieldgen *fg, MJD_Siggen_Setup *setup) {
+
+  Relax_Grid *g = &fg->ev;
+  double **wp = fg->wp.v[fg->wp.cur], V;
+  float  E_r, E_z;
+  int    i, r, z, rlen, zlen;
+
+  if (!fg->field_done) return 1;
+  export_free(setup);
+  rlen = setup->rlen = lrintf(setup->xtal_radius/setup->xtal_grid) + 1;
+  zlen = setup->zlen = lrintf(setup->xtal_length/setup->xtal_grid) + 1;
+
+  if ((setup->efld = (cyl_pt **) calloc(rlen, sizeof(*setup->efld))) == NULL ||
+      (fg->wp_done && (setup->wpot = (float **) calloc(rlen, sizeof(*setup->wpot))) == NULL)) {
+    fprintf(fg->out, "Malloc failed in fieldgen_export\n");
+    export_free(setup);
+    return 1;
+  }
+  for (i=0; i<rlen; i++) {
+    if ((setup->efld[i] = (cyl_pt *) malloc(zlen*sizeof(**setup->efld))) == NULL ||
+	(fg->wp_done && (setup->wpot[i] = (float *) malloc(zlen*sizeof(**setup->wpot))) == NULL)) {
+      fprintf(fg->out, "Malloc failed in fieldgen_export\n");
+      export_free(setup);
+      return 1;
+    }
+    memset(setup->efld[i], 0, zlen*sizeof(**setup->efld));
+    if (fg->wp_done) memset(setup->wpot[i], 0, zlen*sizeof(**setup->wpot));
+  }
+
+  /* the siggen code sets values outside the detector to zero, see fields.c */
+  for (r=0; r<rlen && r<g->R+1; r++) {
+    for (z=0; z<zlen && z<g->L+1; z++) {
+      field_rz(fg, z, r, &V, &E_r, &E_z);
+      setup->efld[r][z].r = file_precision(E_r, "%.1f");
+      setup->efld[r][z].z = file_precision(E_z, "%.1f");
+      setup->efld[r][z].phi = 0;
+      if (fg->wp_done) setup->wpot[r][z] = file_precision(wp[z][r], "%.6f");
+    }
+  }
+  /* for checking a WP file read by the siggen code instead, see fields.c */
+  setup->field_undepleted = undepleted_signature(fg, fg->fully_depleted);
+  setup->have_field_undepleted = 1;
+  return 0;
+}
+
+/* free malloc()'ed memory */
+void fieldgen_free(MJD_Fieldgen *fg) {
+  int r;
+
+  fieldgen_write_wait(fg);
+  grid_free(&fg->ev);
+  grid_free(&fg->wp);
+  if (fg->undepleted) {
+    for (r=0; r<fg->RR+1; r++) free(fg->undepleted[r]);
+    free(fg->undepleted);
+    fg->undepleted = NULL;
+  }
+}
+
+/* copy_file
+   copy file from to file to, via a temporary file that is then renamed,
+   so that other processes never see a partly-written file;
+   errors are reported to out
+   returns 0 for success
+*/
+static int copy_file(char *from, char *to, FILE *out) {
+
+  char   tmp[512], buf[65536];
+  size_t n;
+  FILE   *in, *file;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp%d", to, (int) getpid());
+  if (!(in = fopen(from, "r"))) return 1;
+  if (!(file = fopen(tmp, "w"))) {
+    fprintf(out, "ERROR: Cannot open file %s\n", tmp);
+    fclose(in);
+    return 1;
+  }
+  while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+    if (fwrite(buf, 1, n, file) != n) break;
+  }
+  fclose(in);
+  if (fclose(file) || n > 0 || rename(tmp, to)) {
+    fprintf(out, "ERROR: Failed to write file %s\n", to);
+    remove(tmp);
+    return 1;
+  }
+  return 0;
+}
+
+/* fieldgen_cache_fetch
+   look in setup->cache_dir for field files calculated with the same
+   geometry, impurity, bias and grid (see field_config_hash);
+   if found, copy them to setup->field_name (if write_field != 0)
+   and setup->wp_name (if write_wp != 0); messages are written to out,
+   or to stdout if out is NULL
+   returns 1 if the files were found and copied, 0 otherwise
+*/
+int fieldgen_cache_fetch(MJD_Siggen_Setup *setup, int write_field, int write_wp,
+			 FILE *out) {
+
+  char ev_name[512], wp_name[512];
+
+  if (!out) out = stdout;
+  if (field_cache_file(setup, "ev", ev_name, sizeof(ev_name)) ||
+      field_cache_file(setup, "wp", wp_name, sizeof(wp_name)) ||
+      (write_field && access(ev_name, R_OK)) ||
+      (write_wp && access(wp_name, R_OK))) return 0;
+
+  fprintf(out, "Found fields for config hash %016llx in cache %s\n",
+	  field_config_hash(setup), setup->cache_dir);
+  if (write_field) {
+    fprintf(out, "Copying cached electric field data %s to file %s\n", ev_name, setup->field_name);
+    if (copy_file(ev_name, setup->field_name, out)) return 0;
+  }
+  if (write_wp) {
+    fprintf(out, "Copying cached weighting potential %s to file %s\n", wp_name, setup->wp_name);
+    if (copy_file(wp_name, setup->wp_name, out)) return 0;
+  }
+  return 1;
+}
+
+/* fieldgen_cache_store
+   save the calculated potential and WP in the cache directory setup->cache_dir
+   returns 0 for success
+*/
+int fieldgen_cache_store(MJD_Fieldgen *fg) {
+
+  char name[512], tmp[600];
+
+  if (field_cache_file(fg->setup, "ev", name, sizeof(name))) return 1;
+  snprintf(tmp, sizeof(tmp), "%s.tmp%d", name, (int) getpid());
+  if (fg->field_done &&
+      (fieldgen_write_field(fg, tmp) || rename(tmp, name))) return 1;
+  field_cache_file(fg->setup, "wp", name, sizeof(name));
+  snprintf(tmp, sizeof(tmp), "%s.tmp%d", name, (int) getpid());
+  if (fg->wp_done &&
+      (fieldgen_write_wp(fg, tmp) || rename(tmp, name))) return 1;
+  return 0;
+}
+
+/* report_config
+   copy the non-comment lines of the config file to fp_out, as comments
+*/
+int report_config(FILE *fp_out, char *config_file_name) {
+
+  char  *c, line[256];
+  FILE  *file;
+
+  fprintf(fp_out, "# Config file: %s\n", config_file_name);
+  if (!(file = fopen(config_file_name, "r"))) return 1;
+
+  while (fgets(line, sizeof(line), file)) {
+    if (strlen(line) < 3 || *line == ' ' || *line == '\t' || *line == '#') continue;
+    if ((c = strchr(line, '#')) || (c = strchr(line, '\n'))) *c = '\0';
+    fprintf(fp_out, "# %s\n", line);
+  }
+  fclose(file);
+  return 0;
+}
+
+/* grid_alloc
+   malloc the arrays of g for a final grid of L x R, and a point contact of length LC
+     double v[2][L+1][R+5];
+     double eps[L+1][R+1], eps_dr[L+1][R+1], eps_dz[L+1][R+1];
+     double vfraction[L+1][R+1], s1[R+1], s2[R+1], imp_z[L+1], imp_ra[R+1], imp_rm[R+1];
+     int    bulk[L+1][R+1], rrc[LC+2];
+     float  drrc[LC+2], frrc[L+2];
+     double vsnap[L][R];  char usnap[R][L];
+   returns 0 for success
+*/
+static int grid_alloc(Relax_Grid *g, int L, int R, int LC) {
+  int j;
+
+  g->Lmax = L;
+  g->Rmax = R;
+  g->LCmax = LC;
+  if ((g->v[0]   = (double **) calloc(L+1, sizeof(*g->v[0]))) == NULL ||
+      (g->v[1]   = (double **) calloc(L+1, sizeof(*g->v[1]))) == NULL ||
+      (g->eps    = (double **) calloc(L+1, sizeof(*g->eps)))  == NULL ||
+      (g->eps_dr = (double **) calloc(L+1, sizeof(*g->eps_dr))) == NULL ||
+      (g->eps_dz = (double **) calloc(L+1, sizeof(*g->eps_dz))) == NULL ||
+      (g->bulk   = (int **) calloc(L+1, sizeof(*g->bulk)))   == NULL ||
+      (g->vfraction = (double **) calloc(L+1, sizeof(*g->vfraction)))  == NULL ||
+      (g->vsnap  = (double **) calloc(L, sizeof(*g->vsnap))) == NULL ||
+      (g->usnap  = (char **) calloc(R, sizeof(*g->usnap))) == NULL ||
+      (g->imp_ra = (double *) malloc((R+1)*sizeof(*g->imp_ra))) == NULL ||
+      (g->imp_rm = (double *) malloc((R+1)*sizeof(*g->imp_rm))) == NULL ||
+      (g->imp_z  = (double *) malloc((L+1)*sizeof(*g->imp_z))) == NULL ||
+      (g->rrc    = (int *) calloc(LC+2, sizeof(*g->rrc)))  == NULL ||
+      (g->drrc   = (float *) calloc(LC+2, sizeof(*g->drrc))) == NULL ||
+      (g->frrc   = (float *) calloc(L+2, sizeof(*g->frrc))) == NULL ||
+      (g->s1 = (double *) malloc((R+1)*sizeof(*g->s1))) == NULL ||
+      (g->s2 = (double *) malloc((R+1)*sizeof(*g->s2))) == NULL) {
+    fprintf(g->out, "Malloc failed\n");
+    return 1;
+  }
+#define ERR { fprintf(g->out, "Malloc failed; j = %d\n", j); return 1; }
+  for (j=0; j<L+1; j++) if ((g->v[0][j] = (double *) malloc((R+5)*sizeof(**g->v[0]))) == NULL) ERR;
+  for (j=0; j<L+1; j++) if ((g->v[1][j] = (double *) malloc((R+5)*sizeof(**g->v[1]))) == NULL) ERR;
+  for (j=0; j<L+1; j++) if ((g->eps[j]  = (double *) malloc((R+1)*sizeof(**g->eps)))  == NULL) ERR;
+  for (j=0; j<L+1; j++) if ((g->eps_dr[j] = (double *) malloc((R+1)*sizeof(**g->eps_dr))) == NULL) ERR;
+  for (j=0; j<L+1; j++) if ((g->eps_dz[j] = (double *) malloc((R+1)*sizeof(**g->eps_dz))) == NULL) ERR;
+  for (j=0; j<L+1; j++) if ((g->bulk[j] = (int *) malloc((R+1)*sizeof(**g->bulk))) == NULL) ERR;
+  for (j=0; j<L+1; j++) if ((g->vfraction[j] = (double *) malloc((R+1)*sizeof(**g->vfraction))) == NULL) ERR;
+  for (j=0; j<L; j++) if ((g->vsnap[j] = (double *) malloc(R*sizeof(**g->vsnap))) == NULL) ERR;
+  for (j=0; j<R; j++) if ((g->usnap[j] = (char *) malloc(L*sizeof(**g->usnap))) == NULL) ERR;
+#undef ERR
+  return 0;
+}
+
+static void grid_free(Relax_Grid *g) {
+  int j;
+
+  /* grid_alloc may have failed part of the way through */
+#define FREE_ROWS(a, n) if (a) { for (j=0; j<(n); j++) free(a[j]); free(a); a = NULL; }
+  FREE_ROWS(g->v[0], g->Lmax+1);
+  FREE_ROWS(g->v[1], g->Lmax+1);
+  FREE_ROWS(g->eps, g->Lmax+1);
+  FREE_ROWS(g->eps_dr, g->Lmax+1);
+  FREE_ROWS(g->eps_dz, g->Lmax+1);
+  FREE_ROWS(g->bulk, g->Lmax+1);
+  FREE_ROWS(g->vfraction, g->Lmax+1);
+  FREE_ROWS(g->vsnap, g->Lmax);
+  FREE_ROWS(g->usnap, g->Rmax);
+#undef FREE_ROWS
+  free(g->imp_ra);  free(g->imp_rm);  free(g->imp_z);
+  free(g->rrc);  free(g->drrc);  free(g->frrc);
+  free(g->s1);  free(g->s2);
+  g->imp_z = g->imp_ra = g->imp_rm = g->s1 = g->s2 = NULL;
+  g->rrc = NULL;
+  g->drrc = g->frrc = NULL;
+}
+
+/* grid_expand
+   copy/expand the result of the relaxation on the previous, coarser, grid
+   (of size grid_old) from v[1] into v[0] for the new finer grid (of size grid_new),
+   using linear interpolation
+*/
+static void grid_expand(Relax_Grid *g, float grid_old, float grid_new, int LL, int RR) {
+  double **v[2] = {g->v[0], g->v[1]}, f, f1z, f2z, f1r, f2r;
+  int    i, r, z, rr, zz, rmax, zmax;
+
+  i = (int) (grid_old / grid_new + 0.5);
+  f = 1.0 / (float) i;
+  if (!g->quiet)
+    fprintf(g->out, "\ngrid %.4f -> %.4f; ratio = %d %.3f\n\n",
+	   grid_old, grid_new, i, f);
+  for (z=0; z<g->L+1; z++) {
+    for (r=0; r<g->R+1; r++) {
+      f1z = 0.0;
+      zmax = i*z+i;
+      if (zmax > LL+1) zmax = LL+1;
+      for (zz=i*z; zz<zmax; zz++) {
+	f2z = 1.0 - f1z;
+	f1r = 0.0;
+	rmax = i*r+i;
+	if (rmax > RR+1) rmax = RR+1;
+	for (rr=i*r; rr<rmax; rr++) {
+	  f2r = 1.0 - f1r;
+	  v[0][zz][rr] =      // linear interpolation of potential
+	    f2z*f2r*v[1][z][r  ] + f1z*f2r*v[1][z+1][r  ] +
+	    f2z*f1r*v[1][z][r+1] + f1z*f1r*v[1][z+1][r+1];
+	  f1r += f;
+	}
+	f1z += f;
+      }
+    }
+  }
+}
+
+/* grid_geometry
+   recalculate geometry dimensions in units of the current grid size,
+   including the shape of the (optionally bulletized) point contact
+   and of any borehole;
+   offsets of the PC length from the middle of the nearest pixel that
+   are smaller than dLC_min are ignored
+*/
+static void grid_geometry(MJD_Siggen_Setup *setup, Relax_Grid *g, float grid,
+			  float dLC_min, float *dLC, float *dRC) {
+  int    *rrc = g->rrc, z, LC;
+  float  *drrc = g->drrc, *frrc = g->frrc, c;
+  Geometry mm;   // the shape in mm, for the PC radius
+
+  g->grid = grid;
+  g->L  = lrint(setup->xtal_length/grid);
+  g->R  = lrint(setup->xtal_radius/grid);
+  g->BRT = lrint(setup->top_bullet_radius/grid);
+  // BRB = lrint(setup->bottom_bullet_radius/grid);
+  g->LC = LC = lrint(setup->pc_length/grid);
+  // distance in grid units from PC length to the middle of the nearest pixel:
+  *dLC = setup->pc_length/grid - (float) LC;
+  if (*dLC < dLC_min && *dLC > -dLC_min) *dLC = 0;
+  g->RC = lrint(setup->pc_radius/grid);
+  // distance in grid units from PC radius to the middle of the nearest pixel:
+  *dRC = setup->pc_radius/grid - (float) g->RC;
+  if (*dRC < 0.05 && *dRC > -0.05) *dRC = 0;
+  /* set up bulletization inside point contact */
+  if (setup->bulletize_PC) {
+    geometry_compile(&mm, setup, 0);
+    for (z=0; z<=LC; z++) {
+      c = geometry_radius(&mm, GEOM_PC, z * grid);
+      rrc[z] = lrint(c/grid);
+      drrc[z] = c/grid - (float) rrc[z];
+      if (drrc[z] < 0.05 && drrc[z] > -0.05) drrc[z] = 0;
+      frrc[z] = 0;
+    }
+    drrc[LC+1] = drrc[LC];
+  } else {  // no bulletization
+    for (z=0; z<=LC+1; z++) {
+      rrc[z] = g->RC;
+      drrc[z] = *dRC;
+      frrc[z] = 0;
+    }
+  }
+
+  g->LT = lrint(setup->taper_length/grid);
+  g->RO = lrint(setup->wrap_around_radius/grid);
+  g->LO = lrint(setup->ditch_depth/grid);
+  g->WO = lrint(setup->ditch_thickness/grid);
+  // LiT = lrint(setup->Li_thickness/grid);
+  if (g->RO <= 0.0 || g->RO >= g->R) g->RO = g->R - g->LT;  // inner radius of taper, in grid lengths
+
+  /* borehole of an inverted-coax detector; as for the PC, the distance from its
+     radius and bottom to the middle of the nearest pixel is kept */
+  g->RH = 0;
+  g->ZH = g->L + 2;
+  g->dRH = g->dZH = 0;
+  if (setup->hole_length > 0 && setup->hole_radius > 0) {
+    c = (setup->xtal_length - setup->hole_length)/grid;
+    g->ZH = lrint(c);
+    g->dZH = c - (float) g->ZH;
+    if (g->dZH < 0.05 && g->dZH > -0.05) g->dZH = 0;
+    g->RH = lrint(setup->hole_radius/grid);
+    g->dRH = setup->hole_radius/grid - (float) g->RH;
+    if (g->dRH < 0.05 && g->dRH > -0.05) g->dRH = 0;
+    for (z=g->ZH-1; z<=g->L; z++) frrc[z] = 0;
+  }
+  geometry_compile(&g->geom, setup, grid);
+}
+
+/* grid_permittivity
+   set up the permittivity of each voxel, and the average between neighbours;
+   epsilon0 * E_vac = espilon_Ge * E_Ge
+   Voxels that the surface of the ditch passes through are partly filled,
+   so vfraction is set to the fraction of each voxel that is Ge.
+*/
+static void grid_permittivity(Relax_Grid *g) {
+  double **eps = g->eps, **eps_dr = g->eps_dr, **eps_dz = g->eps_dz;
+  double **vfraction = g->vfraction, f;
+  int    r, z;
+
+  for (z=0; z<g->L+1; z++) {
+    for (r=0; r<g->R+1; r++) {
+      f = geometry_fraction(&g->geom, GEOM_DITCH, r, z, 1, 1);
+      vfraction[z][r] = 1.0 - f;
+      eps[z][r] = eps_dz[z][r] = eps_dr[z][r] = 16 - 15*f;  // permittivity of Ge and vacuum
+      if (r > 0) eps_dr[z][r-1] = (eps[z][r-1]+eps[z][r])/2.0f;
+      if (z > 0) eps_dz[z-1][r] = (eps[z-1][r]+eps[z][r])/2.0f;
+    }
+  }
+}
+
+/* ev_relax_row
+   one relaxation step of the potential for row z of the grid,
+   reading the previous iteration from vo and writing the new values to vn
+   returns 0 on success, 1 on error
+*/
+static int ev_relax_row(Relax_Grid *g, int z, double **vo, double **vn, Relax_Stats *st) {
+  double **eps_dr = g->eps_dr, **eps_dz = g->eps_dz, **vfraction = g->vfraction;
+  double *s1 = g->s1, *s2 = g->s2, eps_sum, v_sum, mean, min;
+  int    **bulk = g->bulk, r, R = g->R, RC = g->RC, RO = g->RO, LO = g->LO, WO = g->WO;
+  float  dif;
+
+  for (r=0; r<R; r++) {
+    if (bulk[z][r] < 0) continue;      // outside or inside contact
+
+    if (bulk[z][r] == 0) {             // normal bulk, no complications
+      v_sum = vo[z+1][r]*eps_dz[z][r] + vo[z][r+1]*eps_dr[z][r]*s1[r];
+      eps_sum = eps_dz[z][r] + eps_dr[z][r]*s1[r];
+      min = fminf(vo[z+1][r], vo[z][r+1]);
+      if (z > 0) {
+	v_sum += vo[z-1][r]*eps_dz[z-1][r];
+	eps_sum += eps_dz[z-1][r];
+	min = fminf(min, vo[z-1][r]);
+      } else {
+	v_sum += vo[z+1][r]*eps_dz[z][r];  // reflection symm around z=0
+	eps_sum += eps_dz[z][r];
+      }
+      if (r > 0) {
+	v_sum += vo[z][r-1]*eps_dr[z][r-1]*s2[r];
+	eps_sum += eps_dr[z][r-1]*s2[r];
+	min = fminf(min, vo[z][r-1]);
+      } else {
+	v_sum += vo[z][r+1]*eps_dr[z][r]*s1[r];  // reflection symm around r=0
+	eps_sum += eps_dr[z][r]*s1[r];
+      }
+
+    } else if (bulk[z][r] == 1) {    // interpolated radial edge of point contact or borehole
+      /* since the PC radius is not in the middle of a pixel,
+	 use a modified weight for the interpolation to (r-1)
+      */
+      v_sum = vo[z+1][r]*eps_dz[z][r] + vo[z][r+1]*eps_dr[z][r]*s1[r] +
+	      vo[z][r-1]*eps_dr[z][r-1]*s2[r]*g->frrc[z];
+      eps_sum = eps_dz[z][r] + eps_dr[z][r]*s1[r] + eps_dr[z][r-1]*s2[r]*g->frrc[z];
+      min = fminf(vo[z+1][r], vo[z][r+1]);
+      min = fminf(min, vo[z][r-1]);
+      if (z > 0) {
+	v_sum += vo[z-1][r]*eps_dz[z-1][r];
+	eps_sum += eps_dz[z-1][r];
+	min = fminf(min, vo[z-1][r]);
+      } else {
+	v_sum += vo[z+1][r]*eps_dz[z][r];  // reflection symm around z=0
+	eps_sum += eps_dz[z][r];
+      }
+    } else if (bulk[z][r] == 2) {    // interpolated z edge of point contact
+      /* since the PC length is not in the middle of a pixel,
+	 use a modified weight for the interpolation to (z-1)
+      */
+      v_sum = vo[z+1][r]*eps_dz[z][r] + vo[z][r+1]*eps_dr[z][r]*s1[r] +
+	      vo[z-1][r]*eps_dz[z-1][r]*g->fLC;
+      eps_sum = eps_dz[z][r] + eps_dr[z][r]*s1[r] + eps_dz[z-1][r]*g->fLC;
+      min = fminf(vo[z+1][r], vo[z][r+1]);
+      min = fminf(min, vo[z-1][r]);
+      if (r > 0) {
+	v_sum += vo[z][r-1]*eps_dr[z][r-1]*s2[r];
+	eps_sum += eps_dr[z][r-1]*s2[r];
+	min = fminf(min, vo[z][r-1]);
+      } else {
+	v_sum += vo[z][r+1]*eps_dr[z][r]*s1[r];  // reflection symm around r=0
+	eps_sum += eps_dr[z][r]*s1[r];
+      }
+      // check for cases where the PC corner needs modification in both r and z
+      if (z == g->LC && bulk[z-1][r] == 1) {
+	v_sum += vo[z][r-1]*eps_dr[z][r-1]*s2[r]*(g->frrc[z]-1.0);
+	eps_sum += eps_dr[z][r-1]*s2[r]*(g->frrc[z]-1.0);
+	min = fminf(min, vo[z][r-1]);
+      }
+
+    } else if (bulk[z][r] == 4) {    // interpolated bottom edge of borehole
+      /* as for the z edge of the PC, but with the contact at (z+1) */
+      v_sum = vo[z+1][r]*eps_dz[z][r]*g->fZH + vo[z][r+1]*eps_dr[z][r]*s1[r] +
+	      vo[z-1][r]*eps_dz[z-1][r];
+      eps_sum = eps_dz[z][r]*g->fZH + eps_dr[z][r]*s1[r] + eps_dz[z-1][r];
+      min = fminf(vo[z+1][r], vo[z][r+1]);
+      min = fminf(min, vo[z-1][r]);
+      if (r > 0) {
+	v_sum += vo[z][r-1]*eps_dr[z][r-1]*s2[r];
+	eps_sum += eps_dr[z][r-1]*s2[r];
+	min = fminf(min, vo[z][r-1]);
+      } else {
+	v_sum += vo[z][r+1]*eps_dr[z][r]*s1[r];  // reflection symm around r=0
+	eps_sum += eps_dr[z][r]*s1[r];
+      }
+      // corner of the borehole
+      if (z == g->ZH && bulk[z+1][r] == 1) {
+	v_sum += vo[z][r-1]*eps_dr[z][r-1]*s2[r]*(g->frrc[z]-1.0);
+	eps_sum += eps_dr[z][r-1]*s2[r]*(g->frrc[z]-1.0);
+	min = fminf(min, vo[z][r-1]);
+      }
+
+    } else {
+      fprintf(g->out, " ERROR! bulk = %d undefined for (z,r) = (%d,%d)\n",
+	     bulk[z][r], z, r);
+      return 1;
+    }
+
+    // calculate the interpolated mean potential and the effect of the space charge
+    mean = v_sum / eps_sum;
+    vn[z][r] = mean + vfraction[z][r] * (g->imp_z[z]*g->imp_rm[r] + g->imp_ra[r]);
+    if (r == 0)  // special case where volume of voxel is 1/6 of area, not 1/4
+      vn[z][r] = mean + (vfraction[z][r] * (g->imp_z[z]*g->imp_rm[r] + g->imp_ra[r])) / 1.5;
+    if (z == 0 && r > RC && r < RO-WO)            // passivated surface at z = 0
+      vn[z][r] += vfraction[z][r] * g->S;
+    else if ((z < LO && (r == RO || r == RO-WO)) ||  // passivated surface on sides of ditch
+	     (z == LO && r <= RO && r >= RO-WO))     // passivated surface at top of ditch
+      vn[z][r] += g->S;   // the surface lies inside these partly-filled voxels
+    // check to see if the pixel is undepleted
+    if (g->linear) {
+      ;  // no; the result is used for superposition, see fieldgen_fit.c
+    } else {
+      if (vfraction[z][r] > 0.45) g->undepleted[r][z] = '.';
+      if (vn[z][r] <= 0.0f) {
+	vn[z][r] = 0.0f;
+	if (vfraction[z][r] > 0.45) g->undepleted[r][z] = '*';
+      } else if (vn[z][r] < min) {
+	if (st->bubble_volts == 0.0f) st->bubble_volts = min + 0.1f;
+	vn[z][r] = st->bubble_volts;
+	if (vfraction[z][r] > 0.45) g->undepleted[r][z] = '*';
+      }
+    }
+    // calculate difference from last iteration, for convergence check
+    dif = vo[z][r] - vn[z][r];
+    if (dif < 0.0f) dif = -dif;
+    st->sum_dif += dif;
+    if (st->max_dif < dif) st->max_dif = dif;
+  }
+  return 0;
+}
+
+/* wp_relax_row
+   one relaxation step of the weighting potential for row z of the grid,
+   reading the previous iteration from vo and writing the new values to vn;
+   pinched-off voxels are only summed here, see relax()
+   returns 0 on success, 1 on error
+*/
+static int wp_relax_row(Relax_Grid *g, int z, double **vo, double **vn, Relax_Stats *st) {
+  double **eps_dr = g->eps_dr, **eps_dz = g->eps_dz;
+  double *s1 = g->s1, *s2 = g->s2, eps_sum, v_sum, mean;
+  int    **bulk = g->bulk, r, R = g->R;
+  float  dif;
+
+  for (r=0; r<R; r++) {
+    if (bulk[z][r] < 0) continue;      // outside or inside contact
+
+    if (bulk[z][r] == 0) {            // normal bulk, no complications
+      v_sum = vo[z+1][r]*eps_dz[z][r] + vo[z][r+1]*eps_dr[z][r]*s1[r];
+      eps_sum = eps_dz[z][r] + eps_dr[z][r]*s1[r];
+      if (z > 0) {
+	v_sum += vo[z-1][r]*eps_dz[z-1][r];
+	eps_sum += eps_dz[z-1][r];
+      } else {
+	v_sum += vo[z+1][r]*eps_dz[z][r];  // reflection symm around z=0
+	eps_sum += eps_dz[z][r];
+      }
+      if (r > 0) {
+	v_sum += vo[z][r-1]*eps_dr[z][r-1]*s2[r];
+	eps_sum += eps_dr[z][r-1]*s2[r];
+      } else {
+	v_sum += vo[z][r+1]*eps_dr[z][r]*s1[r];  // reflection symm around r=0
+	eps_sum += eps_dr[z][r]*s1[r];
+      }
+
+    } else if (bulk[z][r] == 1) {    // interpolated radial edge of point contact or borehole
+      v_sum = vo[z+1][r]*eps_dz[z][r] + vo[z][r+1]*eps_dr[z][r]*s1[r] +
+	vo[z][r-1]*eps_dr[z][r-1]*s2[r]*g->frrc[z];
+      eps_sum = eps_dz[z][r] + eps_dr[z][r]*s1[r] + eps_dr[z][r-1]*s2[r]*g->frrc[z];
+      if (z > 0) {
+	v_sum += vo[z-1][r]*eps_dz[z-1][r];
+	eps_sum += eps_dz[z-1][r];
+      } else {
+	v_sum += vo[z+1][r]*eps_dz[z][r];  // reflection symm around z=0
+	eps_sum += eps_dz[z][r];
+      }
+    } else if (bulk[z][r] == 2) {    // interpolated z edge of point contact
+      v_sum = vo[z+1][r]*eps_dz[z][r] + vo[z][r+1]*eps_dr[z][r]*s1[r] +
+	vo[z-1][r]*eps_dz[z-1][r]*g->fLC;
+      eps_sum = eps_dz[z][r] + eps_dr[z][r]*s1[r] + eps_dz[z-1][r]*g->fLC;
+      if (r > 0) {
+	v_sum += vo[z][r-1]*eps_dr[z][r-1]*s2[r];
+	eps_sum += eps_dr[z][r-1]*s2[r];
+      } else {
+	v_sum += vo[z][r+1]*eps_dr[z][r]*s1[r];  // reflection symm around r=0
+	eps_sum += eps_dr[z][r]*s1[r];
+      }
+      if (z == g->LC && bulk[z-1][r] == 1) {
+	v_sum += vo[z][r-1]*eps_dr[z][r-1]*s2[r]*(g->frrc[z]-1.0);
+	eps_sum += eps_dr[z][r-1]*s2[r]*(g->frrc[z]-1.0);
+      }
+
+    } else if (bulk[z][r] == 4) {    // interpolated bottom edge of borehole
+      v_sum = vo[z+1][r]*eps_dz[z][r]*g->fZH + vo[z][r+1]*eps_dr[z][r]*s1[r] +
+	vo[z-1][r]*eps_dz[z-1][r];
+      eps_sum = eps_dz[z][r]*g->fZH + eps_dr[z][r]*s1[r] + eps_dz[z-1][r];
+      if (r > 0) {
+	v_sum += vo[z][r-1]*eps_dr[z][r-1]*s2[r];
+	eps_sum += eps_dr[z][r-1]*s2[r];
+      } else {
+	v_sum += vo[z][r+1]*eps_dr[z][r]*s1[r];  // reflection symm around r=0
+	eps_sum += eps_dr[z][r]*s1[r];
+      }
+      if (z == g->ZH && bulk[z+1][r] == 1) {
+	v_sum += vo[z][r-1]*eps_dr[z][r-1]*s2[r]*(g->frrc[z]-1.0);
+	eps_sum += eps_dr[z][r-1]*s2[r]*(g->frrc[z]-1.0);
+      }
+
+    } else if (bulk[z][r] == 3) {   // pinched-off
+      if (bulk[z+1][r] == 0) {
+	st->pinched_sum1 += vo[z+1][r]*eps_dz[z][r];
+	st->pinched_sum2 += eps_dz[z][r];
+      }
+      if (bulk[z][r+1] == 0) {
+	st->pinched_sum1 += vo[z][r+1]*eps_dr[z][r]*s1[r];
+	st->pinched_sum2 += eps_dr[z][r]*s1[r];
+      }
+      if (z > 0 && bulk[z-1][r] == 0) {
+	st->pinched_sum1 += vo[z-1][r]*eps_dz[z-1][r];
+	st->pinched_sum2 += eps_dz[z-1][r];
+      }
+      if (r > 0 && bulk[z][r-1] == 0) {
+	st->pinched_sum1 += vo[z][r-1]*eps_dr[z][r-1]*s2[r];
+	st->pinched_sum2 += eps_dr[z][r-1]*s2[r];
+      }
+      continue;
+
+    } else {
+      fprintf(g->out, " ERROR! bulk = %d undefined for (z,r) = (%d,%d)\n",
+	     bulk[z][r], z, r);
+      return 1;
+    }
+    mean = v_sum / eps_sum;
+    vn[z][r] = mean;
+    dif = vo[z][r] - vn[z][r];
+    if (dif < 0.0f) dif = -dif;
+    st->sum_dif += dif;
+    if (st->max_dif < dif) st->max_dif = dif;
+  }
+  return 0;
+}
+
+/* relax_block
+   do nlev iterations on grid g, starting from the values in v[old].
+   Rather than sweeping the whole grid once per iteration, the iterations are
+   skewed into a wavefront: while row z is being updated for iteration 1,
+   row z-1 is updated for iteration 2, row z-2 for iteration 3, and so on.
+   Only about nlev+2 rows are in use at any one time, so they stay in cache,
+   and the whole grid is streamed from memory once per nlev iterations.
+   Each iteration still visits its rows in the same order as a plain sweep,
+   so the values and the convergence information in st[] are identical.
+   The two buffers are enough, since iteration k overwrites row z only after
+   iteration k-1 has finished with rows z-1, z and z+1.
+   returns 0 on success, 1 on error
+*/
+static int relax_block(Relax_Grid *g, int wp, int old, int nlev, Relax_Stats *st) {
+  int    i, k, z, L = g->L, R = g->R;
+  double **vo, **vn;
+
+  for (k=0; k<nlev; k++) memset(&st[k], 0, sizeof(st[k]));
+  for (i=0; i < L + nlev - 1; i++) {
+    for (k=0; k<nlev && k<=i; k++) {
+      z = i - k;
+      if (z >= L) continue;
+      vo = g->v[(old+k)%2];
+      vn = g->v[(old+k+1)%2];
+      if (wp) {
+	if (wp_relax_row(g, z, vo, vn, &st[k])) return 1;
+	if (z == L/2) st[k].v_mid  = vn[L/2][R/2];
+	if (z == L-5) st[k].v_edge = vn[L-5][R-5];
+      } else {
+	if (ev_relax_row(g, z, vo, vn, &st[k])) return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+/* one band of rows for relax_sweep() */
+typedef struct {
+  Relax_Grid  *g;
+  int         wp, old, z0, z1, err;
+  Relax_Stats st;
+} Relax_Band;
+
+static void relax_band(void *arg) {
+  Relax_Band *b = (Relax_Band *) arg;
+  Relax_Grid *g = b->g;
+  double **vo = g->v[b->old], **vn = g->v[1 - b->old];
+  int    z, L = g->L, R = g->R;
+
+  for (z=b->z0; z<b->z1; z++) {
+    if (b->wp) {
+      if ((b->err = wp_relax_row(g, z, vo, vn, &b->st))) return;
+      if (z == L/2) b->st.v_mid  = vn[L/2][R/2];
+      if (z == L-5) b->st.v_edge = vn[L-5][R-5];
+    } else {
+      if ((b->err = ev_relax_row(g, z, vo, vn, &b->st))) return;
+    }
+  }
+}
+
+/* relax_sweep
+   one iteration of the relaxation, as relax_block() with nlev = 1, but with
+   the rows split into nb bands that are done as tasks of g->pool.
+   The new values and st->max_dif are the same as for relax_block(); sum_dif
+   is added up band by band, so it can differ in the last digits.
+   Not for the WP with pinched-off regions, which needs sums over the whole grid.
+   returns 0 on success, 1 on error
+*/
+static int relax_sweep(Relax_Grid *g, int wp, int old, int nb, Relax_Stats *st) {
+  Relax_Band b[MAX_BANDS];
+  Pool_Group grp = {0};
+  float  bubble = 0;
+  int    k, L = g->L;
+
+  for (k=0; k<nb; k++) {
+    memset(&b[k], 0, sizeof(b[k]));
+    b[k].g = g;
+    b[k].wp = wp;
+    b[k].old = old;
+    b[k].z0 = k * L / nb;
+    b[k].z1 = (k+1) * L / nb;
+    pool_spawn(g->pool, &grp, relax_band, &b[k]);
+  }
+  pool_wait(g->pool, &grp);
+
+  memset(st, 0, sizeof(*st));
+  for (k=0; k<nb; k++) {
+    if (b[k].err) return 1;
+    /* the potential of a pinch-off bubble is fixed by the first voxel
+       found in it, so any later bands that used a different value are redone */
+    if (bubble == 0.0f) {
+      bubble = b[k].st.bubble_volts;
+    } else if (b[k].st.bubble_volts != 0.0f && b[k].st.bubble_volts != bubble) {
+      memset(&b[k].st, 0, sizeof(b[k].st));
+      b[k].st.bubble_volts = bubble;
+      relax_band(&b[k]);
+      if (b[k].err) return 1;
+    }
+    st->sum_dif += b[k].st.sum_dif;
+    if (st->max_dif < b[k].st.max_dif) st->max_dif = b[k].st.max_dif;
+    if (b[k].z0 <= L/2 && L/2 < b[k].z1) st->v_mid  = b[k].st.v_mid;
+    if (b[k].z0 <= L-5 && L-5 < b[k].z1) st->v_edge = b[k].st.v_edge;
+  }
+  st->bubble_volts = bubble;
+  return 0;
+}
+
+/* relax
+   perform up to max_its iterations of the relaxation for the potential (wp = 0)
+   or weighting potential (wp = 1) on grid g, starting from the values in v[0],
+   doing up to depth iterations per pass through the grid
+   on return, *iter is the number of iterations done, as for a loop that stops
+   on convergence, v[g->cur] holds the result, and *last has the convergence
+   information for the final iteration
+   returns 0 on success, 1 on error
+*/
+static int relax(Relax_Grid *g, int wp, int depth, int max_its, int *iter, Relax_Stats *last) {
+  Relax_Stats   st[MAX_TILE_DEPTH], *s;
+  double **vsnap = g->vsnap, mean, thresh = (wp ? 0.0000000001 : 0.000000001);
+  char   **usnap = g->usnap;
+  float  dif;
+  int    i, k, nlev, nb, old = 0, it, z, r, L = g->L, R = g->R, conv;
+
+  if (g->thresh > 0) thresh = g->thresh;
+  if (depth < 1) depth = 1;
+  if (depth > MAX_TILE_DEPTH) depth = MAX_TILE_DEPTH;
+  /* the update of the pinched-off WP voxels needs the sums over a full sweep,
+     so in that case we do one iteration at a time */
+  if (wp && g->pinched) depth = 1;
+
+  it = 0;
+  g->cur = 0;
+  memset(last, 0, sizeof(*last));
+  while (it < max_its) {
+    if (g->stop) return 1;
+    nlev = depth;
+    if (nlev > max_its - it) nlev = max_its - it;
+    /* if there are idle threads, share out the rows of the next iteration */
+    nb = 1;
+    if (g->pool && !(wp && g->pinched)) nb = pool_idle(g->pool) + 1;
+    if (nb > L / MIN_BAND_ROWS) nb = L / MIN_BAND_ROWS;
+    if (nb > MAX_BANDS) nb = MAX_BANDS;
+    if (nb > 1) {
+      nlev = 1;
+      if (relax_sweep(g, wp, old, nb, st)) return 1;
+    } else {
+      if (nlev > 1) {
+	for (z=0; z<L; z++) memcpy(vsnap[z], g->v[old][z], R*sizeof(**vsnap));
+	if (!wp)
+	  for (r=0; r<R; r++) memcpy(usnap[r], g->undepleted[r], L*sizeof(**usnap));
+      }
+      if (relax_block(g, wp, old, nlev, st)) return 1;
+    }
+
+    if (nlev == 1 && st[0].pinched_sum2 > 0.1) {
+      /* set all the pinched-off voxels to the mean WP of their surroundings */
+      s = &st[0];
+      mean = s->pinched_sum1 / s->pinched_sum2;
+      for (z=0; z<L; z++) {
+	for (r=0; r<R; r++) {
+	  if (g->bulk[z][r] == 3) {
+	    g->v[1-old][z][r] = mean;
+	    dif = g->v[old][z][r] - g->v[1-old][z][r];
+	    if (dif < 0.0f) dif = -dif;
+	    s->sum_dif += dif;
+	    if (s->max_dif < dif) s->max_dif = dif;
+	  }
+	}
+      }
+      // the reported WP values may have changed
+      s->v_mid  = g->v[1-old][L/2][R/2];
+      s->v_edge = g->v[1-old][L-5][R-5];
+    }
+
+    // report results for some iterations
+    for (k=0, conv=nlev; k<nlev; k++) {
+      i = it + k;
+      s = &st[k];
+      if (!g->quiet && (i < 10 || (i < 600 && i%100 == 0) || i%1000 == 0)) {
+	if (wp) {
+	  fprintf(g->out, "%5d %d %d %.10f %.10f ; %.10f %.10f\n",
+		 i, (old+k)%2, (old+k+1)%2, s->max_dif, s->sum_dif/(float) (L*R),
+		 s->v_mid, s->v_edge);
+	} else {
+	  fprintf(g->out, "%5d %d %d %.10f %.10f\n",
+		 i, (old+k)%2, (old+k+1)%2, s->max_dif, s->sum_dif/(float) (L*R));
+	}
+      }
+      if (g->monitor) g->monitor(g->monitor_arg, wp, g->grid, L, R, i, s);
+      if (s->max_dif < thresh && i >= g->min_its) {
+	conv = k+1;
+	break;
+      }
+    }
+
+    if (conv < nlev) {
+      /* converged part-way through the block; go back to the start of the block
+	 and repeat just the iterations needed */
+      for (z=0; z<L; z++) memcpy(g->v[old][z], vsnap[z], R*sizeof(**vsnap));
+      if (!wp)
+	for (r=0; r<R; r++) memcpy(g->undepleted[r], usnap[r], L*sizeof(**usnap));
+      if (relax_block(g, wp, old, conv, st)) return 1;
+    }
+    g->cur = (old + conv) % 2;
+    *last = st[conv-1];
+    it += conv;
+    old = g->cur;
+    if (st[conv-1].max_dif < thresh && it-1 >= g->min_its) {
+      it--;  // count as for a loop that breaks on convergence
+      break;
+    }
+  }
+  *iter = it;
+  return 0;
+}
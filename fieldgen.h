@@ -0,0 +1,250 @@
+/* fieldgen.h -- library interface to the fieldgen relaxation code
+ *
+ * This module calculates the electric potential and weighting potential
+ * of a PPC or BEGe detector, as done by the stand-alone mjd_fieldgen program.
+ *
+ * To use:
+ * -- fill an MJD_Siggen_Setup, e.g. by calling read_config
+ * -- call fieldgen_init. This will set up the grids and allocate arrays
+ * -- call fieldgen_solve_field, and then fieldgen_solve_wp if needed
+ * -- call fieldgen_capacitance and fieldgen_depletion_voltage for the results
+ * -- either write the usual files with fieldgen_write_field and fieldgen_write_wp,
+ *       or call fieldgen_export to hand the fields directly to the siggen code
+ * -- call fieldgen_free
+ * fieldgen_find_voltages can be called in place of the solve functions,
+ * to find the depletion and pinch-off voltages.
+ * Alternatively, fieldgen_run does all the calculations and writes the files,
+ * overlapping the different steps where possible.
+ * If setup->cache_dir is set, fieldgen_cache_fetch can be used first to check
+ * for previously-calculated fields, and fieldgen_cache_store to save new ones.
+ */
+#ifndef _FIELDGEN_H
+#define _FIELDGEN_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include "mjd_siggen.h"
+#include "pool.h"
+
+#define MAX_ITS 50000     // default max number of iterations for relaxation
+#define MAX_ITS_FACTOR 2  // factor by which max iterations is reduced as grid is refined
+#define TILE_DEPTH 8      // default number of iterations done per pass through the grid
+#define MAX_TILE_DEPTH 32
+#define MIN_BAND_ROWS 16  // smallest number of grid rows handed to another thread
+#define MAX_BANDS 64
+
+/* convergence information for one iteration */
+typedef struct {
+  float  sum_dif, max_dif, bubble_volts;
+  double pinched_sum1, pinched_sum2;
+  double v_mid, v_edge;  // WP at (L/2, R/2) and (L-5, R-5), for reporting
+} Relax_Stats;
+
+/* Relax_Monitor
+   if set, called by relax() after each iteration of the relaxation of the
+   potential (wp = 0) or WP (wp = 1) on a grid of size grid mm and L x R points,
+   e.g. to record the convergence; iter counts from 0 on each grid.
+   Iterations done in one pass through the grid (see tile_depth) are reported
+   together at the end of the pass. fieldgen_run may call it from two threads
+   at once, for the potential and the WP.
+*/
+typedef void (*Relax_Monitor)(void *arg, int wp, float grid, int L, int R, int iter,
+			      Relax_Stats *st);
+
+/* arrays and dimensions for one relaxation (of either the potential or the WP),
+   for the current grid size */
+typedef struct {
+  float  grid;        // grid size in mm
+  int    L, R;        // length and radius of detector, in grid lengths
+  int    LC, RC;      // length and radius of point contact, in grid lengths
+  int    LT, BRT;     // length of taper, radius of top bulletization, in grid lengths
+  int    RO, LO, WO;  // wrap-around radius, ditch depth and width, in grid lengths
+  int    RH, ZH;      // radius and bottom of the ICPC borehole, in grid lengths; ZH > L if none
+  float  dRH, dZH, fZH;  // offsets of the borehole edges from the nearest pixels,
+                         //   and interpolation weight at its bottom, as for the PC
+  Geometry geom;      // detector shape in grid lengths, see geometry.h
+  double **v[2], **eps, **eps_dr, **eps_dz, **vfraction, *s1, *s2;
+  double *imp_z, *imp_ra, *imp_rm, S;
+  int    **bulk, *rrc;  // bulk: -1 fixed, 0 bulk, 1 r edge of PC or borehole, 2 z edge of PC,
+                       //   3 pinched-off, 4 z edge of borehole
+  float  *drrc, *frrc, fLC;  // frrc[z] is used in every row, for the PC or the borehole
+  char   **undepleted;
+  int    pinched;     // set to 1 if any voxels are flagged as pinched-off (bulk = 3)
+  int    cur;         // v[cur] holds the result of the latest iteration
+  double **vsnap;     // copies of v and undepleted, used by relax()
+  char   **usnap;
+  int    Lmax, Rmax, LCmax;  // sizes of the malloc'ed arrays
+  FILE   *out;        // progress of the relaxation is reported here
+  Pool   *pool;       // if not NULL, idle threads of this pool help with the relaxation
+  volatile int stop;  // set nonzero to make relax() give up
+  double thresh;      // convergence limit on max_dif; if zero, the default is used
+  int    min_its;     // number of iterations to do before checking for convergence
+  int    quiet;       // if nonzero, relax() does not report its progress
+  int    linear;      // if nonzero, undepleted regions are not looked for
+  Relax_Monitor monitor;  // if not NULL, called after each iteration
+  void   *monitor_arg;
+} Relax_Grid;
+
+typedef struct {
+  MJD_Siggen_Setup *setup;
+  char   config_file_name[256]; // copied into the headers of the output files
+  const char *undepleted_file;  // map of undepleted voxels is written here; NULL for none
+  FILE   *out;                  // messages are written here
+
+  float  BV;           // bias voltage; the sign is swapped for n-type so that it is positive
+  float  N, M;         // impurity at z=0, and gradient, with the same sign convention as BV
+  int    LL, RR;       // length and radius of detector on the final grid, in grid lengths
+  float  gridstep[3];  // grid sizes used in turn, from coarse to fine; zero if unused
+  int    tile_depth;   // number of iterations per pass through the grid, see relax_block()
+  int    nthreads;     // number of threads fieldgen_run may use; default is the number of CPUs
+  Pool   *pool;        // if not NULL, use the threads of this pool rather than nthreads
+  int    linear;       // if nonzero, fieldgen_solve_field does not look for undepleted
+                       //   regions, so the potential is linear in the bias and impurities
+  Relax_Monitor monitor;  // if not NULL, called after each iteration of the relaxation,
+  void   *monitor_arg;    //   with monitor_arg as its first argument
+
+  Relax_Grid ev, wp;   // relaxation of the potential and of the WP
+  char   **undepleted; // [r][z] map of undepleted (*) and pinched-off (B) voxels
+  int    field_done, wp_done;
+  int    wp_depleted;  // the WP was calculated as for a fully depleted detector
+  char   *wp_log;      // progress messages from the WP thread of fieldgen_run
+  size_t wp_log_len;
+  int    wp_status;
+
+  pthread_t writer;     // background thread used by fieldgen_write_field_bg
+  FILE   *writer_file;
+  int    writer_active, writer_status;
+
+  /* results */
+  int    fully_depleted;
+  float  bubble_volts;   // potential of pinch-off bubble, if any
+  double capacitance;    // in pF
+  double capacitance2;   // alternative calculation, from the field at the point contact
+  int    capacitance2_ok;
+  float  depletion_voltage;
+  float  full_depletion_voltage;  // from fieldgen_find_voltages
+  float  pinchoff_voltage;        // from fieldgen_find_voltages; 0 if no pinch-off
+} MJD_Fieldgen;
+
+/* fieldgen_init
+   set up the grids for the detector described in setup and allocate arrays;
+   config_file_name may be NULL, otherwise the contents of that file are copied
+   to the headers of the output files; messages are written to out, or to
+   stdout if out is NULL
+   returns 0 for success
+*/
+int fieldgen_init(MJD_Fieldgen *fg, MJD_Siggen_Setup *setup, char *config_file_name,
+		  FILE *out);
+
+/* fieldgen_solve_field
+   calculate the electric potential, using setup->xtal_HV as the bias
+   and identifying any undepleted regions of the detector
+   returns 0 for success
+*/
+int fieldgen_solve_field(MJD_Fieldgen *fg);
+
+/* fieldgen_solve_wp
+   calculate the weighting potential of the point contact;
+   fieldgen_solve_field must be called first, so that undepleted regions are known
+   returns 0 for success
+*/
+int fieldgen_solve_wp(MJD_Fieldgen *fg);
+
+/* fieldgen_run
+   do all the calculations, in the same way as calling fieldgen_solve_field,
+   fieldgen_write_field, fieldgen_solve_wp, fieldgen_capacitance, fieldgen_write_wp
+   and fieldgen_depletion_voltage in turn; the WP is calculated only if do_wp
+   is nonzero, and each file is written only if its name is not NULL.
+   If fg->nthreads > 1 (or fg->pool has more than one thread),
+   the WP is calculated at the same time as the potential,
+   assuming that the detector will be fully depleted; that result is discarded
+   and the WP recalculated if this turns out to be wrong.
+   The results and output are the same as for the separate calls.
+   returns 0 for success
+*/
+int fieldgen_run(MJD_Fieldgen *fg, char *field_file, int do_wp, char *wp_file);
+
+/* fieldgen_capacitance
+   calculate the detector capacitance from the WP, in pF
+   returns the capacitance, or -1 if the WP has not been calculated
+*/
+double fieldgen_capacitance(MJD_Fieldgen *fg);
+
+/* fieldgen_depletion_voltage
+   estimate the depletion voltage from the potential and WP close to the point contact;
+   only possible if the detector is fully depleted at the bias voltage
+   returns the estimated voltage, or 0 if it cannot be estimated
+*/
+float fieldgen_depletion_voltage(MJD_Fieldgen *fg);
+
+/* fieldgen_find_voltages
+   find the lowest bias at which the detector is fully depleted, and the lowest
+   bias at which a pinch-off bubble appears (if any), to within tol volts,
+   by bisection on the bias. Each trial bias starts from the solutions on either
+   side of it, and is done on the coarsest grid until the range is narrow;
+   only the last few are done on the final grid, and those are relaxed no
+   further than the normal calculation with the same max_iterations would be.
+   setup->xtal_HV is the first trial bias. The results are put in
+   fg->full_depletion_voltage and fg->pinchoff_voltage; the potential is left
+   as for the last trial, so the field files should not be written.
+   returns 0 for success
+*/
+int fieldgen_find_voltages(MJD_Fieldgen *fg, float tol);
+
+/* fieldgen_write_field, fieldgen_write_wp
+   write the potential and field, or the WP, to text file fname
+   in the format read by the siggen code
+   returns 0 for success
+*/
+int fieldgen_write_field(MJD_Fieldgen *fg, char *fname);
+int fieldgen_write_wp(MJD_Fieldgen *fg, char *fname);
+
+/* fieldgen_write_field_bg
+   as fieldgen_write_field, but the file is written by a background thread,
+   so that the WP can be calculated at the same time;
+   the potential must not be changed until fieldgen_write_wait is called
+   returns 0 if the file was opened and the thread started
+*/
+int fieldgen_write_field_bg(MJD_Fieldgen *fg, char *fname);
+
+/* fieldgen_write_wait
+   wait for any file being written by fieldgen_write_field_bg to be finished
+   returns 0 for success, 1 if writing the file failed
+*/
+int fieldgen_write_wait(MJD_Fieldgen *fg);
+
+/* fieldgen_export
+   fill setup->efld and, if it has been calculated, setup->wpot with the results,
+   in the format used by the siggen code, so that no field files are needed;
+   the arrays are freed as usual by fields_finalize
+   returns 0 for success
+*/
+int fieldgen_export(MJD_Fieldgen *fg, MJD_Siggen_Setup *setup);
+
+/* fieldgen_cache_fetch
+   look in setup->cache_dir for field files calculated with the same
+   geometry, impurity, bias and grid (see field_config_hash in read_config.c);
+   if found, copy them to setup->field_name (if write_field != 0)
+   and setup->wp_name (if write_wp != 0), so that no calculation is needed;
+   messages are written to out, or to stdout if out is NULL
+   returns 1 if the files were found and copied, 0 otherwise
+*/
+int fieldgen_cache_fetch(MJD_Siggen_Setup *setup, int write_field, int write_wp,
+			 FILE *out);
+
+/* fieldgen_cache_store
+   save the calculated potential and (if calculated) WP in setup->cache_dir,
+   named by the config hash
+   returns 0 for success
+*/
+int fieldgen_cache_store(MJD_Fieldgen *fg);
+
+/* free malloc()'ed memory */
+void fieldgen_free(MJD_Fieldgen *fg);
+
+/* report_config
+   copy the non-comment lines of the config file to fp_out, as comments
+*/
+int report_config(FILE *fp_out, char *config_file_name);
+
+#endif /*#ifndef _FIELDGEN_H*/
@@ -0,0 +1,293 @@
+/* fieldgen_bench.c
+ *
+ * benchmark and convergence profile of the fieldgen relaxation: calculates
+ * the potential and weighting potential of one or more detectors, at one or
+ * more grid sizes, and records for each grid level of each relaxation the
+ * wall time, the number of iterations (sweeps through the grid), sweeps per
+ * second, voxel updates per second, and the residual (max_dif, the largest
+ * change of any voxel in an iteration) as a function of time.
+ * The results are written to a JSON file, for comparison of solver options,
+ * versions of the code and machines, and a summary table to stderr.
+ *
+ * usage: fieldgen_bench [-o results.json] [-g grids] [-j threads] [-d tile_depth]
+ *                       [-w {0,1}] [config_file ...]
+ *   -o  JSON output file; default fieldgen_bench.json
+ *       (fieldgen's own messages go to fieldgen_bench.log)
+ *   -g  comma-separated list of final grid sizes, in mm; default 0.5,0.2
+ *   -j  number of threads to share the relaxation; default 1
+ *   -d  number of iterations per pass through the grid (see fieldgen.h); default
+ *       is fieldgen's
+ *   -w  0/1: do not / do also calculate the WP; default 1
+ * The default config files are the reference detectors in config_files/
+ * (p1_new.config, bege_ref.config and icpc_ref.config). The field files are
+ * not written, and the WP cache (cache_dir) is not used.
+ *
+ * The residual curve is recorded at iterations 0-9 and then at intervals of
+ * about 5%, and at the last iteration; times are from the start of each
+ * relaxation (potential or WP), and include setting up each grid level.
+ *
+ * to compile: see the Makefile
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "mjd_siggen.h"
+#include "fieldgen.h"
+#include "pool.h"
+#include "timer.h"
+
+#define MAX_GRIDS 16
+
+static char *default_config[] = {"config_files/p1_new.config",
+				 "config_files/bege_ref.config",
+				 "config_files/icpc_ref.config"};
+static char *relax_name[2] = {"field", "wp"};
+
+typedef struct {
+  double t;              // time since the start of the relaxation, in s
+  int    iter;
+  float  max_dif, mean_dif;
+} Sample;
+
+/* one grid level of one relaxation */
+typedef struct {
+  float  grid;
+  int    L, R;
+  int    iters;          // number of iterations done
+  double t_start, t_end; // times since the start of the relaxation, in s
+  Sample *curve, last;
+  int    ncurve, size, next;
+} Level;
+
+/* everything recorded for one relaxation, potential or WP */
+typedef struct {
+  double t0;             // start time
+  Level  lev[3];
+  int    nlev;
+} Run;
+
+/* record
+   the Relax_Monitor for fieldgen; arg is a Run[2], for the potential and WP
+*/
+static void record(void *arg, int wp, float grid, int L, int R, int iter,
+		   Relax_Stats *st) {
+  Run    *run = (Run *) arg + wp;
+  Level  *lev;
+  Sample *tmp;
+  double t = timer_now() - run->t0;
+
+  if (run->nlev == 0 || run->lev[run->nlev-1].grid != grid || iter == 0) {
+    if (run->nlev == 3) return;   // should not happen
+    lev = &run->lev[run->nlev];
+    memset(lev, 0, sizeof(*lev));
+    lev->grid = grid;
+    lev->L = L;
+    lev->R = R;
+    lev->t_start = (run->nlev > 0 ? run->lev[run->nlev-1].t_end : 0);
+    run->nlev++;
+  }
+  lev = &run->lev[run->nlev-1];
+  lev->iters = iter + 1;
+  lev->t_end = t;
+  lev->last.t = t;
+  lev->last.iter = iter;
+  lev->last.max_dif = st->max_dif;
+  lev->last.mean_dif = st->sum_dif / (float) (L*R);
+  if (iter < 10 || iter >= lev->next) {
+    if (lev->ncurve + 1 >= lev->size) {   // keep room for the last sample
+      if (!(tmp = realloc(lev->curve, (2*lev->size + 64) * sizeof(*tmp)))) return;
+      lev->curve = tmp;
+      lev->size = 2*lev->size + 64;
+    }
+    lev->curve[lev->ncurve++] = lev->last;
+    lev->next = iter + 1 + iter/20;
+  }
+}
+
+/* json_string
+   write string s to fp as a JSON string
+*/
+static void json_string(FILE *fp, const char *s) {
+  putc('"', fp);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\') putc('\\', fp);
+    if ((unsigned char) *s >= ' ') putc(*s, fp);
+  }
+  putc('"', fp);
+}
+
+/* write_run
+   write the levels of run to the table on stderr and to the JSON file fp
+*/
+static void write_run(FILE *fp, Run *run, int wp, char *config, float grid) {
+  Level  *lev;
+  double t;
+  int    k, j;
+
+  for (k = 0; k < run->nlev; k++) {
+    lev = &run->lev[k];
+    t = lev->t_end - lev->t_start;
+    fprintf(stderr, "%-28.28s %5.2f %-5s %d %5.2f %4dx%-4d %6d %8.2f %9.0f %9.2f %9.2e\n",
+	    config, grid, relax_name[wp], k, lev->grid, lev->L, lev->R, lev->iters, t,
+	    (t > 0 ? lev->iters / t : 0),
+	    (t > 0 ? 1e-6 * lev->iters * (double) lev->L * lev->R / t : 0),
+	    lev->last.max_dif);
+    fprintf(fp, "%s\n       {\"relax\": \"%s\", \"level\": %d, \"grid\": %g, \"L\": %d, "
+	    "\"R\": %d,\n        \"iterations\": %d, \"time_s\": %.6f, "
+	    "\"sweeps_per_s\": %.2f, \"voxel_updates_per_s\": %.0f,\n"
+	    "        \"final_max_dif\": %.6e,\n        \"curve\": [",
+	    (wp || k ? "," : ""), relax_name[wp], k, lev->grid, lev->L, lev->R,
+	    lev->iters, t, (t > 0 ? lev->iters / t : 0),
+	    (t > 0 ? lev->iters * (double) lev->L * lev->R / t : 0), lev->last.max_dif);
+    if (lev->ncurve == 0 || lev->curve[lev->ncurve-1].iter != lev->last.iter)
+      lev->curve[lev->ncurve++] = lev->last;   // there is always room for one more
+    for (j = 0; j < lev->ncurve; j++)
+      fprintf(fp, "%s[%.6f, %d, %.6e, %.6e]", (j ? ", " : ""), lev->curve[j].t,
+	      lev->curve[j].iter, lev->curve[j].max_dif, lev->curve[j].mean_dif);
+    fprintf(fp, "]}");
+    free(lev->curve);
+  }
+}
+
+int main(int argc, char **argv) {
+
+  MJD_Siggen_Setup setup;
+  MJD_Fieldgen     fg;
+  Run     run[2];
+  Pool    *pool = NULL;
+  char    **config, *out_name = "fieldgen_bench.json", *grids = NULL, *c;
+  char    default_grids[] = "0.5,0.2", host[256], date[64];
+  FILE    *fp, *log;
+  time_t  tnow;
+  double  t0, t_field, t_wp;
+  float   grid[MAX_GRIDS];
+  int     nthreads = 1, tile_depth = 0, do_wp = 1, ngrids = 0, nconfig;
+  int     i, k, err, first = 1, bad = 0;
+
+  for (i = 1; i < argc && argv[i][0] == '-'; i += 2) {
+    if (i == argc - 1) {
+      bad = 1;
+    } else if (!strcmp(argv[i], "-o")) {
+      out_name = argv[i+1];
+    } else if (!strcmp(argv[i], "-g")) {
+      grids = argv[i+1];
+    } else if (!strcmp(argv[i], "-j")) {
+      nthreads = atoi(argv[i+1]);
+    } else if (!strcmp(argv[i], "-d")) {
+      tile_depth = atoi(argv[i+1]);
+    } else if (!strcmp(argv[i], "-w")) {
+      do_wp = atoi(argv[i+1]);
+    } else {
+      bad = 1;
+    }
+    if (bad) break;
+  }
+  if (!grids) grids = default_grids;
+  for (c = strtok(grids, ","); c && ngrids < MAX_GRIDS; c = strtok(NULL, ",")) {
+    if ((grid[ngrids++] = atof(c)) <= 0) bad = 1;
+  }
+  if (bad || ngrids == 0 || nthreads < 1) {
+    printf("Usage: %s [-o results.json] [-g grids] [-j threads] [-d tile_depth]\n"
+	   "          [-w {0,1}] [config_file ...]\n"
+	   "   grids is a comma-separated list of grid sizes in mm, e.g. 0.5,0.2,0.1\n",
+	   argv[0]);
+    return 1;
+  }
+  if (i < argc) {
+    config = argv + i;
+    nconfig = argc - i;
+  } else {
+    config = default_config;
+    nconfig = sizeof(default_config) / sizeof(default_config[0]);
+  }
+
+  if (!(fp = fopen(out_name, "w"))) {
+    fprintf(stderr, "ERROR: Cannot open output file %s\n", out_name);
+    return 1;
+  }
+  if (!(log = fopen("fieldgen_bench.log", "w"))) {
+    fprintf(stderr, "ERROR: Cannot open log file fieldgen_bench.log\n");
+    return 1;
+  }
+  if (nthreads > 1 && !(pool = pool_create(nthreads))) return 1;
+
+  if (gethostname(host, sizeof(host))) strcpy(host, "unknown");
+  host[sizeof(host)-1] = '\0';
+  tnow = time(NULL);
+  strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&tnow));
+  fprintf(fp, "{\n  \"program\": \"fieldgen_bench\",\n  \"host\": ");
+  json_string(fp, host);
+  fprintf(fp, ",\n  \"cpus\": %ld,\n  \"date\": \"%s\",\n  \"compiler\": ",
+	  sysconf(_SC_NPROCESSORS_ONLN), date);
+  json_string(fp, __VERSION__);
+  fprintf(fp, ",\n  \"threads\": %d,\n  \"tile_depth\": %d,\n  \"results\": [",
+	  nthreads, (tile_depth > 0 ? tile_depth : TILE_DEPTH));
+
+  fprintf(stderr, "%-28s %5s %-5s %s %5s %9s %6s %8s %9s %9s %9s\n", "config", "grid",
+	  "relax", "l", "grid", "L x R", "iters", "time_s", "sweeps/s", "Mvox/s",
+	  "max_dif");
+  for (i = 0; i < nconfig; i++) {
+    for (k = 0; k < ngrids; k++) {
+      if (read_config(config[i], &setup)) return 1;
+      setup.xtal_grid = grid[k];
+      setup.cache_dir[0] = '\0';
+      fprintf(log, "\n===== %s, grid %g mm =====\n", config[i], grid[k]);
+      if (fieldgen_init(&fg, &setup, NULL, log)) {
+	fprintf(stderr, "ERROR: fieldgen_init failed for %s; see fieldgen_bench.log\n",
+		config[i]);
+	return 1;
+      }
+      fg.undepleted_file = NULL;
+      fg.pool = pool;
+      if (tile_depth > 0) fg.tile_depth = tile_depth;
+      memset(run, 0, sizeof(run));
+      fg.monitor = record;
+      fg.monitor_arg = run;
+
+      t_wp = 0;
+      run[0].t0 = t0 = timer_now();
+      err = fieldgen_solve_field(&fg);
+      t_field = timer_now() - t0;
+      if (!err && do_wp) {
+	run[1].t0 = t0 = timer_now();
+	err = fieldgen_solve_wp(&fg);
+	t_wp = timer_now() - t0;
+      }
+      if (err) {
+	fprintf(stderr, "ERROR: fieldgen failed for %s; see fieldgen_bench.log\n", config[i]);
+	return 1;
+      }
+
+      fprintf(fp, "%s\n    {\"config\": ", (first ? "" : ","));
+      json_string(fp, config[i]);
+      first = 0;
+      fprintf(fp, ", \"grid\": %g, \"levels\": [%g", grid[k], fg.gridstep[0]);
+      if (fg.gridstep[1] > 0) fprintf(fp, ", %g", fg.gridstep[1]);
+      if (fg.gridstep[2] > 0) fprintf(fp, ", %g", fg.gridstep[2]);
+      fprintf(fp, "],\n     \"field_s\": %.6f, \"wp_s\": %.6f, \"fully_depleted\": %s",
+	      t_field, t_wp, (fg.fully_depleted ? "true" : "false"));
+      if (do_wp)
+	fprintf(fp, ", \"capacitance_pF\": %.4f, \"depletion_voltage\": %.1f",
+		fieldgen_capacitance(&fg), fieldgen_depletion_voltage(&fg));
+      fprintf(fp, ",\n     \"relax\": [");
+      write_run(fp, &run[0], 0, config[i], grid[k]);
+      if (do_wp) write_run(fp, &run[1], 1, config[i], grid[k]);
+      fprintf(fp, "]}");
+      fflush(fp);
+      fieldgen_free(&fg);
+    }
+  }
+  fprintf(fp, "\n  ]\n}\n");
+  if (pool) pool_finish(pool);
+  fclose(log);
+  if (fclose(fp)) {
+    fprintf(stderr, "ERROR: Failed to write file %s\n", out_name);
+    return 1;
+  }
+  return 0;
+}
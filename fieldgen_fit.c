@@ -0,0 +1,645 @@
+/* fieldgen_fit.c -- fit of the impurity profile to measured capacitances
+   and depletion voltage, see fieldgen_fit.h
+
+   The potential of a fully-depleted detector is a linear function of the bias
+   and of the impurity parameters (except impurity_radial_mult and
+   impurity_rpower, which are kept fixed). So the potential is calculated once
+   for unit bias, once for each fitted parameter set to one, and once for the
+   other impurities; any trial set of values is then a superposition of these
+   basis fields. That gives the depletion voltage for each trial directly,
+   since the detector is depleted if the superposed potential has no
+   undepleted voxels; above it, the capacitance is that of the fully-depleted
+   detector, which does not depend on the impurities.
+   Only for biases below the depletion voltage do the potential and WP need
+   to be calculated in full. All the calculations for one step of the fit
+   (the derivatives, and then several trial steps) are done at once, as tasks
+   of a thread pool.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "mjd_siggen.h"
+#include "fieldgen.h"
+#include "fieldgen_fit.h"
+#include "pool.h"
+
+/* parameters that can be fitted */
+#define NPAR_NAMES 5
+static const char *par_name[NPAR_NAMES] = {"impurity_z0", "impurity_gradient", "impurity_quadratic",
+				     "impurity_surface", "impurity_radial_add"};
+
+static float *par_value(MJD_Siggen_Setup *setup, int i) {
+  float *v[NPAR_NAMES] = {&setup->impurity_z0, &setup->impurity_gradient,
+			  &setup->impurity_quadratic, &setup->impurity_surface,
+			  &setup->impurity_radial_add};
+  return v[i];
+}
+
+/* one set of trial values of the fitted parameters, and the model for them */
+typedef struct {
+  double p[MAX_FIT_PARAMS];
+  double vdep;                // depletion voltage, from the superposed fields
+  double c[MAX_FIT_POINTS];   // capacitance at each bias
+  double chi2;
+  int    status;              // 0 for success
+} Fit_Trial;
+
+typedef struct {
+  MJD_Siggen_Setup *setup;    // the detector, with the starting values
+  int    npar, ipar[MAX_FIT_PARAMS];  // fitted parameters, as indices into par_name[]
+  int    npts;
+  double bias[MAX_FIT_POINTS], cap[MAX_FIT_POINTS], dcap[MAX_FIT_POINTS];
+  double vdep, dvdep;         // measured depletion voltage and uncertainty; vdep = 0 if none
+  double sign;                // -1 for n-type, where fieldgen_init() swaps the signs
+  double vmax;                // upper limit of the depletion voltage search
+  double **unit;              // potential for unit bias and no impurities
+  double **basis[MAX_FIT_PARAMS+1];  // [0]: for the fixed impurities and no bias;
+                                     // [i+1]: for unit value of fitted parameter i
+  double **w;                 // work space for the superposition
+  MJD_Fieldgen geom;          // the unit-bias calculation; gives the final grid
+  double cdep;                // capacitance of the fully-depleted detector
+  Fit_Trial *center;          // current best values
+  Pool   *pool;
+  FILE   *log;
+  pthread_mutex_t lock;
+  int    nsolves, status;
+} Fit;
+
+/* the calculations for a basis field, or for one bias of one trial */
+typedef struct {
+  Fit       *fit;
+  Fit_Trial *t;
+  int       k;                // basis field (-1 for unit bias), or index of the bias
+  MJD_Siggen_Setup setup;
+  int       status;
+} Fit_Task;
+
+/* internal sign of parameter i, as used by fieldgen_solve_field */
+static double par_sign(Fit *fit, int i) {
+  return (i < 2 ? fit->sign : 1.0);
+}
+
+static double **grid_copy(MJD_Fieldgen *fg, double **v) {
+  double **c;
+  int    z;
+
+  if (!(c = (double **) calloc(fg->LL+1, sizeof(*c)))) return NULL;
+  for (z=0; z<fg->LL+1; z++) {
+    if (!(c[z] = (double *) malloc((fg->RR+1)*sizeof(**c)))) return NULL;
+    memcpy(c[z], v[z], (fg->RR+1)*sizeof(**c));
+  }
+  return c;
+}
+
+static void grid_release(double **v, int L) {
+  int z;
+
+  if (!v) return;
+  for (z=0; z<L+1; z++) free(v[z]);
+  free(v);
+}
+
+/* task_log
+   copy the messages of one task to the log file
+*/
+static void task_log(Fit *fit, char *buf, size_t len, char *title) {
+  pthread_mutex_lock(&fit->lock);
+  fprintf(fit->log, "\n======== %s ========\n", title);
+  fwrite(buf, 1, len, fit->log);
+  fit->nsolves++;
+  pthread_mutex_unlock(&fit->lock);
+}
+
+/* fit_basis
+   task to calculate one of the basis fields, without undepleted regions
+*/
+static void fit_basis(void *arg) {
+  Fit_Task     *b = (Fit_Task *) arg;
+  Fit          *fit = b->fit;
+  MJD_Fieldgen fg1, *fg = (b->k < 0 ? &fit->geom : &fg1);
+  double x[NPAR_NAMES];
+  char   *buf = NULL, title[64];
+  size_t len = 0;
+  FILE   *out;
+  int    i, j;
+
+  b->status = 1;
+  if (!(out = open_memstream(&buf, &len))) return;
+  b->setup = *fit->setup;
+  if (fieldgen_init(fg, &b->setup, NULL, out)) goto done;
+  fg->pool = fit->pool;
+  fg->undepleted_file = NULL;
+  fg->linear = 1;
+  fg->ev.quiet = fg->wp.quiet = 1;
+  /* internal values of the impurity parameters, as set up by fieldgen_init() */
+  for (i=0; i<NPAR_NAMES; i++) {
+    x[i] = 0;
+    if (b->k == 0) {
+      for (j=0; j<fit->npar && fit->ipar[j] != i; j++) ;
+      if (j == fit->npar) x[i] = par_sign(fit, i) * *par_value(fit->setup, i);
+    } else if (b->k > 0 && fit->ipar[b->k-1] == i) {
+      x[i] = 1;
+    }
+  }
+  fg->BV = (b->k < 0 ? 1 : 0);
+  fg->N = x[0];
+  fg->M = x[1];
+  b->setup.impurity_quadratic = x[2];
+  b->setup.impurity_surface = x[3];
+  b->setup.impurity_radial_add = x[4];
+  if (fieldgen_solve_field(fg)) goto done;
+
+  if (b->k < 0) {
+    /* the unit-bias field also gives the geometry and the fully-depleted WP */
+    if (!(fit->unit = grid_copy(fg, fg->ev.v[fg->ev.cur])) ||
+	fieldgen_solve_wp(fg)) goto done;
+    fit->cdep = fieldgen_capacitance(fg);
+  } else {
+    if (!(fit->basis[b->k] = grid_copy(fg, fg->ev.v[fg->ev.cur]))) goto done;
+    fieldgen_free(fg);
+  }
+  b->status = 0;
+
+ done:
+  fclose(out);
+  if (b->k < 0) {
+    strcpy(title, "potential for unit bias");
+  } else if (b->k == 0) {
+    strcpy(title, "potential for fixed impurities");
+  } else {
+    snprintf(title, sizeof(title), "potential for unit %s", par_name[fit->ipar[b->k-1]]);
+  }
+  task_log(fit, buf, len, title);
+  free(buf);
+}
+
+/* fit_undepleted
+   returns 1 if the superposed potential for bias V has any undepleted voxels,
+   in the same way as they are found by the relaxation
+*/
+static int fit_undepleted(Fit *fit, double V) {
+  Relax_Grid *g = &fit->geom.ev;
+  double **u = fit->unit, **w = fit->w, v, min;
+  int    r, z;
+
+#define VV(z,r) (V*u[z][r] + w[z][r])
+  for (z=0; z<g->L; z++) {
+    for (r=0; r<g->R; r++) {
+      if (g->bulk[z][r] < 0 || g->vfraction[z][r] <= 0.45) continue;
+      v = VV(z,r);
+      if (v <= 0) return 1;
+      min = fmin(VV(z+1,r), VV(z,r+1));
+      if (z > 0) min = fmin(min, VV(z-1,r));
+      if (r > 0) min = fmin(min, VV(z,r-1));
+      if (v < min) return 1;
+    }
+  }
+#undef VV
+  return 0;
+}
+
+/* fit_depletion
+   find the depletion voltage for trial t from the superposed basis fields
+   returns the voltage, or fit->vmax if the detector is not depleted below that
+*/
+static double fit_depletion(Fit *fit, Fit_Trial *t) {
+  double lo = 0, hi = fit->vmax, mid;
+  int    i, r, z;
+
+  for (z=0; z<fit->geom.LL+1; z++) {
+    for (r=0; r<fit->geom.RR+1; r++) {
+      fit->w[z][r] = fit->basis[0][z][r];
+      for (i=0; i<fit->npar; i++)
+	fit->w[z][r] += par_sign(fit, fit->ipar[i]) * t->p[i] * fit->basis[i+1][z][r];
+    }
+  }
+  if (fit_undepleted(fit, hi)) return hi;
+  for (i=0; i<40 && hi - lo > 0.01; i++) {
+    mid = (lo + hi) / 2.0;
+    if (fit_undepleted(fit, mid)) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  return hi;
+}
+
+/* fit_point
+   task to calculate the capacitance for trial t at bias number k,
+   which is below the depletion voltage
+*/
+static void fit_point(void *arg) {
+  Fit_Task     *pt = (Fit_Task *) arg;
+  Fit          *fit = pt->fit;
+  Fit_Trial    *t = pt->t;
+  MJD_Fieldgen fg;
+  char   *buf = NULL, title[64];
+  size_t len = 0;
+  FILE   *out;
+  int    i, k = pt->k;
+
+  pt->status = 1;
+  if (!(out = open_memstream(&buf, &len))) return;
+  pt->setup = *fit->setup;
+  for (i=0; i<fit->npar; i++) *par_value(&pt->setup, fit->ipar[i]) = t->p[i];
+  pt->setup.xtal_HV = (fit->setup->xtal_HV < 0 ? -1 : 1) * fabs(fit->bias[k]);
+  if (fieldgen_init(&fg, &pt->setup, NULL, out)) goto done;
+  fg.pool = fit->pool;
+  fg.undepleted_file = NULL;
+  fg.ev.quiet = fg.wp.quiet = 1;
+  if (fieldgen_solve_field(&fg)) goto done;
+  if (fg.fully_depleted) {
+    t->c[k] = fit->cdep;
+  } else {
+    if (fieldgen_solve_wp(&fg)) goto done;
+    t->c[k] = fieldgen_capacitance(&fg);
+  }
+  pt->status = 0;
+
+ done:
+  fieldgen_free(&fg);
+  fclose(out);
+  snprintf(title, sizeof(title), "%.0f V", fit->bias[k]);
+  task_log(fit, buf, len, title);
+  free(buf);
+}
+
+/* fit_evaluate
+   calculate the model and chi-squared for the n trials t[]
+   returns 0 for success
+*/
+static int fit_evaluate(Fit *fit, Fit_Trial **t, int n) {
+  Pool_Group grp = {0};
+  Fit_Task   *task;
+  double     d;
+  int        i, j, k, nt = 0;
+
+  if (!(task = (Fit_Task *) calloc(n * fit->npts, sizeof(*task)))) {
+    printf("Malloc failed in fit_evaluate\n");
+    return 1;
+  }
+  for (j=0; j<n; j++) {
+    t[j]->status = 0;
+    /* the type of the detector cannot change */
+    for (i=0; i<fit->npar; i++) {
+      if (fit->ipar[i] == 0 && t[j]->p[i] * fit->setup->impurity_z0 <= 0) t[j]->status = 1;
+    }
+    if (t[j]->status) continue;
+    t[j]->vdep = fit_depletion(fit, t[j]);
+    for (k=0; k<fit->npts; k++) {
+      if (fabs(fit->bias[k]) >= t[j]->vdep) {
+	t[j]->c[k] = fit->cdep;
+      } else {
+	task[nt].fit = fit;
+	task[nt].t = t[j];
+	task[nt].k = k;
+	pool_spawn(fit->pool, &grp, fit_point, &task[nt++]);
+      }
+    }
+  }
+  pool_wait(fit->pool, &grp);
+  for (i=0; i<nt; i++) task[i].t->status |= task[i].status;
+  free(task);
+
+  for (j=0; j<n; j++) {
+    t[j]->chi2 = 0;
+    if (t[j]->status) continue;
+    for (k=0; k<fit->npts; k++) {
+      d = (t[j]->c[k] - fit->cap[k]) / fit->dcap[k];
+      t[j]->chi2 += d*d;
+    }
+    if (fit->vdep > 0) {
+      d = (t[j]->vdep - fit->vdep) / fit->dvdep;
+      t[j]->chi2 += d*d;
+    }
+  }
+  return 0;
+}
+
+/* the residuals for trial t, in the order used for the Jacobian */
+static int fit_residuals(Fit *fit, Fit_Trial *t, double *res) {
+  int k;
+
+  for (k=0; k<fit->npts; k++) res[k] = (t->c[k] - fit->cap[k]) / fit->dcap[k];
+  if (fit->vdep > 0) res[k++] = (t->vdep - fit->vdep) / fit->dvdep;
+  return k;
+}
+
+/* solve_linear
+   solve a.x = b for x by Gaussian elimination; a and b are overwritten
+   returns 0 for success, 1 if a is singular
+*/
+static int solve_linear(int n, double a[MAX_FIT_PARAMS][MAX_FIT_PARAMS], double *b, double *x) {
+  double f, t;
+  int    i, j, k, m;
+
+  for (i=0; i<n; i++) {
+    for (m=i, k=i+1; k<n; k++) if (fabs(a[k][i]) > fabs(a[m][i])) m = k;
+    if (fabs(a[m][i]) < 1e-300) return 1;
+    for (j=0; j<n; j++) {
+      t = a[i][j];  a[i][j] = a[m][j];  a[m][j] = t;
+    }
+    t = b[i];  b[i] = b[m];  b[m] = t;
+    for (k=i+1; k<n; k++) {
+      f = a[k][i] / a[i][i];
+      for (j=i; j<n; j++) a[k][j] -= f * a[i][j];
+      b[k] -= f * b[i];
+    }
+  }
+  for (i=n-1; i>=0; i--) {
+    x[i] = b[i];
+    for (j=i+1; j<n; j++) x[i] -= a[i][j] * x[j];
+    x[i] /= a[i][i];
+  }
+  return 0;
+}
+
+static Fit_Trial *trial_new(Fit *fit, double *p) {
+  Fit_Trial *t;
+
+  if (!(t = (Fit_Trial *) calloc(1, sizeof(*t)))) {
+    printf("Malloc failed in fieldgen_fit\n");
+    return NULL;
+  }
+  memcpy(t->p, p, sizeof(t->p));
+  return t;
+}
+
+static void report_trial(Fit *fit, Fit_Trial *t, int it, double lambda) {
+  int i;
+
+  printf("%3d  chi2 %12.4f  lambda %8.1e  Vdep %7.1f  ", it, t->chi2, lambda, t->vdep);
+  for (i=0; i<fit->npar; i++) printf(" %10.5f", t->p[i]);
+  printf("   [%d calculations]\n", fit->nsolves);
+  fflush(stdout);
+}
+
+/* fit_run
+   pool job that does the whole fit
+*/
+static void fit_run(void *arg) {
+  Fit       *fit = (Fit *) arg;
+  Fit_Task  task[MAX_FIT_PARAMS+2];
+  Fit_Trial *deriv[MAX_FIT_PARAMS], *step[3], *best;
+  Pool_Group grp = {0};
+  double    a[MAX_FIT_PARAMS][MAX_FIT_PARAMS], aa[MAX_FIT_PARAMS][MAX_FIT_PARAMS];
+  double    g[MAX_FIT_PARAMS], b[MAX_FIT_PARAMS], dp[MAX_FIT_PARAMS], p[MAX_FIT_PARAMS];
+  double    h[MAX_FIT_PARAMS], res0[MAX_FIT_POINTS+1], res[MAX_FIT_POINTS+1];
+  double    jac[MAX_FIT_POINTS+1][MAX_FIT_PARAMS], lambda = 0.001, lam[3], chi2_old;
+  int       i, j, k, n, nres, it, tries;
+
+  fit->status = 1;
+  /* basis fields */
+  printf("\nCalculating %d basis fields...\n", fit->npar + 2);
+  fflush(stdout);
+  for (i=0; i<fit->npar+2; i++) {
+    memset(&task[i], 0, sizeof(task[i]));
+    task[i].fit = fit;
+    task[i].k = i - 1;
+    pool_spawn(fit->pool, &grp, fit_basis, &task[i]);
+  }
+  pool_wait(fit->pool, &grp);
+  for (i=0; i<fit->npar+2; i++) {
+    if (task[i].status) {
+      printf("ERROR: Calculation of basis field %d failed; see log file\n", i);
+      return;
+    }
+  }
+  if (!(fit->w = grid_copy(&fit->geom, fit->unit))) return;
+  printf("Capacitance when fully depleted: %.3f pF\n\n", fit->cdep);
+
+  /* starting values */
+  for (i=0; i<fit->npar; i++) p[i] = *par_value(fit->setup, fit->ipar[i]);
+  if (!(fit->center = trial_new(fit, p)) ||
+      fit_evaluate(fit, &fit->center, 1)) return;
+  if (fit->center->status) {
+    printf("ERROR: Calculation for the starting values failed; see log file\n");
+    return;
+  }
+  report_trial(fit, fit->center, 0, 0);
+
+  for (it=1; it<=MAX_FIT_ITS; it++) {
+    /* derivatives, from a step in each parameter */
+    for (i=0; i<fit->npar; i++) {
+      memcpy(p, fit->center->p, sizeof(p));
+      h[i] = 0.02 * fabs(p[i]) + 0.002;
+      if (fit->ipar[i] == 0 && p[i] > 0) h[i] = -h[i];  // keep the sign of impurity_z0
+      p[i] += h[i];
+      if (!(deriv[i] = trial_new(fit, p))) return;
+    }
+    if (fit_evaluate(fit, deriv, fit->npar)) return;
+    nres = fit_residuals(fit, fit->center, res0);
+    for (i=0; i<fit->npar; i++) {
+      if (deriv[i]->status) {
+	printf("ERROR: Calculation of derivatives failed; see log file\n");
+	return;
+      }
+      fit_residuals(fit, deriv[i], res);
+      for (k=0; k<nres; k++) jac[k][i] = (res[k] - res0[k]) / h[i];
+      free(deriv[i]);
+    }
+    for (i=0; i<fit->npar; i++) {
+      g[i] = 0;
+      for (k=0; k<nres; k++) g[i] -= jac[k][i] * res0[k];
+      for (j=0; j<fit->npar; j++) {
+	a[i][j] = 0;
+	for (k=0; k<nres; k++) a[i][j] += jac[k][i] * jac[k][j];
+      }
+    }
+
+    /* try steps for three values of lambda at once */
+    best = NULL;
+    for (tries=0; tries<4 && !best; tries++) {
+      lam[0] = lambda / 10.0;  lam[1] = lambda;  lam[2] = lambda * 10.0;
+      for (n=0; n<3; n++) {
+	memcpy(aa, a, sizeof(aa));
+	memcpy(b, g, sizeof(b));
+	for (i=0; i<fit->npar; i++) aa[i][i] *= 1.0 + lam[n];
+	memcpy(p, fit->center->p, sizeof(p));
+	if (!solve_linear(fit->npar, aa, b, dp))
+	  for (i=0; i<fit->npar; i++) p[i] += dp[i];
+	if (!(step[n] = trial_new(fit, p))) return;
+      }
+      if (fit_evaluate(fit, step, 3)) return;
+      for (n=0; n<3; n++) {
+	if (!step[n]->status && step[n]->chi2 < fit->center->chi2 &&
+	    (!best || step[n]->chi2 < best->chi2)) {
+	  best = step[n];
+	  lambda = lam[n];
+	}
+      }
+      for (n=0; n<3; n++) if (step[n] != best) free(step[n]);
+      if (!best) lambda *= 100.0;
+    }
+    if (!best) {
+      printf("No further improvement\n");
+      break;
+    }
+    if (lambda < 1e-7) lambda = 1e-7;
+    chi2_old = fit->center->chi2;
+    free(fit->center);
+    fit->center = best;
+    report_trial(fit, best, it, lambda);
+    if (chi2_old - best->chi2 < 0.001 * chi2_old + 1e-6) break;
+  }
+
+  /* uncertainties from the curvature matrix */
+  printf("\nFitted values:\n");
+  for (i=0; i<fit->npar; i++) {
+    memcpy(aa, a, sizeof(aa));
+    memset(b, 0, sizeof(b));
+    b[i] = 1;
+    if (solve_linear(fit->npar, aa, b, dp)) dp[i] = 0;
+    printf("  %-20s %10.5f  +/- %.5f\n", par_name[fit->ipar[i]],
+	   fit->center->p[i], sqrt(fabs(dp[i])));
+  }
+  printf("\n   Bias (V)   C meas (pF)   C fit (pF)\n");
+  for (k=0; k<fit->npts; k++)
+    printf("  %9.1f  %10.3f  %10.3f\n", fit->bias[k], fit->cap[k], fit->center->c[k]);
+  if (fit->vdep > 0) {
+    printf("  Depletion voltage: %.1f V measured, %.1f V fit\n", fit->vdep, fit->center->vdep);
+  } else {
+    printf("  Depletion voltage: %.1f V\n", fit->center->vdep);
+  }
+  printf("  chi2 = %.4f for %d degrees of freedom\n",
+	 fit->center->chi2, nres - fit->npar);
+  fit->status = 0;
+}
+
+/* read_fit_file
+   read the parameters to fit and the measurements from file fname
+   returns 0 for success
+*/
+static int read_fit_file(Fit *fit, char *fname) {
+  char   line[256], *c, *tok;
+  double v[3];
+  FILE   *file;
+  int    i, n;
+
+  if (!(file = fopen(fname, "r"))) {
+    printf("ERROR: Cannot open fit file %s\n", fname);
+    return 1;
+  }
+  while (fgets(line, sizeof(line), file)) {
+    if ((c = strchr(line, '#'))) *c = '\0';
+    if (!strncmp(line, "fit", 3) && (line[3] == ' ' || line[3] == '\t')) {
+      for (tok = strtok(line+3, " \t\n"); tok; tok = strtok(NULL, " \t\n")) {
+	for (i=0; i<NPAR_NAMES && strcmp(tok, par_name[i]); i++) ;
+	if (i == NPAR_NAMES) {
+	  printf("ERROR: Cannot fit parameter %s\n", tok);
+	  fclose(file);
+	  return 1;
+	}
+	if (fit->npar >= MAX_FIT_PARAMS) break;
+	fit->ipar[fit->npar++] = i;
+      }
+    } else if (!strncmp(line, "depletion", 9)) {
+      if ((n = sscanf(line+9, "%lf %lf", &v[0], &v[1])) < 1) continue;
+      fit->vdep = fabs(v[0]);
+      fit->dvdep = (n > 1 && v[1] > 0 ? v[1] : 1.0);
+    } else if ((n = sscanf(line, "%lf %lf %lf", &v[0], &v[1], &v[2])) >= 2) {
+      if (fit->npts >= MAX_FIT_POINTS) {
+	printf("ERROR: Too many measurements in fit file %s\n", fname);
+	fclose(file);
+	return 1;
+      }
+      fit->bias[fit->npts] = v[0];
+      fit->cap[fit->npts] = v[1];
+      fit->dcap[fit->npts] = (n > 2 && v[2] > 0 ? v[2] : 0.01);
+      fit->npts++;
+    }
+  }
+  fclose(file);
+  if (fit->npar == 0 || fit->npts + (fit->vdep > 0) <= fit->npar) {
+    printf("ERROR: Fit file %s needs a fit line and more measurements than parameters\n",
+	   fname);
+    return 1;
+  }
+  return 0;
+}
+
+/* fit_file_name
+   put config_file_name, with its extension replaced by ext, into name
+*/
+static void fit_file_name(char *config_file_name, const char *ext, char *name, int len) {
+  char *c;
+
+  snprintf(name, len, "%s", config_file_name);
+  if ((c = strrchr(name, '.')) && !strchr(c, '/')) *c = '\0';
+  strncat(name, ext, len - strlen(name) - 1);
+}
+
+/* fieldgen_fit
+   fit the impurity parameters of the detector in setup to the measurements
+   in fit_file, using nthreads threads
+   returns 0 for success
+*/
+int fieldgen_fit(MJD_Siggen_Setup *setup, char *config_file_name, char *fit_file,
+		 int nthreads) {
+  Fit    fit;
+  MJD_Siggen_Setup out;
+  char   name[300];
+  int    i, k;
+
+  memset(&fit, 0, sizeof(fit));
+  fit.setup = setup;
+  if (read_fit_file(&fit, fit_file)) return 1;
+  for (i=0; i<fit.npar; i++) {
+    if (fit.ipar[i] == 4 && setup->impurity_rpower <= 0.1) {
+      printf("ERROR: impurity_rpower must be set to fit impurity_radial_add\n");
+      return 1;
+    }
+  }
+  fit.sign = (setup->impurity_z0 > 0 ? -1.0 : 1.0);
+  fit.vmax = fabs(setup->xtal_HV) + fit.vdep;
+  for (k=0; k<fit.npts; k++) if (fit.vmax < fabs(fit.bias[k])) fit.vmax = fabs(fit.bias[k]);
+  fit.vmax *= 4.0;
+
+  fit_file_name(config_file_name, "_fit.log", name, sizeof(name));
+  if (!(fit.log = fopen(name, "w"))) {
+    printf("ERROR: Cannot open log file %s\n", name);
+    return 1;
+  }
+  printf("\nFitting");
+  for (i=0; i<fit.npar; i++) printf(" %s", par_name[fit.ipar[i]]);
+  printf(" to %d capacitances%s; details in %s\n", fit.npts,
+	 (fit.vdep > 0 ? " and the depletion voltage" : ""), name);
+
+  pthread_mutex_init(&fit.lock, NULL);
+  if (nthreads < 1) nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (!(fit.pool = pool_create(nthreads)) ||
+      pool_job(fit.pool, fit_run, &fit)) {
+    printf("ERROR: Cannot start threads\n");
+    fclose(fit.log);
+    return 1;
+  }
+  pool_finish(fit.pool);
+  fclose(fit.log);
+
+  if (!fit.status) {
+    /* save the results in a new config file */
+    out = *setup;
+    out.nsweep = fit.npar;
+    for (i=0; i<fit.npar; i++) {
+      *par_value(setup, fit.ipar[i]) = fit.center->p[i];
+      strcpy(out.sweep_key[i], par_name[fit.ipar[i]]);
+      out.sweep_value[i] = fit.center->p[i];
+    }
+    fit_file_name(config_file_name, "_fit.config", name, sizeof(name));
+    if (!write_sweep_config(config_file_name, name, &out))
+      printf("\nConfig file with fitted values written to %s\n", name);
+  }
+
+  free(fit.center);
+  for (i=0; i<fit.npar+1; i++) grid_release(fit.basis[i], fit.geom.LL);
+  grid_release(fit.unit, fit.geom.LL);
+  grid_release(fit.w, fit.geom.LL);
+  fieldgen_free(&fit.geom);
+  return fit.status;
+}
@@ -0,0 +1,36 @@
+/* fieldgen_fit.h -- fit of the impurity profile to measured capacitances
+ *
+ * The impurity parameters in the config file (impurity_z0, impurity_gradient,
+ * impurity_quadratic, impurity_surface, impurity_radial_add) are adjusted by a
+ * Levenberg-Marquardt least-squares fit to a table of measured capacitance vs
+ * bias, and optionally to the measured depletion voltage.
+ *
+ * The table is a text file; anything after a # is a comment:
+ *     fit impurity_z0 impurity_gradient   # the parameters to fit
+ *     depletion 1450 20                   # depletion voltage and its uncertainty, V
+ *     300  3.65  0.02                     # bias (V), capacitance (pF) and uncertainty (pF)
+ *     ...
+ * If no uncertainties are given, 1 V and 0.01 pF are used.
+ */
+#ifndef _FIELDGEN_FIT_H
+#define _FIELDGEN_FIT_H
+
+#include "mjd_siggen.h"
+
+#define MAX_FIT_PARAMS 5
+#define MAX_FIT_POINTS 200
+#define MAX_FIT_ITS    20     // max number of Levenberg-Marquardt iterations
+
+/* fieldgen_fit
+   fit the impurity parameters of the detector in setup, read from config file
+   config_file_name, to the measurements in fit_file, using nthreads threads
+   (or one per CPU if nthreads < 1); progress is reported on stdout and the
+   details of each field calculation in <config>_fit.log. On success, the fitted
+   values are put into setup and a copy of the config file with those values
+   is written to <config>_fit.config
+   returns 0 for success
+*/
+int fieldgen_fit(MJD_Siggen_Setup *setup, char *config_file_name, char *fit_file,
+		 int nthreads);
+
+#endif /*#ifndef _FIELDGEN_FIT_H*/
@@ -28,6 +28,8 @@ static int setup_efield(MJD_Siggen_Setup *setup);
 static int setup_wp(MJD_Siggen_Setup *setup);
 static int setup_velo(MJD_Siggen_Setup *setup);
 static int efield_exists(cyl_pt pt, MJD_Siggen_Setup *setup);
+static char *field_file_name(MJD_Siggen_Setup *setup, const char *type, char *name,
+			     char *cache_name);
 
 /* field_setup
    given a field directory file, read electic field and weighting
@@ -42,6 +44,7 @@ int field_setup(MJD_Siggen_Setup *setup){
   setup->zmin  = 0;
   setup->zmax  = setup->xtal_length;
   setup->zstep = setup->xtal_grid;
+  setup->nearest_valid = 0;
   if (setup->xtal_temp < MIN_TEMP) setup->xtal_temp = MIN_TEMP;
   if (setup->xtal_temp > MAX_TEMP) setup->xtal_temp = MAX_TEMP;
 
@@ -52,6 +55,7 @@ int field_setup(MJD_Siggen_Setup *setup){
 	      setup->zmin, setup->zmax, setup->zstep,
 	      setup->xtal_temp);
 
+  if (geometry_setup(setup) != 0) return -1;
   if (setup_velo(setup) != 0){
     error("Failed to read drift velocity data from file: %s\n", 
 	  setup->drift_name);
@@ -75,7 +79,11 @@ static int efield_exists(cyl_pt pt, MJD_Siggen_Setup *setup){
   cyl_int_pt ipt;
   char ptstr[MAX_LINE];
   int  i, j, ir, iz;
-  sprintf(ptstr, "(r,z) = (%.1f,%.1f)", pt.r, pt.z);
+
+  STATS_ADD(efield_exists, 1);
+
+  if (setup->verbosity >= CHATTY)
+    sprintf(ptstr, "(r,z) = (%.1f,%.1f)", pt.r, pt.z);
   if (outside_detector_cyl(pt, setup)){
     TELL_CHATTY("point %s is outside crystal\n", ptstr);
     return 0;
@@ -129,19 +137,24 @@ int wpotential(point pt, float *wp, MJD_Siggen_Setup *setup){
   return 0;
 }
 
-/* drift_velocity
-   calculates drift velocity for charge q at point pt
+/* drift_velocity_q
+   calculates drift velocity at point pt, for holes if holes != 0, otherwise
+   for electrons; holes is a constant in each caller, so this is inlined
+   into a separate version for each carrier
    returns 0 on success, 1 on success but extrapolation was necessary,
    and -1 for failure
    anisotropic drift: crystal axes are assumed to be (x,y,z)
 */
-int drift_velocity(point pt, float q, vector *velo, MJD_Siggen_Setup *setup){
+static ALWAYS_INLINE int drift_velocity_q(point pt, const int holes, vector *velo,
+					  MJD_Siggen_Setup *setup){
   point  cart_en;
   cyl_pt e, en, cyl;
   cyl_int_pt ipt;
   int   i, sign;
   float abse, absv, f, a, b, c;
+#if DRIFT_VEL_ANISOTROPY
   float bp, cp, en4, en6;
+#endif
   struct velocity_lookup *v_lookup1, *v_lookup2;
 
   /*  DCR: replaced this with faster code below, saves calls to atan and tan
@@ -168,24 +181,32 @@ int drift_velocity(point pt, float q, vector *velo, MJD_Siggen_Setup *setup){
 
   /* find location in table to interpolate from */
   for (i = 0; i < setup->v_lookup_len - 2 && abse > setup->v_lookup[i+1].e; i++);
+  STATS_ADD(velo_lookups, 1);
+  STATS_ADD(velo_search, i+1);
   v_lookup1 = setup->v_lookup + i;
   v_lookup2 = setup->v_lookup + i+1;
   f = (abse - v_lookup1->e)/(v_lookup2->e - v_lookup1->e);
-  if (q > 0){
+  if (holes){
     a = (v_lookup2->ha - v_lookup1->ha)*f+v_lookup1->ha;
     b = (v_lookup2->hb- v_lookup1->hb)*f+v_lookup1->hb;
     c = (v_lookup2->hc - v_lookup1->hc)*f+v_lookup1->hc;
+#if DRIFT_VEL_ANISOTROPY
     bp = (v_lookup2->hbp- v_lookup1->hbp)*f+v_lookup1->hbp;
     cp = (v_lookup2->hcp - v_lookup1->hcp)*f+v_lookup1->hcp;
+#endif
     setup->dv_dE = (v_lookup2->h100 - v_lookup1->h100)/(v_lookup2->e - v_lookup1->e);
   }else{
     a = (v_lookup2->ea - v_lookup1->ea)*f+v_lookup1->ea;
     b = (v_lookup2->eb- v_lookup1->eb)*f+v_lookup1->eb;
     c = (v_lookup2->ec - v_lookup1->ec)*f+v_lookup1->ec;
+#if DRIFT_VEL_ANISOTROPY
     bp = (v_lookup2->ebp- v_lookup1->ebp)*f+v_lookup1->ebp;
     cp = (v_lookup2->ecp - v_lookup1->ecp)*f+v_lookup1->ecp;
+#endif
     setup->dv_dE = (v_lookup2->e100 - v_lookup1->e100)/(v_lookup2->e - v_lookup1->e);
   }
+  sign = (holes ? 1 : -1);
+#if DRIFT_VEL_ANISOTROPY
   /* velocity can vary from the direction of the el. field
      due to effect of crystal axes */
 #define POW4(x) ((x)*(x)*(x)*(x))
@@ -193,7 +214,6 @@ int drift_velocity(point pt, float q, vector *velo, MJD_Siggen_Setup *setup){
   en4 = POW4(cart_en.x) + POW4(cart_en.y) + POW4(cart_en.z);
   en6 = POW6(cart_en.x) + POW6(cart_en.y) + POW6(cart_en.z);
   absv = a + b*en4 + c*en6;
-  sign = (q < 0 ? -1 : 1);
   setup->v_over_E = absv / abse;
   velo->x = sign*cart_en.x*(absv+bp*4*(cart_en.x*cart_en.x - en4)
 			    + cp*6*(POW4(cart_en.x) - en6));
@@ -203,9 +223,35 @@ int drift_velocity(point pt, float q, vector *velo, MJD_Siggen_Setup *setup){
 			    + cp*6*(POW4(cart_en.z) - en6));
 #undef POW4
 #undef POW6
+#else
+  /* isotropic drift, along the field, with the <100> speed */
+  absv = a + b + c;
+  setup->v_over_E = absv / abse;
+  velo->x = sign*cart_en.x*absv;
+  velo->y = sign*cart_en.y*absv;
+  velo->z = sign*cart_en.z*absv;
+#endif
   return 0;
 }
 
+/* drift_velocity, drift_velocity_h, drift_velocity_e
+   calculate drift velocity for charge q, or for holes or electrons, at point pt
+   returns 0 on success, 1 on success but extrapolation was necessary,
+   and -1 for failure
+*/
+int drift_velocity(point pt, float q, vector *velo, MJD_Siggen_Setup *setup){
+  if (q > 0) return drift_velocity_q(pt, 1, velo, setup);
+  return drift_velocity_q(pt, 0, velo, setup);
+}
+
+int drift_velocity_h(point pt, vector *velo, MJD_Siggen_Setup *setup){
+  return drift_velocity_q(pt, 1, velo, setup);
+}
+
+int drift_velocity_e(point pt, vector *velo, MJD_Siggen_Setup *setup){
+  return drift_velocity_q(pt, 0, velo, setup);
+}
+
 /* Find (interpolated or extrapolated) electric field for this point */
 static cyl_pt efield(cyl_pt pt, cyl_int_pt ipt, MJD_Siggen_Setup *setup){
   cyl_pt e = {0,0,0}, ef;
@@ -250,23 +296,24 @@ static int nearest_field_grid_index(cyl_pt pt, cyl_int_pt *ipt,
               0 if interpolation is okay
               1 if we can find a point but extrapolation is needed
   */
-  static cyl_pt  last_pt;
-  static cyl_int_pt last_ipt;
-  static int     last_ret = -99;
   cyl_pt new_pt;
   int    dr, dz;
   float  d[3] = {0.0, -1.0, 1.0};
 
-  if (last_ret != -99 &&
-      pt.r == last_pt.r && pt.z == last_pt.z) {
-    *ipt = last_ipt;
-    return last_ret;
+  STATS_ADD(nearest_calls, 1);
+  if (setup->nearest_valid &&
+      pt.r == setup->nearest_pt.r && pt.z == setup->nearest_pt.z) {
+    *ipt = setup->nearest_ipt;
+    STATS_ADD(nearest_hits, 1);
+    STATS_ADD(extrapolations, setup->nearest_ret == 1);
+    return setup->nearest_ret;
   }
-  last_pt = pt;
-  last_ret = -2;
+  setup->nearest_valid = 1;
+  setup->nearest_pt = pt;
+  setup->nearest_ret = -2;
 
   if (outside_detector_cyl(pt, setup)) {
-    last_ret = -1;
+    setup->nearest_ret = -1;
   } else{
     new_pt.phi = 0.0;
     for (dz=0; dz<3; dz++) {
@@ -274,58 +321,55 @@ static int nearest_field_grid_index(cyl_pt pt, cyl_int_pt *ipt,
       for (dr=0; dr<3; dr++) {
 	new_pt.r = pt.r + d[dr]*setup->rstep;
 	if (efield_exists(new_pt, setup)) {
-	  last_ipt.r = (new_pt.r - setup->rmin)/setup->rstep;
-	  last_ipt.phi = 0;
-	  last_ipt.z = (new_pt.z - setup->zmin)/setup->zstep;
-	  *ipt = last_ipt;
+	  setup->nearest_ipt.r = (new_pt.r - setup->rmin)/setup->rstep;
+	  setup->nearest_ipt.phi = 0;
+	  setup->nearest_ipt.z = (new_pt.z - setup->zmin)/setup->zstep;
+	  *ipt = setup->nearest_ipt;
 	  if (dr == 0 && dz == 0) {
-	    last_ret = 0;
+	    setup->nearest_ret = 0;
 	  } else {
-	    last_ret = 1;
+	    setup->nearest_ret = 1;
+	    STATS_ADD(extrapolations, 1);
 	  }
-	  return last_ret;
+	  return setup->nearest_ret;
 	}
       }
     }
   }
 
-  return last_ret;
+  return setup->nearest_ret;
 }
 
 /* setup_velo
    set up drift velocity calculations (read in table)
 */
 static int setup_velo(MJD_Siggen_Setup *setup){
-  static int vlook_sz = 0;
-  static struct velocity_lookup *v_lookup;
-
   char  line[MAX_LINE], *c;
   FILE  *fp;
-  int   i, v_lookup_len;
-  struct velocity_lookup *tmp, v, v0;
+  int   i, v_lookup_len, vlook_sz = 10;
+  struct velocity_lookup *v_lookup, *tmp, v, v0;
   float sumb_e, sumc_e, sumb_h, sumc_h;
 
   double be=1.3e7, bh=1.2e7, thetae=200.0, thetah=200.0;  // parameters for temperature correction
   double pwre=-1.680, pwrh=-2.398, mue=5.66e7, muh=1.63e9; //     adopted for Ge   DCR Feb 2015
   double mu_0_1, mu_0_2, v_s_1, v_s_2, E_c_1, E_c_2, e, f;
 
-  if (vlook_sz == 0) {
-    vlook_sz = 10;
-    if ((v_lookup = (struct velocity_lookup *)
-	 malloc(vlook_sz*sizeof(*v_lookup))) == NULL) {
-      error("malloc failed in setup_velo\n");
-      return -1;
-    }
-  }
   if ((fp = fopen(setup->drift_name, "r")) == NULL){
     error("failed to open velocity lookup table file: '%s'\n", setup->drift_name);
     return -1;
   }
+  if ((v_lookup = (struct velocity_lookup *)
+       malloc(vlook_sz*sizeof(*v_lookup))) == NULL) {
+    error("malloc failed in setup_velo\n");
+    fclose(fp);
+    return -1;
+  }
   line[0] = '#';
   c = line;
   while ((line[0] == '#' || line[0] == '\0') && c != NULL) c = fgets(line, MAX_LINE, fp);
   if (c == NULL) {
     error("Failed to read velocity lookup table from file: %s\n", setup->drift_name);
+    free(v_lookup);
     fclose(fp);
     return -1;
   }
@@ -337,6 +381,7 @@ static int setup_velo(MJD_Siggen_Setup *setup){
       if ((tmp = (struct velocity_lookup *)
 	   realloc(v_lookup, vlook_sz*sizeof(*v_lookup))) == NULL){
 	error("realloc failed in setup_velo\n");
+	free(v_lookup);
 	fclose(fp);
 	return -1;
       }
@@ -386,6 +431,8 @@ static int setup_velo(MJD_Siggen_Setup *setup){
 
   if (v_lookup_len == 0){
     error("Failed to read velocity lookup table from file: %s\n", setup->drift_name);
+    free(v_lookup);
+    fclose(fp);
     return -1;
   }  
   v_lookup_len++;
@@ -393,6 +440,7 @@ static int setup_velo(MJD_Siggen_Setup *setup){
     if ((tmp = (struct velocity_lookup *) 
 	 realloc(v_lookup, v_lookup_len*sizeof(*v_lookup))) == NULL){
       error("realloc failed in setup_velo. This should not happen\n");
+      free(v_lookup);
       fclose(fp);
       return -1;
     }
@@ -473,6 +521,7 @@ static int setup_velo(MJD_Siggen_Setup *setup){
     v_lookup[i].hcp = sumc_h/v.e;
   }
 
+  free(setup->v_lookup);   // from an earlier call, e.g. by set_temp
   setup->v_lookup = v_lookup;
   setup->v_lookup_len = v_lookup_len;
 
@@ -480,20 +529,109 @@ static int setup_velo(MJD_Siggen_Setup *setup){
 }
 
 
+/* field_file_name
+   find the field file of the given type ("ev" or "wp") to read; this is the
+   file in setup->cache_dir that matches the config hash if there is one,
+   otherwise name. If the header of the file includes hashes from fieldgen,
+   they are checked against the current setup:
+   -- the geometry hash must match the geometry and grid
+   -- the config hash of a field file must match the impurities and bias, and
+      the undepleted signature of a WP file must match that of the field
+      (a WP calculated with undepleted regions is only valid at that bias),
+      unless setup->accept_field_mismatch is set
+   The undepleted signature of a field file is kept in setup for this.
+   cache_name must have space for MAX_FNAME_LEN chars.
+   returns the file name, or NULL if the file does not match the setup
+*/
+static char *field_file_name(MJD_Siggen_Setup *setup, const char *type, char *name,
+			     char *cache_name){
+  FILE   *fp;
+  char   line[MAX_LINE], *cp, *fname = name;
+  const char *why = NULL;
+  unsigned long long hash;
+  int    ev = !strcmp(type, "ev");
+
+  if (!field_cache_file(setup, type, cache_name, MAX_FNAME_LEN) &&
+      (fp = fopen(cache_name, "r")) != NULL) {
+    fclose(fp);
+    fname = cache_name;
+    TELL_NORMAL("Using cached field file %s\n", fname);
+  }
+  if (ev) setup->have_field_undepleted = 0;
+  if ((fp = fopen(fname, "r")) == NULL) return fname;  // error is reported by caller
+  while (fgets(line, MAX_LINE, fp) != NULL){
+    for (cp = line; isspace(*cp) && *cp != '\0'; cp++);
+    if (!strlen(cp)) continue;
+    if (*cp != '#') break;   // end of header
+    if (sscanf(cp, "# Geometry hash: %llx", &hash) == 1 &&
+	hash != wp_config_hash(setup)) {
+      error("File %s was calculated for a different detector geometry or grid\n"
+	    " (geometry hash %016llx, expected %016llx)\n",
+	    fname, hash, wp_config_hash(setup));
+      fclose(fp);
+      return NULL;
+    }
+    if (sscanf(cp, "# Config hash: %llx", &hash) == 1 &&
+	hash != field_config_hash(setup)) {
+      why = "a different bias or impurity";
+    }
+    if (sscanf(cp, "# Undepleted signature: %llx", &hash) == 1) {
+      if (ev) {
+	setup->field_undepleted = hash;
+	setup->have_field_undepleted = 1;
+      } else if (hash != 0 &&
+		 (!setup->have_field_undepleted || hash != setup->field_undepleted)) {
+	why = "undepleted regions that do not match the field";
+      }
+    }
+  }
+  fclose(fp);
+  if (why && !setup->accept_field_mismatch) {
+    error("File %s was calculated for %s;\n"
+	  " set accept_field_mismatch 1 in the config file to use it anyway\n",
+	  fname, why);
+    return NULL;
+  }
+  if (why) TELL_NORMAL("Note: file %s was calculated for %s\n", fname, why);
+  return fname;
+}
+
 /* This may or may not break if we switch to a non-integer grid*/
 /*setup_efield
-  read electric field data from file, apply sanity checks
+  read electric field data from file, apply sanity checks;
+  if setup->efld is already filled, the file is not read
   returns 0 for success
 */
 static int setup_efield(MJD_Siggen_Setup *setup){
   FILE   *fp;
-  char   line[MAX_LINE], *cp;
+  char   line[MAX_LINE], *cp, *fname, cache_name[MAX_FNAME_LEN];
   int    i, j, lineno;
   float  v, eabs, er, ez;
   cyl_pt cyl, **efld;
 
-  if ((fp = fopen(setup->field_name, "r")) == NULL){
-    error("failed to open electric field table: %s\n", setup->field_name);
+  if (setup->efld) {
+    /* field was already filled in, e.g. by fieldgen_export();
+       just zero it outside the detector, as is done when reading the file */
+    setup->rlen = lrintf((setup->rmax - setup->rmin)/setup->rstep) + 1;
+    setup->zlen = lrintf((setup->zmax - setup->zmin)/setup->zstep) + 1;
+    TELL_NORMAL("Using electric field data already in memory\n");
+    for (i = 0; i < setup->rlen; i++){
+      for (j = 0; j < setup->zlen; j++){
+	cyl.r = setup->rmin + i*setup->rstep;
+	cyl.z = setup->zmin + j*setup->zstep;
+	cyl.phi = 0;
+	if (outside_detector_cyl(cyl, setup)) {
+	  setup->efld[i][j].r = setup->efld[i][j].z = setup->efld[i][j].phi = 0;
+	}
+      }
+    }
+    return 0;
+  }
+
+  if ((fname = field_file_name(setup, "ev", setup->field_name, cache_name)) == NULL)
+    return 1;
+  if ((fp = fopen(fname, "r")) == NULL){
+    error("failed to open electric field table: %s\n", fname);
     return 1;
   }
   
@@ -516,7 +654,7 @@ static int setup_efield(MJD_Siggen_Setup *setup){
     }
     memset(efld[i], 0, setup->zlen*sizeof(*efld[i]));
   }
-  TELL_NORMAL("Reading electric field data from file: %s\n", setup->field_name);
+  TELL_NORMAL("Reading electric field data from file: %s\n", fname);
   lineno = 0;
 
   /*now read the table*/
@@ -527,7 +665,7 @@ static int setup_efield(MJD_Siggen_Setup *setup){
     if (sscanf(line, "%f %f %f %f %f %f", 
 	       &cyl.r, &cyl.z, &v, &eabs, &er, &ez) != 6){
       error("failed to read electric field data from line no %d\n"
-	    "of file %s\n", lineno, setup->field_name);
+	    "of file %s\n", lineno, fname);
       fclose(fp);
       return 1;
     }
@@ -554,10 +692,11 @@ static int setup_efield(MJD_Siggen_Setup *setup){
 }
 
 /*setup_wp
-  read weighting potential values from files. returns 0 on success*/
+  read weighting potential values from files, unless setup->wpot is already filled.
+  returns 0 on success*/
 static int setup_wp(MJD_Siggen_Setup *setup){
   FILE   *fp;
-  char   line[MAX_LINE], *cp;
+  char   line[MAX_LINE], *cp, *fname, cache_name[MAX_FNAME_LEN];
   int    i, j, lineno;
   cyl_pt cyl;
   float  wp, **wpot;
@@ -566,6 +705,23 @@ static int setup_wp(MJD_Siggen_Setup *setup){
   setup->zlen = lrintf((setup->zmax - setup->zmin)/setup->zstep) + 1;
   TELL_CHATTY("rlen, zlen: %d, %d\n", setup->rlen, setup->zlen);
 
+  if (setup->wpot) {
+    /* WP was already filled in, e.g. by fieldgen_export() */
+    TELL_NORMAL("Using weighting potential already in memory\n");
+    for (i = 0; i < setup->rlen; i++){
+      for (j = 0; j < setup->zlen; j++){
+	cyl.r = setup->rmin + i*setup->rstep;
+	cyl.z = setup->zmin + j*setup->zstep;
+	cyl.phi = 0;
+	if (outside_detector_cyl(cyl, setup)) setup->wpot[i][j] = 0;
+      }
+    }
+    return 0;
+  }
+
+  if ((fname = field_file_name(setup, "wp", setup->wp_name, cache_name)) == NULL)
+    return 1;
+
   //assuming rlen, zlen never change as for setup_efld
   if ((wpot = (float **) malloc(setup->rlen*sizeof(*wpot))) == NULL){
     error("Malloc failed in setup_wp\n");
@@ -579,12 +735,12 @@ static int setup_wp(MJD_Siggen_Setup *setup){
     }
     memset(wpot[i], 0, setup->zlen*sizeof(*wpot[i]));
   }
-  if ((fp = fopen(setup->wp_name, "r")) == NULL){
-    error("failed to open file: %s\n", setup->wp_name);
+  if ((fp = fopen(fname, "r")) == NULL){
+    error("failed to open file: %s\n", fname);
     return -1;
   }
   lineno = 0;
-  TELL_NORMAL("Reading weighting potential from file: %s\n", setup->wp_name);
+  TELL_NORMAL("Reading weighting potential from file: %s\n", fname);
   while (fgets(line, MAX_LINE, fp) != NULL){
     lineno++;
     for (cp = line; isspace(*cp) && *cp != '\0'; cp++);
@@ -615,13 +771,14 @@ static int setup_wp(MJD_Siggen_Setup *setup){
 int fields_finalize(MJD_Siggen_Setup *setup){
   int i;
 
-  for (i = 0; i < lrintf((setup->rmax - setup->rmin)/setup->rstep) + 1; i++){
-    free(setup->efld[i]);
-    free(setup->wpot[i]);
+  for (i = 0; i < setup->rlen; i++){
+    if (setup->efld) free(setup->efld[i]);
+    if (setup->wpot) free(setup->wpot[i]);
   }
   free(setup->efld);
   free(setup->wpot);
   free(setup->v_lookup);
+  geometry_finalize(setup);
   setup->efld = NULL;
   setup->wpot = NULL;
   setup->v_lookup = NULL;
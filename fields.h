@@ -10,7 +10,8 @@
 
 /* calculate anisotropic drift velocities? (vel. depends on angle between
    el. field and crystal axis; otherwise the velocity will always be 
-   in the direction of the el. field 
+   in the direction of the el. field, with the <100> speed)
+   this is fixed at compile time, so the drift kernels have no test for it
 */
 #define DRIFT_VEL_ANISOTROPY 1
 
@@ -19,7 +20,9 @@
 
 /* field_setup
    given a field directory file, read electic field and weighting
-   potential tables from files listed in directory
+   potential tables from files listed in directory;
+   if setup->efld or setup->wpot have already been filled
+   (e.g. by fieldgen_export), those values are used instead of the files
    returns 0 for success
 */
 int field_setup(MJD_Siggen_Setup *setup);
@@ -41,6 +44,12 @@ int wpotential(point pt, float *wp, MJD_Siggen_Setup *setup);
 */
 int drift_velocity(point pt, float q, vector *velocity, MJD_Siggen_Setup *setup);
 
+/* drift_velocity_h, drift_velocity_e
+   as drift_velocity, for holes or for electrons
+*/
+int drift_velocity_h(point pt, vector *velocity, MJD_Siggen_Setup *setup);
+int drift_velocity_e(point pt, vector *velocity, MJD_Siggen_Setup *setup);
+
 int read_fields(MJD_Siggen_Setup *setup);
 
 /*set detector temperature. 77F (no correction) is the default
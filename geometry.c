@@ -0,0 +1,223 @@
+/* geometry.c -- the shape of the detector, shared by fieldgen and siggen
+ *
+ * The crystal is a cylinder, reflected in r so that the axis is not a surface,
+ * with its top outside edge rounded (top bulletization) and its bottom outside
+ * edge cut at 45 degrees (taper). The point contact, the ditch and, for
+ * inverted-coax detectors, the borehole are cut out of it. See geometry.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "mjd_siggen.h"
+#include "geometry.h"
+
+#define SQ(x) ((x)*(x))
+#define NSUB 8   // subdivisions per side of voxels that the surface passes through
+
+/* geometry_compile
+   set up g for the detector in setup; if grid > 0, lengths are in units of
+   grid and rounded to whole numbers of grid lengths, as used by fieldgen;
+   otherwise they are in mm
+*/
+void geometry_compile(Geometry *g, MJD_Siggen_Setup *setup, float grid){
+  Geom_Prim *p;
+  float     L, R, LT, RO;
+
+#define LEN(x) (grid > 0 ? (float) lrint((x)/grid) : (x))
+  memset(g, 0, sizeof(*g));
+  L  = LEN(setup->xtal_length);
+  R  = LEN(setup->xtal_radius);
+  LT = LEN(setup->taper_length);
+
+  p = &g->prim[g->nprims++];
+  p->region = GEOM_GE;
+  p->r0 = -R;
+  p->r1 = R;
+  p->z0 = 0;
+  p->z1 = L;
+  p->round = LEN(setup->top_bullet_radius);
+  p->chamfer = LT;
+
+  if (setup->pc_radius > 0) {
+    p = &g->prim[g->nprims++];
+    p->region = GEOM_PC;
+    p->r1 = LEN(setup->pc_radius);
+    p->z1 = LEN(setup->pc_length);
+    p->r0 = -p->r1;
+    p->z0 = -p->z1;
+    // bulletization radius is the smaller of the PC radius and length
+    if (setup->bulletize_PC) p->round = (p->z1 < p->r1 ? p->z1 : p->r1);
+  }
+
+  if (setup->ditch_depth > 0 && setup->ditch_thickness > 0 &&
+      setup->wrap_around_radius > 0) {
+    p = &g->prim[g->nprims++];
+    p->region = GEOM_DITCH;
+    p->r1 = LEN(setup->wrap_around_radius);
+    p->r0 = p->r1 - LEN(setup->ditch_thickness);
+    p->z1 = LEN(setup->ditch_depth);
+    p->z0 = -p->z1;
+  }
+
+  if (setup->hole_length > 0 && setup->hole_radius > 0) {
+    /* borehole of an inverted-coax detector, reflected in z about the top
+       of the crystal so that the top is not a surface */
+    p = &g->prim[g->nprims++];
+    p->region = GEOM_HOLE;
+    p->r1 = LEN(setup->hole_radius);
+    p->r0 = -p->r1;
+    p->z0 = L - LEN(setup->hole_length);
+    p->z1 = L + LEN(setup->hole_length);
+  }
+
+  RO = LEN(setup->wrap_around_radius);
+  if (RO <= 0 || RO >= R) RO = R - LT;   // no wrap-around; contact starts at the taper
+  g->wrap_r = RO;
+#undef LEN
+}
+
+/* in_prim
+   returns 1 if (r,z) is inside primitive p; points on its faces count as inside
+   unless open is nonzero, and points on a rounded corner belong to the germanium
+*/
+static int in_prim(Geom_Prim *p, float r, float z, int open){
+  float rc, zc, d2;
+
+  if (open) {
+    if (r <= p->r0 || r >= p->r1 || z <= p->z0 || z >= p->z1) return 0;
+  } else {
+    if (r < p->r0 || r > p->r1 || z < p->z0 || z > p->z1) return 0;
+  }
+  if (p->round > 0 &&
+      r >= (rc = p->r1 - p->round) && z >= (zc = p->z1 - p->round)) {
+    d2 = SQ(r-rc) + SQ(z-zc);
+    if (p->region == GEOM_GE) return (d2 <= SQ(p->round));
+    return (d2 < SQ(p->round));
+  }
+  if (p->chamfer > 0 && z < p->z0 + p->chamfer &&
+      r > z - p->z0 + p->r1 - p->chamfer) return 0;
+  return 1;
+}
+
+/* geometry_classify
+   returns the region (GEOM_GE, GEOM_OUTER, GEOM_PC, GEOM_DITCH or GEOM_HOLE) of (r,z);
+   if nodes is nonzero, points on the outer surface of the crystal, and on the
+   bottom face for r >= g->wrap_r, count as GEOM_OUTER
+*/
+int geometry_classify(Geometry *g, float r, float z, int nodes){
+  Geom_Prim *p = &g->prim[0];
+  float     rc, zc, t;
+  int       i;
+
+  /* outside the crystal; the top face is always part of the outer contact */
+  if (z >= p->z1 || z < p->z0) return GEOM_OUTER;
+  if (nodes ? r >= p->r1 : r > p->r1) return GEOM_OUTER;
+  if (p->round > 0 &&
+      r > (rc = p->r1 - p->round) && z > (zc = p->z1 - p->round) &&
+      SQ(r-rc) + SQ(z-zc) > SQ(p->round)) return GEOM_OUTER;   // top bulletization
+  if (p->chamfer > 0 && z < p->z0 + p->chamfer) {                 // taper
+    t = z - p->z0 + p->r1 - p->chamfer;
+    if (nodes ? r >= t : r > t) return GEOM_OUTER;
+  }
+  if (nodes && z <= p->z0 && r >= g->wrap_r) return GEOM_OUTER;  // wrap-around
+
+  /* cut out of the crystal; the faces of the ditch belong to the germanium */
+  for (i = 1; i < g->nprims; i++){
+    p = &g->prim[i];
+    if (in_prim(p, r, z, (p->region == GEOM_DITCH))) return p->region;
+  }
+  return GEOM_GE;
+}
+
+/* prim_distance
+   returns the signed distance from (r,z) to the surface of p, negative inside;
+   near the chamfer, the magnitude is a lower bound
+*/
+static float prim_distance(Geom_Prim *p, float r, float z){
+  float rc, zc, dr, dz, d;
+
+  if (p->round > 0 &&
+      r >= (rc = p->r1 - p->round) && z >= (zc = p->z1 - p->round)) {
+    d = sqrt(SQ(r-rc) + SQ(z-zc)) - p->round;
+  } else {
+    dr = fmaxf(p->r0 - r, r - p->r1);
+    dz = fmaxf(p->z0 - z, z - p->z1);
+    if (dr > 0 && dz > 0) {
+      d = sqrt(SQ(dr) + SQ(dz));
+    } else {
+      d = fmaxf(dr, dz);
+    }
+  }
+  if (p->chamfer > 0)
+    d = fmaxf(d, (r - (z - p->z0) - (p->r1 - p->chamfer)) * (float) M_SQRT1_2);
+  return d;
+}
+
+/* geometry_distance
+   returns a lower bound on the distance from (r,z) to the surface of the
+   germanium; positive inside and negative outside
+*/
+float geometry_distance(Geometry *g, float r, float z){
+  float d;
+  int   i;
+
+  d = prim_distance(&g->prim[0], r, z);
+  for (i = 1; i < g->nprims; i++) d = fmaxf(d, -prim_distance(&g->prim[i], r, z));
+  return -d;
+}
+
+/* geometry_fraction
+   returns the fraction of the voxel of size dr x dz centered at (r,z) that is
+   in region, which is either GEOM_GE or the region of one of the primitives;
+   only voxels that the surface may pass through are subdivided
+*/
+float geometry_fraction(Geometry *g, int region, float r, float z, float dr, float dz){
+  Geom_Prim *p = NULL;
+  float     d, h, rs, zs;
+  int       i, j, n = 0;
+
+  if (region == GEOM_GE) {
+    d = -geometry_distance(g, r, z);
+  } else {
+    for (i = 1; i < g->nprims && g->prim[i].region != region; i++) ;
+    if (i == g->nprims) return 0;
+    p = &g->prim[i];
+    d = prim_distance(p, r, z);
+  }
+  h = 0.5 * sqrt(SQ(dr) + SQ(dz));
+  if (d >= h) return 0;
+  if (d <= -h) return 1;
+
+  for (i = 0; i < NSUB; i++){
+    rs = r + dr * ((i + 0.5f)/NSUB - 0.5f);
+    for (j = 0; j < NSUB; j++){
+      zs = z + dz * ((j + 0.5f)/NSUB - 0.5f);
+      if (p ? in_prim(p, rs, zs, 0) : geometry_classify(g, rs, zs, 0) == GEOM_GE) n++;
+    }
+  }
+  return (float) n / (float) (NSUB*NSUB);
+}
+
+/* geometry_radius
+   returns the outer radius at height z of the primitive for region,
+   e.g. the radius of the (optionally bulletized) point contact; 0 if none.
+   Past the top of a rounded corner, the radius at the top is returned.
+*/
+float geometry_radius(Geometry *g, int region, float z){
+  Geom_Prim *p;
+  float     b, c;
+  int       i;
+
+  for (i = 0; i < g->nprims && g->prim[i].region != region; i++) ;
+  if (i == g->nprims) return 0;
+  p = &g->prim[i];
+  b = p->round;
+  if (b <= 0 || z <= p->z1 - b) return p->r1;
+  c = SQ(b) - SQ(z - (p->z1 - b));
+  if (c < 0.0) c = 0;
+  return p->r1 - b + sqrt(c);
+}
+#undef SQ
@@ -0,0 +1,50 @@
+/* geometry.h -- the shape of the detector, shared by fieldgen and siggen
+ *
+ * The detector is described as a small CSG: a cylinder (with optional taper
+ * at the bottom and bulletization at the top), minus the point contact
+ * (optionally bulletized), minus the ditch next to the wrap-around contact,
+ * and minus the borehole of an inverted-coax detector.
+ * geometry_compile() turns the dimensions in the setup into this description
+ * once; the functions below then classify points, give the distance to the
+ * surface, and the fraction of a voxel that is in a given region.
+ */
+#ifndef _GEOMETRY_H
+#define _GEOMETRY_H
+
+#include "mjd_siggen.h"
+
+/* geometry_compile
+   set up g for the detector in setup; if grid > 0, lengths are in units of
+   grid and rounded to whole numbers of grid lengths, as used by fieldgen;
+   otherwise they are in mm
+*/
+void geometry_compile(Geometry *g, MJD_Siggen_Setup *setup, float grid);
+
+/* geometry_classify
+   returns the region (GEOM_GE, GEOM_OUTER, GEOM_PC, GEOM_DITCH or GEOM_HOLE) of (r,z);
+   if nodes is nonzero, points on the outer surface of the crystal, and on the
+   bottom face for r >= g->wrap_r, count as GEOM_OUTER, as needed for the
+   boundary conditions of fieldgen's grid
+*/
+int geometry_classify(Geometry *g, float r, float z, int nodes);
+
+/* geometry_distance
+   returns a lower bound on the distance from (r,z) to the surface of the
+   germanium; positive inside and negative outside
+*/
+float geometry_distance(Geometry *g, float r, float z);
+
+/* geometry_fraction
+   returns the fraction of the voxel of size dr x dz centered at (r,z) that is
+   in region, which is either GEOM_GE or the region of one of the primitives
+*/
+float geometry_fraction(Geometry *g, int region, float r, float z, float dr, float dz);
+
+/* geometry_radius
+   returns the outer radius at height z of the primitive for region,
+   e.g. the radius of the (optionally bulletized) point contact; 0 if none.
+   Past the top of a rounded corner, the radius at the top is returned.
+*/
+float geometry_radius(Geometry *g, int region, float z);
+
+#endif /*#ifndef _GEOMETRY_H*/
@@ -0,0 +1,524 @@
+/* golden_check.c
+ *
+ * regression check of faster ways of running the calculations against the
+ * reference: calculates signals for fixed sets of points in one or more
+ * detectors, and the capacitance and depletion voltage from fieldgen, once
+ * in the reference way (the config files as they are, fieldgen on one thread)
+ * and once in a "fast" mode, given by changes to the config parameters and
+ * fieldgen solver options. It reports, in one table, the largest and RMS
+ * difference between the signals, the largest shifts of t90 and A/E, the
+ * differences in capacitance and depletion voltage, and the speed-up,
+ * and fails if any difference is larger than its tolerance.
+ *
+ * The reference results can be saved to a "golden" file (-w) and used
+ * later instead of calculating them again (-r), to check a different
+ * build of the code (compiler options, libraries) against them.
+ *
+ * usage: golden_check [-f changes] [-F changes] [-j threads] [-d tile_depth]
+ *                     [-g grid] [-t tolerances] [-n points] [-s seed]
+ *                     [-w golden_file | -r golden_file] [config_file ...]
+ *   -f  changes to the config files for the signals in the fast mode, as config
+ *       file lines separated by ';', e.g. "time_steps_calc 4000; step_time_calc 2"
+ *       (the number of output time steps and their length must not change)
+ *   -F  changes to the config files for fieldgen in the fast mode, in the same
+ *       way, e.g. "max_iterations 3000"
+ *   -j  number of threads for fieldgen in the fast mode; default 1
+ *   -d  iterations per pass through the grid for fieldgen in the fast mode
+ *   -g  grid size for the fieldgen comparison, in mm; default 0.5; 0 to skip it
+ *       (fieldgen's messages go to golden_check.log)
+ *   -t  tolerances, as a comma-separated list of name=value, from
+ *         max   largest difference of any signal at any time, default 0.002
+ *         rms   RMS difference of the signals, default 0.0005
+ *         t90   largest shift of t90, in ns, default 1
+ *         ae    largest relative shift of A/E, in %, default 0.5
+ *         lost  number of points with a signal in one mode but not the other,
+ *               default 0
+ *         cap   relative difference of the capacitance, in %, default 0.5
+ *         vdep  difference of the depletion voltage, in V, default 10
+ *   -n  number of points in each set; default 250
+ *   -s  seed for the random points; default 1
+ *   -w  write the reference results to golden_file
+ *   -r  read the reference results from golden_file rather than calculating them;
+ *       it must have been written with the same -n, -s, -g and config files
+ * The default config files are the reference detectors of siggen_bench
+ * (p1_new.config, bege_ref.config and icpc_ref.config); their fields must first
+ * be calculated with mjd_fieldgen. The point sets are those of siggen_bench (see point_sets.h):
+ * contact, bulk, corners and surface.
+ *
+ * The table is written to stderr. Returns 0 if all differences are within
+ * the tolerances, 2 if any is not, and 1 for other errors.
+ *
+ * to compile: see the Makefile
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "mjd_siggen.h"
+#include "calc_signal.h"
+#include "detector_geometry.h"
+#include "cyl_point.h"
+#include "point_sets.h"
+#include "timer.h"
+#include "fieldgen.h"
+#include "pool.h"
+
+#define GOLDEN_MAGIC "SGGOLD01"
+
+static char *default_config[] = {"config_files/p1_new.config",
+				 "config_files/bege_ref.config",
+				 "config_files/icpc_ref.config"};
+
+/* tolerances, in the units of the table */
+enum {T_MAX, T_RMS, T_T90, T_AE, T_LOST, T_CAP, T_VDEP, NTOL};
+static char  *tol_name[NTOL] = {"max", "rms", "t90", "ae", "lost", "cap", "vdep"};
+static double tol[NTOL] = {0.002, 0.0005, 1.0, 0.5, 0, 0.5, 10.0};
+
+/* signals for one point set */
+typedef struct {
+  int    n, nt;          // number of points, and of time steps in each signal
+  float  step_time;      // length of the time steps, in ns
+  double time;           // time taken to calculate them, in s
+  point  *pt;
+  char   *ok;            // 1 for points with a signal
+  float  *sig;
+} Sig_Set;
+
+/* results from fieldgen */
+typedef struct {
+  int    done;
+  double cap, vdep;      // capacitance in pF, depletion voltage
+  double time;           // time for the potential and WP, in s
+} Field_Result;
+
+/* the golden file starts with this, followed for each config file by its
+   name (char[256]), its Field_Result and for each point set n, nt, step_time,
+   time, pt[n], ok[n] and sig[n*nt] */
+typedef struct {
+  char   magic[8];
+  int    npts, nconfig;
+  unsigned long long seed;
+  float  grid;
+} Golden_Header;
+
+/* load_setup
+   read config file config_name into setup, with the lines of changes
+   (separated by ';', may be NULL) added to the end
+   returns 0 for success
+*/
+static int load_setup(char *config_name, char *changes, MJD_Siggen_Setup *setup) {
+  FILE *fp;
+  char *text, *c, *v;
+  long len;
+  int  err;
+
+  if (!(fp = fopen(config_name, "r"))) {
+    fprintf(stderr, "ERROR: config file %s does not exist?\n", config_name);
+    return 1;
+  }
+  fseek(fp, 0, SEEK_END);
+  len = ftell(fp);
+  rewind(fp);
+  if (!(text = malloc(len + (changes ? strlen(changes) : 0) + 3))) {
+    fprintf(stderr, "ERROR: malloc failed in load_setup\n");
+    fclose(fp);
+    return 1;
+  }
+  len = fread(text, 1, len, fp);
+  fclose(fp);
+  text[len++] = '\n';
+  text[len] = '\0';
+  if (changes) {
+    /* one line for each change; config keys must start a line */
+    for (c = text + len, v = changes; *v; v++) {
+      if (*v == ';') *c++ = '\n';
+      else if (*v != ' ' || c[-1] != '\n') *c++ = *v;
+    }
+    *c++ = '\n';
+    *c = '\0';
+  }
+  err = read_config_string(text, setup);
+  free(text);
+  return err;
+}
+
+/* set_alloc
+   allocate the arrays of point set s, for n points of nt time steps
+   returns 0 for success
+*/
+static int set_alloc(Sig_Set *s, int n, int nt) {
+  s->n = n;
+  s->nt = nt;
+  if (!(s->pt = malloc((n + 1) * sizeof(*s->pt))) ||
+      !(s->ok = malloc(n + 1)) ||
+      !(s->sig = calloc((size_t) n * nt + 1, sizeof(*s->sig)))) {
+    fprintf(stderr, "ERROR: malloc failed in set_alloc\n");
+    return 1;
+  }
+  return 0;
+}
+
+static void set_free(Sig_Set *s) {
+  free(s->pt);
+  free(s->ok);
+  free(s->sig);
+  memset(s, 0, sizeof(*s));
+}
+
+/* calc_signals
+   calculate the signals for config file config_name with changes, for the
+   points of sets ref (if make_pts is 0) or new ones (if it is nonzero), into set
+   returns 0 for success
+*/
+static int calc_signals(char *config_name, char *changes, Sig_Set *ref,
+			int make_pts, int npts, Sig_Set *set) {
+  MJD_Siggen_Setup setup;
+  double t0;
+  int    i, k, n;
+
+  if (load_setup(config_name, changes, &setup)) return 1;
+  setup.verbosity = 0;
+  if (signal_calc_init_setup(&setup) != 0) {
+    fprintf(stderr, "ERROR: Cannot set up %s; have its fields been calculated?\n",
+	    config_name);
+    return 1;
+  }
+  for (k = 0; k < NSETS; k++) {
+    if (set_alloc(&set[k], (make_pts ? npts : ref[k].n), setup.ntsteps_out)) return 1;
+    set[k].step_time = setup.step_time_out;
+    if (make_pts) {
+      set[k].n = point_set_make(k, set[k].pt, npts, &setup);
+    } else {
+      if (ref[k].nt != set[k].nt || ref[k].step_time != set[k].step_time) {
+	fprintf(stderr, "ERROR: The fast mode has %d output time steps of %g ns, not"
+		" %d of %g ns;\n  the signals cannot be compared\n",
+		set[k].nt, set[k].step_time, ref[k].nt, ref[k].step_time);
+	return 1;
+      }
+      memcpy(set[k].pt, ref[k].pt, ref[k].n * sizeof(*set[k].pt));
+    }
+    n = set[k].n;
+    t0 = timer_now();
+    for (i = 0; i < n; i++)
+      set[k].ok[i] = (get_signal(set[k].pt[i], set[k].sig + (size_t) i * set[k].nt,
+				 &setup) >= 0);
+    set[k].time = timer_now() - t0;
+  }
+  signal_calc_finalize(&setup);
+  return 0;
+}
+
+/* calc_fields
+   run fieldgen for config file config_name with changes, on a grid of grid mm,
+   using the threads of pool (may be NULL) and tile_depth (if > 0), into res
+   returns 0 for success
+*/
+static int calc_fields(char *config_name, char *changes, float grid, Pool *pool,
+		       int tile_depth, FILE *log, Field_Result *res) {
+  MJD_Siggen_Setup setup;
+  MJD_Fieldgen     fg;
+  double t0;
+  int    err;
+
+  memset(res, 0, sizeof(*res));
+  if (load_setup(config_name, changes, &setup)) return 1;
+  setup.xtal_grid = grid;
+  setup.cache_dir[0] = '\0';
+  fprintf(log, "\n===== %s%s%s, grid %g mm =====\n", config_name,
+	  (changes ? " with " : ""), (changes ? changes : ""), grid);
+  if (fieldgen_init(&fg, &setup, NULL, log)) {
+    fprintf(stderr, "ERROR: fieldgen_init failed for %s; see golden_check.log\n",
+	    config_name);
+    return 1;
+  }
+  fg.undepleted_file = NULL;
+  fg.pool = pool;
+  if (tile_depth > 0) fg.tile_depth = tile_depth;
+  t0 = timer_now();
+  if (!(err = fieldgen_solve_field(&fg))) err = fieldgen_solve_wp(&fg);
+  res->time = timer_now() - t0;
+  if (err) {
+    fprintf(stderr, "ERROR: fieldgen failed for %s; see golden_check.log\n", config_name);
+    fieldgen_free(&fg);
+    return 1;
+  }
+  res->cap = fieldgen_capacitance(&fg);
+  res->vdep = fieldgen_depletion_voltage(&fg);
+  res->done = 1;
+  fieldgen_free(&fg);
+  return 0;
+}
+
+/* golden_write, golden_read
+   write / read the reference results for config file config_name to / from fp
+   returns 0 for success
+*/
+static int golden_write(FILE *fp, char *config_name, Field_Result *fr, Sig_Set *set) {
+  char name[256];
+  int  k, n;
+
+  memset(name, 0, sizeof(name));
+  strncpy(name, config_name, sizeof(name) - 1);
+  fwrite(name, sizeof(name), 1, fp);
+  fwrite(fr, sizeof(*fr), 1, fp);
+  for (k = 0; k < NSETS; k++) {
+    n = set[k].n;
+    fwrite(&set[k].n, sizeof(int), 1, fp);
+    fwrite(&set[k].nt, sizeof(int), 1, fp);
+    fwrite(&set[k].step_time, sizeof(float), 1, fp);
+    fwrite(&set[k].time, sizeof(double), 1, fp);
+    fwrite(set[k].pt, sizeof(*set[k].pt), n, fp);
+    fwrite(set[k].ok, 1, n, fp);
+    if (fwrite(set[k].sig, sizeof(float), (size_t) n * set[k].nt, fp) !=
+	(size_t) n * set[k].nt) return 1;
+  }
+  return ferror(fp);
+}
+
+static int golden_read(FILE *fp, char *config_name, Field_Result *fr, Sig_Set *set) {
+  char   name[256];
+  double time;
+  float  step_time;
+  int    k, n, nt;
+
+  if (fread(name, sizeof(name), 1, fp) != 1 ||
+      fread(fr, sizeof(*fr), 1, fp) != 1) return 1;
+  name[sizeof(name)-1] = '\0';
+  if (strcmp(name, config_name)) {
+    fprintf(stderr, "ERROR: The golden file is for %s, not %s\n", name, config_name);
+    return 1;
+  }
+  for (k = 0; k < NSETS; k++) {
+    if (fread(&n, sizeof(int), 1, fp) != 1 ||
+	fread(&nt, sizeof(int), 1, fp) != 1 ||
+	fread(&step_time, sizeof(float), 1, fp) != 1 ||
+	fread(&time, sizeof(double), 1, fp) != 1 ||
+	n < 0 || nt < 1 || set_alloc(&set[k], n, nt)) return 1;
+    set[k].time = time;
+    set[k].step_time = step_time;
+    if (fread(set[k].pt, sizeof(*set[k].pt), n, fp) != (size_t) n ||
+	fread(set[k].ok, 1, n, fp) != (size_t) n ||
+	fread(set[k].sig, sizeof(float), (size_t) n * nt, fp) != (size_t) n * nt) return 1;
+  }
+  return 0;
+}
+
+/* compare_set
+   find the differences between the signals of point sets ref and fast,
+   in the units of the tolerances (see tol_name), and write a row of the table
+   returns the number of tolerances exceeded
+*/
+static int compare_set(char *config_name, int k, Sig_Set *ref, Sig_Set *fast) {
+  double d[NTOL], sum2 = 0, x;
+  float  t10, t90r, t90f, aer, aef, *sr, *sf;
+  long   nsum = 0;
+  int    i, j, fail = 0;
+
+  memset(d, 0, sizeof(d));
+  for (i = 0; i < ref->n; i++) {
+    if (ref->ok[i] != fast->ok[i]) d[T_LOST]++;
+    if (!ref->ok[i] || !fast->ok[i]) continue;
+    sr = ref->sig + (size_t) i * ref->nt;
+    sf = fast->sig + (size_t) i * ref->nt;
+    for (j = 0; j < ref->nt; j++) {
+      x = fabs(sf[j] - sr[j]);
+      if (x > d[T_MAX]) d[T_MAX] = x;
+      sum2 += x*x;
+    }
+    nsum += ref->nt;
+    signal_params(sr, ref->nt, ref->step_time, &t10, &t90r, &aer);
+    signal_params(sf, ref->nt, ref->step_time, &t10, &t90f, &aef);
+    if ((x = fabs(t90f - t90r)) > d[T_T90]) d[T_T90] = x;
+    if (aer > 0 && (x = 100.0 * fabs(aef / aer - 1.0)) > d[T_AE]) d[T_AE] = x;
+  }
+  if (nsum > 0) d[T_RMS] = sqrt(sum2 / nsum);
+  for (j = T_MAX; j <= T_LOST; j++) fail += (d[j] > tol[j]);
+
+  fprintf(stderr, "%-28.28s %-8s %5d %9.2e %9.2e %7.3f %7.3f %4.0f %7.2f  %s\n",
+	  config_name, point_set_name[k], ref->n, d[T_MAX], d[T_RMS], d[T_T90], d[T_AE],
+	  d[T_LOST], (fast->time > 0 ? ref->time / fast->time : 0),
+	  (fail ? "FAIL" : "ok"));
+  return fail;
+}
+
+/* compare_fields
+   as compare_set, for the fieldgen results ref and fast
+*/
+static int compare_fields(char *config_name, Field_Result *ref, Field_Result *fast) {
+  double dc, dv;
+  int    fail;
+
+  dc = (ref->cap > 0 ? 100.0 * fabs(fast->cap / ref->cap - 1.0) : 0);
+  dv = fabs(fast->vdep - ref->vdep);
+  fail = (dc > tol[T_CAP]) + (dv > tol[T_VDEP]);
+  fprintf(stderr, "%-28.28s %-8s %8.3f %8.3f %6.2f%% %8.1f %8.1f %6.1f %7.2f  %s\n",
+	  config_name, "fields", ref->cap, fast->cap, dc, ref->vdep, fast->vdep, dv,
+	  (fast->time > 0 ? ref->time / fast->time : 0), (fail ? "FAIL" : "ok"));
+  return fail;
+}
+
+int main(int argc, char **argv) {
+
+  Golden_Header gh, gh_in;
+  Sig_Set      ref[NSETS], fast[NSETS];
+  Field_Result fref, ffast;
+  Pool    *pool = NULL;
+  FILE    *golden = NULL, *log = NULL;
+  char    **config, *changes = NULL, *fg_changes = NULL, *tols = NULL, *golden_name = NULL, *c, *v;
+  double  tref = 0, tfast = 0;
+  float   grid = 0.5;
+  int     npts = 250, nthreads = 1, tile_depth = 0, write_golden = 0, nconfig;
+  int     i, j, k, fail = 0, bad = 0;
+  unsigned long long seed = 1;
+
+  for (i = 1; i < argc && argv[i][0] == '-'; i += 2) {
+    if (i == argc - 1) {
+      bad = 1;
+    } else if (!strcmp(argv[i], "-f")) {
+      changes = argv[i+1];
+    } else if (!strcmp(argv[i], "-F")) {
+      fg_changes = argv[i+1];
+    } else if (!strcmp(argv[i], "-j")) {
+      nthreads = atoi(argv[i+1]);
+    } else if (!strcmp(argv[i], "-d")) {
+      tile_depth = atoi(argv[i+1]);
+    } else if (!strcmp(argv[i], "-g")) {
+      grid = atof(argv[i+1]);
+    } else if (!strcmp(argv[i], "-t")) {
+      tols = argv[i+1];
+    } else if (!strcmp(argv[i], "-n")) {
+      npts = atoi(argv[i+1]);
+    } else if (!strcmp(argv[i], "-s")) {
+      seed = strtoull(argv[i+1], NULL, 10);
+    } else if (!strcmp(argv[i], "-w") || !strcmp(argv[i], "-r")) {
+      write_golden = (argv[i][1] == 'w');
+      golden_name = argv[i+1];
+    } else {
+      bad = 1;
+    }
+    if (bad) break;
+  }
+  for (c = (tols ? strtok(tols, ",") : NULL); c && !bad; c = strtok(NULL, ",")) {
+    if (!(v = strchr(c, '='))) {
+      bad = 1;
+      break;
+    }
+    *v++ = '\0';
+    for (j = 0; j < NTOL && strcmp(c, tol_name[j]); j++) ;
+    if (j == NTOL) bad = 1;
+    else tol[j] = atof(v);
+  }
+  if (bad || npts < 1 || nthreads < 1 || grid < 0) {
+    printf("Usage: %s [-f changes] [-F changes] [-j threads] [-d tile_depth]\n"
+	   "         [-g grid] [-t tolerances] [-n points] [-s seed]\n"
+	   "         [-w golden_file | -r golden_file] [config_file ...]\n"
+	   "   changes are config file lines separated by ';'\n"
+	   "   tolerances are a comma-separated list of name=value, with names\n"
+	   "   max, rms, t90 (ns), ae (%%), lost, cap (%%) and vdep (V)\n", argv[0]);
+    return 1;
+  }
+  if (i < argc) {
+    config = argv + i;
+    nconfig = argc - i;
+  } else {
+    config = default_config;
+    nconfig = sizeof(default_config) / sizeof(default_config[0]);
+  }
+
+  memset(&gh, 0, sizeof(gh));
+  memcpy(gh.magic, GOLDEN_MAGIC, sizeof(gh.magic));
+  gh.npts = npts;
+  gh.nconfig = nconfig;
+  gh.seed = seed;
+  gh.grid = grid;
+  if (golden_name) {
+    if (!(golden = fopen(golden_name, (write_golden ? "wb" : "rb")))) {
+      fprintf(stderr, "ERROR: Cannot open golden file %s\n", golden_name);
+      return 1;
+    }
+    if (write_golden) {
+      fwrite(&gh, sizeof(gh), 1, golden);
+    } else if (fread(&gh_in, sizeof(gh_in), 1, golden) != 1 ||
+	       memcmp(gh_in.magic, gh.magic, sizeof(gh.magic))) {
+      fprintf(stderr, "ERROR: %s is not a golden file\n", golden_name);
+      return 1;
+    } else if (gh_in.npts != npts || gh_in.nconfig != nconfig ||
+	       gh_in.seed != seed || gh_in.grid != grid) {
+      fprintf(stderr, "ERROR: Golden file %s was made with -n %d -s %llu -g %g"
+	      " and %d config files\n", golden_name, gh_in.npts, gh_in.seed,
+	      gh_in.grid, gh_in.nconfig);
+      return 1;
+    }
+  }
+  if (grid > 0 && !(log = fopen("golden_check.log", "w"))) {
+    fprintf(stderr, "ERROR: Cannot open log file golden_check.log\n");
+    return 1;
+  }
+  if (nthreads > 1 && !(pool = pool_create(nthreads))) return 1;
+
+  fprintf(stderr, "fast mode: signals with %s;\n"
+	  "           fieldgen with %s, threads %d, tile_depth %d\n"
+	  "reference: %s\n", (changes ? changes : "no config changes"),
+	  (fg_changes ? fg_changes : "no config changes"), nthreads,
+	  (tile_depth > 0 ? tile_depth : TILE_DEPTH),
+	  (golden_name && !write_golden ? golden_name : "calculated now"));
+  fprintf(stderr, "tolerances:");
+  for (j = 0; j < NTOL; j++) fprintf(stderr, " %s=%g", tol_name[j], tol[j]);
+  fprintf(stderr, "\n\n%-28s %-8s %5s %9s %9s %7s %7s %4s %7s\n", "config", "set",
+	  "pts", "max_dif", "rms_dif", "dt90_ns", "dA/E_%", "lost", "speedup");
+  if (grid > 0)
+    fprintf(stderr, "%-28s %-8s %8s %8s %7s %8s %8s %6s %7s\n", "", "", "C_ref",
+	    "C_fast", "dC", "Vd_ref", "Vd_fast", "dVd", "speedup");
+
+  for (i = 0; i < nconfig; i++) {
+    /* reference results */
+    memset(&fref, 0, sizeof(fref));
+    if (golden && !write_golden) {
+      if (golden_read(golden, config[i], &fref, ref)) {
+	fprintf(stderr, "ERROR: Cannot read %s from golden file %s\n",
+		config[i], golden_name);
+	return 1;
+      }
+    } else {
+      point_set_seed(seed + i);
+      if (calc_signals(config[i], NULL, NULL, 1, npts, ref) ||
+	  (grid > 0 && calc_fields(config[i], NULL, grid, NULL, 0, log, &fref))) return 1;
+      if (golden && golden_write(golden, config[i], &fref, ref)) {
+	fprintf(stderr, "ERROR: Failed to write golden file %s\n", golden_name);
+	return 1;
+      }
+    }
+
+    /* fast mode, at the same points */
+    if (calc_signals(config[i], changes, ref, 0, npts, fast)) return 1;
+    for (k = 0; k < NSETS; k++) {
+      fail += compare_set(config[i], k, &ref[k], &fast[k]);
+      tref += ref[k].time;
+      tfast += fast[k].time;
+      set_free(&ref[k]);
+      set_free(&fast[k]);
+    }
+    if (grid > 0) {
+      if (!fref.done) {
+	fprintf(stderr, "ERROR: The golden file has no fieldgen results\n");
+	return 1;
+      }
+      if (calc_fields(config[i], fg_changes, grid, pool, tile_depth, log, &ffast)) return 1;
+      fail += compare_fields(config[i], &fref, &ffast);
+    }
+  }
+
+  fprintf(stderr, "\nsignals: %.3f s reference, %.3f s fast, speed-up %.2f\n%s\n",
+	  tref, tfast, (tfast > 0 ? tref / tfast : 0),
+	  (fail ? "FAILED: differences are larger than the tolerances" :
+	   "PASSED: all differences are within the tolerances"));
+  if (pool) pool_finish(pool);
+  if (log) fclose(log);
+  if (golden && fclose(golden) && write_golden) {
+    fprintf(stderr, "ERROR: Failed to write golden file %s\n", golden_name);
+    return 1;
+  }
+  return (fail ? 2 : 0);
+}
@@ -8,70 +8,46 @@
       - added interpolation of RC and LC positions on the grid
    June 2016: added optional bulletization of point contact
    Nov  2017: added top bulletization
-
-   TO DO:
-      - add other bulletizations
-      - add dead layer / Li thickness
-      - on coarse grids, interpolate the position of L, R, LT, and the ditch
-            (as is done now already for RC and LC)
+   Oct  2026: the calculation is now done by the fieldgen library (fieldgen.c);
+                this is just the command-line interface
+   Oct  2026: added batch mode (-l), to calculate the fields for a list of
+                detectors using a pool of threads
+   Oct  2026: added sweep mode (-s), for config files with lists or ranges of values
+   Oct  2026: added -d, to find the depletion and pinch-off voltages by bisection
+   Oct  2026: added -f, to fit the impurity profile to measured capacitances
 */
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>
 #include <string.h>
 #include <math.h>
-#include <time.h>
-#include "mjd_siggen.h"
-
-#define MAX_ITS 50000     // default max number of iterations for relaxation
-#define MAX_ITS_FACTOR 2  // factor by which max iterations is reduced as grid is refined
+#include <unistd.h>
 
-int report_config(FILE *fp_out, char *config_file_name);
+#include "mjd_siggen.h"
+#include "fieldgen.h"
+#include "fieldgen_fit.h"
+#include "pool.h"
+#include "timer.h"
 
+static int batch(char *list_file, int nthreads, int set_BV, float BV, int set_WV, int set_WP,
+		 float find_tol);
+static int sweep(char *config_file_name, int nthreads, int set_WV, int set_WP);
 
 int main(int argc, char **argv)
 {
 
   MJD_Siggen_Setup setup;
-
-  /* --- default values, normally over-ridden by values in a *.conf file --- */
-  int   R = 0;   // radius of detector, in grid lengths
-  int   L = 0;   // length of detector, in grid lengths
-  int   RC = 0;  // radius of central contact, in grid lengths
-  int   LC = 0;  // length of central contact, in grid lengths
-  int   LT = 0;  // length of taper, in grid lengths
-  int   RO = 0;  // radius of wrap-around outer (Li) contact, in grid lengths
-  int   LO = 0;  // length of ditch next to wrap-around outer (Li) contact, in grid lengths
-  int   WO = 0;  // width of ditch next to wrap-around outer (Li) contact, in grid lengths
-  int   BRT = 0; // radius of bulletization at top of crystal
-  float BV = 0;  // bias voltage
-  float N = 1;   // charge density at z=0 in units of e+10/cm3
-  float M = 0;   // charge density gradient, in units of e+10/cm4
+  MJD_Fieldgen     fg;
+  char  *config_file_name = NULL, *list_file = NULL, *sweep_file = NULL, *fit_file = NULL;
+  float BV = 0;  // bias voltage from the command line
+  float find_tol = 0;  // if > 0, find the depletion voltage to within this many volts
+  int   set_BV = 0, set_WV = -1, set_WP = -1, nthreads = 0, i;
 
   int   WV = 0;  // 0: do not write the V and E values to ppc_ev.dat
                  // 1: write the V and E values to ppc_ev.dat
                  // 2: write the V and E values for both +r, -r (for gnuplot, NOT for siggen)
   int   WP = 0;  // 0: do not calculate the weighting potential
                  // 1: calculate the WP and write the values to ppc_wp.dat
-  /* ---  ---  ---  ---  ---  ---  ---  ---  ---  ---  ---  ---  ---  --- */
-
-  double **v[2], **eps, **eps_dr, **eps_dz, **vfraction, *s1, *s2;
-  char   **undepleted, config_file_name[256];
-  int    **bulk, *rrc;
-  float  *drrc, *frrc;
-  double eps_sum, v_sum, mean, min, f, f1z, f2z, f1r, f2r;
-  double e_over_E = 11.31; // e/epsilon
-                           // for 1 mm2, charge units 1e10 e/cm3, espilon = 16*epsilon0
-  float  dif, sum_dif=0, max_dif, a, b, c, grid = 0.5, dRC, dLC, fLC=0;
-  float  E_r, E_z, bubble_volts=0, cs, gridstep[3];
-  int    i, j, r, z, iter, old, new=0, zz, rr, istep, max_its;
-  FILE   *file;
-  time_t t0=0, t1, t2=0;
-  double esum, esum2, pi=3.14159, Epsilon=(8.85*16.0/1000.0);  // permittivity of Ge in pF/mm
-  double pinched_sum1, pinched_sum2, *imp_ra, *imp_rm, *imp_z, S=0;
-  int    gridfact, fully_depleted=0, LL=L, RR=R, zmax, rmax;
-  double **vsave;
 
 
   if (argc%2 != 1) {
@@ -79,1073 +55,466 @@ int main(int argc, char **argv)
 	   "      -c config_file_name\n"
 	   "      -b bias_volts\n"
 	   "      -w {0,1}    (do_not/do write the field file)\n"
-	   "      -p {0,1}    (do_not/do write the WP file)\n");
+	   "      -p {0,1}    (do_not/do write the WP file)\n"
+	   "      -l list_file  (batch mode; list of config file names, optionally with bias volts)\n"
+	   "      -s config_file_name  (sweep mode; config file with lists or ranges of values)\n"
+	   "      -j threads    (number of threads for batch, sweep and fit modes)\n"
+	   "      -d volts      (find depletion and pinch-off voltages to within volts)\n"
+	   "      -f fit_file   (fit impurity profile to the measurements in fit_file)\n");
     return 1;
   }
 
   for (i=1; i<argc-1; i+=2) {
     if (strstr(argv[i], "-c")) {
       if (read_config(argv[i+1], &setup)) return 1;
-      strncpy(config_file_name, argv[i+1], sizeof(config_file_name));
-
-      if (setup.xtal_grid < 0.001) setup.xtal_grid = 0.5;
-      grid = setup.xtal_grid;
-
-      L  = LL = lrint(setup.xtal_length/grid);
-      R  = RR = lrint(setup.xtal_radius/grid);
-      BRT = lrint(setup.top_bullet_radius/grid);
-      // BRB = lrint(setup.bottom_bullet_radius/grid);
-      LC = lrint(setup.pc_length/grid);
-      RC = lrint(setup.pc_radius/grid);
-      LT = lrint(setup.taper_length/grid);
-      RO = lrint(setup.wrap_around_radius/grid);
-      LO = lrint(setup.ditch_depth/grid);
-      WO = lrint(setup.ditch_thickness/grid);
-      // LiT = lrint(setup.Li_thickness/grid);
-      N  = setup.impurity_z0;
-      M  = setup.impurity_gradient;
-      BV = setup.xtal_HV;
-      WV = setup.write_field;
-      WP = setup.write_WP;
-
+      config_file_name = argv[i+1];
+      set_BV = 0;
+      set_WV = set_WP = -1;
     } else if (strstr(argv[i], "-b")) {
       BV = atof(argv[i+1]);   // bias volts
+      set_BV = 1;
     } else if (strstr(argv[i], "-w")) {
-      WV = atoi(argv[i+1]);   // write-out options
+      set_WV = atoi(argv[i+1]);   // write-out options
     } else if (strstr(argv[i], "-p")) {
-      WP = atoi(argv[i+1]);   // weighting-potential options
+      set_WP = atoi(argv[i+1]);   // weighting-potential options
+    } else if (strstr(argv[i], "-l")) {
+      list_file = argv[i+1];      // list of detectors for batch mode
+    } else if (strstr(argv[i], "-s")) {
+      sweep_file = argv[i+1];     // config file for sweep mode
+    } else if (strstr(argv[i], "-j")) {
+      nthreads = atoi(argv[i+1]); // number of threads for batch mode
+    } else if (strstr(argv[i], "-d")) {
+      find_tol = atof(argv[i+1]); // resolution for depletion voltage search
+    } else if (strstr(argv[i], "-f")) {
+      fit_file = argv[i+1];       // measurements for impurity fit
     } else {
       printf("Possible options:\n"
 	     "      -c config_file_name\n"
 	     "      -b bias_volts\n"
 	     "      -w {0,1,2}    (for WV options)\n"
-	     "      -p {0,1}      (for WP options)\n");
+	     "      -p {0,1}      (for WP options)\n"
+	     "      -l list_file  (batch mode)\n"
+	     "      -s config_file_name  (sweep mode)\n"
+	     "      -j threads    (for batch, sweep and fit modes)\n"
+	     "      -d volts      (find depletion and pinch-off voltages)\n"
+	     "      -f fit_file   (fit impurity profile to measurements)\n");
       return 1;
     }
   }
 
-  if (L <= 1 || R <= 1) {
+  if (sweep_file) return sweep(sweep_file, nthreads, set_WV, set_WP);
+  if (list_file) return batch(list_file, nthreads, set_BV, BV, set_WV, set_WP, find_tol);
+  if (!config_file_name) {
     printf("ERROR: No configuration file specified.\n"
 	   "Possible options:\n"
 	   "      -c config_file_name\n"
 	   "      -b bias_volts\n"
 	   "      -w {0,1,2}    (for WV options)\n"
-	   "      -p {0,1}      (for WP options)\n");
-    return 1;
-  }
-  if (L*R > 2500*2500) {
-    printf("Error: Crystal size divided by grid size is too large!\n");
+	   "      -p {0,1}      (for WP options)\n"
+	   "      -l list_file  (batch mode)\n"
+	   "      -s config_file_name  (sweep mode)\n"
+	   "      -j threads    (for batch, sweep and fit modes)\n"
+	   "      -d volts      (find depletion and pinch-off voltages)\n"
+	   "      -f fit_file   (fit impurity profile to measurements)\n");
     return 1;
   }
+  if (set_BV) setup.xtal_HV = BV;
+  WV = (set_WV >= 0 ? set_WV : setup.write_field);
+  WP = (set_WP >= 0 ? set_WP : setup.write_WP);
   if (WV < 0 || WV > 2) WV = 0;
 
-  if (RO <= 0.0 || RO >= R) {
-    RO = R - LT;    // inner radius of taper, in grid lengths
-    printf("\n\n"
-	   " Crystal: Radius x Length: %.1f x %.1f mm\n"
-	   "   Taper: %.1f mm\n"
-	   "No wrap-around contact or ditch...\n"
-	   "Bias: %.0f V\n"
-	   "Impurities: (%.3f + %.3fz) e10/cm3\n\n",
-	   grid * (float) R, grid * (float) L, grid * (float) LT,
-	   BV, N, M);
-  } else {
-    printf("\n\n"
-	   "    Crystal: Radius x length: %.1f x %.1f mm\n"
-	   "      Taper: %.1f mm\n"
-	   "Wrap-around: Radius x ditch x gap:  %.1f x %.1f x %.1f mm\n"
-	   "       Bias: %.0f V\n"
-	   " Impurities: (%.3f + %.3fz) e10/cm3\n\n",
-	   grid * (float) R, grid * (float) L, grid * (float) LT,
-	   grid * (float) RO, grid * (float) LO, grid * (float) WO, BV, N, M);
+  if (fit_file) return fieldgen_fit(&setup, config_file_name, fit_file, nthreads);
+  if (find_tol > 0) {
+    i = (fieldgen_init(&fg, &setup, config_file_name, NULL) ||
+	 fieldgen_find_voltages(&fg, find_tol));
+    fieldgen_free(&fg);
+    return i;
   }
-  if (setup.bulletize_PC)
-    printf("   Contact: Radius x length: %.1f x %.1f mm, bulletized\n\n",
-	   grid * (float) RC, grid * (float) LC);
-  else
-    printf("   Contact: Radius x length: %.1f x %.1f mm, not bulletized\n\n",
-	   grid * (float) RC, grid * (float) LC);
+  if (setup.cache_dir[0] && fieldgen_cache_fetch(&setup, WV, WP == 1, NULL)) return 0;
 
-    if ((BV < 0 && N < 0) || (BV > 0 && N > 0)) {
-    printf("ERROR: Expect bias and impurity to be opposite sign!\n");
-    return 1;
-  }
-  if (BRT > 0)
-    printf("   Radius of top-of-crystal bulletization is %.1f mm\n\n", grid * (float) BRT);
+  if (fieldgen_init(&fg, &setup, config_file_name, NULL) ||
+      fieldgen_run(&fg, (WV ? setup.field_name : NULL),
+		   WP, (WP == 1 ? setup.wp_name : NULL))) return 1;
+  if (setup.cache_dir[0] && fieldgen_cache_store(&fg))
+    printf("ERROR: Failed to save fields in cache %s\n", setup.cache_dir);
 
-  if (N > 0) {
-    // swap polarity for n-type material; this lets me assume all voltages are positive
-    BV = -BV;
-    M = -M;
-    N = -N;
-  }
-
-  /* malloc arrays
-     float v[2][L+5][R+5];
-     float eps[L+1][R+1], eps_dr[L+1][R+1], eps_dz[L+1][R+1];
-     float vfraction[L+1][R+1], s1[R], s2[R], drrc[LC+2], drrc[LC+2];
-     char  undepleted[R+1][L+1];
-     int   bulk[L+1][R+1], rrc[LC+2];
-  */
-  if ((v[0]   = malloc((L+5)*sizeof(*v[0]))) == NULL ||
-      (v[1]   = malloc((L+5)*sizeof(*v[1]))) == NULL ||
-      (eps    = malloc((L+1)*sizeof(*eps)))  == NULL ||
-      (eps_dr = malloc((L+1)*sizeof(*eps_dr))) == NULL ||
-      (eps_dz = malloc((L+1)*sizeof(*eps_dz))) == NULL ||
-      (bulk   = malloc((L+1)*sizeof(*bulk)))   == NULL ||
-      (vfraction  = malloc((L+1)*sizeof(*vfraction)))  == NULL ||
-      (undepleted = malloc((R+1)*sizeof(*undepleted))) == NULL ||
-      (imp_ra = malloc((R+1)*sizeof(*imp_ra))) == NULL ||
-      (imp_rm = malloc((R+1)*sizeof(*imp_rm))) == NULL ||
-      (imp_z = malloc((L+1)*sizeof(*imp_z))) == NULL ||
-      (rrc   = malloc((LC+2)*sizeof(*rrc)))  == NULL ||
-      (drrc  = malloc((LC+2)*sizeof(*drrc))) == NULL ||
-      (frrc  = malloc((LC+2)*sizeof(*frrc))) == NULL ||
-      (s1 = malloc((R+1)*sizeof(*s1))) == NULL ||
-      (s2 = malloc((R+1)*sizeof(*s2))) == NULL ||
-      (vsave = malloc((LC+2)*sizeof(*vsave))) == NULL
-      ) {
-    printf("Malloc failed\n");
-    return 1;
-  }
-#define ERR { printf("Malloc failed; j = %d\n", j); return 1; }
-  for (j=0; j<L+1; j++) if ((v[0][j] = malloc((R+5)*sizeof(**v[0]))) == NULL) ERR;
-  for (j=0; j<L+1; j++) if ((v[1][j] = malloc((R+5)*sizeof(**v[1]))) == NULL) ERR;
-  for (j=0; j<L+1; j++) if ((eps[j]  = malloc((R+1)*sizeof(**eps)))  == NULL) ERR;
-  for (j=0; j<L+1; j++) if ((eps_dr[j] = malloc((R+1)*sizeof(**eps_dr))) == NULL) ERR;
-  for (j=0; j<L+1; j++) if ((eps_dz[j] = malloc((R+1)*sizeof(**eps_dz))) == NULL) ERR;
-  for (j=0; j<L+1; j++) if ((bulk[j] = malloc((R+1)*sizeof(**bulk))) == NULL) ERR;
-  for (j=0; j<L+1; j++) if ((vfraction[j] = malloc((R+1)*sizeof(**vfraction))) == NULL) ERR;
-  for (j=0; j<LC+2; j++) if ((vsave[j]  = malloc((RC+2)*sizeof(**vsave)))  == NULL) ERR;
-  for (j=0; j<R+1; j++) {
-    if ((undepleted[j] = malloc((L+1)*sizeof(**undepleted))) == NULL) ERR;
-    memset(undepleted[j], ' ', (L+1)*sizeof(**undepleted));
-  }
-  for (r=0; r<R+1; r++) {
-    imp_ra[r] = 0.0;
-    imp_rm[r] = 1.0;
-  }
+  fieldgen_free(&fg);
+  return 0;
+}
 
-  /* In the following we divide areas and volumes by pi
-    r_bin   rmax  A_top A_outside A_inside  volume  total_surf  out/top  tot/vol
-      0     1/2    1/4      1         0       1/4      1.5         4        6  << special case
-      1     3/2      2      3         1        2        8        3/2        4
-      2     5/2      4      5         3        4       16        5/4        4
-      3     7/2      6      7         5        6       24        7/6        4
-      r   r+0.5     2r    2r+1      2r-1      2r       8r     (2r+1)/2r     4
-                                                              = 1+0.5/r
-  */
-  // weighting values for the relaxation alg. as a function of r
-  s1[0] = 4.0;
-  s2[0] = 0.0;
-  for (r=1; r<R+1; r++) {
-    s1[r] = 1.0 + 0.5 / (double) r;   //  for r+1
-    s2[r] = 1.0 - 0.5 / (double) r;   //  for r-1
-  }
+/* ------------------------------------------------------------------------
+   batch mode: calculate the fields for many detectors, sharing the threads
+   of a work-stealing pool (see pool.h). Each detector is one job; the largest
+   are started first, and idle threads help with the relaxation of the
+   detectors still running, so that the last few large detectors
+   use all the threads.
+   Each detector gets its own log file, named after its field file;
+   progress and timing are reported on stdout.
+
+   Detectors can also be given as a chain, which are done one after another
+   by the same thread; see sweep() below.
+*/
 
-  /*
-    If grid is too small compared to the crystal size, then it will take too
-    long for the relaxation to converge. In that case, we use an adaptive
-    grid, where we start out coarse and then refine the grid.
-  */
-  cs = sqrt(setup.xtal_length * setup.xtal_radius);
-  i = 1 + ((int) (cs/grid)) / 100;
-  if (i < 2) {
-    gridstep[0] = grid;
-    gridstep[1] = gridstep[2] = 0;
-    printf("Single grid size: %.4f\n", grid);
-  } else if (i < 6) {
-    gridstep[0] = (float) i * grid;
-    gridstep[1] = grid;
-    gridstep[2] = 0;
-    printf("Two grid sizes: %.4f %.4f\n", gridstep[0], grid);
-  } else {  // i > 5
-    j = (i+4)/5;
-    i = (i+j-1)/j;
-    gridstep[0] = (float) (i*j) * grid;
-    gridstep[1] = (float) j * grid;
-    gridstep[2] = grid;
-    printf("Three grid sizes: %.4f %.4f %.4f (%d %d)\n",
-	   gridstep[0], gridstep[1], grid, i, j);
-  }
+typedef struct {
+  char   config_file_name[256];
+  MJD_Siggen_Setup setup;
+  int    WV, WP;      // write-out and WP options, as for a single detector
+  double size;        // number of grid points, used to start large detectors first
+  double seconds;     // time taken
+  int    status;      // 0 for success
+  int    index;       // used for sorting in sweep mode
+} Batch_Job;
+
+/* jobs that are done in turn by one thread */
+typedef struct {
+  Batch_Job *job;
+  int    njobs;
+  double size;
+} Batch_Chain;
+
+static struct {
+  Pool   *pool;
+  Batch_Job *jobs;
+  int    njobs, ndone, nfailed;
+  float  find_tol;    // if > 0, find the depletion voltages rather than the fields
+  double t0;          // start time
+  pthread_mutex_t lock;
+} bat;
+
+/* batch_file_name
+   put the name of the field file of job, with its .dat extension
+   replaced by ext, into name
+*/
+static void batch_file_name(Batch_Job *job, char *ext, char *name, int len) {
+  char *c;
 
-  /* to be safe, initialize overall potential to bias voltage */
-  for (z=0; z<LL+1; z++) {
-    for (r=0; r<RR+1; r++) {
-      v[0][z][r] = v[1][z][r] = BV;
-    }
+  if (job->setup.field_name[0]) {
+    snprintf(name, len, "%s", job->setup.field_name);
+  } else {
+    snprintf(name, len, "%s", job->config_file_name);
   }
-  if (setup.verbosity >= CHATTY)
-    t0 = t2 = time(NULL);  // for calculating elapsed time later...
-  max_its = MAX_ITS;
-  if (setup.max_iterations > 0) max_its = setup.max_iterations;
-  /* now set up and perform the relaxation for each of the grid step sizes in turn */
-  for (istep=0; istep<3 && gridstep[istep]>0; istep++) {
-    grid = gridstep[istep]; // grid size for this go-around
-    old = 1;
-    new = 0;
-    /*  e/espilon * area of pixel in mm2 / 4
-	for 1 mm2, charge units 1e10 e/cm3, espilon = 16*epsilon0
-	4.0 = surface area / volume of voxel in cylindrical (2D) coords
-	(this would be 6.0 in cartesian coords) */
-    e_over_E = 11.31 * grid*grid / 4.0;
-
-    if (istep > 0) {
-      /* not the first go-around, so the previous calculation was on a coarser grid...
-	 now copy/expand the potential to the new finer grid
-      */
-      i = (int) (gridstep[istep-1] / gridstep[istep] + 0.5);
-      f = 1.0 / (float) i;
-      printf("\ngrid %.4f -> %.4f; ratio = %d %.3f\n\n",
-	     gridstep[istep-1], gridstep[istep], i, f);
-      for (z=0; z<L+1; z++) {
-	for (r=0; r<R+1; r++) {
-	  f1z = 0.0;
-	  zmax = i*z+i;
-	  if (zmax > LL+1) zmax = LL+1;
-	  for (zz=i*z; zz<zmax; zz++) {
-	    f2z = 1.0 - f1z;
-	    f1r = 0.0;
-	    rmax = i*r+i;
-	    if (rmax > RR+1) rmax = RR+1;
-	    for (rr=i*r; rr<rmax; rr++) {
-	      f2r = 1.0 - f1r;
-	      v[0][zz][rr] =      // linear interpolation of potential
-		f2z*f2r*v[1][z][r  ] + f1z*f2r*v[1][z+1][r  ] +
-		f2z*f1r*v[1][z][r+1] + f1z*f1r*v[1][z+1][r+1];
-	      f1r += f;
-	    }
-	    f1z += f;
-	  }
-	}
-      }
-    }
-
-    // recalculate geometry dimensions in units of the current grid size
-    L  = lrint(setup.xtal_length/grid);
-    R  = lrint(setup.xtal_radius/grid);
-    BRT = lrint(setup.top_bullet_radius/grid);
-    // BRB = lrint(setup.bottom_bullet_radius/grid);
-    LC = lrint(setup.pc_length/grid);
-    // distance in grid units from PC length to the middle of the nearest pixel:
-    dLC = setup.pc_length/grid - (float) LC;
-    if (dLC < 0.01 && dLC > -0.01) dLC = 0;
-    RC = lrint(setup.pc_radius/grid);
-    // distance in grid units from PC radius to the middle of the nearest pixel:
-    dRC = setup.pc_radius/grid - (float) RC;
-    if (dRC < 0.05 && dRC > -0.05) dRC = 0;
-    /* set up bulletization inside point contact */
-    if (setup.bulletize_PC) {
-      for (z=0; z<=LC; z++) {
-        if (setup.pc_length <= setup.pc_radius) {  // LC <= RC; use LC as bulletization radius
-          a = setup.pc_radius - setup.pc_length;
-          b = z * grid;
-          c = setup.pc_length*setup.pc_length - b*b;
-          if (c < 0.0) c = 0;
-          c = a + sqrt(c);
-        } else {  // LC > RC; use RC as bulletization radius
-          if (z > LC-RC) {
-            a = setup.pc_length - setup.pc_radius;
-            b = z * grid - a;
-            c = setup.pc_radius*setup.pc_radius - b*b;
-            if (c < 0.0) c = 0;
-            c = sqrt(c);
-          } else {
-            c = setup.pc_radius;
-          }
-        }
-        rrc[z] = lrint(c/grid);
-        drrc[z] = c/grid - (float) rrc[z];
-        if (drrc[z] < 0.05 && drrc[z] > -0.05) drrc[z] = 0;
-        frrc[z] = 0;
-        // printf(">> z rrc drrc: %d %d %f\n", z, rrc[z], drrc[z]);
-      }
-      drrc[LC+1] = drrc[LC];
-    } else {  // no bulletization
-      for (z=0; z<=LC+1; z++) {
-        rrc[z] = RC;
-        drrc[z] = dRC;
-        frrc[z] = 0;
-      }
-    }
-    
-    LT = lrint(setup.taper_length/grid);
-    RO = lrint(setup.wrap_around_radius/grid);
-    LO = lrint(setup.ditch_depth/grid);
-    WO = lrint(setup.ditch_thickness/grid);
-    // LiT = lrint(setup.Li_thickness/grid);
-
-    S = setup.impurity_surface * e_over_E / grid;
-    for (z=0; z<L+1; z++) {
-      imp_z[z] = (N + 0.1 * M * grid * (double) z + 
-		  setup.impurity_quadratic * (1.0 - (double) ((z-L/2)*(z-L/2)) /
-					      (double) (L*L/4))) * e_over_E;
-    }
-    if (setup.impurity_rpower > 0.1) {
-      for (r=0; r<R+1; r++) {
-	imp_ra[r] = setup.impurity_radial_add * e_over_E *
-	  pow((double) r / (double) R, setup.impurity_rpower);
-	imp_rm[r] = 1.0 + (setup.impurity_radial_mult - 1.0f) *
-	  pow((double) r / (double) R, setup.impurity_rpower);
-      }
-    }
-    if (setup.verbosity >= NORMAL)
-      printf("grid = %f  RC = %d  dRC = %f  LC = %d  dLC = %f\n\n",
-	     grid, RC, dRC, LC, dLC);
-    if (RO <= 0.0 || RO >= R) RO = R - LT;    // inner radius of taper, in grid lengths
-
-    if (istep == 0) {
-      // no previous coarse relaxation, so make initial wild guess at potential:
-      for (z=0; z<L; z++) {
-	a = BV * (float) (z) / (float) L;
-	for (r=0; r<R; r++) {
-	  v[0][z][r] =  a + (BV - a) * (float) (r) / (float) R;
-	}
-      }
-    }
-
-    /* boundary conditions and permittivity
-       boundary condition at Ge-vacuum interface:
-       epsilon0 * E_vac = espilon_Ge * E_Ge
-    */
-    for (z=0; z<L+1; z++) {
-      for (r=0; r<R+1; r++) {
-	eps[z][r] = eps_dz[z][r] = eps_dr[z][r] = 16;   // permittivity inside Ge
-	if (z < LO  && r < RO && r > RO-WO-1) eps[z][r] =  1;  // permittivity inside vacuum
-	if (r > 0) eps_dr[z][r-1] = (eps[z][r-1]+eps[z][r])/2.0f;
-	if (z > 0) eps_dz[z-1][r] = (eps[z-1][r]+eps[z][r])/2.0f;
-      }
-    }
+  if ((c = strrchr(name, '.')) && !strcmp(c, ".dat")) *c = '\0';
+  strncat(name, ext, len - strlen(name) - 1);
+}
 
-    for (z=0; z<L+1; z++) {
-      for (r=0; r<R+1; r++) {
-	vfraction[z][r] = 1.0;
-	if (z < LO && r < RO && r > RO-WO-1) {
-	  vfraction[z][r] = 0.0;
-	}
-	// boundary conditions
-	bulk[z][r] = 0;  // flag for normal bulk, no complications
-	// outside (HV) contact:
-	if (z == L ||
-	    r == R ||
-	    r >= z + R - LT ||       // taper
-	    (z == 0 && r >= RO) ||   // wrap-around
-            (BRT > 0 && r > R-BRT && z > L-BRT &&
-             (r-R+BRT)*(r-R+BRT) + (z-L+BRT)*(z-L+BRT) > BRT*BRT)) {   // top bulletization
-	  bulk[z][r] = -1;               // value of v[*][z][r] is fixed...
-	  v[0][z][r] = v[1][z][r] = BV;  // at the bias voltage
-	}
-	// inside (point) contact, with optional bulletization:
-	else if (z <= LC && r <= rrc[z]) {
-	  bulk[z][r] = -1;                // value of v[*][z][r] is fixed...
-	  v[0][z][r] = v[1][z][r] = 0;    // at zero volts
-	  /* radial edge of inside contact; if the PC radius is not in the middle
-	     of a pixel, we want to modify interpolation of V in surrounding pixels
-	  */
-	  if (r == rrc[z] && drrc[z] < -0.05) {
-	    bulk[z][r] = 1;  // flag for radial edge of PC
-	    frrc[z] = -1.0/drrc[z];  // interpolation weight for pixel at (r-1)
-	    // only part of the pixel has volume charge density, the rest is contact
-	    vfraction[z][r] *= -2.0*drrc[z];
-	  }
-	  /* z edge of inside contact; if the PC length is not in the middle
-	     of a pixel, we want to modify interpolation of V in surrounding pixels
-	  */
-	  if (z == LC && dLC < -0.05) {
-	    bulk[z][r] = 2;  // flag for z edge of PC
-	    fLC = -1.0/dLC;  // interpolation weight for pixel at (z-1)
-	    // only part of the pixel has volume charge density, the rest is contact
-	    vfraction[z][r] *= -2.0*dLC;
-	  }
-	}
-	/* edges of inside contact; if the PC radius and/or legth is not in the middle
-	   of a pixel, we want to modify interpolation of V in surrounding pixels...
-	   in this case, the radius/length > grid point, so it modifies the
-	   interpolation for the next point out
-	*/
-	// FIXME: Check for adjacent ditch
-	else if (z <= LC && r == rrc[z]+1 && drrc[z] > 0.05) {
-	  bulk[z][r] = 1;         // flag for radial edge of PC
-	  frrc[z] = 1.0/(1.0 - drrc[z]);  // interpolation weight for pixel at (r-1)
-	}
-	else if (z == LC+1 && r <= rrc[z] && dLC > 0.05) {
-	  bulk[z][r] = 2;         // flag for z edge of PC
-	  fLC = 1.0/(1.0 - dLC);  // interpolation weight for pixel at (z-1)
+/* batch_run
+   calculate the fields for one detector
+*/
+static void batch_run(Batch_Job *job) {
+  MJD_Fieldgen fg;
+  double t0;
+  char   log_name[300], undep_name[300], volts[80], *result;
+  FILE   *log;
+
+  t0 = timer_now();
+  result = "done";
+  job->status = 0;
+  if (bat.find_tol <= 0 && job->setup.cache_dir[0] &&
+      fieldgen_cache_fetch(&job->setup, job->WV, job->WP == 1, NULL)) {
+    result = "from cache";
+  } else {
+    batch_file_name(job, ".log", log_name, sizeof(log_name));
+    batch_file_name(job, "_undepleted.txt", undep_name, sizeof(undep_name));
+    if (!(log = fopen(log_name, "w"))) {
+      printf("ERROR: Cannot open log file %s\n", log_name);
+      job->status = 1;
+    } else {
+      job->status = fieldgen_init(&fg, &job->setup, job->config_file_name, log);
+      if (!job->status && bat.find_tol > 0) {
+	fg.pool = bat.pool;
+	if (!(job->status = fieldgen_find_voltages(&fg, bat.find_tol))) {
+	  snprintf(volts, sizeof(volts), "depletion %.1f V, pinch-off %.1f V",
+		   fg.full_depletion_voltage, fg.pinchoff_voltage);
+	  result = volts;
 	}
+      } else if (!job->status) {
+	fg.pool = bat.pool;
+	fg.undepleted_file = undep_name;
+	job->status = fieldgen_run(&fg, (job->WV ? job->setup.field_name : NULL),
+				   job->WP, (job->WP == 1 ? job->setup.wp_name : NULL));
       }
+      if (!job->status && bat.find_tol <= 0 &&
+	  job->setup.cache_dir[0] && fieldgen_cache_store(&fg))
+	fprintf(log, "ERROR: Failed to save fields in cache %s\n", job->setup.cache_dir);
+      fieldgen_free(&fg);
+      fclose(log);
     }
+    if (job->status) result = "FAILED; see log file";
+  }
+  job->seconds = timer_now() - t0;
+
+  pthread_mutex_lock(&bat.lock);
+  bat.ndone++;
+  if (job->status) bat.nfailed++;
+  printf("[%3d/%d] %8.1f s  %-40s %7.1f s  %s\n", bat.ndone, bat.njobs,
+	 timer_now() - bat.t0, job->config_file_name, job->seconds, result);
+  fflush(stdout);
+  pthread_mutex_unlock(&bat.lock);
+}
 
-    // now do the actual relaxation
-    //for (iter=0; iter<max_its/3; iter++) {
-    for (iter=0; iter<max_its; iter++) {
-      if (old == 0) {
-	old = 1;
-	new = 0;
-      } else {
-	old = 0;
-	new = 1;
-      }
-      sum_dif = 0.0f;
-      max_dif = 0.0f;
-      bubble_volts = 0.0f;
-
-      for (z=0; z<L; z++) {
-	for (r=0; r<R; r++) {
-	  if (bulk[z][r] < 0) continue;      // outside or inside contact
+/* batch_chain
+   pool job to calculate the fields for a chain of detectors
+*/
+static void batch_chain(void *arg) {
+  Batch_Chain *chain = arg;
+  int i;
 
-	  if (bulk[z][r] == 0) {             // normal bulk, no complications
-	    v_sum = v[old][z+1][r]*eps_dz[z][r] + v[old][z][r+1]*eps_dr[z][r]*s1[r];
-	    eps_sum = eps_dz[z][r] + eps_dr[z][r]*s1[r];
-	    min = fminf(v[old][z+1][r], v[old][z][r+1]);
-	    if (z > 0) {
-	      v_sum += v[old][z-1][r]*eps_dz[z-1][r];
-	      eps_sum += eps_dz[z-1][r];
-	      min = fminf(min, v[old][z-1][r]);
-	    } else {
-	      v_sum += v[old][z+1][r]*eps_dz[z][r];  // reflection symm around z=0
-	      eps_sum += eps_dz[z][r];
-	    }
-	    if (r > 0) {
-	      v_sum += v[old][z][r-1]*eps_dr[z][r-1]*s2[r];
-	      eps_sum += eps_dr[z][r-1]*s2[r];
-	      min = fminf(min, v[old][z][r-1]);
-	    } else {
-	      v_sum += v[old][z][r+1]*eps_dr[z][r]*s1[r];  // reflection symm around r=0
-	      eps_sum += eps_dr[z][r]*s1[r];
-	    }
+  for (i=0; i<chain->njobs; i++) batch_run(&chain->job[i]);
+}
 
-	  } else if (bulk[z][r] == 1) {    // interpolated radial edge of point contact
-	    /* since the PC radius is not in the middle of a pixel,
-	       use a modified weight for the interpolation to (r-1)
-	     */
-	    v_sum = v[old][z+1][r]*eps_dz[z][r] + v[old][z][r+1]*eps_dr[z][r]*s1[r] +
-	            v[old][z][r-1]*eps_dr[z][r-1]*s2[r]*frrc[z];
-	    eps_sum = eps_dz[z][r] + eps_dr[z][r]*s1[r] + eps_dr[z][r-1]*s2[r]*frrc[z];
-	    min = fminf(v[old][z+1][r], v[old][z][r+1]);
-	    min = fminf(min, v[old][z][r-1]);
-	    if (z > 0) {
-	      v_sum += v[old][z-1][r]*eps_dz[z-1][r];
-	      eps_sum += eps_dz[z-1][r];
-	      min = fminf(min, v[old][z-1][r]);
-	    } else {
-	      v_sum += v[old][z+1][r]*eps_dz[z][r];  // reflection symm around z=0
-	      eps_sum += eps_dz[z][r];
-	    }
-	  } else if (bulk[z][r] == 2) {    // interpolated z edge of point contact
-	    /* since the PC length is not in the middle of a pixel,
-	       use a modified weight for the interpolation to (z-1)
-	     */
-	    v_sum = v[old][z+1][r]*eps_dz[z][r] + v[old][z][r+1]*eps_dr[z][r]*s1[r] +
-	            v[old][z-1][r]*eps_dz[z-1][r]*fLC;
-	    eps_sum = eps_dz[z][r] + eps_dr[z][r]*s1[r] + eps_dz[z-1][r]*fLC;
-	    min = fminf(v[old][z+1][r], v[old][z][r+1]);
-	    min = fminf(min, v[old][z-1][r]);
-	    if (r > 0) {
-	      v_sum += v[old][z][r-1]*eps_dr[z][r-1]*s2[r];
-	      eps_sum += eps_dr[z][r-1]*s2[r];
-	      min = fminf(min, v[old][z][r-1]);
-	    } else {
-	      v_sum += v[old][z][r+1]*eps_dr[z][r]*s1[r];  // reflection symm around r=0
-	      eps_sum += eps_dr[z][r]*s1[r];
-	    }
-	    // check for cases where the PC corner needs modification in both r and z
-	    if (z == LC && bulk[z-1][r] == 1) {
-	      v_sum += v[old][z][r-1]*eps_dr[z][r-1]*s2[r]*(frrc[z]-1.0);
-	      eps_sum += eps_dr[z][r-1]*s2[r]*(frrc[z]-1.0);
-	      min = fminf(min, v[old][z][r-1]);
-	    }
+static int chain_cmp(const void *a, const void *b) {
+  double sa = ((Batch_Chain *) a)->size, sb = ((Batch_Chain *) b)->size;
 
-	  } else {
-	    printf(" ERROR! bulk = %d undefined for (z,r) = (%d,%d)\n",
-		   bulk[z][r], z, r);
-	    return 1;
-	  }
+  return (sa < sb) - (sa > sb);   // largest first
+}
 
-	  // calculate the interpolated mean potential and the effect of the space charge
-	  mean = v_sum / eps_sum;
-	  v[new][z][r] = mean + vfraction[z][r] * (imp_z[z]*imp_rm[r] + imp_ra[r]);
-	  if (r == 0)  // special case where volume of voxel is 1/6 of area, not 1/4
-	    v[new][z][r] = mean + (vfraction[z][r] * (imp_z[z]*imp_rm[r] + imp_ra[r])) / 1.5;
-	  if ((z == 0 && r > RC && r < RO-WO) ||        // passivated surface at z = 0
-              (z < LO && (r == RO || r == RO-WO-1)) ||  // passivated surface on sides of ditch
-              (z == LO && r <= RO && r >= RO-WO-1))     // passivated surface at top of ditch
-	    v[new][z][r] += vfraction[z][r] * S;
-	  // check to see if the pixel is undepleted
-	  if (vfraction[z][r] > 0.45) undepleted[r][z] = '.';
-	  if (v[new][z][r] <= 0.0f) {
-	    v[new][z][r] = 0.0f;
-	    if (vfraction[z][r] > 0.45) undepleted[r][z] = '*';
-	  } else if (v[new][z][r] < min) {
-	    if (bubble_volts == 0.0f) bubble_volts = min + 0.1f;
-	    v[new][z][r] = bubble_volts;
-	    if (vfraction[z][r] > 0.45) undepleted[r][z] = '*';
-	  }
-	  // calculate difference from last iteration, for convergence check
-	  dif = v[old][z][r] - v[new][z][r];
-	  if (dif < 0.0f) dif = -dif;
-	  sum_dif += dif;
-	  if (max_dif < dif) max_dif = dif;
-	}
-      }
-      // report results for some iterations
-      if (iter < 10 || (iter < 600 && iter%100 == 0) || iter%1000 == 0)
-	printf("%5d %d %d %.10f %.10f\n", iter, old, new, max_dif, sum_dif/(float) (L*R));
-      if (max_dif < 0.000000001) break;
-    }
+/* batch_start
+   calculate the fields for the nchains chains of jobs, largest first,
+   using a pool of nthreads threads
+   returns 0 if all succeeded
+*/
+static int batch_start(Batch_Chain *chain, int nchains, int nthreads) {
+  int    i;
+
+  qsort(chain, nchains, sizeof(*chain), chain_cmp);
+  if (nthreads < 1) nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  printf("\nCalculating fields for %d detectors with %d threads\n\n", bat.njobs, nthreads);
+  fflush(stdout);
+  pthread_mutex_init(&bat.lock, NULL);
+  bat.t0 = timer_now();
+  if (!(bat.pool = pool_create(nthreads))) return 1;
+  for (i=0; i<nchains; i++) {
+    if (pool_job(bat.pool, batch_chain, &chain[i])) break;
+  }
+  pool_finish(bat.pool);
 
-    printf("\n>> %d %.16f\n\n", iter, sum_dif);
+  printf("\nFinished %d detectors in %.1f s; %d failed\n",
+	 bat.ndone, timer_now() - bat.t0, bat.nfailed);
+  return (bat.nfailed > 0 || bat.ndone < bat.njobs);
+}
 
-    fully_depleted = 1;
-    for (r=0; r<R+1; r++) {
-      for (z=0; z<L+1; z++) {
-	if (undepleted[r][z] == '*') {
-	  fully_depleted = 0;
-	  if (v[new][z][r] > 0.001) undepleted[r][z] = 'B';  // identifies pinch-off
-	}
-      }
-    }
-    if (fully_depleted) {
-      printf("Detector is fully depleted.\n");
-    } else {
-      printf("Detector is not fully depleted.\n");
-      if (bubble_volts > 0.0f) printf("Pinch-off bubble at %.0f V potential\n", bubble_volts);
-    }
-    if (setup.verbosity >= CHATTY) {
-      t1 = time(NULL);
-      printf("\n ^^^^^^^^^^^^^ %d (%d) s elapsed ^^^^^^^^^^^^^^\n",
-	     (int) (t1 - t0), (int) (t1 - t2));
-      t2 = t1;
-    }
+/* batch
+   calculate the fields for the detectors in list_file, which has
+   one config file name per line, optionally followed by the bias voltage;
+   if find_tol > 0, find the depletion and pinch-off voltages instead
+   returns 0 if all succeeded
+*/
+static int batch(char *list_file, int nthreads, int set_BV, float BV, int set_WV, int set_WP,
+		 float find_tol) {
+  Batch_Job   *job;
+  Batch_Chain *chain;
+  char   line[512], name[256];
+  float  bv;
+  FILE   *file;
+  int    i, n;
 
-    if (istep == 0) {
-      // can reduce # of iterations after first go-around
-      max_its /= MAX_ITS_FACTOR;
-      // report V and E along the axes r=0 and z=0
-      if (setup.verbosity >= NORMAL) {
-	printf("  z(mm)(r=0)      V   E(V/cm) |  r(mm)(z=0)      V   E(V/cm)\n");
-	a = b = v[new][0][0];
-	for (z=0; z<L+1; z++) {
-	  printf("%10.1f %8.1f %8.1f  |",
-		 ((float) z)*grid, v[new][z][0], (v[new][z][0] - a)/(0.1*grid));
-	  a = v[new][z][0];
-	  if (z > R) {
-	    printf("\n");
-	  } else {
-	    r = z;
-	    printf("%10.1f %8.1f %8.1f\n",
-		   ((float) r)*grid, v[new][0][r], (v[new][0][r] - b)/(0.1*grid));
-	    b = v[new][0][r];
-	  }
-	}
-      }
-      // write a little file that shows any undepleted voxels in the crystal
-      file = fopen("undepleted.txt", "w");
-      for (r=R; r>=0; r--) {
-	undepleted[r][L] = '\0';
-	fprintf(file, "%s\n", undepleted[r]);
-      }
-      fclose(file);
-    }
+  if (!(file = fopen(list_file, "r"))) {
+    printf("ERROR: Cannot open list file %s\n", list_file);
+    return 1;
   }
-
-  if (WV) {
-    if (setup.impurity_z0 > 0) {
-      // swap voltages back to negative for n-type material
-      for (r=0; r<R+1; r++) {
-	for (z=0; z<L+1; z++) {
-	  v[new][z][r] = -v[new][z][r];
-	}
-      }
-    }
-    // write potential and field to output file
-    if (!(file = fopen(setup.field_name, "w"))) {
-      printf("ERROR: Cannot open file %s for electric field...\n", setup.field_name);
+  bat.find_tol = find_tol;
+  while (fgets(line, sizeof(line), file)) {
+    /* ignore comments and blank lines */
+    if ((n = sscanf(line, "%255s %f", name, &bv)) < 1 || name[0] == '#') continue;
+    if (bat.njobs % 16 == 0 &&
+	!(bat.jobs = realloc(bat.jobs, (bat.njobs + 16) * sizeof(*bat.jobs)))) {
+      printf("Malloc failed in batch\n");
       return 1;
-    } else {
-      printf("Writing electric field data to file %s\n", setup.field_name);
     }
-    /* copy configuration parameters to output file */
-    report_config(file, config_file_name);
-    fprintf(file, "#\n# HV bias in fieldgen: %.1f V\n", BV);
-    if (fully_depleted) {
-      fprintf(file, "# Detector is fully depleted.\n");
-    } else {
-      fprintf(file, "# Detector is not fully depleted.\n");
-      if (bubble_volts > 0.0f) fprintf(file, "# Pinch-off bubble at %.0f V potential\n", bubble_volts);
-    }
-    fprintf(file, "#\n## r (mm), z (mm), V (V),  E (V/cm), E_r (V/cm), E_z (V/cm)\n");
-
-    for (r=0; r<R+1; r++) {
-      for (z=0; z<L+1; z++) {
-	// calc E in r-direction
-	if (r==0) {
-	  // E_r = (v[new][z][r] - v[new][z][r+1])/(0.1*grid);
-	  E_r = 0;
-	} else if (r==R) {
-	  E_r = (v[new][z][r-1] - v[new][z][r])/(0.1*grid);
-	} else {
-	  E_r = (v[new][z][r-1] - v[new][z][r+1])/(0.2*grid);
-	}
-	// calc E in z-direction
-	if (z==0) {
-	  E_z = (v[new][z][r] - v[new][z+1][r])/(0.1*grid);
-	} else if (z==L) {
-	  E_z = (v[new][z-1][r] - v[new][z][r])/(0.1*grid);
-	} else {
-	  E_z = (v[new][z-1][r] - v[new][z+1][r])/(0.2*grid);
-	}
-	fprintf(file, "%7.2f %7.2f %7.1f %7.1f %7.1f %7.1f\n",
-		((float) r)*grid,  ((float) z)*grid, v[new][z][r],
-		sqrt(E_r*E_r + E_z*E_z), E_r, E_z);
-      }
-      fprintf(file, "\n");
-    }
-    fclose(file);
+    job = &bat.jobs[bat.njobs];
+    memset(job, 0, sizeof(*job));
+    strcpy(job->config_file_name, name);
+    if (read_config(name, &job->setup)) return 1;
+    if (n > 1) {
+      job->setup.xtal_HV = bv;
+    } else if (set_BV) {
+      job->setup.xtal_HV = BV;
+    }
+    job->WV = (set_WV >= 0 ? set_WV : job->setup.write_field);
+    job->WP = (set_WP >= 0 ? set_WP : job->setup.write_WP);
+    if (job->WV < 0 || job->WV > 2) job->WV = 0;
+    if (job->setup.xtal_grid < 0.001) job->setup.xtal_grid = 0.5;
+    job->size = (job->setup.xtal_length * job->setup.xtal_radius /
+		 (job->setup.xtal_grid * job->setup.xtal_grid));
+    bat.njobs++;
   }
-
-
-  if (WP == 0) return 0;
-  if (fully_depleted) {
-    /* save potential close to point contact,
-       to use later when calculating depletion voltage */
-    for (z=0; z<LC+2; z++) {
-      for (r=0; r<RC+2; r++) {
-        vsave[z][r] = fabs(v[new][z][r]);
-      }
-    }
+  fclose(file);
+  if (bat.njobs == 0) {
+    printf("ERROR: No config files in list file %s\n", list_file);
+    return 1;
   }
-
-  /*
-    -------------------------------------------------------------------------
-    now calculate the weighting potential for the central contact
-    the WP is also needed for calculating the capacitance
-    -------------------------------------------------------------------------
-  */
-
-  printf("\nCalculating weighting potential...\n\n");
-  if (setup.verbosity >= CHATTY) t0 = t2 = time(NULL);
-  max_its = MAX_ITS;
-  if (setup.max_iterations > 0) max_its = setup.max_iterations;
-  // max_its = 2*MAX_ITS;  // use twice as many iterations for WP; accuracy is more important?
-  // if (setup.max_iterations > 0) max_its = 2*setup.max_iterations;
-
-  /* to be safe, initialize overall potential to 0 */
-  for (z=0; z<LL+1; z++) {
-    for (r=0; r<RR+1; r++) {
-      v[0][z][r] = v[1][z][r] = 0;
-    }
+  /* each detector is a chain of its own */
+  if (!(chain = calloc(bat.njobs, sizeof(*chain)))) {
+    printf("Malloc failed in batch\n");
+    return 1;
   }
-  for (istep=0; istep<3 && gridstep[istep]>0; istep++) {
-    grid = gridstep[istep];
-    old = 1;
-    new = 0;
-    // gridfact = integer ratio of current grid step size to final grid step size
-    gridfact = lrintf(grid / setup.xtal_grid);
-
-    if (istep > 0) {
-      /* the previous calculation was on a coarser grid...
-	 now copy/expand the potential to the new finer grid
-      */
-      i = (int) (gridstep[istep-1] / gridstep[istep] + 0.5);
-      f = 1.0 / (float) i;
-      printf("\ngrid %.4f -> %.4f; ratio = %d %.3f\n\n",
-	     gridstep[istep-1], gridstep[istep], i, f);
-      for (z=0; z<L+1; z++) {
-	for (r=0; r<R+1; r++) {
-	  f1z = 0.0;
-	  zmax = i*z+i;
-	  if (zmax > LL+1) zmax = LL+1;
-	  for (zz=i*z; zz<zmax; zz++) {
-	    f2z = 1.0 - f1z;
-	    f1r = 0.0;
-	    rmax = i*r+i;
-	    if (rmax > RR+1) rmax = RR+1;
-	    for (rr=i*r; rr<rmax; rr++) {
-	      f2r = 1.0 - f1r;
-	      v[0][zz][rr] =      // linear interpolation
-		f2z*f2r*v[1][z][r  ] + f1z*f2r*v[1][z+1][r  ] +
-		f2z*f1r*v[1][z][r+1] + f1z*f1r*v[1][z+1][r+1];
-	      f1r += f;
-	    }
-	    f1z += f;
-	  }
-	}
-      }
-    }
-
-    L  = lrint(setup.xtal_length/grid);
-    R  = lrint(setup.xtal_radius/grid);
-    BRT = lrint(setup.top_bullet_radius/grid);
-    // BRB = lrint(setup.bottom_bullet_radius/grid);
-    LC = lrint(setup.pc_length/grid);
-    dLC = setup.pc_length/grid - (float) LC;
-    if (dLC < 0.05 && dLC > -0.05) dLC = 0;
-    RC = lrint(setup.pc_radius/grid);
-    dRC = setup.pc_radius/grid - (float) RC;
-    if (dRC < 0.05 && dRC > -0.05) dRC = 0;
-    printf("grid = %f  RC = %d  dRC = %f  LC = %d  dLC = %f\n\n",
-	   grid, RC, dRC, LC, dLC);
-    /* set up bulletization inside point contact */
-    if (setup.bulletize_PC) {
-      for (z=0; z<=LC; z++) {
-        if (setup.pc_length <= setup.pc_radius) {  // LC <= RC; use LC as bulletization radius
-          a = setup.pc_radius - setup.pc_length;
-          b = z * grid;
-          c = setup.pc_length*setup.pc_length - b*b;
-          if (c < 0.0) c = 0;
-          c = a + sqrt(c);
-        } else {  // LC > RC; use RC as bulletization radius
-          if (z > LC-RC) {
-            a = setup.pc_length - setup.pc_radius;
-            b = z * grid - a;
-            c = setup.pc_radius*setup.pc_radius - b*b;
-            if (c < 0.0) c = 0;
-            c = sqrt(c);
-          } else {
-            c = setup.pc_radius;
-          }
-        }
-        rrc[z] = lrint(c/grid);
-        drrc[z] = c/grid - (float) rrc[z];
-        if (drrc[z] < 0.05 && drrc[z] > -0.05) drrc[z] = 0;
-        frrc[z] = 0;
-      }
-      drrc[LC+1] = drrc[LC];
-    } else {  // no bulletization
-      for (z=0; z<=LC+1; z++) {
-        rrc[z] = RC;
-        drrc[z] = dRC;
-        frrc[z] = 0;
-      }
-    }
-    
-    LT = lrint(setup.taper_length/grid);
-    RO = lrint(setup.wrap_around_radius/grid);
-    LO = lrint(setup.ditch_depth/grid);
-    WO = lrint(setup.ditch_thickness/grid);
-    // LiT = lrint(setup.Li_thickness/grid);
-    if (RO <= 0.0 || RO >= R) RO = R - LT;    // inner radius of taper, in grid lengths
-
-    if (istep == 0) {
-      // no previous coarse relaxation, so set initial potential:
-      for (z=0; z<L+1; z++) {
-	for (r=0; r<R+1; r++) {
-	  v[0][z][r] = v[1][z][r] = 0.0;
-	}
-      }
-      /*  ----- can comment out this next section to test convergence of WP ----- */
-      // perhaps this is a better initial guess than just zero everywhere
-      a = LC + RC / 2;
-      b = 2.0f*a / (float) (L + R);
-      for (z=1; z<L; z++) {
-	for (r=1; r<R; r++) {
-	  c = a / sqrt(z*z + r*r) - b;
-	  if (c < 0) c = 0;
-	  if (c > 1) c = 1;
-	  v[0][z][r] = v[1][z][r] = c;
-	}
-      }
-      /* ----- ----- */
-      // inside contact:
-      for (z=0; z<LC+1; z++) {
-	for (r=0; r<rrc[z]+1; r++) {
-	  v[0][z][r] = v[1][z][r] = 1.0;
-	}
-      }
-    }
-
-    /* boundary conditions and permittivity
-       boundary condition at Ge-vacuum interface:
-       epsilon0 * E_vac = espilon_Ge * E_Ge
-    */
-    for (z=0; z<L+1; z++) {
-      for (r=0; r<R+1; r++) {
-	eps[z][r] = eps_dz[z][r] = eps_dr[z][r] = 16;   // permittivity inside Ge
-	if (z < LO  && r < RO && r > RO-WO-1) eps[z][r] =  1;  // permittivity inside vacuum
-	if (r > 0) eps_dr[z][r-1] = (eps[z][r-1]+eps[z][r])/2.0f;
-	if (z > 0) eps_dz[z-1][r] = (eps[z-1][r]+eps[z][r])/2.0f;
-      }
-    }
-
-    for (z=0; z<L+1; z++) {
-      for (r=0; r<R+1; r++) {
-	// boundary conditions
-	bulk[z][r] = 0;  // normal bulk, no complications
-	// outside (HV) contact:
-	if (z == L ||
-	    r == R ||
-	    r >= z + R - LT ||       // taper
-	    (z == 0 && r >= RO) ||   // wrap-around
-            (BRT > 0 && r > R-BRT && z > L-BRT &&
-             (r-R+BRT)*(r-R+BRT) + (z-L+BRT)*(z-L+BRT) > BRT*BRT)) {   // top bulletization
-	  bulk[z][r] = -1;                 // value of v[*][z][r] is fixed...
-	  v[0][z][r] = v[1][z][r] = 0.0;   // to zero
-	}
-	// inside (point) contact:
-	else if (z <= LC && r <= rrc[z]) {
-	  bulk[z][r] = -1;                 // value of v[*][z][r] is fixed...
-	  v[0][z][r] = v[1][z][r] = 1.0;   // to 1.0
-	  // radial edge of inside contact:
-	  if (r == rrc[z] && drrc[z] < -0.05) {
-	    bulk[z][r] = 1;
-	    frrc[z] = -1.0/drrc[z];
-	  }
-	  // z edge of inside contact:
-	  if (z == LC && dLC < -0.05) {
-	    bulk[z][r] = 2;
-	    fLC = -1.0/dLC;
-	  }
-	}
-	// edge of inside contact:
-	// FIXME: Check for adjacent ditch
-	else if (z <= LC && r == rrc[z]+1 && drrc[z] > 0.05) {
-	  bulk[z][r] = 1;
-	  frrc[z] = 1.0/(1.0 - drrc[z]);
-	}
-	else if (z == LC+1 && r <= rrc[z] && dLC > 0.05) {
-	  bulk[z][r] = 2;
-	  fLC = 1.0/(1.0 - dLC);
-	}
-
-	/* determine bulk regions where the detector is undepleted */
-	if (!fully_depleted) {
-	  if (undepleted[r*gridfact][z*gridfact] == '*') {
-	    bulk[z][r] = -1;	            // treat like part of point contact
-	    v[0][z][r] = v[1][z][r] = 1.0;  // set WP to one
-	  } else if (undepleted[r*gridfact][z*gridfact] == 'B') { // pinch-off
-	    bulk[z][r] = 3;
-	  }
-	}
-      }
-    }
-
-    // now do the actual relaxation
-    for (iter=0; iter<max_its; iter++) {
-      if (old == 0) {
-	old = 1;
-	new = 0;
-      } else {
-	old = 0;
-	new = 1;
-      }
-      sum_dif = 0.0f;
-      max_dif = 0.0f;
-      pinched_sum1 = pinched_sum2 = 0.0;
-
-      for (z=0; z<L; z++) {
-	for (r=0; r<R; r++) {
-	  if (bulk[z][r] < 0) continue;      // outside or inside contact
+  for (i=0; i<bat.njobs; i++) {
+    chain[i].job = &bat.jobs[i];
+    chain[i].njobs = 1;
+    chain[i].size = bat.jobs[i].size;
+  }
+  i = batch_start(chain, bat.njobs, nthreads);
+  free(chain);
+  free(bat.jobs);
+  return i;
+}
 
-	  if (bulk[z][r] == 0) {            // normal bulk, no complications
-	    v_sum = v[old][z+1][r]*eps_dz[z][r] + v[old][z][r+1]*eps_dr[z][r]*s1[r];
-	    eps_sum = eps_dz[z][r] + eps_dr[z][r]*s1[r];
-	    if (z > 0) {
-	      v_sum += v[old][z-1][r]*eps_dz[z-1][r];
-	      eps_sum += eps_dz[z-1][r];
-	    } else {
-	      v_sum += v[old][z+1][r]*eps_dz[z][r];  // reflection symm around z=0
-	      eps_sum += eps_dz[z][r];
-	    }
-	    if (r > 0) {
-	      v_sum += v[old][z][r-1]*eps_dr[z][r-1]*s2[r];
-	      eps_sum += eps_dr[z][r-1]*s2[r];
-	    } else {
-	      v_sum += v[old][z][r+1]*eps_dr[z][r]*s1[r];  // reflection symm around r=0
-	      eps_sum += eps_dr[z][r]*s1[r];
-	    }
+/* ------------------------------------------------------------------------
+   sweep mode: the config file has lists or ranges of values for some of the
+   parameters (see read_config.c). For each combination of values, a new
+   config file is written, named <config>_NNN.config, with its own field
+   and WP file names, and a list of these is written to <config>_sweep.txt.
+   The fields are then calculated as in batch mode, once for each different
+   set of fieldgen parameters (e.g. a sweep in xtal_temp needs only one).
+   Only the fields are calculated: values of siggen parameters such as
+   xtal_temp or charge_cloud_size just go into the config files, which must
+   then be run with siggen_batch (or another siggen program) one by one.
+   The detectors are ordered so that those with the same geometry are done
+   together, and chains with the same geometry and impurities are done by
+   one thread in order of increasing bias, so that a cached WP (if cache_dir
+   is set) is found by the next job that can use it.
+*/
 
-	  } else if (bulk[z][r] == 1) {    // interpolated radial edge of point contact
-	    v_sum = v[old][z+1][r]*eps_dz[z][r] + v[old][z][r+1]*eps_dr[z][r]*s1[r] +
-	      v[old][z][r-1]*eps_dr[z][r-1]*s2[r]*frrc[z];
-	    eps_sum = eps_dz[z][r] + eps_dr[z][r]*s1[r] + eps_dr[z][r-1]*s2[r]*frrc[z];
-	    if (z > 0) {
-	      v_sum += v[old][z-1][r]*eps_dz[z-1][r];
-	      eps_sum += eps_dz[z-1][r];
-	    } else {
-	      v_sum += v[old][z+1][r]*eps_dz[z][r];  // reflection symm around z=0
-	      eps_sum += eps_dz[z][r];
-	    }
-	  } else if (bulk[z][r] == 2) {    // interpolated z edge of point contact
-	    v_sum = v[old][z+1][r]*eps_dz[z][r] + v[old][z][r+1]*eps_dr[z][r]*s1[r] +
-	      v[old][z-1][r]*eps_dz[z-1][r]*fLC;
-	    eps_sum = eps_dz[z][r] + eps_dr[z][r]*s1[r] + eps_dz[z-1][r]*fLC;
-	    if (r > 0) {
-	      v_sum += v[old][z][r-1]*eps_dr[z][r-1]*s2[r];
-	      eps_sum += eps_dr[z][r-1]*s2[r];
-	    } else {
-	      v_sum += v[old][z][r+1]*eps_dr[z][r]*s1[r];  // reflection symm around r=0
-	      eps_sum += eps_dr[z][r]*s1[r];
-	    }
-	    if (z == LC && bulk[z-1][r] == 1) {
-	      v_sum += v[old][z][r-1]*eps_dr[z][r-1]*s2[r]*(frrc[z]-1.0);
-	      eps_sum += eps_dr[z][r-1]*s2[r]*(frrc[z]-1.0);
-	    }
+typedef struct {
+  int    first;     // index of first setup with these fields
+  unsigned long long hash;      // field_config_hash of the fields
+  unsigned long long geometry, impurity;
+  double bias;
+} Sweep_Field;
 
-	  } else if (bulk[z][r] == 3) {   // pinched-off
-	    if (bulk[z+1][r] == 0) {
-	      pinched_sum1 += v[old][z+1][r]*eps_dz[z][r];
-	      pinched_sum2 += eps_dz[z][r];
-	    }
-	    if (bulk[z][r+1] == 0) {
-	      pinched_sum1 += v[old][z][r+1]*eps_dr[z][r]*s1[r];
-	      pinched_sum2 += eps_dr[z][r]*s1[r];
-	    }
-	    if (z > 0 && bulk[z-1][r] == 0) {
-	      pinched_sum1 += v[old][z-1][r]*eps_dz[z-1][r];
-	      pinched_sum2 += eps_dz[z-1][r];
-	    }
-	    if (r > 0 && bulk[z][r-1] == 0) {
-	      pinched_sum1 += v[old][z][r-1]*eps_dr[z][r-1]*s2[r];
-	      pinched_sum2 += eps_dr[z][r-1]*s2[r];
-	    }
-	    v_sum = pinched_sum1;
-	    eps_sum = pinched_sum2;
+static Sweep_Field *sweep_fields;
 
-	  } else {
-	    printf(" ERROR! bulk = %d undefined for (z,r) = (%d,%d)\n",
-		   bulk[z][r], z, r);
-	    return 1;
-	  }
-	  if (bulk[z][r] != 3) {
-	    mean = v_sum / eps_sum;
-	    v[new][z][r] = mean;
-	    dif = v[old][z][r] - v[new][z][r];
-	    if (dif < 0.0f) dif = -dif;
-	    sum_dif += dif;
-	    if (max_dif < dif) max_dif = dif;
-	  }
-	}
-      }
+static int sweep_cmp(const void *a, const void *b) {
+  Sweep_Field *fa = &sweep_fields[((Batch_Job *) a)->index];
+  Sweep_Field *fb = &sweep_fields[((Batch_Job *) b)->index];
 
-      if (pinched_sum2 > 0.1) {
-	mean = pinched_sum1 / pinched_sum2;
-	for (z=0; z<L; z++) {
-	  for (r=0; r<R; r++) {
-	    if (bulk[z][r] == 3) {
-	      v[new][z][r] = mean;
-	      dif = v[old][z][r] - v[new][z][r];
-	      if (dif < 0.0f) dif = -dif;
-	      sum_dif += dif;
-	      if (max_dif < dif) max_dif = dif;
-	    }
-	  }
-	}
-      }
+  if (fa->geometry != fb->geometry) return (fa->geometry < fb->geometry) ? -1 : 1;
+  if (fa->impurity != fb->impurity) return (fa->impurity < fb->impurity) ? -1 : 1;
+  return (fa->bias > fb->bias) - (fa->bias < fb->bias);
+}
 
-      // report results for some iterations
-      if (iter < 10 || (iter < 600 && iter%100 == 0) || iter%1000 == 0)
-	printf("%5d %d %d %.10f %.10f ; %.10f %.10f\n",
-	       iter, old, new, max_dif, sum_dif/(float) (L*R),
-	       v[new][L/2][R/2], v[new][L-5][R-5]);
-      if (max_dif < 0.0000000001) break;
-    }
-    printf(">> %d %.16f\n\n", iter, sum_dif);
-    if (setup.verbosity >= CHATTY) {
-      t1 = time(NULL);
-      printf(" ^^^^^^^^^^^^^ %d (%d) s elapsed ^^^^^^^^^^^^^^\n",
-	     (int) (t1 - t0), (int) (t1 - t2));
-      t2 = t1;
-    }
-    if (istep == 0) max_its /= MAX_ITS_FACTOR;
-  }
+/* sweep_name
+   put fname, with its extension replaced by _NNN (if ndigits = 3) or _NNNN
+   (if ndigits = 4), and ext, into name
+*/
+static void sweep_name(char *fname, int i, int ndigits, char *ext, char *name, int len) {
+  char *c;
+
+  strncpy(name, fname, len - 1);
+  name[len - 1] = '\0';
+  if ((c = strrchr(name, '.')) && !strchr(c, '/')) *c = '\0';
+  c = name + strlen(name);
+  if (ndigits > 0 && c - name < len - 12)  // at most MAX_SWEEP_VALUES names
+    c += sprintf(c, (ndigits > 3 ? "_%04d" : "_%03d"), i % 10000);
+  strncat(name, ext, len - (c - name) - 1);
+}
 
-  /* --------------------- calculate capacitance ---------------------
-     1/2 * epsilon * integral(E^2) = 1/2 * C * V^2
-     so    C = epsilon * integral(E^2) / V^2
-     V = 1 volt
-  */
-  printf("Calculating integrals of weighting field\n");
-  esum = esum2 = j = 0;
-  for (z=0; z<L; z++) {
-    for (r=1; r<R; r++) {
-      E_r = eps_dr[z][r]/16.0 * (v[new][z][r] - v[new][z][r+1])/(0.1*grid);
-      E_z = eps_dz[z][r]/16.0 * (v[new][z][r] - v[new][z+1][r])/(0.1*grid);
-      esum += (E_r*E_r + E_z*E_z) * (double) r;
-      /*
-      if ((z <= LC && r == rrc[z]) ||
-	  (z == LC && r <= rrc[z]) ||
-	  (z <= LC+1 && r == rrc[z]+1) || // average over two different surfaces
-	  (z == LC+1 && r <= rrc[z]+1)) {
-      */
-      if ((r == RC && z <= LC) ||
-	  (r <= RC && z == LC) ||
-	  (r == RC+1 && z <= LC+1) || // average over two different surfaces
-	  (r <= RC+1 && z == LC+1)) {
-	if (bulk[z+1][r+1] < 0) j = 1;
-	esum2 += 0.5 * sqrt(E_r*E_r + E_z*E_z) * (double) r;  // 0.5 since averaging over 2 surfaces
-      }
-    }
-  }
-  esum  *= 2.0 * pi * 0.01 * Epsilon * pow(grid, 3.0);
-  // Epsilon is in pF/mm
-  // 0.01 converts (V/cm)^2 to (V/mm)^2, pow() converts to grid^3 to mm3
-  esum2 *= 2.0 * pi * 0.1 * Epsilon * pow(grid, 2.0);
-  // 0.1 converts (V/cm) to (V/mm),  grid^2 to  mm2
-  printf("\n  >>  Calculated capacitance at %.0f V: %.3lf pF\n", BV, esum);
-  if (j==0) {
-    printf("  >>  Alternative calculation of capacitance: %.3lf pF\n\n", esum2);
-  } else {
-    printf("\n");
+/* sweep
+   expand config file config_file_name into a set of config files,
+   one for each combination of the parameter values, and calculate the fields
+   returns 0 if all succeeded
+*/
+static int sweep(char *config_file_name, int nthreads, int set_WV, int set_WP) {
+  MJD_Siggen_Setup base, *list, s;
+  Batch_Chain *chain;
+  Batch_Job   *job;
+  Sweep_Field *f;
+  char   name[256];
+  unsigned long long hash;
+  FILE   *file;
+  int    i, j, k, n, nf, nd, nchains, maxlen;
+
+  if (read_config(config_file_name, &base)) return 1;
+  if ((n = config_sweep_expand(&base, &list)) < 1) return 1;
+  nd = (n > 1000 ? 4 : 3);   // number of digits for file names
+  if (nthreads < 1) nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (!(sweep_fields = calloc(n, sizeof(*sweep_fields))) ||
+      !(bat.jobs = calloc(n, sizeof(*bat.jobs))) ||
+      !(chain = calloc(n, sizeof(*chain)))) {
+    printf("Malloc failed in sweep\n");
+    return 1;
   }
 
-  if (WP == 1) {
-    // write WP values to output file
-    if (!(file = fopen(setup.wp_name, "w"))) {
-      printf("ERROR: Cannot open file %s for weighting potential...\n", setup.wp_name);
-      return 1;
-    } else {
-      printf("Writing weighting potential to file %s\n", setup.wp_name);
-    }
-    /* copy configuration parameters to output file */
-    report_config(file, config_file_name);
-    fprintf(file, "#\n# HV bias in fieldgen: %.1f V\n", BV);
-    if (fully_depleted) {
-      fprintf(file, "# Detector is fully depleted.\n");
-    } else {
-      fprintf(file, "# Detector is not fully depleted.\n");
-      if (bubble_volts > 0.0f) fprintf(file, "# Pinch-off bubble at %.0f V potential\n", bubble_volts);
-    }
-    fprintf(file, "#\n## r (mm), z (mm), WP\n");
-    for (r=0; r<R+1; r++) {
-      for (z=0; z<L+1; z++) {
-	fprintf(file, "%7.2f %7.2f %10.6f\n",
-		((float) r)*grid,  ((float) z)*grid, v[new][z][r]);
-      }
-      fprintf(file, "\n");
-    }
-    fclose(file);
+  /* find the different sets of fields that are needed and name their files;
+     the first config that needs each set is used to calculate it */
+  for (i=nf=0; i<n; i++) {
+    hash = field_config_hash(&list[i]);
+    for (j=0; j<nf && sweep_fields[j].hash != hash; j++) ;
+    if (j < nf) {
+      strcpy(list[i].field_name, list[sweep_fields[j].first].field_name);
+      strcpy(list[i].wp_name, list[sweep_fields[j].first].wp_name);
+      continue;
+    }
+    f = &sweep_fields[nf++];
+    f->first = i;
+    f->hash = hash;
+    f->geometry = wp_config_hash(&list[i]);
+    s = list[i];
+    s.xtal_HV = 0;
+    f->impurity = field_config_hash(&s);
+    f->bias = fabs(list[i].xtal_HV);
+    sweep_name(base.field_name, j, nd, ".dat", list[i].field_name, sizeof(list[i].field_name));
+    sweep_name(base.wp_name, j, nd, ".dat", list[i].wp_name, sizeof(list[i].wp_name));
+
+    job = &bat.jobs[j];
+    sweep_name(config_file_name, i, nd, ".config", job->config_file_name,
+	       sizeof(job->config_file_name));
+    job->setup = list[i];
+    job->index = j;
+    job->WV = (set_WV >= 0 ? set_WV : job->setup.write_field);
+    job->WP = (set_WP >= 0 ? set_WP : job->setup.write_WP);
+    if (job->WV < 0 || job->WV > 2) job->WV = 0;
+    if (job->setup.xtal_grid < 0.001) job->setup.xtal_grid = 0.5;
+    job->size = (job->setup.xtal_length * job->setup.xtal_radius /
+		 (job->setup.xtal_grid * job->setup.xtal_grid));
   }
+  bat.njobs = nf;
 
-  if (fully_depleted) {
-    /* estimate depletion voltage */
-    min = BV;
-    for (z=0; z<LC+2; z++) {
-      for (r=0; r<RC+2; r++) {
-        if (vsave[z][r] > 0 &&
-            min > vsave[z][r] / (1.0 - v[new][z][r])) {
-          min = vsave[z][r] / (1.0 - v[new][z][r]);
-        }
-      }
-    }
-    printf("\nEstimated depletion voltage (or pinch-off?) = %.0f V\n", BV - min);
+  /* write the config files, and the list of them */
+  sweep_name(config_file_name, 0, 0, "_sweep.txt", name, sizeof(name));
+  if (!(file = fopen(name, "w"))) {
+    printf("ERROR: Cannot open file %s\n", name);
+    return 1;
   }
-
-  return 0;
-}
-
-int report_config(FILE *fp_out, char *config_file_name) {
-
-  char  *c, line[256];
-  FILE  *file;
-
-  fprintf(fp_out, "# Config file: %s\n", config_file_name);
-  if (!(file = fopen(config_file_name, "r"))) return 1;
-
-  while (fgets(line, sizeof(line), file)) {
-    if (strlen(line) < 3 || *line == ' ' || *line == '\t' || *line == '#') continue;
-    if ((c = strchr(line, '#')) || (c = strchr(line, '\n'))) *c = '\0';
-    fprintf(fp_out, "# %s\n", line);
+  fprintf(file, "# configs from %s; parameter(s) varied:", config_file_name);
+  for (k=0; k<base.nsweep; k++) fprintf(file, " %s", base.sweep_key[k]);
+  fprintf(file, "\n");
+  for (i=0; i<n; i++) {
+    sweep_name(config_file_name, i, nd, ".config", name, sizeof(name));
+    if (write_sweep_config(config_file_name, name, &list[i])) return 1;
+    fprintf(file, "%s   #", name);
+    for (k=0; k<base.nsweep; k++)
+      fprintf(file, " %s=%.7g", base.sweep_key[k], list[i].sweep_value[k]);
+    fprintf(file, "  fields %s\n", list[i].field_name);
   }
   fclose(file);
-  return 0;
+  sweep_name(config_file_name, 0, 0, "_sweep.txt", name, sizeof(name));
+  printf("\n%d config files written, listed in %s; %d different fields\n", n, name, nf);
+  for (k=0; k<base.nsweep; k++)
+    if (!config_field_key(base.sweep_key[k]))
+      printf("WARNING: %s does not change the fields; only the config files are made for\n"
+	     "  its values, so run the signals for each of them, e.g. with siggen_batch -c\n",
+	     base.sweep_key[k]);
+
+  /* order the jobs by geometry, impurity and bias, and make chains of the
+     same geometry and impurity, short enough to keep all the threads busy */
+  qsort(bat.jobs, nf, sizeof(*bat.jobs), sweep_cmp);
+  maxlen = (nf + nthreads - 1) / nthreads;
+  for (i=nchains=0; i<nf; i++) {
+    f = &sweep_fields[bat.jobs[i].index];
+    if (i == 0 || chain[nchains-1].njobs >= maxlen ||
+	f->geometry != sweep_fields[bat.jobs[i-1].index].geometry ||
+	f->impurity != sweep_fields[bat.jobs[i-1].index].impurity) {
+      chain[nchains++].job = &bat.jobs[i];
+    }
+    chain[nchains-1].njobs++;
+    chain[nchains-1].size += bat.jobs[i].size;
+  }
+
+  i = batch_start(chain, nchains, nthreads);
+  free(chain);
+  free(bat.jobs);
+  free(sweep_fields);
+  free(list);
+  return i;
 }
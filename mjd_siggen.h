@@ -18,6 +18,14 @@
 #define TELL_NORMAL if (setup->verbosity >= NORMAL) tell
 #define TELL_CHATTY if (setup->verbosity >= CHATTY) tell
 
+/* for functions that are specialized by inlining them with constant arguments,
+   e.g. the drift kernels in calc_signal.c */
+#ifdef __GNUC__
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
+
 /* Reference temperature for drift vel. corrections is 77K */
 #define REF_TEMP 77.0
 /* max, min temperatures for allowed range */
@@ -27,6 +35,9 @@
 #define CYL 0
 #define CART 1
 
+#define MAX_SWEEP 8            // max number of config parameters with multiple values
+#define MAX_SWEEP_VALUES 10000 // max number of values, or of combinations of values
+
 float sqrtf(float x);
 float fminf(float x, float y);
 
@@ -53,6 +64,67 @@ struct velocity_lookup{
   float ecorr;
 };
 
+// from geometry.c
+/* regions of the detector, from geometry_classify() */
+#define GEOM_GE    0   // germanium
+#define GEOM_OUTER 1   // outside the crystal, or on the outer contact
+#define GEOM_PC    2   // inside the point contact
+#define GEOM_DITCH 3   // inside the ditch next to the wrap-around contact
+#define GEOM_HOLE  4   // inside the borehole of an inverted-coax detector
+#define GEOM_MAX_PRIMS 5
+
+/* one primitive of the detector shape: the region r0 <= r <= r1, z0 <= z <= z1
+   in (r,z), i.e. a cylinder or annulus, with the (r1,z1) corner rounded with
+   radius round, and the (r1,z0) corner cut at 45 degrees over a length chamfer */
+typedef struct {
+  int   region;       // GEOM_GE for the crystal, otherwise the region cut out of it
+  float r0, r1, z0, z1, round, chamfer;
+} Geom_Prim;
+
+/* the detector shape, as the crystal (prim[0]) minus the other primitives */
+typedef struct {
+  Geom_Prim prim[GEOM_MAX_PRIMS];
+  int   nprims;
+  float wrap_r;       // the bottom face is part of the outer contact for r >= wrap_r
+} Geometry;
+
+/* counters and timers for the signal calculation, from calc_signal.c and fields.c;
+   they are only updated if the code is compiled with SIGGEN_STATS defined
+   (e.g. "make STATS=1"), so that normally they cost nothing. [0] is for
+   electrons and [1] for holes. See signal_calc_stats() in calc_signal.h */
+#define STATS_DRIFT       0   // phases of get_signal, for phase_time
+#define STATS_CONVOLUTION 1
+#define STATS_COMPRESSION 2
+#define STATS_RC          3
+
+typedef struct {
+  long   signals;             // signals calculated by get_signal
+  long   drifts[2];           // charges drifted by make_signal
+  long   drift_steps[2];      // time steps in the field
+  long   final_steps[2];      // time steps from the edge of the field to the contact
+  long   low_field[2];        // drifts stopped by low field next to the point contact
+  long   max_steps[2];        // drifts that used up all time_steps_calc steps
+  long   nearest_calls;       // calls to nearest_field_grid_index
+  long   nearest_hits;        //   that were answered from the cache of the last point
+  long   extrapolations;      //   that returned 1: extrapolation needed
+  long   efield_exists;       // calls to efield_exists
+  long   velo_lookups;        // searches of the drift velocity table
+  long   velo_search;         //   and the number of table rows looked at in them
+  double phase_time[4];       // seconds in each phase of get_signal, STATS_DRIFT etc.
+} Siggen_Stats;
+
+#ifdef SIGGEN_STATS
+#include "timer.h"
+#define STATS_ADD(field, n) (setup->stats.field += (n))
+#define STATS_TIMER(t) double t = timer_now()
+#define STATS_PHASE(k, t)  do { double t1_ = timer_now();			\
+                                setup->stats.phase_time[k] += t1_ - t; t = t1_; } while (0)
+#else
+#define STATS_ADD(field, n) ((void) 0)
+#define STATS_TIMER(t) ((void) 0)
+#define STATS_PHASE(k, t) ((void) 0)
+#endif
+
 /* setup parameters data structure */
 typedef struct {
   // general
@@ -70,6 +142,9 @@ typedef struct {
   float ditch_depth;          // depth of ditch next to wrap-around for BEGes. Set to zero for ORTEC
   float ditch_thickness;      // width of ditch next to wrap-around for BEGes. Set to zero for ORTEC
   float Li_thickness;         // depth of full-charge-collection boundary for Li contact
+  float hole_length;          // depth of central borehole from the top, for inverted-coax
+                              //   (ICPC) detectors; the borehole is part of the outer contact
+  float hole_radius;          // radius of central borehole
 
   // electric fields & weighing potentials
   float xtal_grid;            // grid size in mm for field files (either 0.5 or 0.1 mm)
@@ -90,9 +165,18 @@ typedef struct {
   char drift_name[256];       // drift velocity lookup table
   char field_name[256];       // potential/efield file name
   char wp_name[256];          // weighting potential file name
+  char cache_dir[256];        // directory for cached field files, named by config hash; optional
+
+  // parameters given a list or range of values in the config file; see read_config.c
+  int   nsweep;
+  char  sweep_key[MAX_SWEEP][32];
+  char  sweep_spec[MAX_SWEEP][128];
+  double sweep_value[MAX_SWEEP];   // values used for this setup, from config_sweep_expand()
 
   // signal calculation 
   float xtal_temp;            // crystal temperature in Kelvin
+  int   accept_field_mismatch;  // set to 1 to use field and WP files calculated for
+                                //   a different bias or impurity; see fields.c
   float preamp_tau;           // integration time constant for preamplifier, in ns
   int   time_steps_calc;      // number of time steps used in calculations
   float step_time_calc;       // length of time step used for calculation, in ns
@@ -114,17 +198,39 @@ typedef struct {
   struct velocity_lookup *v_lookup;
   cyl_pt **efld;
   float  **wpot;
+  unsigned long long field_undepleted;  // undepleted signature of the field, to check
+  int    have_field_undepleted;         //   the WP file against; see field_file_name()
+  cyl_pt     nearest_pt;      // last point looked up by nearest_field_grid_index(),
+  cyl_int_pt nearest_ipt;     //   and its result; kept here rather than in statics
+  int        nearest_ret;     //   so that each thread's setup has its own
+  int        nearest_valid;   // nonzero if nearest_pt etc. hold a lookup
+
+  // data for detector_geometry.c
+  Geometry geom;    // detector shape in mm, see geometry.h
+  float  **sdist;   // [r][z] bound on distance from each grid cell to the surface,
+                    //   > 0 inside and < 0 outside; see geometry_setup()
   
   // data for calc_signal.c
   point *dpath_e, *dpath_h;      // electron and hole drift paths
+  float *sig_work;               // work space for get_signal, 3*time_steps_calc floats
   float initial_vel, final_vel;  // initial and final drift velocities for charges collected to PC
   float dv_dE;     // derivative of drift velocity with field ((mm/ns) / (V/cm))
   float v_over_E;  // ratio of drift velocity to field ((mm/ns) / (V/cm))
   double final_charge_size;     // in mm
 
+  Siggen_Stats stats;   // only used if compiled with SIGGEN_STATS, see above
+
 } MJD_Siggen_Setup;
 
 
 int read_config(char *config_file_name, MJD_Siggen_Setup *setup);
+int read_config_string(const char *text, MJD_Siggen_Setup *setup);
+int write_config(FILE *fp, MJD_Siggen_Setup *setup);
+unsigned long long field_config_hash(MJD_Siggen_Setup *setup);
+unsigned long long wp_config_hash(MJD_Siggen_Setup *setup);
+int config_field_key(const char *key);
+int field_cache_file(MJD_Siggen_Setup *setup, const char *type, char *fname, int len);
+int config_sweep_expand(MJD_Siggen_Setup *setup, MJD_Siggen_Setup **list);
+int write_sweep_config(char *in_name, char *out_name, MJD_Siggen_Setup *setup);
 
 #endif /*#ifndef _MJD_SIGGEN_H */
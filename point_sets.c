@@ -0,0 +1,62 @@
+/* point_sets.c -- reproducible sets of points in a detector, see point_sets.h */
+
+#include <stdio.h>
+#include <math.h>
+
+#include "point_sets.h"
+#include "cyl_point.h"
+#include "detector_geometry.h"
+
+char *point_set_name[NSETS] = {"contact", "bulk", "corners", "surface"};
+
+static unsigned long long rng_state;
+
+void point_set_seed(unsigned long long seed) {
+  rng_state = seed;
+}
+
+/* rng
+   returns a uniform random number in [0, 1); the same on all machines
+*/
+static double rng(void) {
+  rng_state = rng_state * 6364136223846793005ULL + 1442695040888963407ULL;
+  return (rng_state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+int point_set_make(int k, point *pt, int n, MJD_Siggen_Setup *setup) {
+  struct cyl_pt c;
+  float  R = setup->xtal_radius, L = setup->xtal_length, r0, r1, dz;
+  int    i = 0, tries, corner;
+
+  r1 = (setup->wrap_around_radius > 0 ? setup->wrap_around_radius : R) - 0.5f;
+  r0 = setup->pc_radius + 0.5f;
+  for (tries = 0; i < n && tries < 100*n; tries++) {
+    if (k == 0) {          // contact
+      c.r = (setup->pc_radius + 3.0f) * rng();
+      c.z = (setup->pc_length + 3.0f) * rng();
+    } else if (k == 1) {   // bulk
+      c.r = R * sqrt(rng());
+      c.z = L * rng();
+    } else if (k == 2) {   // corners
+      corner = (int) ((setup->hole_length > 0 ? 3 : 2) * rng());
+      dz = 3.0f * rng();
+      c.r = R - 3.0f * rng();
+      if (corner == 0) {
+	c.z = dz;
+      } else if (corner == 1) {
+	c.z = L - dz;
+      } else {
+	c.r = setup->hole_radius + 3.0f * rng();
+	c.z = L - setup->hole_length - dz;
+      }
+    } else {               // surface
+      if (r1 <= r0) return 0;
+      c.r = r0 + (r1 - r0) * rng();
+      c.z = 0.5f * rng();
+    }
+    c.phi = (M_PI / 2.0) * rng();
+    pt[i] = cyl_to_cart(c);
+    if (!outside_detector(pt[i], setup)) i++;
+  }
+  return i;
+}
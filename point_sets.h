@@ -0,0 +1,32 @@
+/* point_sets.h -- reproducible sets of points in a detector, for testing
+ *
+ * Used by siggen_bench and golden_check, so that the benchmark and the
+ * regression check always use the same points. Each set covers one kind of
+ * region of the detector; the points come from a simple random number
+ * generator that gives the same sequence on all machines, so that a given
+ * seed always gives the same points.
+ */
+#ifndef _POINT_SETS_H
+#define _POINT_SETS_H
+
+#include "mjd_siggen.h"
+#include "point.h"
+
+#define NSETS  4
+extern char *point_set_name[NSETS];   // "contact", "bulk", "corners", "surface"
+
+/* point_set_seed
+   start the sequence of random numbers used by point_set_make() from seed
+*/
+void point_set_seed(unsigned long long seed);
+
+/* point_set_make
+   fill pt with up to n points of set k in detector setup:
+   0, near the point contact; 1, anywhere in the bulk; 2, near the corners
+   (and the bottom of the borehole, if there is one); 3, just under the
+   passivated surface between the contact and the wrap-around
+   returns the number of points made
+*/
+int point_set_make(int k, point *pt, int n, MJD_Siggen_Setup *setup);
+
+#endif /*#ifndef _POINT_SETS_H*/
@@ -0,0 +1,301 @@
+/* pool.c -- a small work-stealing thread pool, see pool.h
+
+   Each worker thread has its own queue of tasks. It adds and removes its
+   own tasks at the tail, and other (idle) workers steal from the head, so
+   that the oldest (and usually largest) pieces of work move between threads.
+   Jobs are kept in a separate list, and are only started by workers that
+   have no tasks to run, so that a thread waiting for its tasks in pool_wait()
+   never gets stuck in some other long job.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+
+typedef struct {
+  void   (*fn)(void *);
+  void   *arg;
+  Pool_Group *grp;       // NULL for a job
+} Pool_Task;
+
+typedef struct {
+  pthread_mutex_t lock;
+  Pool_Task *t;          // tasks waiting to run are t[head] ... t[tail-1]
+  int    head, tail, size;
+} Pool_Queue;
+
+struct Pool {
+  int    nthreads;
+  pthread_t *threads;
+  Pool_Queue *q;         // one task queue for each worker
+  pthread_mutex_t lock;   // protects everything below
+  pthread_cond_t work, done;
+  pthread_cond_t wake;    // for threads in pool_wait() with nothing to take
+  Pool_Task *jobs;
+  int    njobs, next_job, jobs_size, jobs_left;
+  int    queued;          // number of jobs and tasks waiting to run
+  int    idle;            // number of workers waiting for work
+  int    waiting;         // number of threads asleep in pool_wait()
+  unsigned int spawned;   // number of tasks added so far, to detect new ones
+  int    quit;
+};
+
+/* the pool that the current thread belongs to, and its index in that pool */
+static __thread Pool *my_pool = NULL;
+static __thread int    my_id = -1;
+
+/* take
+   find a task to run: first from the tail of the worker's own queue,
+   then from the heads of the other queues; if grp is not NULL, only tasks of
+   that group are taken. If jobs is nonzero and there are no tasks, a job is taken.
+   returns 1 if something was found, 0 otherwise
+*/
+static int take(Pool *s, int self, Pool_Group *grp, int jobs, Pool_Task *t) {
+  Pool_Queue *q;
+  int    i, k, found = 0;
+
+  if (self >= 0) {
+    q = &s->q[self];
+    pthread_mutex_lock(&q->lock);
+    if (q->tail > q->head && (!grp || q->t[q->tail-1].grp == grp)) {
+      *t = q->t[--q->tail];
+      found = 1;
+    }
+    pthread_mutex_unlock(&q->lock);
+  }
+  for (k=1; k<=s->nthreads && !found; k++) {
+    i = (self + k + s->nthreads) % s->nthreads;
+    if (i == self) continue;
+    q = &s->q[i];
+    pthread_mutex_lock(&q->lock);
+    if (q->tail > q->head && (!grp || q->t[q->head].grp == grp)) {
+      *t = q->t[q->head++];
+      found = 1;
+    }
+    pthread_mutex_unlock(&q->lock);
+  }
+
+  pthread_mutex_lock(&s->lock);
+  if (found) {
+    s->queued--;
+  } else if (jobs && s->next_job < s->njobs) {
+    *t = s->jobs[s->next_job++];
+    if (s->next_job == s->njobs) s->next_job = s->njobs = 0;   // reuse the list
+    s->queued--;
+    found = 1;
+  }
+  pthread_mutex_unlock(&s->lock);
+  return found;
+}
+
+/* run
+   run task t, and record that it has finished
+*/
+static void run(Pool *s, Pool_Task *t) {
+
+  t->fn(t->arg);
+  if (t->grp) {
+    if (__sync_sub_and_fetch(&t->grp->pending, 1) == 0) {
+      pthread_mutex_lock(&s->lock);
+      if (s->waiting > 0) pthread_cond_broadcast(&s->wake);
+      pthread_mutex_unlock(&s->lock);
+    }
+  } else {
+    pthread_mutex_lock(&s->lock);
+    if (--s->jobs_left == 0) pthread_cond_broadcast(&s->done);
+    pthread_mutex_unlock(&s->lock);
+  }
+}
+
+static void *worker(void *arg) {
+  Pool_Task t;
+  Pool  *s = (Pool *) arg;
+  int    i;
+
+  /* find our own index, once pool_create has filled in s->threads */
+  pthread_mutex_lock(&s->lock);
+  pthread_mutex_unlock(&s->lock);
+  for (i=0; !pthread_equal(s->threads[i], pthread_self()); i++) ;
+  my_pool = s;
+  my_id = i;
+
+  for (;;) {
+    if (take(s, my_id, NULL, 1, &t)) {
+      run(s, &t);
+      continue;
+    }
+    pthread_mutex_lock(&s->lock);
+    if (s->quit) {
+      pthread_mutex_unlock(&s->lock);
+      break;
+    }
+    if (s->queued == 0) {
+      s->idle++;
+      pthread_cond_wait(&s->work, &s->lock);
+      s->idle--;
+    }
+    pthread_mutex_unlock(&s->lock);
+  }
+  return NULL;
+}
+
+Pool *pool_create(int nthreads) {
+  Pool  *s;
+  int    i;
+
+  if (nthreads < 1) nthreads = 1;
+  if (!(s = (Pool *) calloc(1, sizeof(*s))) ||
+      !(s->threads = (pthread_t *) calloc(nthreads, sizeof(*s->threads))) ||
+      !(s->q = (Pool_Queue *) calloc(nthreads, sizeof(*s->q)))) {
+    printf("Malloc failed in pool_create\n");
+    return NULL;
+  }
+  s->nthreads = nthreads;
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->work, NULL);
+  pthread_cond_init(&s->done, NULL);
+  pthread_cond_init(&s->wake, NULL);
+  for (i=0; i<nthreads; i++) pthread_mutex_init(&s->q[i].lock, NULL);
+
+  /* hold the lock so that the workers do not look for their index too soon */
+  pthread_mutex_lock(&s->lock);
+  for (i=0; i<nthreads; i++) {
+    if (pthread_create(&s->threads[i], NULL, worker, s)) {
+      printf("ERROR: Cannot start thread %d in pool_create\n", i);
+      s->nthreads = i;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&s->lock);
+  if (s->nthreads == 0) {
+    free(s->q);
+    free(s->threads);
+    free(s);
+    return NULL;
+  }
+  return s;
+}
+
+int pool_job(Pool *s, void (*fn)(void *), void *arg) {
+  Pool_Task *t;
+
+  pthread_mutex_lock(&s->lock);
+  if (s->njobs == s->jobs_size) {
+    if (!(t = (Pool_Task *) realloc(s->jobs, (2*s->jobs_size + 16) * sizeof(*t)))) {
+      pthread_mutex_unlock(&s->lock);
+      printf("Malloc failed in pool_job\n");
+      return 1;
+    }
+    s->jobs = t;
+    s->jobs_size = 2*s->jobs_size + 16;
+  }
+  t = &s->jobs[s->njobs++];
+  t->fn = fn;
+  t->arg = arg;
+  t->grp = NULL;
+  s->jobs_left++;
+  s->queued++;
+  pthread_cond_signal(&s->work);
+  pthread_mutex_unlock(&s->lock);
+  return 0;
+}
+
+void pool_spawn(Pool *s, Pool_Group *grp, void (*fn)(void *), void *arg) {
+  Pool_Queue *q;
+  Pool_Task *t;
+
+  if (my_pool != s) {
+    fn(arg);
+    return;
+  }
+  q = &s->q[my_id];
+  pthread_mutex_lock(&q->lock);
+  if (q->tail == q->size) {
+    if (q->head > 0) {  // move the waiting tasks to the start of the array
+      memmove(q->t, q->t + q->head, (q->tail - q->head) * sizeof(*q->t));
+      q->tail -= q->head;
+      q->head = 0;
+    } else if ((t = (Pool_Task *) realloc(q->t, (2*q->size + 16) * sizeof(*t)))) {
+      q->t = t;
+      q->size = 2*q->size + 16;
+    } else {
+      pthread_mutex_unlock(&q->lock);
+      fn(arg);
+      return;
+    }
+  }
+  __sync_fetch_and_add(&grp->pending, 1);
+  t = &q->t[q->tail++];
+  t->fn = fn;
+  t->arg = arg;
+  t->grp = grp;
+  pthread_mutex_unlock(&q->lock);
+
+  pthread_mutex_lock(&s->lock);
+  s->queued++;
+  s->spawned++;
+  if (s->idle > 0) pthread_cond_signal(&s->work);
+  if (s->waiting > 0) pthread_cond_broadcast(&s->wake);
+  pthread_mutex_unlock(&s->lock);
+}
+
+void pool_wait(Pool *s, Pool_Group *grp) {
+  Pool_Task t;
+  unsigned int spawned;
+
+  while (grp->pending > 0) {
+    spawned = s->spawned;   // no lock; it is checked again before sleeping
+    if (take(s, (my_pool == s ? my_id : -1), grp, 0, &t)) {
+      run(s, &t);
+      continue;
+    }
+    /* the remaining tasks are being run by other workers; sleep until the
+       last of them is finished, or until more tasks are added that this
+       thread could help with, rather than spinning */
+    pthread_mutex_lock(&s->lock);
+    if (grp->pending > 0 && s->spawned == spawned) {
+      s->waiting++;
+      pthread_cond_wait(&s->wake, &s->lock);
+      s->waiting--;
+    }
+    pthread_mutex_unlock(&s->lock);
+  }
+  __sync_synchronize();  // make sure we see everything done by the tasks
+}
+
+int pool_thread_id(Pool *s) {
+  return (my_pool == s ? my_id : -1);
+}
+
+int pool_nthreads(Pool *s) {
+  return s->nthreads;
+}
+
+int pool_idle(Pool *s) {
+  return s->idle;   // no lock; this is only a hint
+}
+
+void pool_finish(Pool *s) {
+  int i;
+
+  pthread_mutex_lock(&s->lock);
+  while (s->jobs_left > 0) pthread_cond_wait(&s->done, &s->lock);
+  s->quit = 1;
+  pthread_cond_broadcast(&s->work);
+  pthread_mutex_unlock(&s->lock);
+  for (i=0; i<s->nthreads; i++) {
+    pthread_join(s->threads[i], NULL);
+    pthread_mutex_destroy(&s->q[i].lock);
+    free(s->q[i].t);
+  }
+  pthread_mutex_destroy(&s->lock);
+  pthread_cond_destroy(&s->work);
+  pthread_cond_destroy(&s->done);
+  pthread_cond_destroy(&s->wake);
+  free(s->jobs);
+  free(s->q);
+  free(s->threads);
+  free(s);
+}
@@ -0,0 +1,68 @@
+/* pool.h -- a small work-stealing thread pool
+ *
+ * Used by mjd_fieldgen to run many fieldgen calculations at once, and to
+ * split the relaxation of large grids over threads that would otherwise be idle.
+ *
+ * There are two kinds of work:
+ * -- jobs, added with pool_job(); these are independent and are started in
+ *    the order they were added, whenever a worker thread has nothing else to do
+ * -- tasks, added with pool_spawn() from inside a job (or another task);
+ *    each worker keeps its own queue of tasks, and idle workers steal from
+ *    the queues of the others. pool_wait() waits for a group of tasks to
+ *    finish, running queued tasks itself in the meantime.
+ */
+#ifndef _POOL_H
+#define _POOL_H
+
+#include <pthread.h>
+
+typedef struct Pool Pool;
+
+/* a group of tasks that can be waited for; initialize pending to zero */
+typedef struct {
+  volatile int pending;   // number of tasks not yet finished
+} Pool_Group;
+
+/* pool_create
+   start a pool of nthreads worker threads
+   returns the pool, or NULL on failure
+*/
+Pool *pool_create(int nthreads);
+
+/* pool_job
+   add a job fn(arg) to the pool
+   returns 0 for success
+*/
+int pool_job(Pool *s, void (*fn)(void *), void *arg);
+
+/* pool_spawn
+   add a task fn(arg) to group grp; if the calling thread is not one of the
+   workers of the pool, or the task cannot be queued, it is run immediately
+*/
+void pool_spawn(Pool *s, Pool_Group *grp, void (*fn)(void *), void *arg);
+
+/* pool_wait
+   wait for all the tasks in group grp to be finished, running any of them
+   that are still queued; the thread sleeps while the others are run elsewhere
+*/
+void pool_wait(Pool *s, Pool_Group *grp);
+
+/* pool_thread_id
+   returns the index (0 ... nthreads-1) of the calling worker thread of pool s,
+   or -1 if it is not one of them; e.g. to give each worker its own data
+*/
+int pool_thread_id(Pool *s);
+
+/* pool_nthreads, pool_idle
+   return the number of worker threads, and the number that are waiting for work
+*/
+int pool_nthreads(Pool *s);
+int pool_idle(Pool *s);
+
+/* pool_finish
+   wait for all the jobs to be finished, then stop the worker threads and
+   free the pool
+*/
+void pool_finish(Pool *s);
+
+#endif /*#ifndef _POOL_H*/
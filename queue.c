@@ -0,0 +1,132 @@
+/* queue.c -- a bounded lock-free queue of pointers, see queue.h
+
+   The items are kept in a ring of cells, each with a sequence number that
+   says whether the cell is ready to be filled (seq == position) or emptied
+   (seq == position + 1) on the current pass around the ring. A thread claims
+   a position by advancing head (put) or tail (get) with compare-and-swap,
+   and then hands the cell on by setting its sequence number; no thread ever
+   holds a lock, so a slow or descheduled thread cannot block the others.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <time.h>
+
+#include "queue.h"
+
+typedef struct {
+  volatile unsigned seq;
+  void     *item;
+} Queue_Cell;
+
+struct Queue {
+  Queue_Cell *cell;
+  unsigned mask;         // number of cells - 1
+  char     pad1[64];     // keep head and tail in different cache lines
+  volatile unsigned head;   // next position to put to
+  char     pad2[64];
+  volatile unsigned tail;   // next position to get from
+  char     pad3[64];
+};
+
+Queue *queue_create(int size) {
+  Queue    *q;
+  unsigned i, n = 2;
+
+  while (n < (unsigned) size) n *= 2;
+  if (!(q = calloc(1, sizeof(*q))) ||
+      !(q->cell = malloc(n * sizeof(*q->cell)))) {
+    printf("ERROR: malloc failed in queue_create\n");
+    free(q);
+    return NULL;
+  }
+  for (i = 0; i < n; i++) q->cell[i].seq = i;
+  q->mask = n - 1;
+  return q;
+}
+
+int queue_push(Queue *q, void *item) {
+  Queue_Cell *c;
+  unsigned   pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+  int        d;
+
+  while (1) {
+    c = &q->cell[pos & q->mask];
+    d = (int) (__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) - pos);
+    if (d == 0) {
+      if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1, 1,
+				      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+    } else if (d < 0) {
+      return 1;          // full: this cell has not been emptied yet
+    } else {
+      pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    }
+  }
+  c->item = item;
+  __atomic_store_n(&c->seq, pos + 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+void *queue_pop(Queue *q) {
+  Queue_Cell *c;
+  unsigned   pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+  void       *item;
+  int        d;
+
+  while (1) {
+    c = &q->cell[pos & q->mask];
+    d = (int) (__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) - (pos + 1));
+    if (d == 0) {
+      if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 1,
+				      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+    } else if (d < 0) {
+      return NULL;       // empty: this cell has not been filled yet
+    } else {
+      pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    }
+  }
+  item = c->item;
+  __atomic_store_n(&c->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+  return item;
+}
+
+/* backoff
+   wait a little before trying again; n counts the tries so far.
+   Spin at first, since the other side is usually about to finish,
+   then give up the core, then sleep for up to a millisecond
+*/
+static void backoff(int *n) {
+  struct timespec t;
+
+  if (*n < 16) {
+    __sync_synchronize();
+  } else if (*n < 64) {
+    sched_yield();
+  } else {
+    t.tv_sec = 0;
+    t.tv_nsec = (*n < 128 ? 50000 : 1000000);
+    nanosleep(&t, NULL);
+  }
+  if (*n < 1000) (*n)++;
+}
+
+void queue_put(Queue *q, void *item) {
+  int n = 0;
+
+  while (queue_push(q, item)) backoff(&n);
+}
+
+void *queue_get(Queue *q) {
+  void *item;
+  int  n = 0;
+
+  while (!(item = queue_pop(q))) backoff(&n);
+  return item;
+}
+
+void queue_free(Queue *q) {
+  if (!q) return;
+  free(q->cell);
+  free(q);
+}
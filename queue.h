@@ -0,0 +1,41 @@
+/* queue.h -- a bounded lock-free queue of pointers
+ *
+ * Used by siggen_batch to connect the threads of its pipeline (reader,
+ * workers, writer). Any number of threads may put and get at the same time.
+ * The queue has a fixed size; queue_put() waits while it is full, and
+ * queue_get() while it is empty, so that a fast stage cannot run far ahead
+ * of a slow one. Waiting threads spin briefly, then yield, then sleep for
+ * short intervals, so that idle stages use little CPU time.
+ */
+#ifndef _QUEUE_H
+#define _QUEUE_H
+
+typedef struct Queue Queue;
+
+/* queue_create
+   make an empty queue for at least size items (rounded up to a power of 2)
+   returns the queue, or NULL on failure
+*/
+Queue *queue_create(int size);
+
+/* queue_push, queue_pop
+   add item (not NULL) to the end of queue q / take the item at its front,
+   without waiting
+   queue_push returns 0 for success, 1 if the queue is full;
+   queue_pop returns the item, or NULL if the queue is empty
+*/
+int  queue_push(Queue *q, void *item);
+void *queue_pop(Queue *q);
+
+/* queue_put, queue_get
+   the same, but wait until there is room in the queue / an item in it
+*/
+void queue_put(Queue *q, void *item);
+void *queue_get(Queue *q);
+
+/* queue_free
+   free queue q; any items still in it are not freed
+*/
+void queue_free(Queue *q);
+
+#endif /*#ifndef _QUEUE_H*/
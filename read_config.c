@@ -3,68 +3,336 @@
 #include <unistd.h>
 #include <string.h>
 #include <math.h>
+#include <stddef.h>
 #include "mjd_siggen.h"
 
+/* the config file keywords, as a typed schema: where each value goes in
+   MJD_Siggen_Setup, its type, default, and allowed range. This is used for
+   parsing, validation and writing of configs, and for the config hash.
+   Keywords are found with a perfect hash; see schema_init() */
+#define CFG_INT    0
+#define CFG_FLOAT  1
+#define CFG_DOUBLE 2
+#define CFG_NAME   3   // file or directory name, up to 255 characters
+
+typedef struct {
+  const char *key;
+  int    type;
+  size_t offset;        // offsetof(MJD_Siggen_Setup, ...)
+  double def;           // default value
+  double min, max;      // allowed range of numerical values
+} Config_Key;
+
+#define KEY(key, field, type, def, min, max) \
+  {key, type, offsetof(MJD_Siggen_Setup, field), def, min, max}
+#define LMAX 1000.0     // largest length in mm
+#define IMAX 1000.0     // largest impurity, in 1e10 e/cm3
+
+static Config_Key schema[] = {
+  KEY("verbosity_level",      verbosity,            CFG_INT,    0, 0, 9),
+  // geometry
+  KEY("xtal_length",          xtal_length,          CFG_FLOAT,  0, 0, LMAX),
+  KEY("xtal_radius",          xtal_radius,          CFG_FLOAT,  0, 0, LMAX),
+  KEY("top_bullet_radius",    top_bullet_radius,    CFG_FLOAT,  0, 0, LMAX),
+  KEY("bottom_bullet_radius", bottom_bullet_radius, CFG_FLOAT,  0, 0, LMAX),
+  KEY("pc_length",            pc_length,            CFG_FLOAT,  0, 0, LMAX),
+  KEY("pc_radius",            pc_radius,            CFG_FLOAT,  0, 0, LMAX),
+  KEY("bulletize_PC",         bulletize_PC,         CFG_INT,    0, 0, 1),
+  KEY("taper_length",         taper_length,         CFG_FLOAT,  0, 0, LMAX),
+  KEY("wrap_around_radius",   wrap_around_radius,   CFG_FLOAT,  0, 0, LMAX),
+  KEY("ditch_depth",          ditch_depth,          CFG_FLOAT,  0, 0, LMAX),
+  KEY("ditch_thickness",      ditch_thickness,      CFG_FLOAT,  0, 0, LMAX),
+  KEY("hole_length",          hole_length,          CFG_FLOAT,  0, 0, LMAX),
+  KEY("hole_radius",          hole_radius,          CFG_FLOAT,  0, 0, LMAX),
+  KEY("Li_thickness",         Li_thickness,         CFG_FLOAT,  0, 0, LMAX),
+  // fieldgen
+  KEY("xtal_grid",            xtal_grid,            CFG_FLOAT,  0, 0, 10),
+  KEY("impurity_z0",          impurity_z0,          CFG_FLOAT,  0, -IMAX, IMAX),
+  KEY("impurity_gradient",    impurity_gradient,    CFG_FLOAT,  0, -IMAX, IMAX),
+  KEY("impurity_quadratic",   impurity_quadratic,   CFG_FLOAT,  0, -IMAX, IMAX),
+  KEY("impurity_surface",     impurity_surface,     CFG_FLOAT,  0, -IMAX, IMAX),
+  KEY("impurity_radial_add",  impurity_radial_add,  CFG_FLOAT,  0, -IMAX, IMAX),
+  KEY("impurity_radial_mult", impurity_radial_mult, CFG_FLOAT,  1, 0, IMAX),
+  KEY("impurity_rpower",      impurity_rpower,      CFG_FLOAT,  0, 0, 100),
+  KEY("xtal_HV",              xtal_HV,              CFG_FLOAT,  0, -1e5, 1e5),
+  KEY("max_iterations",       max_iterations,       CFG_INT,    0, 0, 1e9),
+  KEY("write_field",          write_field,          CFG_INT,    0, 0, 2),
+  KEY("write_WP",             write_WP,             CFG_INT,    0, 0, 2),
+  // file names
+  KEY("drift_name",           drift_name,           CFG_NAME,   0, 0, 0),
+  KEY("field_name",           field_name,           CFG_NAME,   0, 0, 0),
+  KEY("wp_name",              wp_name,              CFG_NAME,   0, 0, 0),
+  KEY("cache_dir",            cache_dir,            CFG_NAME,   0, 0, 0),
+  // siggen
+  KEY("xtal_temp",            xtal_temp,            CFG_FLOAT,  0, 0, 1000),
+  KEY("accept_field_mismatch", accept_field_mismatch, CFG_INT,   0, 0, 1),
+  KEY("preamp_tau",           preamp_tau,           CFG_FLOAT,  0, 0, 1e6),
+  KEY("time_steps_calc",      time_steps_calc,      CFG_INT,    0, 0, 1e8),
+  KEY("step_time_calc",       step_time_calc,       CFG_FLOAT,  0, 0, 1e6),
+  KEY("step_time_out",        step_time_out,        CFG_FLOAT,  0, 0, 1e6),
+  KEY("charge_cloud_size",    charge_cloud_size,    CFG_FLOAT,  0, 0, LMAX),
+  KEY("use_diffusion",        use_diffusion,        CFG_INT,    0, 0, 1),
+  KEY("energy",               energy,               CFG_FLOAT,  0, 0, 1e8),
+  KEY("charge_trapping_per_step", charge_trapping_per_step, CFG_DOUBLE, 1, 0, 1),
+};
+#define NKEYS (int) (sizeof(schema)/sizeof(schema[0]))
+#undef KEY
+
+#define HASH_SIZE 512   // slots in the keyword hash table; must be a power of 2
+static unsigned int hash_seed;
+static short        hash_slot[HASH_SIZE];   // index into schema[], or -1
+static int          hash_ready = 0;
+
+static unsigned int key_hash(const char *key, int len, unsigned int seed) {
+  unsigned int h = 2166136261u ^ seed;
+  int i;
+
+  for (i=0; i<len; i++) {
+    h ^= (unsigned char) key[i];
+    h *= 16777619u;
+  }
+  return (h ^ (h >> 15)) & (HASH_SIZE - 1);
+}
+
+/* schema_init
+   find a seed for which key_hash() has no collisions among the keywords,
+   so that each keyword is found with one hash and one string compare;
+   run at program start where the compiler allows it, otherwise on first use
+*/
+#ifdef __GNUC__
+__attribute__((constructor))
+#endif
+static void schema_init(void) {
+  unsigned int seed;
+  int   i, h;
+
+  for (seed = 0; ; seed++) {
+    for (h=0; h<HASH_SIZE; h++) hash_slot[h] = -1;
+    for (i=0; i<NKEYS; i++) {
+      h = key_hash(schema[i].key, strlen(schema[i].key), seed);
+      if (hash_slot[h] >= 0) break;
+      hash_slot[h] = i;
+    }
+    if (i == NKEYS) break;
+  }
+  hash_seed = seed;
+  hash_ready = 1;
+}
+
+/* config_key
+   returns the schema entry for the keyword of length len at key, or NULL
+*/
+static Config_Key *config_key(const char *key, int len) {
+  int i;
+
+  if (!hash_ready) schema_init();
+  i = hash_slot[key_hash(key, len, hash_seed)];
+  if (i < 0 || strncmp(schema[i].key, key, len) || schema[i].key[len]) return NULL;
+  return &schema[i];
+}
+
+/* set_value
+   set config parameter k in setup to x, or to name for file and directory names
+   returns 0 on success, 1 if x is out of range
+*/
+static int set_value(MJD_Siggen_Setup *setup, Config_Key *k, double x, const char *name) {
+  char *p = (char *) setup + k->offset;
+
+  if (k->type == CFG_NAME) {
+    strncpy(p, name, 255);
+    p[255] = '\0';
+    return 0;
+  }
+  if (x < k->min || x > k->max) {
+    printf("ERROR: Value %g for %s is out of range; allowed range is %g to %g\n",
+	   x, k->key, k->min, k->max);
+    return 1;
+  }
+  if (k->type == CFG_INT) {
+    *(int *) p = lrint(x);
+  } else if (k->type == CFG_FLOAT) {
+    *(float *) p = x;
+  } else {
+    *(double *) p = x;
+  }
+  return 0;
+}
+
+/* get_value
+   returns the value of numerical config parameter k in setup
+*/
+static double get_value(MJD_Siggen_Setup *setup, Config_Key *k) {
+  char *p = (char *) setup + k->offset;
+
+  if (k->type == CFG_INT) return *(int *) p;
+  if (k->type == CFG_FLOAT) return *(float *) p;
+  if (k->type == CFG_DOUBLE) return *(double *) p;
+  return 0;
+}
+
+/* config_defaults
+   set every config parameter in setup to its default, and everything else to zero
+*/
+static void config_defaults(MJD_Siggen_Setup *setup) {
+  int i;
+
+  memset(setup, 0, sizeof(*setup));
+  for (i=0; i<NKEYS; i++)
+    if (schema[i].def != 0) set_value(setup, &schema[i], schema[i].def, "");
+}
+
+/* sweep_values
+   put up to max of the values given by spec into val, where spec is a
+   comma-separated list of values and/or ranges start:stop[:step]
+   (step defaults to 1, and stop is included)
+   returns the total number of values, or 0 if spec is not valid
+*/
+static int sweep_values(char *spec, double *val, int max) {
+  double start, stop, step, x;
+  char   *c, *end;
+  int    i, n = 0;
+
+  for (c = spec; *c; ) {
+    start = strtod(c, &end);
+    if (end == c) return 0;
+    stop = start;
+    step = 1;
+    c = end;
+    if (*c == ':') {
+      stop = strtod(c+1, &end);
+      if (end == c+1) return 0;
+      c = end;
+      if (*c == ':') {
+	step = strtod(c+1, &end);
+	if (end == c+1) return 0;
+	c = end;
+      }
+      if (step == 0 || (stop - start) / step < 0) return 0;
+    }
+    /* allow for rounding of step, so that stop is included */
+    for (i=0; (x = start + i*step, (stop - x) / step > -1e-6); i++) {
+      if (n < max) val[n] = x;
+      if (++n > MAX_SWEEP_VALUES) return 0;
+    }
+    if (*c == ',') {
+      c++;
+    } else if (*c) {
+      return 0;
+    }
+  }
+  return n;
+}
+
+/* parse_config
+   fill in setup from the lines of config file, or if file is NULL, from the
+   string text; source is the name used in messages
+   returns 0 on success, 1 otherwise
+*/
+static int parse_config(MJD_Siggen_Setup *setup, FILE *file, const char *text, const char *source) {
+
+  Config_Key *k;
+  double val[1], x;
+  float  fi;
+  int    ii, l, n=0, ok;
+  char   *c, line[256], name[256], spec[128];
+
+  while (1) {
+    if (file) {
+      if (!fgets(line, sizeof(line), file)) break;
+    } else {
+      if (!*text) break;
+      for (l=0; *text && *text != '\n'; text++)
+	if (l < (int) sizeof(line) - 2) line[l++] = *text;
+      if (*text) text++;
+      line[l++] = '\n';
+      line[l] = '\0';
+    }
+    n++;
+    /* ignore comments and blank lines */
+    if (strlen(line) < 3 || *line == ' ' || *line == '\t' || *line == '#') continue;
+    for (l=0; line[l] && line[l] != ' ' && line[l] != '\t' &&
+	   line[l] != '\n' && line[l] != '\r'; l++) ;
+    if (!(k = config_key(line, l))) continue;   // not a keyword
+
+    /* find next non-white-space char */
+    for (c = line + l; *c == ' ' || *c == '\t'; c++) ;
+    name[0] = 0;
+    x = 0;
+    if (c == line + l) {
+      ok = 0;
+    } else if (k->type == CFG_NAME) {
+      /* extract character string for file or directory name */
+      for (ok=0; ok<255 && *c && *c != ' ' && *c != '\t' && *c != '\n' &&  *c != '\r'; ok++) {
+	name[ok] = *c;
+	c++;
+      }
+      name[ok] = '\0';
+    } else if (sscanf(c, "%127[-+0-9.eE:,]", spec) == 1 &&
+	       (strchr(spec, ':') || strchr(spec, ','))) {
+      /* list or range of values */
+      if (setup->nsweep >= MAX_SWEEP) {
+	printf("ERROR: Too many parameters with multiple values; maximum is %d\n",
+	       MAX_SWEEP);
+	ok = 0;
+      } else if ((ok = sweep_values(spec, val, 1)) > 0) {
+	strcpy(setup->sweep_key[setup->nsweep], k->key);
+	strcpy(setup->sweep_spec[setup->nsweep], spec);
+	setup->nsweep++;
+	x = val[0];
+	if (setup->verbosity >= CHATTY)
+	  printf("%s: values %s\n", k->key, spec);
+      }
+    } else if (k->type == CFG_INT) {
+      ok = sscanf(c, "%d", &ii);
+      x = ii;
+    } else if (k->type == CFG_FLOAT) {
+      ok = sscanf(c, "%f", &fi);
+      x = fi;
+    } else {
+      ok = sscanf(c, "%lf", &x);
+    }
+    if (ok < 1) {
+      printf("ERROR reading %s from config file %s\n"
+	     "   ...line number %d is: %s",
+	     k->key, source, n, line);
+      return 1;
+    }
+    if (set_value(setup, k, x, name)) {
+      printf("   ...in config file %s, line number %d\n", source, n);
+      return 1;
+    }
+
+    if (setup->verbosity >= CHATTY) {
+      if (k->type == CFG_INT) {
+	printf("%s: %ld\n", k->key, lrint(x));
+      } else if (k->type == CFG_NAME) {
+	printf("%s: %s\n", k->key, name);
+      } else {
+	printf("%s: %f\n", k->key, x);
+      }
+    }
+  }
+  return 0;
+}
+
 int read_config(char *config_file_name, MJD_Siggen_Setup *setup) {
 
   /* reads and parses configuration file of name config_file_name
      fills in values of MJD_Siggen_Setup setup, defined in mjd_siggen.h
      returns 0 on success, 1 otherwise
+
+     numerical values can also be given as a comma-separated list and/or
+     ranges start:stop[:step], e.g. "xtal_HV 1500:3500:100" or
+     "impurity_gradient -0.1,0,0.1"; the first value is used, and
+     the rest are recorded in setup->sweep_key, sweep_spec for config_sweep_expand()
   */
 
-  char key_word[][32] = {
-    "xtal_length",
-    "xtal_radius",
-    "top_bullet_radius",
-    "bottom_bullet_radius",
-    "pc_length",
-    "pc_radius",
-    "bulletize_PC",
-    "taper_length",
-    "wrap_around_radius",
-    "ditch_depth",
-    "ditch_thickness",
-    "Li_thickness",
-    "xtal_grid",
-    "impurity_z0",
-    "impurity_gradient",
-    "impurity_quadratic",
-    "impurity_surface",
-    "impurity_radial_add",
-    "impurity_radial_mult",
-    "impurity_rpower",
-    "xtal_HV",
-    "drift_name",
-    "field_name",
-    "wp_name",
-    "xtal_temp",
-    "preamp_tau",
-    "time_steps_calc",
-    "step_time_calc",
-    "step_time_out",
-    "charge_cloud_size",
-    "use_diffusion",
-    "energy",
-    "charge_trapping_per_step",
-    "verbosity_level",
-    "max_iterations",
-    "write_field",
-    "write_WP",
-    ""
-  };
-
-  int   ii, i, l, n=0, ok, iint = 0;
-  float fi;
-  char  *c, line[256], name[256];
-  FILE  *file;
-
-
-  /* initialize everything to zero... */
-  memset(setup, 0, sizeof(*setup));
-  /* ...except for impurity_radial_mult */
-  setup->impurity_radial_mult = 1.0f;  // 1.0 is neutral (no radial gradient)
-  /* ...and charge trapping */
-  setup->charge_trapping_per_step = 1.0;  // 1.0 is no trapping
+  FILE   *file;
+  int    err;
+
+  /* initialize everything to zero, except for the parameters with other
+     defaults (impurity_radial_mult and charge_trapping_per_step) */
+  config_defaults(setup);
 
   if (!(file = fopen(config_file_name, "r"))) {
     printf("\nERROR: config file %s does not exist?\n", config_file_name);
@@ -72,143 +340,257 @@ int read_config(char *config_file_name, MJD_Siggen_Setup *setup) {
   }
   /* read config file */
   printf("\nReading values from config file %s\n", config_file_name);
-  while (fgets(line, sizeof(line), file)) {
-    n++;
-    /* ignore comments and blank lines */
-    if (strlen(line) < 3 || *line == ' ' || *line == '\t' || *line == '#') continue;
-    for (i=0; (l=strlen(key_word[i])) > 0; i++) {
-      if (!strncmp(line, key_word[i], l)) {
-	/* line starts with key_word[i] */
-	if (line[l] != ' ' && line[l] != '\t') {
-	  ok = 0;
-	} else {
-	  /* find next non-white-space char */
-	  for (c = line + l; *c == ' ' || *c == '\t'; c++) ;
-	  name[0] = 0;
-	  ii = iint = 0;
-	  fi = 0;
-	  if (strstr(key_word[i], "_name")) {
-	    /* extract character string for file name */
-	    for (ok=0; ok<256 && *c != ' ' && *c != '\t' && *c != '\n' &&  *c != '\r'; ok++) {
-	      name[ok] = *c;
-	      c++;
-	    }
-	    name[ok] = '\0';	    
-	  } else if (!strncmp("time_steps_calc", key_word[i], l) ||
-		     !strncmp("use_diffusion", key_word[i], l) ||
-		     !strncmp("verbosity_level", key_word[i], l) ||
-		     !strncmp("max_iterations", key_word[i], l) ||
-		     !strncmp("write_field", key_word[i], l) ||
-		     !strncmp("write_WP", key_word[i], l) ||
-		     !strncmp("bulletize_PC", key_word[i], l)) {
-	    /* extract integer value */
-	    ok = sscanf(c, "%d", &ii);
-	    iint = 1;
-	  } else {
-	    /* extract float value */
-	    ok = sscanf(c, "%f", &fi);
-	  }
-	}
-	if (ok < 1) {
-	  printf("ERROR reading %s from config file %s\n"
-		 "   ...line number %d is: %s",
-		 key_word[i], config_file_name, n, line);
-	  return 1;
-	}
-	if (strstr(key_word[i], "verbosity_level")) {
-	  setup->verbosity = ii;
-	} else if (strstr(key_word[i], "xtal_length")) {
-	  setup->xtal_length = fi;
-	} else if (strstr(key_word[i], "xtal_radius")) {
-	  setup->xtal_radius = fi;
-	} else if (strstr(key_word[i], "top_bullet_radius")) {
-	  setup->top_bullet_radius = fi;
-	} else if (strstr(key_word[i], "bottom_bullet_radius")) {
-	  setup->bottom_bullet_radius = fi;
-	} else if (strstr(key_word[i], "pc_length")) {
-	  setup->pc_length = fi;
-	} else if (strstr(key_word[i], "pc_radius")) {
-	  setup->pc_radius = fi;
-	} else if (strstr(key_word[i], "bulletize_PC")) {
-	  setup->bulletize_PC = ii;
-	} else if (strstr(key_word[i], "taper_length")) {
-	  setup->taper_length = fi;
-	} else if (strstr(key_word[i], "wrap_around_radius")) {
-	  setup->wrap_around_radius = fi;
-	} else if (strstr(key_word[i], "ditch_depth")) {
-	  setup->ditch_depth = fi;
-	} else if (strstr(key_word[i], "ditch_thickness")) {
-	  setup->ditch_thickness = fi;
-	} else if (strstr(key_word[i], "Li_thickness")) {
-	  setup->Li_thickness = fi;
-	} else if (strstr(key_word[i], "xtal_grid")) {
-	  setup->xtal_grid = fi;
-	} else if (strstr(key_word[i], "impurity_z0")) {
-	  setup->impurity_z0 = fi;
-	} else if (strstr(key_word[i], "impurity_gradient")) {
-	  setup->impurity_gradient = fi;
-	} else if (strstr(key_word[i], "impurity_quadratic")) {
-	  setup->impurity_quadratic = fi;
-	} else if (strstr(key_word[i], "impurity_surface")) {
-	  setup->impurity_surface = fi;
-	} else if (strstr(key_word[i], "impurity_radial_add")) {
-	  setup->impurity_radial_add = fi;
-	} else if (strstr(key_word[i], "impurity_radial_mult")) {
-	  setup->impurity_radial_mult = fi;
-	} else if (strstr(key_word[i], "impurity_rpower")) {
-	  setup->impurity_rpower = fi;
-	} else if (strstr(key_word[i], "xtal_HV")) {
-	  setup->xtal_HV = fi;
-	} else if (strstr(key_word[i], "drift_name")) {
-	  strncpy(setup->drift_name, name, 256);
-	} else if (strstr(key_word[i], "field_name")) {
-	  strncpy(setup->field_name, name, 256);
-	} else if (strstr(key_word[i], "wp_name")) {
-	  strncpy(setup->wp_name, name, 256);
-	} else if (strstr(key_word[i], "xtal_temp")) {
-	  setup->xtal_temp = fi;
-	} else if (strstr(key_word[i], "preamp_tau")) {
-	  setup->preamp_tau = fi;
-	} else if (strstr(key_word[i], "time_steps_calc")) {
-	  setup->time_steps_calc = ii;
-	} else if (strstr(key_word[i], "step_time_calc")) {
-	  setup->step_time_calc = fi;
-	} else if (strstr(key_word[i], "step_time_out")) {
-	  setup->step_time_out = fi;
-	} else if (strstr(key_word[i], "charge_cloud_size")) {
-	  setup->charge_cloud_size = fi;
-	} else if (strstr(key_word[i], "use_diffusion")) {
-	  setup->use_diffusion = ii;
-	} else if (strstr(key_word[i], "energy")) {
-	  setup->energy = fi;
-	} else if (strstr(key_word[i], "charge_trapping_per_step")) {
-	  setup->charge_trapping_per_step = fi;
-	} else if (strstr(key_word[i], "max_iterations")) {
-	  setup->max_iterations = ii;
-	} else if (strstr(key_word[i], "write_field")) {
-	  setup->write_field = ii;
-	} else if (strstr(key_word[i], "write_WP")) {
-	  setup->write_WP = ii;
-	} else {
-	  printf("ERROR; unrecognized keyword %s\n", key_word[i]);
-	  return 1;
-	}
-
-	if (setup->verbosity >= CHATTY) {
-	  // printf("%s", line);
-	  if (iint) {
-	    printf("%s: %d\n", key_word[i], ii);
-	  } else if (strlen(name) > 0) {
-	    printf("%s: %s\n", key_word[i], name);
-	  } else {
-	    printf("%s: %f\n", key_word[i], fi);
-	  }
-	}
-	break;
-      }
+  err = parse_config(setup, file, NULL, config_file_name);
+  fclose(file);
+
+  return err;
+}
+
+/* read_config_string
+   as read_config, but the config is given as a string in memory,
+   e.g. from a sweep driver, so that no file is needed
+   returns 0 on success, 1 otherwise
+*/
+int read_config_string(const char *text, MJD_Siggen_Setup *setup) {
+
+  config_defaults(setup);
+  return parse_config(setup, NULL, text, "(string)");
+}
+
+/* write_config
+   write every config parameter in setup to fp, in the config file format
+   read by read_config; names that are not set are left out
+   returns 0 on success, 1 on a write error
+*/
+int write_config(FILE *fp, MJD_Siggen_Setup *setup) {
+  Config_Key *k;
+  char       *p;
+
+  for (k = schema; k < schema + NKEYS; k++) {
+    p = (char *) setup + k->offset;
+    if (k->type == CFG_NAME) {
+      if (*p) fprintf(fp, "%-24s %s\n", k->key, p);
+    } else if (k->type == CFG_INT) {
+      fprintf(fp, "%-24s %d\n", k->key, *(int *) p);
+    } else {  // enough digits for the value to be read back exactly
+      fprintf(fp, "%-24s %.*g\n", k->key, (k->type == CFG_FLOAT ? 9 : 17), get_value(setup, k));
     }
   }
-  fclose(file);
+  return (ferror(fp) != 0);
+}
+
+/* keywords hashed by config_hash(), in order; neither the order nor the text
+   form of the values may change, or existing field files and cache entries
+   would no longer match. The optional ones are hashed only if all are nonzero. */
+static const char *hash_geometry[] = {
+  "xtal_length", "xtal_radius", "top_bullet_radius", "bottom_bullet_radius",
+  "pc_length", "pc_radius", "bulletize_PC", "taper_length", "wrap_around_radius",
+  "ditch_depth", "ditch_thickness", "Li_thickness", "xtal_grid", "max_iterations", NULL};
+static const char *hash_optional[] = {"hole_length", "hole_radius", NULL};
+static const char *hash_bias[] = {
+  "impurity_z0", "impurity_gradient", "impurity_quadratic", "impurity_surface",
+  "impurity_radial_add", "impurity_radial_mult", "impurity_rpower", "xtal_HV", NULL};
 
+/* hash_keys
+   add "key value\n" for each of the keywords in keys to buf, for config_hash()
+   returns a pointer to the end of the text in buf
+*/
+static char *hash_keys(char *buf, char *end, const char **keys, MJD_Siggen_Setup *setup) {
+  Config_Key *k;
+
+  for (; *keys; keys++) {
+    k = config_key(*keys, strlen(*keys));
+    if (k->type == CFG_INT) {
+      buf += snprintf(buf, end - buf, "%s %d\n", k->key, (int) get_value(setup, k));
+    } else {
+      buf += snprintf(buf, end - buf, "%s %a\n", k->key, get_value(setup, k));
+    }
+    if (buf >= end) return end - 1;
+  }
+  return buf;
+}
+
+/* config_hash
+   returns a 64-bit (FNV-1a) hash of the config parameters that affect
+   the fields calculated by fieldgen, i.e. geometry, grid, and (if bias != 0)
+   impurities and bias.
+   The values are hashed in a canonical text form, so the hash does not depend
+   on how they were written in the config file, or on parameters that are unused
+*/
+static unsigned long long config_hash(MJD_Siggen_Setup *setup, int bias) {
+
+  MJD_Siggen_Setup canon;
+  char  buf[2048], *c;
+  const char **keys;
+  unsigned long long hash = 14695981039346656037ULL;
+
+  /* canonical values: defaults used by fieldgen, and unused parameters */
+  memcpy(&canon, setup, sizeof(canon));
+  if (canon.xtal_grid < 0.001) canon.xtal_grid = 0.5;
+  if (canon.impurity_rpower <= 0.1) {
+    canon.impurity_radial_add  = 0;
+    canon.impurity_radial_mult = 1;
+    canon.impurity_rpower      = 0;
+  }
+
+  c = buf + snprintf(buf, sizeof(buf), "fieldgen 1\n");
+  c = hash_keys(c, buf + sizeof(buf), hash_geometry, &canon);
+  for (keys = hash_optional;
+       *keys && get_value(&canon, config_key(*keys, strlen(*keys))) > 0; keys++) ;
+  if (!*keys) c = hash_keys(c, buf + sizeof(buf), hash_optional, &canon);
+  if (bias) c = hash_keys(c, buf + sizeof(buf), hash_bias, &canon);
+  for (c = buf; *c; c++) {
+    hash ^= (unsigned char) *c;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+/* field_config_hash
+   returns a hash of all the config parameters that affect the fields
+   calculated by fieldgen: geometry, impurities, bias and grid
+*/
+unsigned long long field_config_hash(MJD_Siggen_Setup *setup) {
+  return config_hash(setup, 1);
+}
+
+/* wp_config_hash
+   returns a hash of the config parameters that affect the weighting potential
+   of a fully-depleted detector: geometry and grid only
+*/
+unsigned long long wp_config_hash(MJD_Siggen_Setup *setup) {
+  return config_hash(setup, 0);
+}
+
+/* config_field_key
+   returns 1 if keyword key is one of the parameters hashed by
+   field_config_hash(), i.e. one that affects the fields, and 0 otherwise
+*/
+int config_field_key(const char *key) {
+  const char **lists[] = {hash_geometry, hash_optional, hash_bias}, **k;
+  int i;
+
+  for (i=0; i<3; i++)
+    for (k = lists[i]; *k; k++)
+      if (!strcmp(*k, key)) return 1;
+  return 0;
+}
+
+/* field_cache_file
+   puts the name of the cached field file for this setup into fname,
+   for type = "ev" (potential and field) or "wp" (weighting potential)
+   returns 0 on success, 1 if no cache directory is defined
+*/
+int field_cache_file(MJD_Siggen_Setup *setup, const char *type, char *fname, int len) {
+
+  if (!setup->cache_dir[0]) return 1;
+  snprintf(fname, len, "%s/%s_%016llx.dat",
+	   setup->cache_dir, type, field_config_hash(setup));
+  return 0;
+}
+
+/* config_sweep_expand
+   for a setup read from a config file with lists or ranges of values
+   (see read_config), make a copy of setup for every combination of
+   the values, with the values also listed in sweep_value[]; the last
+   parameter in the config file varies fastest.
+   *list is malloc'ed, and should be freed by the caller
+   returns the number of setups, or 0 on error
+*/
+int config_sweep_expand(MJD_Siggen_Setup *setup, MJD_Siggen_Setup **list) {
+  double *val[MAX_SWEEP];
+  int    nval[MAX_SWEEP], idx[MAX_SWEEP], i, j, k, n = 1;
+
+  *list = NULL;
+  for (k=0; k<setup->nsweep; k++) {
+    nval[k] = sweep_values(setup->sweep_spec[k], NULL, 0);
+    if (nval[k] < 1 || n * nval[k] > MAX_SWEEP_VALUES) {
+      printf("ERROR: Bad or too many values for %s: %s\n",
+	     setup->sweep_key[k], setup->sweep_spec[k]);
+      n = 0;
+      break;
+    }
+    n *= nval[k];
+  }
+  if (n > 0 && !(*list = (MJD_Siggen_Setup *) malloc(n * sizeof(**list)))) {
+    printf("Malloc failed in config_sweep_expand\n");
+    n = 0;
+  }
+  for (k=0; k<setup->nsweep; k++) {
+    val[k] = NULL;
+    if (n > 0 && (val[k] = (double *) malloc(nval[k] * sizeof(*val[k]))))
+      sweep_values(setup->sweep_spec[k], val[k], nval[k]);
+    if (!val[k]) n = 0;
+    idx[k] = 0;
+  }
+
+  for (i=0; i<n; i++) {
+    memcpy(&(*list)[i], setup, sizeof(*setup));
+    for (k=0; k<setup->nsweep; k++) {
+      (*list)[i].sweep_value[k] = val[k][idx[k]];
+      if (set_value(&(*list)[i], config_key(setup->sweep_key[k], strlen(setup->sweep_key[k])),
+		    val[k][idx[k]], "")) n = 0;
+    }
+    /* next combination */
+    for (j=setup->nsweep-1; j>=0 && ++idx[j] == nval[j]; j--) idx[j] = 0;
+  }
+  for (k=0; k<setup->nsweep; k++) free(val[k]);
+  if (n == 0) {
+    free(*list);
+    *list = NULL;
+  }
+  return n;
+}
+
+/* write_sweep_config
+   write a copy of config file in_name to out_name, with the values of
+   any parameters with lists or ranges of values, and the field and WP file names,
+   replaced by those in setup (from config_sweep_expand)
+   returns 0 on success, 1 otherwise
+*/
+int write_sweep_config(char *in_name, char *out_name, MJD_Siggen_Setup *setup) {
+  Config_Key *key;
+  char  line[256];
+  FILE  *in, *out;
+  int   k, l, field = 0, wp = 0;
+
+  if (!(in = fopen(in_name, "r"))) {
+    printf("\nERROR: config file %s does not exist?\n", in_name);
+    return 1;
+  }
+  if (!(out = fopen(out_name, "w"))) {
+    printf("ERROR: Cannot open file %s\n", out_name);
+    fclose(in);
+    return 1;
+  }
+  while (fgets(line, sizeof(line), in)) {
+    for (l=0; line[l] && line[l] != ' ' && line[l] != '\t' &&
+	   line[l] != '\n' && line[l] != '\r'; l++) ;
+    if (!(key = config_key(line, l)) || (line[l] != ' ' && line[l] != '\t')) {
+      fputs(line, out);
+    } else if (!strcmp(key->key, "field_name")) {
+      fprintf(out, "field_name %s\n", setup->field_name);
+      field = 1;
+    } else if (!strcmp(key->key, "wp_name")) {
+      fprintf(out, "wp_name    %s\n", setup->wp_name);
+      wp = 1;
+    } else {
+      for (k=0; k<setup->nsweep && strcmp(key->key, setup->sweep_key[k]); k++) ;
+      if (k == setup->nsweep) {
+	fputs(line, out);
+      } else if (key->type == CFG_INT) {
+	fprintf(out, "%s %ld\n", key->key, lrint(setup->sweep_value[k]));
+      } else {
+	fprintf(out, "%s %.7g\n", key->key, setup->sweep_value[k]);
+      }
+    }
+  }
+  if (!field && setup->field_name[0]) fprintf(out, "field_name %s\n", setup->field_name);
+  if (!wp && setup->wp_name[0]) fprintf(out, "wp_name    %s\n", setup->wp_name);
+  fclose(in);
+  if (fclose(out)) {
+    printf("ERROR: Failed to write file %s\n", out_name);
+    return 1;
+  }
   return 0;
 }
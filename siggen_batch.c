@@ -0,0 +1,479 @@
+/* siggen_batch.c
+ *
+ * non-interactive batch driver for the signal calculation code, for production:
+ * reads a list of points or events from a file (or stdin), calculates
+ * the signals using a thread for each core, and writes the signals to
+ * a binary output file, in the same order as the input.
+ *
+ * Input, one of:
+ * -- text, one point per line:    x y z
+ * -- text, events (-e 1):         event x y z energy
+ *      consecutive lines with the same event number are the hits of one event
+ *      (e.g. the steps of a Geant4/MaGe event in the detector); the signal of the
+ *      event is the energy-weighted mean of those of the hits. Any further
+ *      columns on a line are ignored.
+ * -- binary (-b 1): Batch_Hit records, {int event; float x, y, z, energy;}
+ *      in native byte order; event and energy are used only with -e 1
+ * Coordinates are in mm, cartesian, or cylindrical (r, phi in radians, z) with -y 1.
+ * Lines starting with # are ignored.
+ *
+ * Output: a Batch_Header, then for each point or event a record of
+ *   int   seq;                  sequence index of the point or event in the input, from 0
+ *   int   status;               number of hits outside the detector or with no field
+ *                               (these are left out of the signal); 0 for good signals
+ *   float signal[ntsteps];      the signal, ntsteps = ntsteps_out from the config file
+ *
+ * Or, with -z 1, a chunked, compressed signal file (see wave_file.h), also in
+ * input order, with the position, energy, t90 and A/E of each signal; with
+ * -q scale, the signals in that file are quantized to 16 bits in units of scale,
+ * e.g. -q 3.3e-5.
+ *
+ * The work is done by a pipeline of threads, so that reading, calculation and
+ * writing all go on at the same time, and the input can come straight from
+ * the Monte Carlo through a pipe:
+ *   reader  -- parses the input into batches of BATCH events
+ *   workers -- one for each thread (-j), each calculating whole batches
+ *   writer  -- puts the batches back into input order and writes them
+ * The stages are connected by bounded lock-free queues (queue.h). There is
+ * a fixed number of batches, which go around from reader to workers to writer
+ * and back to the reader, so if the calculation or the output cannot keep up,
+ * the reader waits rather than filling memory.
+ *
+ * The number of signals per second is reported at the end.
+ *
+ * to compile: see the Makefile
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "mjd_siggen.h"
+#include "calc_signal.h"
+#include "cyl_point.h"
+#include "wave_file.h"
+#include "queue.h"
+#include "timer.h"
+
+#define BATCH 64   // number of points or events in each batch
+
+typedef struct {
+  int   event;
+  float x, y, z, energy;
+} Batch_Hit;
+
+typedef struct {
+  char  magic[4];        // "SGB1"
+  int   ntsteps;         // number of time steps in each signal
+  float step_time_out;   // length of each time step, in ns
+  int   spare;
+} Batch_Header;
+
+/* a batch of points or events, and their signals */
+typedef struct {
+  long  seq;             // index of the batch in the input, from 0
+  int   last;            // 1 for the (empty) batch after the end of the input,
+                         //   -1 if the input ended with an error
+  Batch_Hit *hit;        // max_hits hits
+  int   first[BATCH+1];  // first[i] .. first[i+1]-1 are the hits of event i
+  int   nevents, nhits, max_hits;
+  float *sig;            // signals, ntsteps floats for each event
+  int   status[BATCH];
+  Wave_Meta meta[BATCH]; // position (energy-weighted mean, cartesian), energy, t90, A/E
+} Batch;
+
+/* the pipeline */
+static struct {
+  Queue *free;           // empty batches, for the reader
+  Queue *work;           // batches read, for the workers
+  Queue *done;           // batches calculated, for the writer
+  Batch *batch;          // all nbatch batches
+  int   nbatch, nthreads;
+  int   ntsteps;
+  float step_time;
+  volatile int stop;     // set by the writer if it cannot write, to stop the reader
+} pl;
+
+static Batch end_of_work;   // put on the work queue to stop a worker
+
+/* the input stream */
+static struct {
+  FILE  *fp;
+  int   binary, events, cyl;
+  int   line_no;
+  int   have_next;       // read-ahead hit, for the first hit of the next event
+  Batch_Hit next;
+} in;
+
+/* the output */
+static struct {
+  FILE  *fp;
+  Wave_Writer *wave;
+  long  nevents, nhits;
+  int   err;
+} out;
+
+/* read_hit
+   read the next hit from the input into h
+   returns 1 for success, 0 at the end of the input, -1 on error
+*/
+static int read_hit(Batch_Hit *h) {
+  char  line[MAX_LINE], *c;
+  int   n;
+
+  if (in.binary) {
+    if ((n = fread(h, sizeof(*h), 1, in.fp)) == 1) return 1;
+    return (ferror(in.fp) ? -1 : 0);
+  }
+  while (fgets(line, sizeof(line), in.fp)) {
+    in.line_no++;
+    for (c = line; *c == ' ' || *c == '\t'; c++) ;
+    if (*c == '#' || *c == '\n' || *c == '\r' || *c == '\0') continue;
+    h->event = in.line_no;
+    h->energy = 1;
+    if (in.events) {
+      n = (sscanf(c, "%d %f %f %f %f", &h->event, &h->x, &h->y, &h->z, &h->energy) == 5);
+    } else {
+      n = (sscanf(c, "%f %f %f", &h->x, &h->y, &h->z) == 3);
+    }
+    if (!n) {
+      fprintf(stderr, "ERROR: Bad input at line %d: %s", in.line_no, line);
+      return -1;
+    }
+    return 1;
+  }
+  return (ferror(in.fp) ? -1 : 0);
+}
+
+/* read_batch
+   read up to BATCH points or events into b
+   returns the number read, or -1 on error
+*/
+static int read_batch(Batch *b) {
+  Batch_Hit h, *tmp;
+  int       ok;
+
+  b->nevents = b->nhits = 0;
+  /* the batch is full only when the first hit of the next event is read,
+     so that an event is never split between batches */
+  for (;;) {
+    if (in.have_next) {
+      h = in.next;
+      in.have_next = 0;
+    } else if ((ok = read_hit(&h)) <= 0) {
+      if (ok < 0) return -1;
+      break;
+    }
+    if (!in.events) h.energy = 1;
+    if (!in.events || b->nhits == 0 || h.event != b->hit[b->nhits-1].event) {
+      if (b->nevents == BATCH) {   // first hit of an event in the next batch
+	in.next = h;
+	in.have_next = 1;
+	break;
+      }
+      b->first[b->nevents++] = b->nhits;
+    }
+    if (b->nhits == b->max_hits) {
+      if (!(tmp = realloc(b->hit, 2*b->max_hits*sizeof(*tmp)))) {
+	fprintf(stderr, "ERROR: realloc failed in read_batch\n");
+	return -1;
+      }
+      b->hit = tmp;
+      b->max_hits *= 2;
+    }
+    b->hit[b->nhits++] = h;
+  }
+  b->first[b->nevents] = b->nhits;
+  return b->nevents;
+}
+
+/* reader
+   thread that reads the input into batches, and hands them to the workers;
+   the last batch is an empty one that marks the end of the input
+*/
+static void *reader(void *arg) {
+  Batch *b;
+  long  seq = 0;
+  int   i, n;
+
+  do {
+    b = queue_get(pl.free);
+    b->seq = seq++;
+    n = (pl.stop ? 0 : read_batch(b));
+    b->last = 0;
+    if (n <= 0) {
+      b->last = (n < 0 ? -1 : 1);
+      b->nevents = b->nhits = 0;
+    }
+    queue_put(pl.work, b);
+  } while (n > 0);
+  for (i = 0; i < pl.nthreads; i++) queue_put(pl.work, &end_of_work);
+  return NULL;
+}
+
+/* calc_batch
+   calculate the signals for the events in batch b, with setup;
+   s is space for ntsteps floats
+*/
+static void calc_batch(Batch *b, MJD_Siggen_Setup *setup, float *s) {
+  struct cyl_pt cyl;
+  point     pt;
+  Batch_Hit *h;
+  Wave_Meta *m;
+  float     *out, etot, t10;
+  int       i, j, k;
+
+  for (i = 0; i < b->nevents; i++) {
+    out = b->sig + (size_t) i * pl.ntsteps;
+    for (j = 0; j < pl.ntsteps; j++) out[j] = 0;
+    b->status[i] = 0;
+    m = &b->meta[i];
+    memset(m, 0, sizeof(*m));
+    etot = 0;
+    for (k = b->first[i]; k < b->first[i+1]; k++) {
+      h = &b->hit[k];
+      if (in.cyl) {
+	cyl.r = h->x;  cyl.phi = h->y;  cyl.z = h->z;
+	pt = cyl_to_cart(cyl);
+      } else {
+	pt.x = h->x;  pt.y = h->y;  pt.z = h->z;
+      }
+      if (get_signal(pt, s, setup) < 0) {
+	b->status[i]++;
+	continue;
+      }
+      for (j = 0; j < pl.ntsteps; j++) out[j] += h->energy * s[j];
+      etot += h->energy;
+      m->x += h->energy * pt.x;
+      m->y += h->energy * pt.y;
+      m->z += h->energy * pt.z;
+    }
+    if (etot > 0) {
+      for (j = 0; j < pl.ntsteps; j++) out[j] /= etot;
+      m->x /= etot;
+      m->y /= etot;
+      m->z /= etot;
+      signal_params(out, pl.ntsteps, pl.step_time, &t10, &m->t90, &m->a_over_e);
+    }
+    m->energy = (in.events ? etot : 0);
+    m->status = b->status[i];
+  }
+}
+
+/* worker
+   thread that calculates batches, until it gets end_of_work;
+   arg is the thread's own copy of the setup, from signal_calc_clone
+*/
+static void *worker(void *arg) {
+  Batch *b;
+  float *s;
+
+  if (!(s = malloc(pl.ntsteps * sizeof(*s)))) {
+    fprintf(stderr, "ERROR: malloc failed in worker\n");
+    exit(1);
+  }
+  while ((b = queue_get(pl.work)) != &end_of_work) {
+    calc_batch(b, arg, s);
+    queue_put(pl.done, b);
+  }
+  free(s);
+  return NULL;
+}
+
+/* write_batch
+   write the signals of batch b to the output
+   returns 0 for success, 1 on error
+*/
+static int write_batch(Batch *b) {
+  int  i, seq;
+
+  for (i = 0; i < b->nevents; i++) {
+    if (out.wave) {
+      if (wave_write(out.wave, b->sig + (size_t) i * pl.ntsteps, &b->meta[i])) return 1;
+      continue;
+    }
+    seq = out.nevents + i;
+    fwrite(&seq, sizeof(seq), 1, out.fp);
+    fwrite(&b->status[i], sizeof(int), 1, out.fp);
+    if (fwrite(b->sig + (size_t) i * pl.ntsteps, sizeof(float), pl.ntsteps, out.fp) !=
+	pl.ntsteps) return 1;
+  }
+  return 0;
+}
+
+/* writer
+   thread that takes the calculated batches, in whatever order they are
+   finished, and writes them in input order; written batches go back to
+   the reader. Since there are only nbatch batches, a batch that finishes early
+   can be held in slot seq % nbatch until the ones before it are done.
+*/
+static void *writer(void *arg) {
+  Batch **held, *b;
+  long  next = 0;
+  int   end = 0;
+
+  if (!(held = calloc(pl.nbatch, sizeof(*held)))) {
+    fprintf(stderr, "ERROR: malloc failed in writer\n");
+    exit(1);
+  }
+  while (!end) {
+    b = queue_get(pl.done);
+    held[b->seq % pl.nbatch] = b;
+    while (!end && (b = held[next % pl.nbatch]) && b->seq == next) {
+      held[next++ % pl.nbatch] = NULL;
+      if (b->last) {
+	if (b->last < 0) out.err = 1;
+	end = 1;
+      } else if (!out.err) {
+	if (write_batch(b)) {
+	  fprintf(stderr, "ERROR: Write failed\n");
+	  out.err = 1;
+	  pl.stop = 1;   // the reader stops at the next batch
+	}
+	out.nevents += b->nevents;
+	out.nhits += b->nhits;
+      }
+      queue_put(pl.free, b);
+    }
+  }
+  free(held);
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+
+  MJD_Siggen_Setup setup, *copy;
+  Batch_Header     hdr;
+  pthread_t        *thread, read_thread, write_thread;
+  double           t0;
+  char   *config_file_name = NULL, *in_name = "-", *out_name = NULL;
+  double t;
+  float  scale = 0;
+  int    nthreads = 0, nt, i, err = 0, bad = (argc%2 != 1), compress = 0;
+
+  for (i=1; i<argc-1 && !bad; i+=2) {
+    if (!strcmp(argv[i], "-c")) {
+      config_file_name = argv[i+1];
+    } else if (!strcmp(argv[i], "-i")) {
+      in_name = argv[i+1];
+    } else if (!strcmp(argv[i], "-o")) {
+      out_name = argv[i+1];
+    } else if (!strcmp(argv[i], "-j")) {
+      nthreads = atoi(argv[i+1]);
+    } else if (!strcmp(argv[i], "-b")) {
+      in.binary = atoi(argv[i+1]);
+    } else if (!strcmp(argv[i], "-e")) {
+      in.events = atoi(argv[i+1]);
+    } else if (!strcmp(argv[i], "-y")) {
+      in.cyl = atoi(argv[i+1]);
+    } else if (!strcmp(argv[i], "-z")) {
+      compress = atoi(argv[i+1]);
+    } else if (!strcmp(argv[i], "-q")) {
+      scale = atof(argv[i+1]);
+    } else {
+      bad = 1;
+    }
+  }
+  if (bad || !config_file_name || !out_name) {
+    printf("Usage: %s -c config_file_name -o output_file [options]\n"
+	   "Possible options:\n"
+	   "      -i input_file  (points or events; default is stdin)\n"
+	   "      -j threads     (default is one for each core)\n"
+	   "      -b {0,1}       (text/binary input)\n"
+	   "      -e {0,1}       (input is points: x y z / events: event x y z energy)\n"
+	   "      -y {0,1}       (cartesian/cylindrical coordinates)\n"
+	   "      -z {0,1}       (plain/compressed output file)\n"
+	   "      -q scale       (quantize signals in compressed file to 16 bits of scale)\n",
+	   argv[0]);
+    return 1;
+  }
+
+  if (signal_calc_init(config_file_name, &setup) != 0) return 1;
+  if (!strcmp(in_name, "-")) {
+    in.fp = stdin;
+  } else if (!(in.fp = fopen(in_name, (in.binary ? "rb" : "r")))) {
+    fprintf(stderr, "ERROR: Cannot open input file %s\n", in_name);
+    return 1;
+  }
+  if (compress) {
+    if (!(out.wave = wave_open_write(out_name, setup.ntsteps_out, setup.step_time_out,
+				     scale, 0))) return 1;
+  } else if (!(out.fp = fopen(out_name, "wb"))) {
+    fprintf(stderr, "ERROR: Cannot open output file %s\n", out_name);
+    return 1;
+  }
+
+  if (nthreads < 1) nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (nthreads < 1) nthreads = 1;
+  pl.nthreads = nthreads;
+  pl.ntsteps = setup.ntsteps_out;
+  pl.step_time = setup.step_time_out;
+  /* enough batches for each worker to have one in hand and a few waiting,
+     and for the reader and writer to each be working on some */
+  pl.nbatch = 4 * nthreads + 4;
+  if (!(pl.batch = calloc(pl.nbatch, sizeof(*pl.batch))) ||
+      !(pl.free = queue_create(pl.nbatch)) ||
+      !(pl.work = queue_create(pl.nbatch + nthreads)) ||
+      !(pl.done = queue_create(pl.nbatch)) ||
+      !(thread = malloc(nthreads * sizeof(*thread))) ||
+      !(copy   = malloc(nthreads * sizeof(*copy)))) {
+    fprintf(stderr, "ERROR: malloc failed\n");
+    return 1;
+  }
+  for (i = 0; i < pl.nbatch; i++) {
+    pl.batch[i].max_hits = BATCH;
+    if (!(pl.batch[i].hit = malloc(BATCH * sizeof(*pl.batch[i].hit))) ||
+	!(pl.batch[i].sig = malloc((size_t) BATCH * pl.ntsteps * sizeof(float)))) {
+      fprintf(stderr, "ERROR: malloc failed\n");
+      return 1;
+    }
+    queue_put(pl.free, &pl.batch[i]);
+  }
+  for (i = 0; i < nthreads; i++) {
+    if (signal_calc_clone(&copy[i], &setup)) return 1;
+  }
+
+  if (!compress) {
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, "SGB1", 4);
+    hdr.ntsteps = pl.ntsteps;
+    hdr.step_time_out = setup.step_time_out;
+    fwrite(&hdr, sizeof(hdr), 1, out.fp);
+  }
+
+  t0 = timer_now();
+  for (nt = 0; nt < nthreads; nt++) {
+    if (pthread_create(&thread[nt], NULL, worker, &copy[nt])) break;
+  }
+  if (nt == 0 ||
+      pthread_create(&write_thread, NULL, writer, NULL) ||
+      pthread_create(&read_thread, NULL, reader, NULL)) {
+    fprintf(stderr, "ERROR: Cannot start threads\n");
+    return 1;
+  }
+  pthread_join(read_thread, NULL);
+  pthread_join(write_thread, NULL);
+  for (i = 0; i < nt; i++) pthread_join(thread[i], NULL);
+  t = timer_now() - t0;
+  err = out.err;
+
+  if (compress ? wave_close_write(out.wave) : fclose(out.fp)) {
+    fprintf(stderr, "ERROR: Failed to write file %s\n", out_name);
+    err = 1;
+  }
+  if (in.fp != stdin) fclose(in.fp);
+
+  fprintf(stderr, "%ld %s, %ld signals in %.2f s on %d threads: %.0f signals/s\n",
+	  out.nevents, (in.events ? "events" : "points"), out.nhits, t, nt,
+	  (t > 0 ? out.nhits / t : 0));
+
+  for (i = 0; i < nthreads; i++) {
+    signal_calc_stats_add(&setup, &copy[i]);
+    signal_calc_clone_free(&copy[i]);
+  }
+  signal_calc_finalize(&setup);
+  return err;
+}
@@ -0,0 +1,308 @@
+/* siggen_bench.c
+ *
+ * benchmark for the signal calculation code: calculates signals for fixed,
+ * reproducible sets of points in one or more detectors, in each of several
+ * modes of the calculation, and reports the number of signals per second,
+ * the time taken by each step of get_signal, and the memory used.
+ * The results are written to a JSON file, for comparison between versions
+ * of the code and between machines, and a summary table to stderr.
+ *
+ * usage: siggen_bench [-o results.json] [-n points] [-r repeats] [-s seed]
+ *                     [-m modes] [config_file ...]
+ *   -o  JSON output file; default siggen_bench.json
+ *   -n  number of points in each set; default 250
+ *   -r  the calculation is repeated this many times, and the fastest is reported
+ *   -s  seed for the random points; the same seed always gives the same points
+ *   -m  comma-separated list of modes; default base,diffusion,cloud,trapping,temperature
+ * The default config files are the reference detectors in config_files/
+ * (p1_new.config, bege_ref.config and icpc_ref.config); their fields must first
+ * be calculated with mjd_fieldgen.
+ *
+ * Point sets, in the r-z plane, at random angles:
+ *   contact  -- within 3 mm of the point contact
+ *   bulk     -- uniform over the detector volume
+ *   corners  -- within 3 mm of the outer corners (and of the bottom of the
+ *               borehole, if there is one)
+ *   surface  -- within 0.5 mm of the passivated surface, between the point contact
+ *               and the wrap-around (or the outer radius)
+ * Points outside the detector are not used.
+ *
+ * Modes; charge cloud size, diffusion and trapping are off unless they are turned on:
+ *   base         the config file's values otherwise
+ *   diffusion    use_diffusion 1
+ *   cloud        charge_cloud_size 1 mm
+ *   trapping     charge_trapping_per_step 0.999995
+ *   temperature  xtal_temp 110 K
+ *
+ * Each set is calculated once with get_signal, for the number of signals per
+ * second, and once calling the steps of get_signal separately (drift_signal,
+ * charge_cloud_convolve, compress_signal, rc_integrate) to time each of them;
+ * the two must give the same signals. Timing is on one thread;
+ * siggen_batch reports the throughput on all cores.
+ *
+ * to compile: see the Makefile
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "mjd_siggen.h"
+#include "calc_signal.h"
+#include "detector_geometry.h"
+#include "cyl_point.h"
+#include "point_sets.h"
+#include "timer.h"
+
+#define NMODES 5
+
+static char *mode_name[NMODES] = {"base", "diffusion", "cloud", "trapping", "temperature"};
+static char *default_config[] = {"config_files/p1_new.config",
+				 "config_files/bege_ref.config",
+				 "config_files/icpc_ref.config"};
+
+/* phases of get_signal */
+enum {DRIFT, CONVOLUTION, COMPRESSION, RC, NPHASES};
+static char *phase_name[NPHASES] = {"drift", "convolution", "compression", "rc"};
+
+typedef struct {
+  double time;           // fastest time for all points with get_signal, in s
+  double phase[NPHASES]; // time in each step, in s
+  double checksum;       // of all signals, to see if the results change
+  int    good;           // number of points with a signal
+  int    same;           // 1 if the separate steps gave the same signals as get_signal
+} Result;
+
+/* run_set
+   calculate the signals for the n points pt, and time them, into res;
+   sig has space for n signals
+*/
+static void run_set(point *pt, int n, int repeats, float *sig, Result *res,
+		    MJD_Siggen_Setup *setup) {
+  float  *s, *out;
+  double t, t0, t1;
+  int    i, j, r, err, nt = setup->ntsteps_out;
+
+  memset(res, 0, sizeof(*res));
+  res->same = 1;
+  memset(sig, 0, (size_t) n * nt * sizeof(*sig));
+  for (r = 0; r < repeats; r++) {
+    res->good = 0;
+    t0 = timer_now();
+    for (i = 0; i < n; i++) {
+      if (get_signal(pt[i], sig + (size_t) i * nt, setup) >= 0) res->good++;
+    }
+    t = timer_now() - t0;
+    if (r == 0 || t < res->time) res->time = t;
+  }
+  for (i = 0; i < n; i++) {
+    for (j = 0; j < nt; j++) res->checksum += sig[(size_t) i * nt + j] * (j % 7 + 1);
+  }
+
+  /* the same again, one step at a time */
+  if (!(out = malloc(nt * sizeof(*out)))) {
+    fprintf(stderr, "ERROR: malloc failed in run_set\n");
+    exit(1);
+  }
+  s = setup->sig_work;
+  for (i = 0; i < n; i++) {
+    t0 = timer_now();
+    err = drift_signal(pt[i], s, setup);
+    t1 = timer_now();
+    res->phase[DRIFT] += t1 - t0;
+    if (err < 0) continue;
+    t0 = t1;
+    charge_cloud_convolve(s, setup);
+    t1 = timer_now();
+    res->phase[CONVOLUTION] += t1 - t0;
+    t0 = t1;
+    compress_signal(s, out, setup);
+    t1 = timer_now();
+    res->phase[COMPRESSION] += t1 - t0;
+    t0 = t1;
+    if (setup->preamp_tau/setup->step_time_out >= 0.1f)
+      rc_integrate(out, out, setup->preamp_tau/setup->step_time_out, nt);
+    res->phase[RC] += timer_now() - t0;
+    if (memcmp(out, sig + (size_t) i * nt, nt * sizeof(*out))) res->same = 0;
+  }
+  free(out);
+}
+
+/* json_string
+   write string s to fp as a JSON string
+*/
+static void json_string(FILE *fp, const char *s) {
+  putc('"', fp);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\') putc('\\', fp);
+    if ((unsigned char) *s >= ' ') putc(*s, fp);
+  }
+  putc('"', fp);
+}
+
+/* memory_kb
+   returns the resident memory of the process now, and its maximum so far, in kB
+*/
+static void memory_kb(long *rss, long *max_rss) {
+  struct rusage u;
+  FILE  *fp;
+  long  pages;
+
+  *rss = -1;
+  if ((fp = fopen("/proc/self/statm", "r"))) {
+    if (fscanf(fp, "%*d %ld", &pages) == 1) *rss = pages * (sysconf(_SC_PAGESIZE) / 1024);
+    fclose(fp);
+  }
+  getrusage(RUSAGE_SELF, &u);
+  *max_rss = u.ru_maxrss;
+}
+
+int main(int argc, char **argv) {
+
+  MJD_Siggen_Setup setup;
+  Result  res;
+  point   *pt[NSETS];
+  float   *sig;
+  char    **config, *out_name = "siggen_bench.json", *modes = NULL, *c, host[256], date[64];
+  FILE    *fp;
+  time_t  tnow;
+  double  t0, init_time;
+  long    rss, max_rss, field_bytes;
+  unsigned long long seed = 1;
+  int     npts = 250, repeats = 1, nconfig, use[NMODES], np[NSETS];
+  int     i, j, k, m, first = 1, bad = 0;
+
+  for (i = 1; i < argc && argv[i][0] == '-'; i += 2) {
+    if (i == argc - 1) {
+      bad = 1;
+    } else if (!strcmp(argv[i], "-o")) {
+      out_name = argv[i+1];
+    } else if (!strcmp(argv[i], "-n")) {
+      npts = atoi(argv[i+1]);
+    } else if (!strcmp(argv[i], "-r")) {
+      repeats = atoi(argv[i+1]);
+    } else if (!strcmp(argv[i], "-s")) {
+      seed = strtoull(argv[i+1], NULL, 10);
+    } else if (!strcmp(argv[i], "-m")) {
+      modes = argv[i+1];
+    } else {
+      bad = 1;
+    }
+    if (bad) break;
+  }
+  for (m = 0; m < NMODES; m++) use[m] = (modes == NULL);
+  for (c = (modes ? strtok(modes, ",") : NULL); c && !bad; c = strtok(NULL, ",")) {
+    for (m = 0; m < NMODES && strcmp(c, mode_name[m]); m++) ;
+    if (m == NMODES) bad = 1;
+    else use[m] = 1;
+  }
+  if (bad || npts < 1 || repeats < 1) {
+    printf("Usage: %s [-o results.json] [-n points] [-r repeats] [-s seed]\n"
+	   "         [-m modes] [config_file ...]\n"
+	   "   modes are a comma-separated list of "
+	   "base,diffusion,cloud,trapping,temperature\n", argv[0]);
+    return 1;
+  }
+  if (i < argc) {
+    config = argv + i;
+    nconfig = argc - i;
+  } else {
+    config = default_config;
+    nconfig = sizeof(default_config) / sizeof(default_config[0]);
+  }
+
+  if (!(fp = fopen(out_name, "w"))) {
+    fprintf(stderr, "ERROR: Cannot open output file %s\n", out_name);
+    return 1;
+  }
+  for (k = 0; k < NSETS; k++) {
+    if (!(pt[k] = malloc(npts * sizeof(*pt[k])))) {
+      fprintf(stderr, "ERROR: malloc failed\n");
+      return 1;
+    }
+  }
+  if (gethostname(host, sizeof(host))) strcpy(host, "unknown");
+  host[sizeof(host)-1] = '\0';
+  tnow = time(NULL);
+  strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&tnow));
+  fprintf(fp, "{\n  \"program\": \"siggen_bench\",\n  \"host\": ");
+  json_string(fp, host);
+  fprintf(fp, ",\n  \"cpus\": %ld,\n  \"date\": \"%s\",\n  \"compiler\": ",
+	  sysconf(_SC_NPROCESSORS_ONLN), date);
+  json_string(fp, __VERSION__);
+  fprintf(fp, ",\n  \"points_per_set\": %d,\n  \"repeats\": %d,\n  \"seed\": %llu,\n"
+	  "  \"results\": [", npts, repeats, seed);
+
+  fprintf(stderr, "%-28s %-11s %-8s %5s %9s %9s %9s %9s %9s\n", "config", "mode", "set",
+	  "good", "signals/s", "drift_us", "conv_us", "comp_us", "rc_us");
+  for (i = 0; i < nconfig; i++) {
+    for (m = 0; m < NMODES; m++) {
+      if (!use[m]) continue;
+      if (read_config(config[i], &setup)) return 1;
+      setup.verbosity = 0;
+      setup.charge_cloud_size = 0;
+      setup.use_diffusion = 0;
+      setup.charge_trapping_per_step = 1.0;
+      if (m == 1) setup.use_diffusion = 1;
+      if (m == 2) setup.charge_cloud_size = 1.0;
+      if (m == 3) setup.charge_trapping_per_step = 0.999995;
+      if (m == 4) setup.xtal_temp = 110.0;
+      t0 = timer_now();
+      if (signal_calc_init_setup(&setup) != 0) {
+	fprintf(stderr, "ERROR: Cannot set up %s; have its fields been calculated?\n",
+		config[i]);
+	return 1;
+      }
+      init_time = timer_now() - t0;
+      memory_kb(&rss, &max_rss);
+      field_bytes = (long) setup.rlen * setup.zlen *
+	(sizeof(cyl_pt) + 2*sizeof(float)) +
+	(long) setup.time_steps_calc * (2*sizeof(point) + 3*sizeof(float));
+      if (!(sig = malloc((size_t) npts * setup.ntsteps_out * sizeof(*sig)))) {
+	fprintf(stderr, "ERROR: malloc failed\n");
+	return 1;
+      }
+
+      /* the same points for every mode, and for every run with the same seed */
+      point_set_seed(seed + i);
+      for (k = 0; k < NSETS; k++) np[k] = point_set_make(k, pt[k], npts, &setup);
+
+      for (k = 0; k < NSETS; k++) {
+	if (np[k] == 0) continue;
+	run_set(pt[k], np[k], repeats, sig, &res, &setup);
+	fprintf(stderr, "%-28.28s %-11s %-8s %5d %9.0f", config[i], mode_name[m],
+		point_set_name[k], res.good, (res.time > 0 ? np[k] / res.time : 0));
+	for (j = 0; j < NPHASES; j++) fprintf(stderr, " %9.2f", 1e6 * res.phase[j] / np[k]);
+	fprintf(stderr, "%s\n", (res.same ? "" : "  (steps differ!)"));
+
+	fprintf(fp, "%s\n    {\"config\": ", (first ? "" : ","));
+	json_string(fp, config[i]);
+	first = 0;
+	fprintf(fp, ", \"mode\": \"%s\", \"set\": \"%s\",\n"
+		"     \"points\": %d, \"good\": %d, \"time_s\": %.6f, \"signals_per_s\": %.1f,\n"
+		"     \"phase_us_per_signal\": {", mode_name[m], point_set_name[k],
+		np[k], res.good, res.time, (res.time > 0 ? np[k] / res.time : 0));
+	for (j = 0; j < NPHASES; j++)
+	  fprintf(fp, "%s\"%s\": %.3f", (j ? ", " : ""), phase_name[j],
+		  1e6 * res.phase[j] / np[k]);
+	fprintf(fp, "},\n     \"steps_match\": %s, \"checksum\": %.9g,\n"
+		"     \"time_steps_calc\": %d, \"step_time_calc\": %g, \"ntsteps_out\": %d,\n"
+		"     \"init_s\": %.3f, \"field_bytes\": %ld, \"rss_kb\": %ld, \"max_rss_kb\": %ld}",
+		(res.same ? "true" : "false"), res.checksum, setup.time_steps_calc,
+		setup.step_time_calc, setup.ntsteps_out, init_time, field_bytes, rss, max_rss);
+      }
+      free(sig);
+      signal_calc_finalize(&setup);
+    }
+  }
+  fprintf(fp, "\n  ]\n}\n");
+  if (fclose(fp)) {
+    fprintf(stderr, "ERROR: Failed to write file %s\n", out_name);
+    return 1;
+  }
+  return 0;
+}
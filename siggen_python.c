@@ -0,0 +1,429 @@
+/* siggen_python.c
+ *
+ * Python bindings for the signal calculation code, as the module "siggen";
+ * to build: make python
+ *
+ *   import numpy as np, siggen
+ *   det = siggen.Detector("p1.config", threads=0)   # 0: one thread for each core
+ *   pts = np.array([[10, 0, 20], [5, 5, 30]], np.float32)        # x, y, z in mm
+ *   s, status = det.signals(pts)       # s is (n, det.ntsteps), status is (n,)
+ *   e_path, h_path = det.drift_paths((10, 0, 20))    # (det.time_steps_calc, 3)
+ *   t10, t90, a_over_e = siggen.signal_params(s, det.step_time)
+ *
+ * Arrays are passed through the buffer protocol, so numpy arrays (and also
+ * array.array, bytearray etc.) are used without copying; they must be
+ * C-contiguous float32. The results are memoryviews of new buffers, or of
+ * the arrays given as out=...; np.asarray() of a result does not copy it.
+ * For no points, the results are empty, of shape (0,), since a memoryview
+ * cannot be cast to a shape with a zero in it.
+ * The interpreter lock is released during the calculations, so other Python
+ * threads can run at the same time.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "mjd_siggen.h"
+#include "calc_signal.h"
+#include "cyl_point.h"
+
+typedef struct {
+  PyObject_HEAD
+  MJD_Siggen_Setup setup;
+  MJD_Siggen_Setup *copy;     // one for each thread, from signal_calc_clone
+  int    nthreads;
+  int    ready;               // nonzero once setup has been initialized
+  pthread_mutex_t lock;       // one calculation at a time for each detector
+} Detector;
+
+/* work for the threads of Detector.signals() */
+typedef struct {
+  Detector *det;
+  float    *pt, *sig;         // n points, and n signals
+  int      *status;
+  int      n, cyl;
+  volatile int next;          // next point to be calculated
+} Batch;
+
+typedef struct {
+  Batch            *b;
+  MJD_Siggen_Setup *setup;
+} Batch_Thread;
+
+/* get_floats
+   get the buffer of obj, which must be C-contiguous float32 with a multiple of
+   width values; if writable, it must be writable too
+   returns the number of values / width, or -1 with a Python exception set
+*/
+static Py_ssize_t get_floats(PyObject *obj, Py_buffer *view, int width, int writable,
+			     char *name) {
+  char *f;
+
+  if (PyObject_GetBuffer(obj, view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT |
+			 (writable ? PyBUF_WRITABLE : 0))) return -1;
+  f = view->format;
+  if (f && (*f == '@' || *f == '=' || *f == '<')) f++;
+  if (!f || strcmp(f, "f") || view->itemsize != sizeof(float) ||
+      (view->len / sizeof(float)) % width) {
+    PyErr_Format(PyExc_ValueError, "%s must be a contiguous float32 array of shape (n, %d)",
+		 name, width);
+    PyBuffer_Release(view);
+    return -1;
+  }
+  return view->len / sizeof(float) / width;
+}
+
+/* new_array
+   returns a memoryview of a new bytearray of n x m items of format
+   ("f" or "i"), of shape (n, m), or (n) if m is 0, and sets *data to its values;
+   if n is 0, the result is empty, of shape (0), since memoryview.cast()
+   does not allow zeros in the shape
+*/
+static PyObject *new_array(Py_ssize_t n, Py_ssize_t m, char *format, void **data) {
+  PyObject   *ba, *mv, *shape, *cast;
+
+  if (!(ba = PyByteArray_FromStringAndSize(NULL, n * (m > 0 ? m : 1) * 4))) return NULL;
+  *data = PyByteArray_AS_STRING(ba);
+  mv = PyMemoryView_FromObject(ba);
+  Py_DECREF(ba);
+  if (!mv) return NULL;
+  if (n == 0) {
+    cast = PyObject_CallMethod(mv, "cast", "s", format);
+    Py_DECREF(mv);
+    return cast;
+  }
+  if (m > 0) {
+    shape = Py_BuildValue("(nn)", n, m);
+  } else {
+    shape = Py_BuildValue("(n)", n);
+  }
+  cast = (shape ? PyObject_CallMethod(mv, "cast", "sO", format, shape) : NULL);
+  Py_XDECREF(shape);
+  Py_DECREF(mv);
+  return cast;
+}
+
+static void *batch_thread(void *arg) {
+  Batch_Thread *t = arg;
+  Batch        *b = t->b;
+  struct cyl_pt cyl;
+  point  pt;
+  float  *p;
+  int    i, nt = b->det->setup.ntsteps_out;
+
+  while ((i = __sync_fetch_and_add(&b->next, 1)) < b->n) {
+    p = b->pt + 3*i;
+    if (b->cyl) {
+      cyl.r = p[0];  cyl.phi = p[1];  cyl.z = p[2];
+      pt = cyl_to_cart(cyl);
+    } else {
+      pt.x = p[0];  pt.y = p[1];  pt.z = p[2];
+    }
+    b->status[i] = (get_signal(pt, b->sig + (size_t) i * nt, t->setup) < 0 ? -1 : 0);
+  }
+  return NULL;
+}
+
+static int Detector_init(Detector *self, PyObject *args, PyObject *kw) {
+  static char *kwlist[] = {"config_file", "threads", NULL};
+  char   *config_file_name;
+  int    i, err, nthreads = 0;
+
+  if (self->ready) {
+    PyErr_SetString(PyExc_RuntimeError, "Detector is already initialized");
+    return -1;
+  }
+  if (!PyArg_ParseTupleAndKeywords(args, kw, "s|i", kwlist, &config_file_name, &nthreads))
+    return -1;
+  if (nthreads < 1) nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (nthreads < 1) nthreads = 1;
+
+  Py_BEGIN_ALLOW_THREADS
+  err = signal_calc_init(config_file_name, &self->setup);
+  Py_END_ALLOW_THREADS
+  if (err) {
+    PyErr_Format(PyExc_RuntimeError, "Failed to set up detector from %s", config_file_name);
+    return -1;
+  }
+  if (!(self->copy = PyMem_Calloc(nthreads, sizeof(*self->copy)))) {
+    signal_calc_finalize(&self->setup);
+    PyErr_NoMemory();
+    return -1;
+  }
+  for (i = 0; i < nthreads; i++) {
+    if (signal_calc_clone(&self->copy[i], &self->setup)) break;
+    self->nthreads++;
+  }
+  pthread_mutex_init(&self->lock, NULL);
+  self->ready = 1;
+  if (i < nthreads) {
+    PyErr_NoMemory();
+    return -1;
+  }
+  return 0;
+}
+
+static void Detector_dealloc(Detector *self) {
+  int i;
+
+  if (self->ready) {
+    for (i = 0; i < self->nthreads; i++) {
+      signal_calc_stats_add(&self->setup, &self->copy[i]);
+      signal_calc_clone_free(&self->copy[i]);
+    }
+    signal_calc_finalize(&self->setup);
+    pthread_mutex_destroy(&self->lock);
+  }
+  PyMem_Free(self->copy);
+  Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+#define CHECK_READY(self, ret)						\
+  if (!(self)->ready) {							\
+    PyErr_SetString(PyExc_RuntimeError, "Detector is not initialized");	\
+    return ret;								\
+  }
+
+static PyObject *Detector_signals(Detector *self, PyObject *args, PyObject *kw) {
+  static char *kwlist[] = {"points", "out", "cyl", NULL};
+  PyObject     *points, *out = Py_None, *sig_obj = NULL, *status_obj = NULL;
+  Py_buffer    pview, oview;
+  Batch        b;
+  Batch_Thread *t = NULL;
+  pthread_t    *thread = NULL;
+  Py_ssize_t   n;
+  int          i, nt, cyl = 0;
+
+  CHECK_READY(self, NULL);
+  if (!PyArg_ParseTupleAndKeywords(args, kw, "O|Op", kwlist, &points, &out, &cyl))
+    return NULL;
+  if ((n = get_floats(points, &pview, 3, 0, "points")) < 0) return NULL;
+  memset(&b, 0, sizeof(b));
+  b.det = self;
+  b.pt = pview.buf;
+  b.n = n;
+  b.cyl = cyl;
+  nt = self->setup.ntsteps_out;
+
+  if (out == Py_None) {
+    sig_obj = new_array(n, nt, "f", (void **) &b.sig);
+  } else if (get_floats(out, &oview, nt, 1, "out") != n) {
+    if (!PyErr_Occurred()) {
+      PyErr_Format(PyExc_ValueError, "out must have shape (%zd, %d)", n, nt);
+      PyBuffer_Release(&oview);
+    }
+  } else {
+    b.sig = oview.buf;
+    sig_obj = PyMemoryView_FromObject(out);
+    PyBuffer_Release(&oview);   // sig_obj holds its own reference to the buffer
+  }
+  if (sig_obj) status_obj = new_array(n, 0, "i", (void **) &b.status);
+  if (status_obj &&
+      (!(t = PyMem_Malloc(self->nthreads * sizeof(*t))) ||
+       !(thread = PyMem_Malloc(self->nthreads * sizeof(*thread))))) PyErr_NoMemory();
+  if (PyErr_Occurred()) {
+    PyMem_Free(t);
+    PyBuffer_Release(&pview);
+    Py_XDECREF(sig_obj);
+    Py_XDECREF(status_obj);
+    return NULL;
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  pthread_mutex_lock(&self->lock);
+  for (i = 0; i < self->nthreads && i < n; i++) {
+    t[i].b = &b;
+    t[i].setup = &self->copy[i];
+    if (pthread_create(&thread[i], NULL, batch_thread, &t[i])) break;
+  }
+  if (i == 0) {   // no threads; do it here
+    t[0].b = &b;
+    t[0].setup = &self->copy[0];
+    batch_thread(&t[0]);
+  }
+  while (--i >= 0) pthread_join(thread[i], NULL);
+  pthread_mutex_unlock(&self->lock);
+  Py_END_ALLOW_THREADS
+
+  PyMem_Free(thread);
+  PyMem_Free(t);
+  PyBuffer_Release(&pview);
+  return Py_BuildValue("(NN)", sig_obj, status_obj);
+}
+
+static PyObject *Detector_drift_paths(Detector *self, PyObject *args, PyObject *kw) {
+  static char *kwlist[] = {"point", "cyl", NULL};
+  struct cyl_pt cyl;
+  PyObject *e_obj, *h_obj;
+  point    pt, *dpe, *dph;
+  float    *e, *h, x, y, z;
+  char     msg[120];
+  int      ok, nt, i, c = 0;
+
+  CHECK_READY(self, NULL);
+  if (!PyArg_ParseTupleAndKeywords(args, kw, "(fff)|p", kwlist, &x, &y, &z, &c))
+    return NULL;
+  if (c) {
+    cyl.r = x;  cyl.phi = y;  cyl.z = z;
+    pt = cyl_to_cart(cyl);
+  } else {
+    pt.x = x;  pt.y = y;  pt.z = z;
+  }
+  nt = self->setup.time_steps_calc;
+  if (!(e_obj = new_array(nt, 3, "f", (void **) &e))) return NULL;
+  if (!(h_obj = new_array(nt, 3, "f", (void **) &h))) {
+    Py_DECREF(e_obj);
+    return NULL;
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  pthread_mutex_lock(&self->lock);
+  ok = (get_signal(pt, NULL, &self->copy[0]) >= 0);
+  drift_path_e(&dpe, &self->copy[0]);
+  drift_path_h(&dph, &self->copy[0]);
+  for (i = 0; i < nt; i++) {
+    e[3*i] = dpe[i].x;  e[3*i+1] = dpe[i].y;  e[3*i+2] = dpe[i].z;
+    h[3*i] = dph[i].x;  h[3*i+1] = dph[i].y;  h[3*i+2] = dph[i].z;
+  }
+  pthread_mutex_unlock(&self->lock);
+  Py_END_ALLOW_THREADS
+
+  if (!ok) {
+    Py_DECREF(e_obj);
+    Py_DECREF(h_obj);
+    snprintf(msg, sizeof(msg), "point (%g, %g, %g) is not in the detector, or has no field",
+	     x, y, z);
+    PyErr_SetString(PyExc_ValueError, msg);
+    return NULL;
+  }
+  return Py_BuildValue("(NN)", e_obj, h_obj);
+}
+
+static PyObject *signal_params_py(PyObject *module, PyObject *args, PyObject *kw) {
+  static char *kwlist[] = {"signals", "step_time", "ntsteps", NULL};
+  PyObject   *signals, *t10_obj, *t90_obj, *ae_obj;
+  Py_buffer  view;
+  Py_ssize_t n, i;
+  float      step_time, *s, *t10, *t90, *ae;
+  int        nt = 0, ndim;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kw, "Of|i", kwlist, &signals, &step_time, &nt))
+    return NULL;
+  if (nt <= 0) {   // from the shape of signals
+    if (PyObject_GetBuffer(signals, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT)) return NULL;
+    ndim = view.ndim;
+    nt = (ndim > 0 && view.shape ? view.shape[ndim-1] : view.len / sizeof(float));
+    PyBuffer_Release(&view);
+    if (nt < 1) nt = 1;   // no signals, so empty results
+  }
+  if ((n = get_floats(signals, &view, nt, 0, "signals")) < 0) return NULL;
+  t10_obj = new_array(n, 0, "f", (void **) &t10);
+  t90_obj = new_array(n, 0, "f", (void **) &t90);
+  ae_obj  = new_array(n, 0, "f", (void **) &ae);
+  if (!t10_obj || !t90_obj || !ae_obj) {
+    Py_XDECREF(t10_obj);
+    Py_XDECREF(t90_obj);
+    Py_XDECREF(ae_obj);
+    PyBuffer_Release(&view);
+    return NULL;
+  }
+  s = view.buf;
+  Py_BEGIN_ALLOW_THREADS
+  for (i = 0; i < n; i++)
+    signal_params(s + i*nt, nt, step_time, &t10[i], &t90[i], &ae[i]);
+  Py_END_ALLOW_THREADS
+  PyBuffer_Release(&view);
+  return Py_BuildValue("(NNN)", t10_obj, t90_obj, ae_obj);
+}
+
+static PyObject *Detector_get_int(Detector *self, void *offset) {
+  CHECK_READY(self, NULL);
+  return PyLong_FromLong(*(int *) ((char *) &self->setup + (size_t) offset));
+}
+
+static PyObject *Detector_get_float(Detector *self, void *offset) {
+  CHECK_READY(self, NULL);
+  return PyFloat_FromDouble(*(float *) ((char *) &self->setup + (size_t) offset));
+}
+
+#define SETUP_OFFSET(field) ((void *) offsetof(MJD_Siggen_Setup, field))
+
+static PyGetSetDef Detector_getset[] = {
+  {"ntsteps", (getter) Detector_get_int, NULL,
+   "number of time steps in each signal", SETUP_OFFSET(ntsteps_out)},
+  {"step_time", (getter) Detector_get_float, NULL,
+   "length of each time step of the signals, in ns", SETUP_OFFSET(step_time_out)},
+  {"time_steps_calc", (getter) Detector_get_int, NULL,
+   "number of time steps in the calculation, and in the drift paths",
+   SETUP_OFFSET(time_steps_calc)},
+  {"step_time_calc", (getter) Detector_get_float, NULL,
+   "length of each time step of the calculation, in ns", SETUP_OFFSET(step_time_calc)},
+  {"length", (getter) Detector_get_float, NULL, "crystal length, in mm", SETUP_OFFSET(xtal_length)},
+  {"radius", (getter) Detector_get_float, NULL, "crystal radius, in mm", SETUP_OFFSET(xtal_radius)},
+  {NULL}
+};
+
+static PyMethodDef Detector_methods[] = {
+  {"signals", (PyCFunction) (void (*)(void)) Detector_signals, METH_VARARGS | METH_KEYWORDS,
+   "signals(points, out=None, cyl=False) -> (signals, status)\n"
+   "calculate the signals for points, a float32 array of shape (n, 3), in mm;\n"
+   "cartesian (x, y, z), or if cyl, cylindrical (r, phi in radians, z).\n"
+   "signals is out if given, otherwise a new float32 array, of shape (n, ntsteps);\n"
+   "status[i] is 0, or -1 if point i is outside the detector or has no field"},
+  {"drift_paths", (PyCFunction) (void (*)(void)) Detector_drift_paths, METH_VARARGS | METH_KEYWORDS,
+   "drift_paths(point, cyl=False) -> (electron_path, hole_path)\n"
+   "the drift paths of the charges from point, each of shape (time_steps_calc, 3)"},
+  {NULL}
+};
+
+static PyTypeObject DetectorType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  .tp_name = "siggen.Detector",
+  .tp_doc = "Detector(config_file, threads=0)\n"
+            "a detector, with its fields read as given in config_file;\n"
+            "signals are calculated with threads threads (0: one for each core)",
+  .tp_basicsize = sizeof(Detector),
+  .tp_flags = Py_TPFLAGS_DEFAULT,
+  .tp_new = PyType_GenericNew,
+  .tp_init = (initproc) Detector_init,
+  .tp_dealloc = (destructor) Detector_dealloc,
+  .tp_methods = Detector_methods,
+  .tp_getset = Detector_getset,
+};
+
+static PyMethodDef siggen_methods[] = {
+  {"signal_params", (PyCFunction) (void (*)(void)) signal_params_py, METH_VARARGS | METH_KEYWORDS,
+   "signal_params(signals, step_time, ntsteps=0) -> (t10, t90, a_over_e)\n"
+   "the 10% and 90% times (in ns) and A/E of each of the signals, a float32 array\n"
+   "of shape (n, ntsteps); ntsteps is taken from the shape if not given"},
+  {NULL}
+};
+
+static struct PyModuleDef siggen_module = {
+  PyModuleDef_HEAD_INIT,
+  .m_name = "siggen",
+  .m_doc = "signal calculation for point-contact HPGe detectors",
+  .m_size = -1,
+  .m_methods = siggen_methods,
+};
+
+PyMODINIT_FUNC PyInit_siggen(void) {
+  PyObject *m;
+
+  if (PyType_Ready(&DetectorType) < 0) return NULL;
+  if (!(m = PyModule_Create(&siggen_module))) return NULL;
+  Py_INCREF(&DetectorType);
+  if (PyModule_AddObject(m, "Detector", (PyObject *) &DetectorType) < 0) {
+    Py_DECREF(&DetectorType);
+    Py_DECREF(m);
+    return NULL;
+  }
+  return m;
+}
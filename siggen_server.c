@@ -0,0 +1,359 @@
+/* siggen_server.c
+ *
+ * long-running server for signal calculation: keeps the fields of one or
+ * more detectors loaded, and calculates signals for clients that connect
+ * to a Unix domain socket, using a pool of threads. See siggen_server.h
+ * for the protocol.
+ *
+ * usage: siggen_server -s socket_name [-j threads] config_file [config_file ...]
+ *
+ * Each client has a thread that reads its requests and hands them to the pool;
+ * the signals for a request are split into blocks of points that are calculated
+ * at the same time, and the reply is sent as soon as they are all done.
+ *
+ * to compile: see the Makefile
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "mjd_siggen.h"
+#include "calc_signal.h"
+#include "siggen_server.h"
+#include "pool.h"
+
+#define MAX_DETECTORS 16
+#define MAX_PENDING   16   // requests of one client being worked on at once
+#define BLOCK         8    // points per task
+
+typedef struct {
+  MJD_Siggen_Setup setup;    // as read from the config file, with the fields
+  MJD_Siggen_Setup *copy;    // one for each worker thread, from signal_calc_clone
+} Detector;
+
+typedef struct {
+  int    fd;
+  pthread_mutex_t lock;      // protects pending and closed, and writes to fd
+  pthread_cond_t  cond;
+  int    pending;            // number of requests being worked on
+  int    closed;             // nonzero once the client has disconnected
+} Client;
+
+typedef struct {
+  Client         *client;
+  Server_Request req;
+  Server_Point   *pt;
+  char           *out;       // the reply: Server_Reply, then req.n signals
+  size_t         rec;        // bytes of each signal, with its status
+  Pool_Group     grp;
+} Request;
+
+typedef struct {
+  Request *r;
+  int     i0, i1;            // points i0 ... i1-1 of the request
+} Block;
+
+static Detector det[MAX_DETECTORS];
+static int      ndet = 0;
+static Pool     *pool;
+static char     *socket_name;
+
+/* read_all, write_all
+   read or write len bytes from/to socket fd
+   return 0 for success, 1 on error or end of file
+*/
+static int read_all(int fd, void *buf, size_t len) {
+  char    *c = buf;
+  ssize_t n;
+
+  while (len > 0) {
+    if ((n = recv(fd, c, len, 0)) < 0 && errno == EINTR) continue;
+    if (n <= 0) return 1;
+    c += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+  const char *c = buf;
+  ssize_t    n;
+
+  while (len > 0) {
+    if ((n = send(fd, c, len, MSG_NOSIGNAL)) < 0 && errno == EINTR) continue;
+    if (n <= 0) return 1;
+    c += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/* send_reply
+   send the reply to a request; only one thread at a time writes to the client,
+   and the client may have stopped sending but still be reading
+*/
+static void send_reply(Client *c, void *buf, size_t len) {
+
+  pthread_mutex_lock(&c->lock);
+  if (write_all(c->fd, buf, len)) shutdown(c->fd, SHUT_RDWR);
+  pthread_mutex_unlock(&c->lock);
+}
+
+/* client_done
+   record that a request of client c is finished, or (if req is 0) that the
+   client has disconnected; the client is freed once both have happened
+*/
+static void client_done(Client *c, int req) {
+  int done;
+
+  pthread_mutex_lock(&c->lock);
+  if (req) {
+    c->pending--;
+    pthread_cond_signal(&c->cond);
+  } else {
+    c->closed = 1;
+  }
+  done = (c->closed && c->pending == 0);
+  pthread_mutex_unlock(&c->lock);
+  if (done) {
+    close(c->fd);
+    pthread_mutex_destroy(&c->lock);
+    pthread_cond_destroy(&c->cond);
+    free(c);
+  }
+}
+
+/* set_reply
+   fill in the reply header at buf for request req, with status
+*/
+static void set_reply(void *buf, Server_Request *req, int status, int n) {
+  Server_Reply reply;
+
+  memset(&reply, 0, sizeof(reply));
+  reply.magic = SERVER_REPLY_MAGIC;
+  reply.status = status;
+  reply.id = req->id;
+  reply.n = n;
+  if (status == SERVER_OK) {
+    reply.ntsteps = det[req->detector].setup.ntsteps_out;
+    reply.step_time = det[req->detector].setup.step_time_out;
+  }
+  memcpy(buf, &reply, sizeof(reply));
+}
+
+/* calc_block
+   calculate the signals for a block of points, a task in the pool
+*/
+static void calc_block(void *arg) {
+  Block            *b = arg;
+  MJD_Siggen_Setup *setup;
+  point  pt;
+  char   *out;
+  int    i, status;
+
+  setup = &det[b->r->req.detector].copy[pool_thread_id(pool)];
+  for (i = b->i0; i < b->i1; i++) {
+    out = b->r->out + sizeof(Server_Reply) + i * b->r->rec;
+    pt.x = b->r->pt[i].x;
+    pt.y = b->r->pt[i].y;
+    pt.z = b->r->pt[i].z;
+    status = (get_signal(pt, (float *) (out + sizeof(int)), setup) < 0 ? -1 : 0);
+    memcpy(out, &status, sizeof(int));
+  }
+}
+
+/* run_request
+   calculate the signals for a request and send the reply; a job in the pool
+*/
+static void run_request(void *arg) {
+  Request *r = arg;
+  Block   *b = NULL;
+  int     i, nb = (r->req.n + BLOCK - 1) / BLOCK;
+
+  if (nb > 0 && !(b = malloc(nb * sizeof(*b)))) {
+    set_reply(r->out, &r->req, SERVER_NO_MEMORY, 0);
+    send_reply(r->client, r->out, sizeof(Server_Reply));
+  } else {
+    r->grp.pending = 0;
+    for (i = 0; i < nb; i++) {
+      b[i].r = r;
+      b[i].i0 = i * BLOCK;
+      b[i].i1 = (i == nb-1 ? r->req.n : (i+1) * BLOCK);
+      pool_spawn(pool, &r->grp, calc_block, &b[i]);
+    }
+    pool_wait(pool, &r->grp);
+    set_reply(r->out, &r->req, SERVER_OK, r->req.n);
+    send_reply(r->client, r->out, sizeof(Server_Reply) + r->req.n * r->rec);
+    free(b);
+  }
+  client_done(r->client, 1);
+  free(r->out);
+  free(r->pt);
+  free(r);
+}
+
+/* client_thread
+   read the requests of one client, until it disconnects
+*/
+static void *client_thread(void *arg) {
+  Client         *c = arg;
+  Server_Request req;
+  Request        *r;
+  char           reply[sizeof(Server_Reply)];
+  Server_Point   *pt;
+  int            status;
+
+  while (!read_all(c->fd, &req, sizeof(req))) {
+    if (req.magic != SERVER_REQUEST_MAGIC || req.n < 0 || req.n > SERVER_MAX_POINTS) {
+      set_reply(reply, &req, SERVER_BAD_REQUEST, 0);
+      send_reply(c, reply, sizeof(reply));
+      break;   // we cannot find the next request
+    }
+    if (!(pt = malloc((req.n + 1) * sizeof(*pt))) ||
+	read_all(c->fd, pt, req.n * sizeof(*pt))) {
+      free(pt);
+      break;
+    }
+    status = SERVER_OK;
+    if (req.detector < 0 || req.detector >= ndet) {
+      status = SERVER_BAD_DETECTOR;
+    } else if (req.type != SERVER_INFO && req.type != SERVER_SIGNALS) {
+      status = SERVER_BAD_REQUEST;
+    }
+    if (status != SERVER_OK || req.type == SERVER_INFO) {
+      set_reply(reply, &req, status, 0);
+      send_reply(c, reply, sizeof(reply));
+      free(pt);
+      continue;
+    }
+
+    if (!(r = calloc(1, sizeof(*r)))) {
+      set_reply(reply, &req, SERVER_NO_MEMORY, 0);
+      send_reply(c, reply, sizeof(reply));
+      free(pt);
+      continue;
+    }
+    r->client = c;
+    r->req = req;
+    r->pt = pt;
+    r->rec = sizeof(int) + det[req.detector].setup.ntsteps_out * sizeof(float);
+    if (!(r->out = malloc(sizeof(Server_Reply) + req.n * r->rec))) {
+      set_reply(reply, &req, SERVER_NO_MEMORY, 0);
+      send_reply(c, reply, sizeof(reply));
+      free(pt);
+      free(r);
+      continue;
+    }
+
+    /* limit the number of requests that each client can have waiting */
+    pthread_mutex_lock(&c->lock);
+    while (c->pending >= MAX_PENDING) pthread_cond_wait(&c->cond, &c->lock);
+    c->pending++;
+    pthread_mutex_unlock(&c->lock);
+    if (pool_job(pool, run_request, r)) {
+      set_reply(r->out, &req, SERVER_NO_MEMORY, 0);
+      send_reply(c, r->out, sizeof(Server_Reply));
+      client_done(c, 1);
+      free(r->out);
+      free(pt);
+      free(r);
+    }
+  }
+  client_done(c, 0);
+  return NULL;
+}
+
+static void stop(int sig) {
+  unlink(socket_name);
+  _exit(0);
+}
+
+int main(int argc, char **argv) {
+
+  struct sockaddr_un addr;
+  pthread_t thread;
+  Client    *c;
+  int       nthreads = 0, fd, i, j;
+
+  for (i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-s") && i < argc-1) {
+      socket_name = argv[++i];
+    } else if (!strcmp(argv[i], "-j") && i < argc-1) {
+      nthreads = atoi(argv[++i]);
+    } else if (ndet < MAX_DETECTORS) {
+      if (signal_calc_init(argv[i], &det[ndet].setup) != 0) return 1;
+      ndet++;
+    } else {
+      printf("ERROR: Too many detectors; maximum is %d\n", MAX_DETECTORS);
+      return 1;
+    }
+  }
+  if (!socket_name || ndet == 0) {
+    printf("Usage: %s -s socket_name [-j threads] config_file [config_file ...]\n",
+	   argv[0]);
+    return 1;
+  }
+
+  if (nthreads < 1) nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (!(pool = pool_create(nthreads))) return 1;
+  nthreads = pool_nthreads(pool);
+  for (j = 0; j < ndet; j++) {
+    if (!(det[j].copy = malloc(nthreads * sizeof(*det[j].copy)))) {
+      printf("ERROR: malloc failed\n");
+      return 1;
+    }
+    for (i = 0; i < nthreads; i++)
+      if (signal_calc_clone(&det[j].copy[i], &det[j].setup)) return 1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(socket_name) >= sizeof(addr.sun_path)) {
+    printf("ERROR: Socket name %s is too long\n", socket_name);
+    return 1;
+  }
+  strcpy(addr.sun_path, socket_name);
+  unlink(socket_name);
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+      bind(fd, (struct sockaddr *) &addr, sizeof(addr)) ||
+      listen(fd, 16)) {
+    printf("ERROR: Cannot listen on socket %s: %s\n", socket_name, strerror(errno));
+    return 1;
+  }
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, stop);
+  signal(SIGTERM, stop);
+  printf("siggen_server: %d detector(s), %d threads, listening on %s\n",
+	 ndet, nthreads, socket_name);
+  fflush(stdout);
+
+  while (1) {
+    if (!(c = calloc(1, sizeof(*c)))) {
+      printf("ERROR: malloc failed\n");
+      sleep(1);
+      continue;
+    }
+    if ((c->fd = accept(fd, NULL, NULL)) < 0) {
+      free(c);
+      if (errno != EINTR) printf("ERROR: accept failed: %s\n", strerror(errno));
+      continue;
+    }
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->cond, NULL);
+    if (pthread_create(&thread, NULL, client_thread, c)) {
+      printf("ERROR: Cannot start thread for client\n");
+      close(c->fd);
+      free(c);
+      continue;
+    }
+    pthread_detach(thread);
+  }
+  return 0;
+}
@@ -0,0 +1,54 @@
+/* siggen_server.h -- the protocol of siggen_server
+ *
+ * siggen_server keeps the fields of one or more detectors loaded, and
+ * calculates signals for clients that connect to its Unix domain socket.
+ * This saves each client the time of signal_calc_init.
+ *
+ * A client sends requests, each a Server_Request followed by n Server_Points,
+ * and gets back, for each request, a Server_Reply followed by n signals,
+ * each an int status (0 for success, -1 if the point is outside the detector
+ * or has no field) and ntsteps floats. All values are in native byte order.
+ * A client may send many requests without waiting for the replies; the requests
+ * are worked on at the same time, so the replies may come back in a different
+ * order, and are matched to the requests by id.
+ */
+#ifndef _SIGGEN_SERVER_H
+#define _SIGGEN_SERVER_H
+
+#define SERVER_REQUEST_MAGIC 0x53475251   // "SGRQ"
+#define SERVER_REPLY_MAGIC   0x53475250   // "SGRP"
+#define SERVER_MAX_POINTS    4096         // largest number of points in a request
+
+/* request types */
+#define SERVER_INFO    0    // no points; the reply gives ntsteps and step_time
+#define SERVER_SIGNALS 1    // signals for n points
+
+/* reply status */
+#define SERVER_OK           0
+#define SERVER_BAD_REQUEST  1   // unknown type, too many points, or bad magic number
+#define SERVER_BAD_DETECTOR 2   // no detector with that index
+#define SERVER_NO_MEMORY    3
+
+typedef struct {
+  int      magic;       // SERVER_REQUEST_MAGIC
+  int      type;        // SERVER_INFO or SERVER_SIGNALS
+  int      detector;    // index of the detector; the order of the config files
+                        //   on the server's command line, from 0
+  int      n;           // number of points that follow
+  unsigned id;          // chosen by the client, and returned in the reply
+} Server_Request;
+
+typedef struct {
+  float    x, y, z;     // cartesian coordinates, in mm
+} Server_Point;
+
+typedef struct {
+  int      magic;       // SERVER_REPLY_MAGIC
+  int      status;      // SERVER_OK, or one of the errors above
+  unsigned id;          // id of the request
+  int      n;           // number of signals that follow
+  int      ntsteps;     // number of time steps in each signal
+  float    step_time;   // length of each time step, in ns
+} Server_Reply;
+
+#endif /*#ifndef _SIGGEN_SERVER_H*/
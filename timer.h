@@ -0,0 +1,17 @@
+/* timer.h -- wall-clock time, for timing the calculations */
+#ifndef _TIMER_H
+#define _TIMER_H
+
+#include <time.h>
+
+/* timer_now
+   returns the time in seconds, from an arbitrary start, for elapsed times
+*/
+static inline double timer_now(void) {
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+#endif /*#ifndef _TIMER_H*/
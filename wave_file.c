@@ -0,0 +1,348 @@
+/* wave_file.c -- chunked, compressed files of calculated signals, see wave_file.h
+
+   The calling thread fills one chunk at a time; full chunks go into a small
+   ring of buffers that the writer thread encodes and writes in order.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "wave_file.h"
+
+#define NBUF        4      // chunk buffers; up to NBUF-1 can wait for the writer thread
+#define CHUNK_SIZE  1024   // default number of signals per chunk
+#define NCOLS       6      // float metadata columns, x ... a_over_e
+
+typedef struct {
+  int       n;
+  Wave_Meta *meta;         // chunk_size of each
+  float     *sig;          // chunk_size*ntsteps values
+} Wave_Chunk;
+
+struct Wave_Writer {
+  FILE      *fp;
+  Wave_Header hdr;
+  Wave_Chunk chunk[NBUF];
+  int       cur;           // chunk being filled by wave_write
+  int       tail, queued;  // chunks tail ... tail+queued-1 are waiting to be written
+  unsigned char *data;     // encoded signals of one chunk
+  float     *col;          // one metadata column
+  pthread_t thread;
+  pthread_mutex_t lock;    // protects tail, queued, done and err
+  pthread_cond_t  cond;
+  int       done, err;
+};
+
+struct Wave_Reader {
+  FILE      *fp;
+  Wave_Header hdr;
+  int       n, next;       // number of signals in the current chunk, and next one to read
+  Wave_Meta *meta;
+  float     *col;
+  unsigned char *data, *c, *end;   // encoded signals, next one, and end of data
+  int       data_size;
+};
+
+/* largest number of bytes for one encoded value */
+#define MAX_BYTES 5
+
+/* encode
+   delta-encode and pack signal s of hdr->ntsteps values into c
+   returns a pointer to the end of the encoded signal
+*/
+static unsigned char *encode(Wave_Header *hdr, float *s, unsigned char *c) {
+  unsigned int u, prev = 0, z;
+  float        x;
+  int          i, d;
+
+  for (i = 0; i < hdr->ntsteps; i++) {
+    if (hdr->scale > 0) {
+      x = s[i] / hdr->scale;
+      if (x >  32767.0f) x =  32767.0f;
+      if (x < -32768.0f) x = -32768.0f;
+      u = (unsigned int) lrintf(x);
+    } else {
+      memcpy(&u, &s[i], sizeof(u));
+    }
+    d = (int) (u - prev);
+    prev = u;
+    z = ((unsigned int) d << 1) ^ (unsigned int) (d >> 31);   // zig-zag
+    while (z >= 0x80) {
+      *c++ = (z & 0x7f) | 0x80;
+      z >>= 7;
+    }
+    *c++ = z;
+  }
+  return c;
+}
+
+/* decode
+   unpack and undo the delta encoding of signal s from c, which ends at end
+   returns a pointer to the end of the encoded signal, or NULL if it is corrupt
+*/
+static unsigned char *decode(Wave_Header *hdr, float *s, unsigned char *c,
+			     unsigned char *end) {
+  unsigned int u = 0, z;
+  int          i, k;
+
+  for (i = 0; i < hdr->ntsteps; i++) {
+    z = 0;
+    for (k = 0; k < 7*MAX_BYTES; k += 7) {
+      if (c >= end) return NULL;
+      z |= (unsigned int) (*c & 0x7f) << k;
+      if (!(*c++ & 0x80)) break;
+    }
+    u += (z >> 1) ^ -(z & 1);
+    if (hdr->scale > 0) {
+      s[i] = (float) (int) u * hdr->scale;
+    } else {
+      memcpy(&s[i], &u, sizeof(u));
+    }
+  }
+  return c;
+}
+
+/* write_chunk
+   encode chunk c and write it to the file
+   returns 0 for success
+*/
+static int write_chunk(Wave_Writer *w, Wave_Chunk *c) {
+  unsigned char *e = w->data;
+  int   i, j, nbytes;
+
+  for (i = 0; i < c->n; i++)
+    e = encode(&w->hdr, c->sig + (size_t) i * w->hdr.ntsteps, e);
+  nbytes = e - w->data;
+
+  fwrite("WCHK", 1, 4, w->fp);
+  fwrite(&c->n, sizeof(int), 1, w->fp);
+  fwrite(&nbytes, sizeof(int), 1, w->fp);
+  for (j = 0; j < NCOLS; j++) {
+    for (i = 0; i < c->n; i++) w->col[i] = ((float *) &c->meta[i].x)[j];
+    fwrite(w->col, sizeof(float), c->n, w->fp);
+  }
+  for (i = 0; i < c->n; i++) ((int *) w->col)[i] = c->meta[i].status;
+  fwrite(w->col, sizeof(int), c->n, w->fp);
+  fwrite(w->data, 1, nbytes, w->fp);
+  return (ferror(w->fp) != 0);
+}
+
+/* writer
+   the writer thread; writes the queued chunks in order until told to stop
+*/
+static void *writer(void *arg) {
+  Wave_Writer *w = arg;
+  Wave_Chunk  *c;
+  int         err;
+
+  pthread_mutex_lock(&w->lock);
+  while (1) {
+    while (w->queued == 0 && !w->done) pthread_cond_wait(&w->cond, &w->lock);
+    if (w->queued == 0) break;
+    c = &w->chunk[w->tail];
+    pthread_mutex_unlock(&w->lock);
+
+    err = write_chunk(w, c);
+
+    pthread_mutex_lock(&w->lock);
+    if (err) w->err = 1;
+    c->n = 0;
+    w->tail = (w->tail + 1) % NBUF;
+    w->queued--;
+    pthread_cond_broadcast(&w->cond);
+  }
+  pthread_mutex_unlock(&w->lock);
+  return NULL;
+}
+
+/* free_writer
+   free w and its buffers
+*/
+static void free_writer(Wave_Writer *w) {
+  int i;
+
+  for (i = 0; i < NBUF; i++) {
+    free(w->chunk[i].meta);
+    free(w->chunk[i].sig);
+  }
+  free(w->data);
+  free(w->col);
+  free(w);
+}
+
+Wave_Writer *wave_open_write(char *name, int ntsteps, float step_time, float scale,
+			     int chunk_size) {
+  Wave_Writer *w;
+  int         i;
+
+  if (chunk_size < 1) chunk_size = CHUNK_SIZE;
+  if (!(w = calloc(1, sizeof(*w)))) {
+    printf("ERROR: malloc failed in wave_open_write\n");
+    return NULL;
+  }
+  memcpy(w->hdr.magic, "SGW1", 4);
+  w->hdr.version = 1;
+  w->hdr.ntsteps = ntsteps;
+  w->hdr.chunk_size = chunk_size;
+  w->hdr.step_time = step_time;
+  w->hdr.scale = (scale > 0 ? scale : 0);
+  for (i = 0; i < NBUF; i++) {
+    if (!(w->chunk[i].meta = malloc(chunk_size * sizeof(Wave_Meta))) ||
+	!(w->chunk[i].sig = malloc((size_t) chunk_size * ntsteps * sizeof(float)))) break;
+  }
+  if (i < NBUF ||
+      !(w->data = malloc((size_t) chunk_size * ntsteps * MAX_BYTES)) ||
+      !(w->col = malloc(chunk_size * sizeof(float)))) {
+    printf("ERROR: malloc failed in wave_open_write\n");
+    free_writer(w);
+    return NULL;
+  }
+  if (!(w->fp = fopen(name, "wb"))) {
+    printf("ERROR: Cannot open file %s\n", name);
+    free_writer(w);
+    return NULL;
+  }
+  fwrite(&w->hdr, sizeof(w->hdr), 1, w->fp);
+
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->cond, NULL);
+  if (pthread_create(&w->thread, NULL, writer, w)) {
+    printf("ERROR: Cannot start writer thread for %s\n", name);
+    fclose(w->fp);
+    free_writer(w);
+    return NULL;
+  }
+  return w;
+}
+
+/* queue_chunk
+   hand the current chunk to the writer thread, and start filling the next one
+   returns 0 for success, 1 if the writer thread has failed
+*/
+static int queue_chunk(Wave_Writer *w) {
+  int err;
+
+  pthread_mutex_lock(&w->lock);
+  while (w->queued == NBUF-1) pthread_cond_wait(&w->cond, &w->lock);
+  w->queued++;
+  w->cur = (w->cur + 1) % NBUF;
+  err = w->err;
+  pthread_cond_broadcast(&w->cond);
+  pthread_mutex_unlock(&w->lock);
+  return err;
+}
+
+int wave_write(Wave_Writer *w, float *signal, Wave_Meta *meta) {
+  Wave_Chunk *c = &w->chunk[w->cur];
+
+  memcpy(c->sig + (size_t) c->n * w->hdr.ntsteps, signal, w->hdr.ntsteps * sizeof(float));
+  c->meta[c->n++] = *meta;
+  if (c->n == w->hdr.chunk_size) return queue_chunk(w);
+  return 0;
+}
+
+int wave_close_write(Wave_Writer *w) {
+  int err = 0;
+
+  if (w->chunk[w->cur].n > 0) queue_chunk(w);
+  pthread_mutex_lock(&w->lock);
+  w->done = 1;
+  pthread_cond_broadcast(&w->cond);
+  pthread_mutex_unlock(&w->lock);
+  pthread_join(w->thread, NULL);
+
+  if (w->err) err = 1;
+  if (fclose(w->fp)) err = 1;
+  pthread_mutex_destroy(&w->lock);
+  pthread_cond_destroy(&w->cond);
+  free_writer(w);
+  return err;
+}
+
+Wave_Reader *wave_open_read(char *name, Wave_Header *hdr) {
+  Wave_Reader *r;
+
+  if (!(r = calloc(1, sizeof(*r)))) {
+    printf("ERROR: malloc failed in wave_open_read\n");
+    return NULL;
+  }
+  if (!(r->fp = fopen(name, "rb"))) {
+    printf("ERROR: Cannot open file %s\n", name);
+    free(r);
+    return NULL;
+  }
+  if (fread(&r->hdr, sizeof(r->hdr), 1, r->fp) != 1 ||
+      strncmp(r->hdr.magic, "SGW1", 4) || r->hdr.version != 1 ||
+      r->hdr.ntsteps < 1 || r->hdr.chunk_size < 1) {
+    printf("ERROR: %s is not a signal file\n", name);
+    wave_close_read(r);
+    return NULL;
+  }
+  if (!(r->meta = malloc(r->hdr.chunk_size * sizeof(Wave_Meta))) ||
+      !(r->col = malloc(r->hdr.chunk_size * sizeof(float)))) {
+    printf("ERROR: malloc failed in wave_open_read\n");
+    wave_close_read(r);
+    return NULL;
+  }
+  *hdr = r->hdr;
+  return r;
+}
+
+/* read_chunk
+   read the next chunk into r
+   returns 1 for success, 0 at the end of the file, -1 on error
+*/
+static int read_chunk(Wave_Reader *r) {
+  unsigned char *tmp;
+  char  magic[4];
+  int   i, j, nbytes;
+
+  if (fread(magic, 1, 4, r->fp) != 4) return (ferror(r->fp) ? -1 : 0);
+  if (strncmp(magic, "WCHK", 4) ||
+      fread(&r->n, sizeof(int), 1, r->fp) != 1 ||
+      fread(&nbytes, sizeof(int), 1, r->fp) != 1 ||
+      r->n < 0 || r->n > r->hdr.chunk_size || nbytes < 0) return -1;
+  for (j = 0; j < NCOLS; j++) {
+    if ((int) fread(r->col, sizeof(float), r->n, r->fp) != r->n) return -1;
+    for (i = 0; i < r->n; i++) ((float *) &r->meta[i].x)[j] = r->col[i];
+  }
+  if ((int) fread(r->col, sizeof(int), r->n, r->fp) != r->n) return -1;
+  for (i = 0; i < r->n; i++) r->meta[i].status = ((int *) r->col)[i];
+
+  if (nbytes > r->data_size) {
+    if (!(tmp = realloc(r->data, nbytes))) return -1;
+    r->data = tmp;
+    r->data_size = nbytes;
+  }
+  if ((int) fread(r->data, 1, nbytes, r->fp) != nbytes) return -1;
+  r->c = r->data;
+  r->end = r->data + nbytes;
+  r->next = 0;
+  return 1;
+}
+
+int wave_read(Wave_Reader *r, float *signal, Wave_Meta *meta) {
+  int ok;
+
+  while (r->next == r->n) {
+    if ((ok = read_chunk(r)) < 0) printf("ERROR: Corrupt signal file\n");
+    if (ok <= 0) return ok;
+  }
+  if (!(r->c = decode(&r->hdr, signal, r->c, r->end))) {
+    printf("ERROR: Corrupt signal file\n");
+    return -1;
+  }
+  *meta = r->meta[r->next++];
+  return 1;
+}
+
+void wave_close_read(Wave_Reader *r) {
+  if (r->fp) fclose(r->fp);
+  free(r->meta);
+  free(r->col);
+  free(r->data);
+  free(r);
+}
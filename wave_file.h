@@ -0,0 +1,91 @@
+/* wave_file.h -- chunked, compressed files of calculated signals
+ *
+ * For large productions; a file holds any number of signals, in chunks of up
+ * to chunk_size signals. Each chunk has columns of per-signal metadata
+ * (position, energy, t90, A/E, status), followed by the signals themselves,
+ * delta-encoded and packed into variable-length bytes. The signals are stored
+ * either exactly, as floats, or quantized to 16 bits with a scale factor.
+ *
+ * Layout, all in native byte order:
+ *   Wave_Header
+ *   for each chunk:
+ *     char  magic[4] = "WCHK";  int n;  int nbytes;
+ *     float x[n], y[n], z[n], energy[n], t90[n], a_over_e[n];  int status[n];
+ *     unsigned char data[nbytes];   // the n signals, ntsteps values each
+ * Each value is stored as the difference from the previous value of the same
+ * signal (as 16-bit integers, or as the bit patterns of the floats), zig-zag
+ * encoded so that small negative differences are small numbers, and then
+ * written 7 bits to a byte, with the top bit set on all but the last byte.
+ *
+ * Files are written through a separate thread, so that the compression and
+ * writing do not hold up the calculation, and can be read one signal at a time
+ * without loading the whole file.
+ */
+#ifndef _WAVE_FILE_H
+#define _WAVE_FILE_H
+
+typedef struct {
+  char  magic[4];        // "SGW1"
+  int   version;         // 1
+  int   ntsteps;         // number of time steps in each signal
+  int   chunk_size;      // maximum number of signals in each chunk
+  float step_time;       // length of each time step, in ns
+  float scale;           // if > 0, signals are stored as 16-bit integers of this unit
+  int   spare[2];
+} Wave_Header;
+
+/* metadata for each signal */
+typedef struct {
+  float x, y, z;         // position, in mm
+  float energy;          // energy, in keV
+  float t90;             // time to 90% of the final signal, in ns
+  float a_over_e;        // maximum slope of the signal, per time step
+  int   status;          // 0 for good signals
+} Wave_Meta;
+
+typedef struct Wave_Writer Wave_Writer;
+typedef struct Wave_Reader Wave_Reader;
+
+/* wave_open_write
+   create file name for signals of ntsteps time steps, each step_time ns long;
+   if scale > 0, the signals are quantized to 16-bit multiples of scale
+   (e.g. 1/30000 for signals that go from 0 to 1), otherwise they are stored exactly.
+   chunk_size is the number of signals per chunk, or 0 for the default.
+   returns the writer, or NULL on failure
+*/
+Wave_Writer *wave_open_write(char *name, int ntsteps, float step_time, float scale,
+			     int chunk_size);
+
+/* wave_write
+   add a signal and its metadata to the file; the signal is copied.
+   Full chunks are handed to the writer thread; this only waits
+   if that thread is several chunks behind.
+   Only one thread at a time may call wave_write for the same writer.
+   returns 0 for success, 1 if the writer thread has failed
+*/
+int wave_write(Wave_Writer *w, float *signal, Wave_Meta *meta);
+
+/* wave_close_write
+   write any remaining signals, close the file and free w
+   returns 0 for success, 1 if any write failed
+*/
+int wave_close_write(Wave_Writer *w);
+
+/* wave_open_read
+   open file name for reading, and copy its header to hdr
+   returns the reader, or NULL on failure
+*/
+Wave_Reader *wave_open_read(char *name, Wave_Header *hdr);
+
+/* wave_read
+   read the next signal (hdr->ntsteps values) and its metadata from the file
+   returns 1 for success, 0 at the end of the file, -1 on error
+*/
+int wave_read(Wave_Reader *r, float *signal, Wave_Meta *meta);
+
+/* wave_close_read
+   close the file and free r
+*/
+void wave_close_read(Wave_Reader *r);
+
+#endif /*#ifndef _WAVE_FILE_H*/